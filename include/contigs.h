@@ -0,0 +1,257 @@
+/**
+ * @file contigs.h
+ * @author Daniel Nichols
+ * @brief Table of record boundaries and collapsed gaps for mapping text positions back to (contig, offset).
+ * @date 2022-04-23
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>    // any_of, fill, find_if_not, lower_bound, min
+#include <array>        // array
+#include <cstdint>      // int64_t, uint32_t, uint64_t
+#include <iterator>     // next
+#include <span>         // span
+#include <string_view>  // string_view
+#include <vector>       // vector
+
+/* local includes */
+#include "fasta.h"      // Record, RECORD_SEPARATOR
+#include "indexfile.h"  // Storage
+#include "kmer.h"       // BASE_CODES, INVALID_BASE
+
+namespace suffixarray {
+
+/**
+ * @brief Position of a hit within its contig.
+ */
+struct ContigPosition {
+    uint32_t contig;
+    int64_t offset;
+};
+
+/**
+ * @brief Start offset and name of every contig in an indexed text. Contig i occupies [start(i), start(i+1) - 1),
+ * the last character being the separator. Names are stored as one '\n' joined block so that both arrays can be
+ * written and mapped as flat sections.
+ *
+ * Runs of ambiguous bases may have been collapsed into a single separator each (see withCollapsedRuns). Those
+ * longer than one character are listed as gaps, each with the number of characters removed up to and including
+ * it, so that offsets still count every base of the original record.
+ */
+class ContigTable {
+public:
+    /* positions whose contigs are searched in lock step */
+    constexpr static size_t LOOKUP_BATCH_SIZE = 16;
+
+    /**
+     * @brief A single unnamed contig covering the whole text.
+     */
+    ContigTable() : ContigTable(indexfile::Storage<uint64_t>(std::vector<uint64_t>{0}), {}) {}
+
+    ContigTable(indexfile::Storage<uint64_t> starts, indexfile::Storage<char> names,
+        indexfile::Storage<uint64_t> gapStarts = {}, indexfile::Storage<uint64_t> gapShifts = {})
+        : starts_(std::move(starts)), names_(std::move(names)), gapStarts_(std::move(gapStarts)), gapShifts_(std::move(gapShifts)) {
+        nameOffsets_.push_back(0);
+        for (size_t i = 0; i < names_.size(); i += 1) {
+            if (names_[i] == '\n') {
+                nameOffsets_.push_back(i + 1);
+            }
+        }
+    }
+
+    /**
+     * @brief Build a table from the records of a parsed FASTA file.
+     */
+    static ContigTable fromRecords(std::vector<fasta::Record> const& records) {
+        if (records.empty()) {
+            return ContigTable();
+        }
+
+        std::vector<uint64_t> starts;
+        std::vector<char> names;
+        for (auto const& record : records) {
+            starts.push_back(record.start);
+            names.insert(std::end(names), std::begin(record.name), std::end(record.name));
+            names.push_back('\n');
+        }
+        return ContigTable(indexfile::Storage<uint64_t>(std::move(starts)), indexfile::Storage<char>(std::move(names)));
+    }
+
+    /**
+     * @brief Replace every run of characters in `text` that are neither bases nor separators, e.g. N gaps in a
+     * scaffold, by one separator, and describe the shortened text. Queries still cannot match across a run, the
+     * text and everything indexed over it no longer spend a suffix on each of its characters, and lookup still
+     * reports offsets within the original records.
+     *
+     * @param text text this table describes; compacted in place
+     * @return ContigTable table for the compacted text
+     */
+    ContigTable withCollapsedRuns(std::vector<char> &text) const {
+        auto isAmbiguous = [](char c) {
+            return kmer::BASE_CODES[static_cast<uint8_t>(c)] == kmer::INVALID_BASE && c != fasta::RECORD_SEPARATOR;
+        };
+
+        std::vector<uint64_t> starts(starts_.size()), gapStarts, gapShifts;
+        size_t out = 0, contig = 0;
+        uint64_t removed = 0;
+        for (size_t in = 0; in < text.size();) {
+            /* records start after a separator, so a run never straddles a record start */
+            for (; contig < starts_.size() && starts_[contig] == in; contig += 1) {
+                starts[contig] = out;
+            }
+            if (!isAmbiguous(text[in])) {
+                text[out++] = text[in++];
+                continue;
+            }
+            const size_t runEnd = static_cast<size_t>(std::find_if_not(std::next(std::begin(text), in), std::end(text), isAmbiguous) - std::begin(text));
+            if (runEnd - in > 1) {
+                removed += runEnd - in - 1;
+                gapStarts.push_back(out);
+                gapShifts.push_back(removed);
+            }
+            text[out++] = fasta::RECORD_SEPARATOR;
+            in = runEnd;
+        }
+        for (; contig < starts_.size(); contig += 1) {
+            starts[contig] = out;
+        }
+        text.resize(out);
+
+        return ContigTable(indexfile::Storage<uint64_t>(std::move(starts)), names_,
+            indexfile::Storage<uint64_t>(std::move(gapStarts)), indexfile::Storage<uint64_t>(std::move(gapShifts)));
+    }
+
+    /**
+     * @brief Table of texts joined end to end, e.g. suffix array shards, text i starting at `offsets[i]`. Gaps keep
+     * counting the characters removed before them in every earlier text, and contigs of unnamed tables get empty
+     * names if any table has names.
+     *
+     * @param tables table of each text
+     * @param offsets position of each text in the joined one, ascending
+     */
+    static ContigTable joined(std::span<const ContigTable> tables, std::span<const uint64_t> offsets) {
+        const bool named = std::ranges::any_of(tables, [](auto const& table) { return !table.names().empty(); });
+        std::vector<uint64_t> starts, gapStarts, gapShifts;
+        std::vector<char> names;
+        uint64_t removed = 0;
+        for (size_t i = 0; i < tables.size(); i += 1) {
+            auto const& table = tables[i];
+            for (const uint64_t start : table.starts()) {
+                starts.push_back(offsets[i] + start);
+            }
+            if (named && table.names().empty()) {
+                names.insert(std::end(names), table.size(), '\n');
+            } else {
+                names.insert(std::end(names), std::begin(table.names()), std::end(table.names()));
+            }
+            for (size_t gap = 0; gap < table.gapStarts().size(); gap += 1) {
+                gapStarts.push_back(offsets[i] + table.gapStarts()[gap]);
+                gapShifts.push_back(removed + table.gapShifts()[gap]);
+            }
+            if (!table.gapShifts().empty()) {
+                removed += table.gapShifts()[table.gapShifts().size() - 1];
+            }
+        }
+        return ContigTable(indexfile::Storage<uint64_t>(std::move(starts)), indexfile::Storage<char>(std::move(names)),
+            indexfile::Storage<uint64_t>(std::move(gapStarts)), indexfile::Storage<uint64_t>(std::move(gapShifts)));
+    }
+
+    size_t size() const noexcept {
+        return starts_.size();
+    }
+
+    uint64_t start(size_t contig) const noexcept {
+        return starts_[contig];
+    }
+
+    /**
+     * @brief Name of `contig`; empty for unnamed contigs.
+     */
+    std::string_view name(size_t contig) const noexcept {
+        if (contig + 1 >= nameOffsets_.size()) {
+            return {};
+        }
+        return std::string_view(names_.data() + nameOffsets_[contig], nameOffsets_[contig + 1] - nameOffsets_[contig] - 1);
+    }
+
+    /**
+     * @brief Contig containing `position`.
+     */
+    ContigPosition lookup(int64_t position) const noexcept {
+        ContigPosition result;
+        lookup(std::span<const int64_t>(&position, 1), std::span<ContigPosition>(&result, 1));
+        return result;
+    }
+
+    /**
+     * @brief Contigs containing each of `positions`. Every position takes the same number of branch free steps
+     * over the starts, so a batch of them is searched level by level and their loads overlap.
+     *
+     * @param positions text positions
+     * @param result receives the contig and offset of each position; same size as positions
+     */
+    template <typename Position>
+    void lookup(std::span<const Position> positions, std::span<ContigPosition> result) const noexcept {
+        uint64_t const* starts = starts_.data();
+        std::array<uint64_t const*, LOOKUP_BATCH_SIZE> bases;
+
+        for (size_t batchStart = 0; batchStart < positions.size(); batchStart += LOOKUP_BATCH_SIZE) {
+            const size_t batchSize = std::min(LOOKUP_BATCH_SIZE, positions.size() - batchStart);
+            std::fill(std::begin(bases), std::end(bases), starts);
+
+            for (size_t length = starts_.size(); length > 1; length -= length / 2) {
+                const size_t half = length / 2;
+                for (size_t j = 0; j < batchSize; j += 1) {
+                    const auto position = static_cast<uint64_t>(static_cast<int64_t>(positions[batchStart + j]));
+                    bases[j] = (bases[j][half] <= position) ? bases[j] + half : bases[j];
+                }
+            }
+
+            for (size_t j = 0; j < batchSize; j += 1) {
+                const auto contig = static_cast<uint32_t>(bases[j] - starts);
+                result[batchStart + j] = {contig, static_cast<int64_t>(positions[batchStart + j]) - static_cast<int64_t>(starts[contig])};
+            }
+        }
+
+        if (!gapStarts_.empty()) {
+            for (size_t i = 0; i < positions.size(); i += 1) {
+                const auto position = static_cast<uint64_t>(static_cast<int64_t>(positions[i]));
+                result[i].offset += static_cast<int64_t>(removedBefore(position) - removedBefore(starts[result[i].contig]));
+            }
+        }
+    }
+
+    /**
+     * @brief Sanity check a table read from disk against the text it describes.
+     */
+    bool isConsistent(size_t textLength) const noexcept {
+        return !starts_.empty() && starts_[0] == 0 && std::ranges::is_sorted(starts_)
+            && starts_[starts_.size() - 1] < textLength
+            && (names_.empty() || nameOffsets_.size() == starts_.size() + 1)
+            && gapStarts_.size() == gapShifts_.size() && std::ranges::is_sorted(gapStarts_) && std::ranges::is_sorted(gapShifts_)
+            && (gapStarts_.empty() || gapStarts_[gapStarts_.size() - 1] < textLength);
+    }
+
+    indexfile::Storage<uint64_t> const& starts() const noexcept { return starts_; }
+    indexfile::Storage<char> const& names() const noexcept { return names_; }
+    indexfile::Storage<uint64_t> const& gapStarts() const noexcept { return gapStarts_; }
+    indexfile::Storage<uint64_t> const& gapShifts() const noexcept { return gapShifts_; }
+
+private:
+    indexfile::Storage<uint64_t> starts_;
+    indexfile::Storage<char> names_;
+    std::vector<size_t> nameOffsets_;
+    indexfile::Storage<uint64_t> gapStarts_;    // text position of each collapsed run's separator
+    indexfile::Storage<uint64_t> gapShifts_;    // characters removed by that gap and all before it
+
+    /**
+     * @brief Characters removed by the gaps before `position`.
+     */
+    uint64_t removedBefore(uint64_t position) const noexcept {
+        const auto gap = std::lower_bound(std::begin(gapStarts_), std::end(gapStarts_), position);
+        return (gap == std::begin(gapStarts_)) ? 0 : gapShifts_[static_cast<size_t>(gap - std::begin(gapStarts_)) - 1];
+    }
+};
+
+}   // namespace suffixarray
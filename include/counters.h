@@ -0,0 +1,247 @@
+/**
+ * @file counters.h
+ * @author Daniel Nichols
+ * @brief Optional per-thread counters of suffix array search events, with hardware counters where the kernel
+ * provides them. Compiled in with `make COUNTERS=1`, which defines SEARCH_COUNTERS; otherwise every count is a
+ * no-op and snapshots are empty.
+ * @date 2022-04-28
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>    // find
+#include <array>        // array
+#include <atomic>       // atomic, memory_order_relaxed
+#include <cstdint>      // uint64_t
+#include <mutex>        // mutex, lock_guard
+#include <ostream>      // ostream
+#include <string_view>  // string_view
+#include <vector>       // vector
+
+#if defined(SEARCH_COUNTERS) && defined(__linux__)
+/* linux includes */
+#include <linux/perf_event.h>   // perf_event_attr, PERF_*
+#include <sys/syscall.h>        // SYS_perf_event_open
+#include <unistd.h>             // syscall, read, close
+#endif
+
+namespace counters {
+
+#if defined(SEARCH_COUNTERS)
+constexpr bool ENABLED = true;
+#else
+constexpr bool ENABLED = false;
+#endif
+
+/**
+ * @brief Events counted by the search. LCPDecisions are LCPAccelerated probes settled from the LCP-LR arrays
+ * without reading the text; SkippableBases sums min(lowerLCP, upperLCP) over the other modes' comparisons,
+ * the bases a SimpleAccelerant search that skipped them would not compare. PrefixTableRefinements are lookups
+ * answered by the second level of a two level prefix table.
+ */
+enum Event : size_t { Searches, SearchSteps, Comparisons, BasesCompared, LCPDecisions, SkippableBases,
+    PrefixTableHits, PrefixTableMisses, PrefixTableBypasses, PrefixTableRefinements, NUM_EVENTS };
+
+constexpr std::array<std::string_view, NUM_EVENTS> EVENT_NAMES{"searches", "search_steps", "comparisons",
+    "bases_compared", "lcp_decisions", "skippable_bases", "preftab_hits", "preftab_misses", "preftab_bypasses",
+    "preftab_refined"};
+
+enum HardwareEvent : size_t { Cycles, Instructions, CacheMisses, BranchMisses, NUM_HARDWARE_EVENTS };
+
+constexpr std::array<std::string_view, NUM_HARDWARE_EVENTS> HARDWARE_EVENT_NAMES{"cycles", "instructions",
+    "cache_misses", "branch_misses"};
+
+/**
+ * @brief Totals over every thread at one point in time. Subtract two to get the counts in between.
+ */
+struct Snapshot {
+    std::array<uint64_t, NUM_EVENTS> events{};
+    std::array<uint64_t, NUM_HARDWARE_EVENTS> hardware{};
+    bool hasHardware = false;   // whether any thread could open the hardware counters
+
+    Snapshot &operator+=(Snapshot const& other) noexcept {
+        for (size_t i = 0; i < NUM_EVENTS; i += 1) {
+            events[i] += other.events[i];
+        }
+        for (size_t i = 0; i < NUM_HARDWARE_EVENTS; i += 1) {
+            hardware[i] += other.hardware[i];
+        }
+        hasHardware |= other.hasHardware;
+        return *this;
+    }
+
+    Snapshot operator-(Snapshot const& earlier) const noexcept {
+        Snapshot difference = *this;
+        for (size_t i = 0; i < NUM_EVENTS; i += 1) {
+            difference.events[i] -= earlier.events[i];
+        }
+        for (size_t i = 0; i < NUM_HARDWARE_EVENTS; i += 1) {
+            difference.hardware[i] -= earlier.hardware[i];
+        }
+        return difference;
+    }
+
+    /**
+     * @brief One `name<TAB>value` line per counter, then the per search averages worth tuning from.
+     */
+    void print(std::ostream &output) const {
+        for (size_t i = 0; i < NUM_EVENTS; i += 1) {
+            output << EVENT_NAMES[i] << "\t" << events[i] << "\n";
+        }
+        if (hasHardware) {
+            for (size_t i = 0; i < NUM_HARDWARE_EVENTS; i += 1) {
+                output << HARDWARE_EVENT_NAMES[i] << "\t" << hardware[i] << "\n";
+            }
+        }
+        auto ratio = [](uint64_t a, uint64_t b) { return (b == 0) ? 0.0 : static_cast<double>(a) / static_cast<double>(b); };
+        output << "steps_per_search\t" << ratio(events[SearchSteps], events[Searches]) << "\n"
+            << "comparisons_per_search\t" << ratio(events[Comparisons], events[Searches]) << "\n"
+            << "bases_per_comparison\t" << ratio(events[BasesCompared], events[Comparisons]) << "\n"
+            << "preftab_hit_rate\t"
+            << ratio(events[PrefixTableHits], events[PrefixTableHits] + events[PrefixTableMisses]) << "\n";
+        if (hasHardware) {
+            output << "instructions_per_cycle\t" << ratio(hardware[Instructions], hardware[Cycles]) << "\n"
+                << "cycles_per_search\t" << ratio(hardware[Cycles], events[Searches]) << "\n";
+        }
+    }
+};
+
+/**
+ * @brief One thread's counters. Only the owning thread writes them, so a count is a relaxed load and store
+ * rather than an atomic add, and the block takes whole cache lines so threads never write to a shared one.
+ * Hardware counters are opened for the thread when it first counts, and any thread can read them.
+ */
+class alignas(64) ThreadCounters {
+public:
+    ThreadCounters();
+    ~ThreadCounters();
+
+    ThreadCounters(ThreadCounters const&) = delete;
+    ThreadCounters &operator=(ThreadCounters const&) = delete;
+
+    void add(Event event, uint64_t amount) noexcept {
+        auto &counter = events_[event];
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Add this thread's counts to `totals`.
+     */
+    void addTo(Snapshot &totals) const noexcept {
+        for (size_t i = 0; i < NUM_EVENTS; i += 1) {
+            totals.events[i] += events_[i].load(std::memory_order_relaxed);
+        }
+        #if defined(SEARCH_COUNTERS) && defined(__linux__)
+        if (hardwareFds_[0] >= 0) {
+            for (size_t i = 0; i < NUM_HARDWARE_EVENTS; i += 1) {
+                uint64_t value = 0;
+                if (hardwareFds_[i] >= 0 && ::read(hardwareFds_[i], &value, sizeof(value)) == sizeof(value)) {
+                    totals.hardware[i] += value;
+                }
+            }
+            totals.hasHardware = true;
+        }
+        #endif
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, NUM_EVENTS> events_{};
+    std::array<int, NUM_HARDWARE_EVENTS> hardwareFds_;
+};
+
+/**
+ * @brief Every live thread's counters, plus the totals of threads that have exited.
+ */
+class Registry {
+public:
+    /* never destroyed, so that threads still running at exit can unregister */
+    static Registry &instance() {
+        static Registry *registry = new Registry;
+        return *registry;
+    }
+
+    void add(ThreadCounters const* counters) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        live_.push_back(counters);
+    }
+
+    void remove(ThreadCounters const* counters) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        counters->addTo(exited_);
+        live_.erase(std::find(std::begin(live_), std::end(live_), counters));
+    }
+
+    Snapshot snapshot() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Snapshot totals = exited_;
+        for (auto const* counters : live_) {
+            counters->addTo(totals);
+        }
+        return totals;
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<ThreadCounters const*> live_;
+    Snapshot exited_;
+};
+
+inline ThreadCounters::ThreadCounters() {
+    hardwareFds_.fill(-1);
+    #if defined(SEARCH_COUNTERS) && defined(__linux__)
+    constexpr std::array<uint64_t, NUM_HARDWARE_EVENTS> CONFIGS{PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    for (size_t i = 0; i < NUM_HARDWARE_EVENTS; i += 1) {
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = CONFIGS[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        /* this thread, on whichever cpu it runs */
+        hardwareFds_[i] = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if (hardwareFds_[i] < 0) {
+            /* unsupported or not permitted; counting only some of them would mislead */
+            for (size_t j = 0; j < i; j += 1) {
+                ::close(hardwareFds_[j]);
+            }
+            hardwareFds_.fill(-1);
+            break;
+        }
+    }
+    #endif
+    Registry::instance().add(this);
+}
+
+inline ThreadCounters::~ThreadCounters() {
+    Registry::instance().remove(this);
+    #if defined(SEARCH_COUNTERS) && defined(__linux__)
+    for (const int fd : hardwareFds_) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    #endif
+}
+
+/**
+ * @brief Count `amount` `event`s on the calling thread. Compiles to nothing without SEARCH_COUNTERS.
+ */
+inline void add([[maybe_unused]] Event event, [[maybe_unused]] uint64_t amount = 1) noexcept {
+    if constexpr (ENABLED) {
+        thread_local ThreadCounters counters;
+        counters.add(event, amount);
+    }
+}
+
+/**
+ * @brief Totals over every thread so far. Empty without SEARCH_COUNTERS.
+ */
+inline Snapshot snapshot() {
+    if constexpr (ENABLED) {
+        return Registry::instance().snapshot();
+    }
+    return {};
+}
+
+}   // namespace counters
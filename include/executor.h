@@ -0,0 +1,230 @@
+/**
+ * @file executor.h
+ * @author Daniel Nichols
+ * @brief Persistent pool of query threads, optionally pinned to cpus across the NUMA nodes, that share out each
+ * batch by work stealing.
+ * @date 2022-04-29
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>            // min
+#include <atomic>               // atomic, memory_order_relaxed
+#include <condition_variable>   // condition_variable
+#include <cstdint>              // uint64_t
+#include <exception>            // exception_ptr, current_exception, rethrow_exception
+#include <functional>           // function
+#include <memory>               // unique_ptr
+#include <mutex>                // mutex, lock_guard, unique_lock
+#include <thread>               // thread
+#include <utility>              // exchange
+#include <vector>               // vector
+
+#if defined(__linux__)
+/* linux includes */
+#include <pthread.h>            // pthread_setaffinity_np, pthread_self
+#include <sched.h>              // cpu_set_t
+#endif
+
+/* local includes */
+#include "numa.h"               // Topology
+
+namespace executor {
+
+/**
+ * @brief One thread of an Executor.
+ */
+struct Worker {
+    size_t id;      // 0 to size() - 1
+    size_t node;    // index into the Topology's nodes, e.g. to pick that node's replica of the index
+    int cpu;        // cpu the thread is pinned to, or -1 if it is not pinned
+};
+
+/**
+ * @brief Fixed set of threads that run a body over the items of a batch. Unlike an OpenMP loop, the number of
+ * threads and where they run are set once for the executor, and the threads live until it is destroyed.
+ *
+ * Worker w is placed on node w % numNodes, so the threads are spread evenly over the nodes. Each run splits the
+ * items into one contiguous slice per worker. A worker claims CHUNK_SIZE items at a time from its own slice, and
+ * once that is empty steals chunks from the others' slices, those of workers on its own node first, so a few
+ * slow queries do not hold up the batch and stolen work tends to stay on the node.
+ */
+class Executor {
+public:
+    /* items claimed at a time; enough to amortize the atomic, few enough to balance batches of long queries */
+    constexpr static size_t CHUNK_SIZE = 16;
+
+    /**
+     * @param numThreads number of workers; 0 for one per allowed cpu
+     * @param pin pin each worker to one cpu of its node, cycling through the node's cpus
+     * @param topology nodes and cpus to place the workers on
+     */
+    explicit Executor(size_t numThreads, bool pin = false, numa::Topology const& topology = numa::Topology::detect()) {
+        if (numThreads == 0) {
+            numThreads = topology.numCpus();
+        }
+        for (size_t id = 0; id < numThreads; id += 1) {
+            const size_t node = id % topology.size();
+            auto const& cpus = topology.cpus[node];
+            workers_.push_back({id, node, pin ? cpus[(id / topology.size()) % cpus.size()] : -1});
+        }
+
+        /* same node workers first, each list starting after the thief so thieves spread over the victims */
+        victims_.resize(numThreads);
+        for (size_t id = 0; id < numThreads; id += 1) {
+            for (const bool sameNode : {true, false}) {
+                for (size_t offset = 1; offset < numThreads; offset += 1) {
+                    const size_t victim = (id + offset) % numThreads;
+                    if ((workers_[victim].node == workers_[id].node) == sameNode) {
+                        victims_[id].push_back(victim);
+                    }
+                }
+            }
+        }
+
+        slices_ = std::make_unique<Slice[]>(numThreads);
+        for (size_t id = 0; id < numThreads; id += 1) {
+            threads_.emplace_back([this, id] { work(id); });
+        }
+    }
+
+    ~Executor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        start_.notify_all();
+        for (auto &thread : threads_) {
+            thread.join();
+        }
+    }
+
+    Executor(Executor const&) = delete;
+    Executor &operator=(Executor const&) = delete;
+
+    size_t size() const noexcept {
+        return workers_.size();
+    }
+
+    std::vector<Worker> const& workers() const noexcept {
+        return workers_;
+    }
+
+    /**
+     * @brief Call `body(item, worker)` once for every item in [0, numItems) on the workers, and wait for them.
+     * If a call throws, the remaining chunks are abandoned and the first exception is rethrown here.
+     * @note only one run at a time; the calling thread waits rather than working
+     */
+    template <typename Body>
+    void run(size_t numItems, Body &&body) {
+        runChunks(numItems, [&body](size_t first, size_t last, Worker const& worker) {
+            for (size_t item = first; item < last; item += 1) {
+                body(item, worker);
+            }
+        });
+    }
+
+private:
+    /* a worker's share of the current run; a cache line each, since the owner and its thieves all claim from it */
+    struct alignas(64) Slice {
+        std::atomic<size_t> next{0};
+        size_t end = 0;
+    };
+
+    std::vector<Worker> workers_;
+    std::vector<std::vector<size_t>> victims_;  // other workers in the order each worker steals from them
+    std::unique_ptr<Slice[]> slices_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable start_, finished_;
+    uint64_t generation_ = 0;                   // bumped to start each run
+    size_t numRunning_ = 0;
+    bool stopping_ = false;
+    std::function<void(size_t, size_t, Worker const&)> const* job_ = nullptr;
+    std::atomic<bool> cancelled_ = false;
+    std::exception_ptr error_;
+
+    void runChunks(size_t numItems, std::function<void(size_t, size_t, Worker const&)> const& job) {
+        if (numItems == 0) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        const size_t numWorkers = workers_.size();
+        for (size_t id = 0; id < numWorkers; id += 1) {
+            slices_[id].next.store(numItems * id / numWorkers, std::memory_order_relaxed);
+            slices_[id].end = numItems * (id + 1) / numWorkers;
+        }
+        job_ = &job;
+        cancelled_.store(false, std::memory_order_relaxed);
+        error_ = nullptr;
+        numRunning_ = numWorkers;
+        generation_ += 1;
+        start_.notify_all();
+        finished_.wait(lock, [this] { return numRunning_ == 0; });
+
+        job_ = nullptr;
+        if (error_) {
+            std::rethrow_exception(std::exchange(error_, nullptr));
+        }
+    }
+
+    void work(size_t id) {
+        Worker const& worker = workers_[id];
+        #if defined(__linux__)
+        if (worker.cpu >= 0) {
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+            CPU_SET(worker.cpu, &mask);
+            /* a cpu taken away since the topology was read only costs locality */
+            ::pthread_setaffinity_np(::pthread_self(), sizeof(mask), &mask);
+        }
+        #endif
+
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_.wait(lock, [this, seen] { return stopping_ || generation_ != seen; });
+                if (stopping_) {
+                    return;
+                }
+                seen = generation_;
+            }
+
+            try {
+                drain(slices_[id], worker);
+                for (const size_t victim : victims_[id]) {
+                    drain(slices_[victim], worker);
+                }
+            } catch (...) {
+                cancelled_.store(true, std::memory_order_relaxed);
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!error_) {
+                    error_ = std::current_exception();
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            numRunning_ -= 1;
+            if (numRunning_ == 0) {
+                finished_.notify_one();
+            }
+        }
+    }
+
+    /**
+     * @brief Run chunks claimed from `slice` until it has none left.
+     */
+    void drain(Slice &slice, Worker const& worker) {
+        while (!cancelled_.load(std::memory_order_relaxed)) {
+            const size_t first = slice.next.fetch_add(CHUNK_SIZE, std::memory_order_relaxed);
+            if (first >= slice.end) {
+                return;
+            }
+            (*job_)(first, std::min(first + CHUNK_SIZE, slice.end), worker);
+        }
+    }
+};
+
+}   // namespace executor
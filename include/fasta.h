@@ -0,0 +1,513 @@
+/**
+ * @file fasta.h
+ * @author Daniel Nichols
+ * @brief Parallel FASTA parsing straight into a suffix array text buffer, and batched reading of query files.
+ * @date 2022-04-23
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>    // find_if, max, min, transform
+#include <array>        // array
+#include <cctype>       // isspace
+#include <condition_variable> // condition_variable
+#include <cstdint>      // uint8_t, uint64_t
+#include <cstring>      // memchr, memmove
+#include <deque>        // deque
+#include <exception>    // ios_base::failure
+#include <fstream>      // ifstream
+#include <ios>          // streamsize
+#include <mutex>        // mutex, unique_lock
+#include <string>       // string
+#include <string_view>  // string_view
+#include <thread>       // thread
+#include <tuple>        // tie
+#include <utility>      // exchange, pair
+#include <vector>       // vector
+
+/* posix includes */
+#include <sys/stat.h>   // stat, S_ISREG
+
+/* tpl includes */
+#include <zlib.h>       // gzopen, gzread, gzclose
+
+/* local includes */
+#include "indexfile.h"  // MappedFile
+
+namespace fasta {
+
+/**
+ * @brief Where the parser is relative to the line structure of the file.
+ */
+enum class LineState : uint8_t { LineStart, Sequence, Header };
+
+/* bytes handed from the decompression thread to the parser at a time */
+constexpr size_t GZIP_BLOCK_SIZE = size_t(4) << 20;
+
+/* written between records so that no query can match across a record boundary */
+constexpr char RECORD_SEPARATOR = '#';
+
+/**
+ * @brief One FASTA record: the first word of its header and where its sequence starts in the parsed text.
+ */
+struct Record {
+    std::string name;
+    uint64_t start;
+};
+
+/**
+ * @brief Parsed FASTA file. Records are separated by RECORD_SEPARATOR in `sequence`.
+ */
+struct Reference {
+    std::vector<char> sequence;
+    std::vector<Record> records;
+};
+
+/**
+ * @brief Upper case ASCII letters without branching.
+ */
+constexpr char toUpper(char c) noexcept {
+    return static_cast<char>(c - ((c >= 'a' && c <= 'z') << 5));
+}
+
+/**
+ * @brief Append the record name starting at `first` to `name`, stopping at the first whitespace.
+ *
+ * @return true if `last` was reached before the name ended
+ */
+inline bool appendName(std::string &name, char const* first, char const* last) {
+    char const* end = std::find_if(first, last, [](char c) { return std::isspace(static_cast<unsigned char>(c)); });
+    name.append(first, end);
+    return end == last;
+}
+
+/**
+ * @brief Parse [first, last) starting in `state`. Sequence bytes are upper cased and, if Write, written to `out`;
+ * header lines, newlines, and carriage returns are dropped. Line ends are found with memchr and lines without
+ * carriage returns are copied with a plain transform, so the work is vectorized in the common case.
+ * Every header except one at the very start of the file writes a RECORD_SEPARATOR.
+ *
+ * @tparam Write whether to write the sequence or only count it
+ * @param fileBegin start of the whole file, if it lies in this range
+ * @param onRecord called with (header, start of the record in `out`) for each header line that begins in range
+ * @return std::pair<size_t, LineState> number of sequence bytes and the state after `last`
+ */
+template <bool Write, typename RecordVisitor>
+std::pair<size_t, LineState> parse(char const* first, char const* last, LineState state, char *out,
+    char const* fileBegin, RecordVisitor &&onRecord) {
+
+    size_t count = 0;
+    while (first < last) {
+        if (state == LineState::LineStart && *first == '>') {
+            state = LineState::Header;
+            if (first != fileBegin) {
+                if constexpr (Write) {
+                    out[count] = RECORD_SEPARATOR;
+                }
+                count += 1;
+            }
+            onRecord(first, count);
+        } else if (state == LineState::LineStart) {
+            state = LineState::Sequence;
+        }
+
+        auto const* newline = static_cast<char const*>(std::memchr(first, '\n', last - first));
+        char const* lineEnd = (newline == nullptr) ? last : newline;
+        if (state == LineState::Sequence && std::memchr(first, '\r', lineEnd - first) == nullptr) {
+            if constexpr (Write) {
+                std::transform(first, lineEnd, out + count, toUpper);
+            }
+            count += lineEnd - first;
+        } else if (state == LineState::Sequence) {
+            for (char const* it = first; it < lineEnd; ++it) {
+                if (*it != '\r') {
+                    if constexpr (Write) {
+                        out[count] = toUpper(*it);
+                    }
+                    count += 1;
+                }
+            }
+        }
+
+        if (newline == nullptr) {
+            return {count, state};
+        }
+        first = newline + 1;
+        state = LineState::LineStart;
+    }
+    return {count, state};
+}
+
+/**
+ * @brief Count the sequence bytes of [first, last) without recording anything.
+ */
+inline std::pair<size_t, LineState> count(char const* first, char const* last, LineState state, char const* fileBegin) {
+    return parse<false>(first, last, state, nullptr, fileBegin, [](char const*, size_t) {});
+}
+
+/**
+ * @brief Sequence before the first header, if any, is an unnamed record.
+ */
+inline void addLeadingRecord(Reference &reference) {
+    if (reference.records.empty() || reference.records.front().start != 0) {
+        reference.records.insert(std::begin(reference.records), Record{"", 0});
+    }
+}
+
+/**
+ * @brief Read the records of a plain text FASTA file.
+ *
+ * The file is memory mapped and split into fixed chunks. Every chunk is in a known state after its first
+ * newline, so a parallel counting pass can size each chunk's output without knowing where it starts; a
+ * serial pass over the chunk summaries then resolves the start states and offsets, and a second parallel pass
+ * writes every chunk straight into its place in the result.
+ */
+inline Reference readPlain(std::string const& path) {
+    constexpr size_t NUM_CHUNKS = 128;
+    struct ChunkSummary {
+        size_t prefixCount = 0;     // sequence bytes up to the first newline if that line is sequence
+        bool startsHeader = false, hasNewline = false;
+        size_t tailCount = 0;       // sequence bytes after the first newline
+        LineState tailState = LineState::LineStart;
+    };
+
+    const indexfile::MappedFile file(path);
+    file.advise(0, file.size(), MADV_SEQUENTIAL);
+    auto const* text = reinterpret_cast<char const*>(file.data());
+    const size_t size = file.size();
+    auto chunkStart = [size](size_t i) { return i * size / NUM_CHUNKS; };
+
+    std::array<ChunkSummary, NUM_CHUNKS> summaries;
+    #pragma omp parallel for
+    for (size_t i = 0; i < NUM_CHUNKS; i += 1) {
+        char const* first = text + chunkStart(i);
+        char const* last = text + chunkStart(i + 1);
+        if (first == last) {
+            continue;
+        }
+
+        auto &summary = summaries[i];
+        auto const* newline = static_cast<char const*>(std::memchr(first, '\n', last - first));
+        summary.hasNewline = newline != nullptr;
+        summary.startsHeader = *first == '>';
+        char const* prefixEnd = summary.hasNewline ? newline : last;
+        summary.prefixCount = count(first, prefixEnd, LineState::Sequence, text).first;
+        if (summary.hasNewline) {
+            std::tie(summary.tailCount, summary.tailState) = count(newline + 1, last, LineState::LineStart, text);
+        }
+    }
+
+    std::array<LineState, NUM_CHUNKS> startStates;
+    std::array<size_t, NUM_CHUNKS + 1> offsets;
+    LineState state = LineState::LineStart;
+    offsets[0] = 0;
+    for (size_t i = 0; i < NUM_CHUNKS; i += 1) {
+        auto const& summary = summaries[i];
+        startStates[i] = state;
+        size_t prefixCount = 0;
+        if (state == LineState::LineStart && chunkStart(i) != chunkStart(i + 1)) {
+            state = summary.startsHeader ? LineState::Header : LineState::Sequence;
+            prefixCount = (summary.startsHeader && chunkStart(i) != 0) ? 1 : 0;    // the record separator
+        }
+        prefixCount += (state == LineState::Sequence) ? summary.prefixCount : 0;
+        offsets[i + 1] = offsets[i] + prefixCount + summary.tailCount;
+        if (summary.hasNewline) {
+            state = summary.tailState;
+        }
+    }
+
+    /* one spare byte so that the terminator can be appended without reallocating */
+    Reference reference;
+    reference.sequence.reserve(offsets[NUM_CHUNKS] + 1);
+    reference.sequence.resize(offsets[NUM_CHUNKS]);
+
+    std::array<std::vector<Record>, NUM_CHUNKS> chunkRecords;
+    #pragma omp parallel for
+    for (size_t i = 0; i < NUM_CHUNKS; i += 1) {
+        auto &records = chunkRecords[i];
+        const uint64_t offset = offsets[i];
+        parse<true>(text + chunkStart(i), text + chunkStart(i + 1), startStates[i], reference.sequence.data() + offset,
+            text, [&records, offset, end = text + size](char const* header, size_t start) {
+                records.push_back({"", offset + start});
+                appendName(records.back().name, header + 1, end);
+            });
+    }
+
+    for (auto const& records : chunkRecords) {
+        reference.records.insert(std::end(reference.records), std::begin(records), std::end(records));
+    }
+    addLeadingRecord(reference);
+    return reference;
+}
+
+/**
+ * @brief Read the records of a gzip compressed FASTA file. A second thread decompresses blocks
+ * ahead of the parser through a small bounded queue, so decompression and parsing overlap.
+ *
+ * zlib passes plain text through unchanged, so this also reads pipes and other files that cannot be mapped,
+ * compressed or not, in one pass and without seeking.
+ * @throws std::ios_base::failure if the file cannot be opened or decompressed
+ *
+ * @param fileSize size of the file if it is a regular one, or 0
+ */
+inline Reference readGzip(std::string const& path, size_t fileSize) {
+    constexpr size_t MAX_QUEUED_BLOCKS = 4;
+
+    gzFile file = gzopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        throw std::ios_base::failure("File \"" + path + "\" could not be opened.");
+    }
+    gzbuffer(file, 1 << 20);
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<char>> blocks;
+    bool finished = false, failed = false;
+
+    std::thread decompressor([&] {
+        while (true) {
+            std::vector<char> block(GZIP_BLOCK_SIZE);
+            const int bytesRead = gzread(file, block.data(), static_cast<unsigned>(block.size()));
+            block.resize(std::max(bytesRead, 0));
+
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return blocks.size() < MAX_QUEUED_BLOCKS; });
+            if (bytesRead <= 0) {
+                failed = bytesRead < 0;
+                finished = true;
+                changed.notify_all();
+                return;
+            }
+            blocks.push_back(std::move(block));
+            changed.notify_all();
+        }
+    });
+
+    /* DNA rarely compresses better than 4:1 and untouched capacity costs no memory */
+    Reference reference;
+    auto &sequence = reference.sequence;
+    sequence.reserve(5 * fileSize + 1);
+    LineState state = LineState::LineStart;
+    bool firstBlock = true, nameOpen = false;
+    while (true) {
+        std::vector<char> block;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return !blocks.empty() || finished; });
+            if (blocks.empty()) {
+                break;
+            }
+            block = std::move(blocks.front());
+            blocks.pop_front();
+            changed.notify_all();
+        }
+
+        char const* first = block.data();
+        char const* last = block.data() + block.size();
+        if (nameOpen) {
+            /* a header split across blocks */
+            nameOpen = appendName(reference.records.back().name, first, last);
+        }
+
+        const size_t oldSize = sequence.size();
+        sequence.resize(oldSize + block.size());
+        const auto [count, newState] = parse<true>(first, last, state, sequence.data() + oldSize,
+            firstBlock ? first : nullptr, [&reference, &nameOpen, oldSize, last](char const* header, size_t start) {
+                reference.records.push_back({"", oldSize + start});
+                nameOpen = appendName(reference.records.back().name, header + 1, last);
+            });
+        sequence.resize(oldSize + count);
+        state = newState;
+        firstBlock = false;
+    }
+    decompressor.join();
+    gzclose(file);
+
+    if (failed) {
+        throw std::ios_base::failure("Could not decompress \"" + path + "\".");
+    }
+    addLeadingRecord(reference);
+    return reference;
+}
+
+/**
+ * @brief Whether `path` starts with the gzip magic number.
+ */
+inline bool isGzip(std::string const& path) {
+    std::ifstream inputFile(path, std::ios::binary);
+    std::array<unsigned char, 2> magic{};
+    inputFile.read(reinterpret_cast<char *>(magic.data()), magic.size());
+    return inputFile && magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+/**
+ * @brief Upper cased sequence and record table of a FASTA file, which may be gzip compressed.
+ * The sequence has spare capacity for one more character. Regular files are mapped; pipes, e.g. from
+ * process substitution, are streamed.
+ * @throws std::ios_base::failure if file open/read error
+ *
+ * @param path path to FASTA formatted file
+ * @return Reference records joined by RECORD_SEPARATOR, with headers and line breaks removed
+ */
+inline Reference read(std::string const& path) {
+    struct stat status{};
+    if (::stat(path.c_str(), &status) != 0) {
+        throw std::ios_base::failure("File \"" + path + "\" could not be opened.");
+    }
+    if (!S_ISREG(status.st_mode)) {
+        /* a pipe has no size to map, and peeking at its magic number would consume it */
+        return readGzip(path, 0);
+    }
+    const auto size = static_cast<size_t>(status.st_size);
+    return isGzip(path) ? readGzip(path, size) : readPlain(path);
+}
+
+/**
+ * @brief Reads the records of a query FASTA file a batch at a time, so a file of any size can be searched in
+ * bounded memory. Records without a sequence are skipped, except a trailing one.
+ *
+ * The file is read in blocks into one buffer per batch, and each record's sequence lines are joined in place,
+ * so a batch's titles and sequences are ranges of its buffer rather than strings of their own. The record cut
+ * off at the end of a batch is copied over to the next one.
+ */
+class QueryReader {
+public:
+    /* bytes read from the file at a time */
+    constexpr static size_t BUFFER_SIZE = size_t(1) << 20;
+
+    /**
+     * @throws std::ios_base::failure if the file cannot be opened
+     */
+    explicit QueryReader(std::string const& path) : input_(path, std::ios::binary) {
+        if (!input_) {
+            throw std::ios_base::failure("Could not open " + path + " for reading.");
+        }
+    }
+
+    /**
+     * @brief The next records of the file, each with strings of its own.
+     * @throws std::ios_base::failure if the file cannot be read
+     *
+     * @tparam Query aggregate of title, sequence, and result
+     * @param maxQueries most records to return
+     * @return std::vector<Query> up to maxQueries records; empty once the file is exhausted
+     */
+    template <typename Query>
+    std::vector<Query> next(size_t maxQueries) {
+        const std::vector<char> buffer = readRecords(maxQueries);
+        const std::string_view text(buffer.data(), buffer.size());
+        std::vector<Query> queries;
+        queries.reserve(records_.size());
+        for (auto const& record : records_) {
+            queries.push_back({std::string(record.title(text)), std::string(record.sequence(text)), {}});
+        }
+        return queries;
+    }
+
+    /**
+     * @brief The next records of the file as one batch that owns the buffer they were read into.
+     * @throws std::ios_base::failure if the file cannot be read
+     *
+     * @tparam Batch constructible from the std::vector<char> buffer, with `text()` viewing it and
+     * `add(title, sequence)` taking views of it, e.g. querybatch::QueryBatch
+     * @param maxQueries most records to return
+     * @return Batch up to maxQueries records; empty once the file is exhausted
+     */
+    template <typename Batch>
+    Batch nextBatch(size_t maxQueries) {
+        Batch batch(readRecords(maxQueries));
+        const std::string_view text = batch.text();
+        batch.reserve(records_.size());
+        for (auto const& record : records_) {
+            batch.add(record.title(text), record.sequence(text));
+        }
+        return batch;
+    }
+
+private:
+    /* a record's title and joined sequence within its batch's buffer */
+    struct RecordRange {
+        size_t titleStart, titleEnd, sequenceStart, sequenceEnd;
+
+        std::string_view title(std::string_view text) const noexcept {
+            return text.substr(titleStart, titleEnd - titleStart);
+        }
+        std::string_view sequence(std::string_view text) const noexcept {
+            return text.substr(sequenceStart, sequenceEnd - sequenceStart);
+        }
+    };
+
+    std::ifstream input_;
+    std::vector<char> pending_;         // start of the records after the last batch
+    std::vector<RecordRange> records_;  // records of the last batch
+    size_t batchBytes_ = 0;             // largest buffer a batch has needed
+    bool finished_ = false;
+
+    /**
+     * @brief Read up to `maxQueries` records into a new buffer, their ranges into records_.
+     */
+    std::vector<char> readRecords(size_t maxQueries) {
+        records_.clear();
+        std::vector<char> text = std::exchange(pending_, {});
+        if (finished_) {
+            return text;
+        }
+        text.reserve(batchBytes_);
+
+        /* `in` is the next byte to parse, and the current record's sequence is joined up to `out` */
+        RecordRange current{0, 0, 0, 0};
+        size_t in = 0, out = 0;
+        bool endOfFile = false;
+        while (true) {
+            auto const* newline = (in == text.size()) ? nullptr
+                : static_cast<char const*>(std::memchr(text.data() + in, '\n', text.size() - in));
+            if (newline == nullptr && !endOfFile) {
+                endOfFile = !readBlock(text);
+                continue;
+            }
+            const size_t lineEnd = (newline == nullptr) ? text.size() : static_cast<size_t>(newline - text.data());
+            if (lineEnd > in && text[in] == '>') {
+                if (out > current.sequenceStart) {
+                    current.sequenceEnd = out;
+                    records_.push_back(current);
+                    if (records_.size() == maxQueries) {
+                        pending_.assign(text.data() + in, text.data() + text.size());
+                        text.resize(in);
+                        break;
+                    }
+                }
+                out = std::min(lineEnd + 1, text.size());
+                current = {in + 1, lineEnd, out, 0};
+            } else {
+                std::memmove(text.data() + out, text.data() + in, lineEnd - in);
+                out += lineEnd - in;
+            }
+            if (newline == nullptr) {
+                current.sequenceEnd = out;
+                records_.push_back(current);
+                finished_ = true;
+                break;
+            }
+            in = lineEnd + 1;
+        }
+        batchBytes_ = std::max(batchBytes_, text.size() + pending_.size());
+        return text;
+    }
+
+    /**
+     * @brief Append up to BUFFER_SIZE bytes of the file to `text`.
+     * @return false at the end of the file
+     */
+    bool readBlock(std::vector<char> &text) {
+        const size_t oldSize = text.size();
+        text.resize(oldSize + BUFFER_SIZE);
+        input_.read(text.data() + oldSize, static_cast<std::streamsize>(BUFFER_SIZE));
+        if (input_.bad()) {
+            throw std::ios_base::failure("Could not read the query file.");
+        }
+        text.resize(oldSize + static_cast<size_t>(input_.gcount()));
+        return text.size() != oldSize;
+    }
+};
+
+}   // namespace fasta
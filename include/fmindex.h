@@ -0,0 +1,519 @@
+/**
+ * @file fmindex.h
+ * @author Daniel Nichols
+ * @brief FM-index over a suffix array for small memory count and locate queries.
+ * @date 2022-04-22
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>    // copy, for_each, lower_bound, max, min
+#include <array>        // array
+#include <bit>          // popcount
+#include <cstdint>      // int32_t, int64_t, uint32_t, uint64_t
+#include <exception>    // ios_base::failure
+#include <iterator>     // distance
+#include <span>         // span
+#include <string>       // string
+#include <string_view>  // string_view
+#include <utility>      // pair
+#include <vector>       // vector
+
+/* local includes */
+#include "contigs.h"    // ContigTable
+#include "fasta.h"      // RECORD_SEPARATOR
+#include "indexfile.h"  // IndexReader, IndexWriter, Storage
+#include "kmer.h"       // BASE_CODES
+#include "suffixarray.h"// SuffixArray
+#include "utilities.h"  // executionPolicy, Timer
+
+namespace suffixarray {
+
+/**
+ * @brief FM-index of a text. Replaces the text and the 4 byte per base suffix array with the 2-bit packed BWT,
+ * its occurrence counts, and every `sampleRate`-th suffix array value. At the default rate this is about
+ * 0.6 bytes per base instead of 5.
+ *
+ * The BWT is stored in cache line sized blocks that begin with the occurrence counts of every base before the
+ * block, so each rank query is a single cache miss. Sampled entries are those whose text position is a multiple
+ * of the sampling rate, so `locate` needs at most `sampleRate - 1` LF steps per occurrence.
+ *
+ * Rows whose BWT character is the '$' or a record separator are "sentinels". They are stored as A but left out
+ * of every count, so no query can extend across them, and they are always sampled so LF never steps off them.
+ */
+class FMIndex {
+    constexpr static uint32_t FILE_MAGIC = 0xabeef4d1;
+    constexpr static uint32_t FILE_VERSION = 4;
+
+    enum SectionId : uint32_t { MetadataSection = 0, OccurrenceSection, SampledRowsSection, SamplesSection,
+        SentinelRowsSection, ContigStartsSection, ContigNamesSection, GapStartsSection, GapShiftsSection };
+    struct IndexMetadata { uint64_t length, numSentinels, sampleRate; std::array<uint64_t, 5> cumulative; };
+
+public:
+    using Query = SuffixArray::Query;
+    constexpr static int64_t ALL_RESULTS = SuffixArray::ALL_RESULTS;
+    constexpr static uint32_t DEFAULT_SAMPLE_RATE = 32;
+
+    /* 16 bytes of counts and 48 bytes of packed bases per 64 byte line */
+    constexpr static size_t BASES_PER_WORD = 32;
+    constexpr static size_t BASES_PER_BLOCK = 6 * BASES_PER_WORD;
+    struct alignas(64) OccurrenceBlock {
+        std::array<uint32_t, 4> counts;   // occurrences of each base before this block
+        std::array<uint64_t, 6> bases;    // 2-bit codes, first base in the least significant bits
+    };
+
+    /* one bit per suffix array row marking the sampled rows, with the number of set bits before the block */
+    constexpr static size_t ROWS_PER_SAMPLE_BLOCK = 7 * 64;
+    struct alignas(64) SampleBlock {
+        uint64_t rank;
+        std::array<uint64_t, 7> bits;
+    };
+
+    /**
+     * @brief Build an FM-index from a suffix array. The BWT is read straight off the suffix array, so no
+     * second suffix sorting pass is needed.
+     *
+     * @param text text the suffix array is built on; must end in a unique '$' and otherwise only hold A, C, G, T
+     * @param suffixes suffix array of text
+     * @param sampleRate keep the suffix array value of every text position divisible by this
+     * @param contigs record boundaries of text
+     * @return FMIndex index over text
+     */
+    static FMIndex build(std::string_view text, std::span<const int32_t> suffixes,
+        uint32_t sampleRate = DEFAULT_SAMPLE_RATE, ContigTable contigs = ContigTable()) {
+
+        FMIndex index;
+        utilities::Timer timer;
+        timer.start();
+        index.sampleRate_ = std::max<uint32_t>(sampleRate, 1);
+        index.contigs_ = std::move(contigs);
+        index.buildOccurrences(text, suffixes);
+        index.buildSamples(text, suffixes);
+        timer.stop();
+        index.buildTime_ = timer.millisecondsElapsed();
+        return index;
+    }
+
+    /**
+     * @brief Build an FM-index over an existing SuffixArray.
+     * @see build
+     */
+    static FMIndex fromSuffixArray(SuffixArray const& sa, uint32_t sampleRate = DEFAULT_SAMPLE_RATE) {
+        return build(sa.data(), sa.suffixes(), sampleRate, sa.contigs());
+    }
+
+    /**
+     * @brief Load an FMIndex from a file written by `save`. Like SuffixArray the file is memory mapped.
+     * @see load
+     *
+     * @param path file path to saved FMIndex
+     * @param populate pre-fault the whole file rather than paging it in lazily
+     * @param verify check every section of the file against its checksum first
+     * @return FMIndex the index from the specified file
+     */
+    static FMIndex fromSave(std::string const& path, bool populate=false, bool verify=false) {
+        FMIndex index;
+        index.load(path, populate, verify);
+        return index;
+    }
+
+    /**
+     * @brief Whether `path` holds a saved FMIndex rather than some other index type.
+     * @throws std::ios_base::failure if the file cannot be read
+     */
+    static bool isIndexFile(std::string const& path) {
+        return indexfile::readMagic(path) == FILE_MAGIC;
+    }
+
+    /**
+     * @brief Backward search for the rows of the suffix array whose suffixes have `query` as a prefix.
+     * Two rank queries per query character, independent of the text length.
+     *
+     * @param query query string
+     * @return std::pair<int64_t, int64_t> [lower, upper) suffix array rows
+     */
+    std::pair<int64_t, int64_t> equalRange(std::string_view query) const noexcept {
+        int64_t lower = 0, upper = static_cast<int64_t>(length_);
+        for (auto it = std::rbegin(query); it != std::rend(query) && lower < upper; ++it) {
+            const uint8_t base = kmer::BASE_CODES[static_cast<uint8_t>(*it)];
+            if (base == kmer::INVALID_BASE) {
+                return {0, 0};
+            }
+            lower = cumulative_[base] + rank(base, lower);
+            upper = cumulative_[base] + rank(base, upper);
+        }
+        return (lower < upper) ? std::pair<int64_t, int64_t>{lower, upper} : std::pair<int64_t, int64_t>{0, 0};
+    }
+
+    /**
+     * @brief Number of occurrences of `query`.
+     */
+    int64_t count(std::string_view query) const noexcept {
+        const auto [lower, upper] = equalRange(query);
+        return upper - lower;
+    }
+
+    /**
+     * @brief Write the first occurrences of `query` into a caller provided buffer. Positions are in
+     * suffix array order, the same order SuffixArray::locate reports them in.
+     *
+     * @param query query string
+     * @param positions buffer receiving up to positions.size() occurrences
+     * @return int64_t total number of occurrences; min(total, positions.size()) of them were written
+     */
+    int64_t locate(std::string_view query, std::span<int32_t> positions) const noexcept {
+        const auto [lower, upper] = equalRange(query);
+        const auto numResults = std::min<int64_t>(upper - lower, positions.size());
+        for (int64_t i = 0; i < numResults; i += 1) {
+            positions[i] = suffixAt(lower + i);
+        }
+        return upper - lower;
+    }
+
+    /**
+     * @brief Query the index for the specific Query. Same semantics as SuffixArray::query.
+     *
+     * @param q Query object. `count` receives the number of occurrences and `result` at most `maxResults` of them.
+     * @param maxResults Most positions to store in `q.result`. 0 only counts; ALL_RESULTS stores every one.
+     */
+    template <typename QueryType>
+    void query(QueryType &q, int64_t maxResults = ALL_RESULTS) const {
+        const auto [lower, upper] = equalRange(q.query);
+        q.count = upper - lower;
+        q.result.resize((maxResults < 0) ? q.count : std::min(q.count, maxResults));
+        for (size_t i = 0; i < q.result.size(); i += 1) {
+            q.result[i] = suffixAt(lower + static_cast<int64_t>(i));
+        }
+    }
+
+    /**
+     * @brief Perform a set of queries. If enabled, will do them in parallel.
+     * @see query
+     *
+     * @tparam Iterator iterator which returns FMIndex::Query objects, or ones with the same fields.
+     * @param begin Start of query range.
+     * @param end End of query range.
+     * @param maxResults Most positions to store per query. 0 only counts; ALL_RESULTS stores every one.
+     */
+    template <typename Iterator>
+    void queries(Iterator begin, Iterator end, int64_t maxResults = ALL_RESULTS) const {
+        std::for_each(utilities::executionPolicy, begin, end, [this, maxResults](auto &q) {
+            this->query(q, maxResults); });
+    }
+
+    /**
+     * @brief Suffix array value of `row`, recovered by LF stepping back to the nearest sampled text position.
+     */
+    int32_t suffixAt(int64_t row) const noexcept {
+        int32_t steps = 0;
+        while (!isSampled(row)) {
+            const uint8_t base = baseAt(row);
+            row = cumulative_[base] + rank(base, row);
+            steps += 1;
+        }
+        return samples_[sampleIndex(row)] + steps;
+    }
+
+    /**
+     * @brief Length of the indexed text, including the '$' terminator.
+     */
+    size_t size() const noexcept {
+        return length_;
+    }
+
+    /**
+     * @brief Boundaries of the records of the indexed text, for mapping positions to (contig, offset).
+     */
+    ContigTable const& contigs() const noexcept {
+        return contigs_;
+    }
+
+    uint32_t getSampleRate() const noexcept {
+        return sampleRate_;
+    }
+
+    /**
+     * @brief Returns the duration it took to build the FMIndex from its suffix array.
+     */
+    double getBuildTime() const noexcept {
+        return buildTime_;
+    }
+
+    bool isMapped() const noexcept {
+        return occurrences_.isMapped();
+    }
+
+    /**
+     * @brief Saves the FMIndex to the file `fname` in the sectioned index format.
+     * @throws std::ios_base::failure on i/o errors
+     * @see load
+     *
+     * @param fname File to save data to.
+     */
+    void save(std::string const& fname) const {
+        IndexMetadata metadata{length_, sentinelRows_.size(), sampleRate_, {}};
+        std::copy(std::begin(cumulative_), std::end(cumulative_), std::begin(metadata.cumulative));
+
+        indexfile::IndexWriter writer(FMIndex::FILE_MAGIC, FMIndex::FILE_VERSION);
+        writer.addSection(MetadataSection, std::span<const IndexMetadata>(&metadata, 1));
+        writer.addSection(OccurrenceSection, occurrences_.span());
+        writer.addSection(SampledRowsSection, sampledRows_.span());
+        writer.addSection(SamplesSection, samples_.span());
+        writer.addSection(SentinelRowsSection, sentinelRows_.span());
+        writer.addSection(ContigStartsSection, contigs_.starts().span());
+        writer.addSection(ContigNamesSection, contigs_.names().span());
+        writer.addSection(GapStartsSection, contigs_.gapStarts().span());
+        writer.addSection(GapShiftsSection, contigs_.gapShifts().span());
+        writer.write(fname);
+    }
+
+    /**
+     * @brief Loads an FMIndex from a file. Expects the format outputted by FMIndex::save.
+     * @throws std::ios_base::failure on i/o errors, or if `verify` finds a corrupt section
+     * @see save
+     *
+     * @param fname File to load data from.
+     * @param populate pre-fault the whole file rather than paging it in lazily
+     * @param verify check every section against its checksum first, which reads the whole file
+     */
+    void load(std::string const& fname, bool populate=false, bool verify=false) {
+        indexfile::IndexReader reader(fname, FMIndex::FILE_MAGIC, FMIndex::FILE_VERSION, populate);
+        if (verify) {
+            reader.verify();
+        }
+
+        const auto metadata = reader.section<IndexMetadata>(MetadataSection);
+        if (metadata.size() != 1 || metadata[0].sampleRate == 0) {
+            throw std::ios_base::failure("Invalid FM-index file.");
+        }
+        length_ = metadata[0].length;
+        sampleRate_ = static_cast<uint32_t>(metadata[0].sampleRate);
+        std::copy(std::begin(metadata[0].cumulative), std::end(metadata[0].cumulative), std::begin(cumulative_));
+
+        occurrences_ = reader.section<OccurrenceBlock>(OccurrenceSection, MADV_RANDOM);
+        sampledRows_ = reader.section<SampleBlock>(SampledRowsSection, MADV_RANDOM);
+        samples_ = reader.section<int32_t>(SamplesSection, MADV_RANDOM);
+        if (occurrences_.size() != length_ / BASES_PER_BLOCK + 1 || sampledRows_.size() != length_ / ROWS_PER_SAMPLE_BLOCK + 1
+            || samples_.size() != sampleIndex(static_cast<int64_t>(length_)) || cumulative_[4] != length_) {
+            throw std::ios_base::failure("Corrupt FM-index file.");
+        }
+
+        sentinelRows_ = reader.section<uint64_t>(SentinelRowsSection, MADV_WILLNEED);
+        if (sentinelRows_.size() != metadata[0].numSentinels || sentinelRows_.size() != cumulative_[0]
+            || !std::ranges::is_sorted(sentinelRows_) || (!sentinelRows_.empty() && sentinelRows_[sentinelRows_.size() - 1] >= length_)) {
+            throw std::ios_base::failure("Corrupt FM-index sentinel rows.");
+        }
+        markSentinelBlocks();
+
+        contigs_ = ContigTable(reader.section<uint64_t>(ContigStartsSection, MADV_WILLNEED), reader.section<char>(ContigNamesSection),
+            reader.section<uint64_t>(GapStartsSection, MADV_WILLNEED), reader.section<uint64_t>(GapShiftsSection, MADV_WILLNEED));
+        if (!contigs_.isConsistent(length_)) {
+            throw std::ios_base::failure("Corrupt contig table in FM-index file.");
+        }
+        buildTime_ = 0.0;
+    }
+
+private:
+    uint64_t length_ = 0;
+    uint32_t sampleRate_ = DEFAULT_SAMPLE_RATE;
+    std::array<uint64_t, 5> cumulative_{};  // rows starting with a smaller character than each base
+    indexfile::Storage<OccurrenceBlock> occurrences_;
+    indexfile::Storage<SampleBlock> sampledRows_;
+    indexfile::Storage<int32_t> samples_;
+    indexfile::Storage<uint64_t> sentinelRows_;     // sorted
+    std::vector<uint64_t> sentinelBlocks_;          // one bit per occurrence block holding a sentinel row
+    ContigTable contigs_;
+    double buildTime_ = 0.0;
+
+    FMIndex() = default;
+
+    /**
+     * @brief Bit mask of the lower bit of every 2-bit field of `word` that equals `base`.
+     */
+    static uint64_t matches(uint64_t word, uint8_t base) noexcept {
+        constexpr uint64_t LOW_BITS = 0x5555555555555555ULL;
+        const uint64_t diff = word ^ (LOW_BITS * base);
+        return ~(diff | (diff >> 1)) & LOW_BITS;
+    }
+
+    /**
+     * @brief Whether the BWT character of the suffix starting at `suffix` is the '$' or a record separator.
+     */
+    static bool isSentinel(std::string_view text, int32_t suffix) noexcept {
+        return suffix == 0 || text[suffix - 1] == fasta::RECORD_SEPARATOR;
+    }
+
+    /**
+     * @brief Number of sentinel rows in [blockStart, row). Almost every block has none, which one bit tells.
+     */
+    uint64_t sentinelsBefore(int64_t row, uint64_t blockStart) const noexcept {
+        const uint64_t block = blockStart / BASES_PER_BLOCK;
+        if (((sentinelBlocks_[block / 64] >> (block % 64)) & 1) == 0) {
+            return 0;
+        }
+        const auto first = std::lower_bound(std::begin(sentinelRows_), std::end(sentinelRows_), blockStart);
+        return std::distance(first, std::lower_bound(first, std::end(sentinelRows_), static_cast<uint64_t>(row)));
+    }
+
+    void markSentinelBlocks() {
+        sentinelBlocks_.assign(length_ / BASES_PER_BLOCK / 64 + 1, 0);
+        for (const uint64_t row : sentinelRows_) {
+            const uint64_t block = row / BASES_PER_BLOCK;
+            sentinelBlocks_[block / 64] |= uint64_t(1) << (block % 64);
+        }
+    }
+
+    /**
+     * @brief Occurrences of `base` in the BWT before `row`. Sentinels are stored as A, so those within the
+     * block before `row` are subtracted.
+     */
+    uint64_t rank(uint8_t base, int64_t row) const noexcept {
+        auto const& block = occurrences_[row / BASES_PER_BLOCK];
+        const auto offset = static_cast<size_t>(row % BASES_PER_BLOCK);
+        const auto blockStart = static_cast<uint64_t>(row) - offset;
+
+        uint64_t count = block.counts[base];
+        for (size_t w = 0; w < offset / BASES_PER_WORD; w += 1) {
+            count += std::popcount(matches(block.bases[w], base));
+        }
+        if (const auto partial = offset % BASES_PER_WORD; partial != 0) {
+            const uint64_t mask = (uint64_t(1) << (2 * partial)) - 1;
+            count += std::popcount(matches(block.bases[offset / BASES_PER_WORD], base) & mask);
+        }
+        return (base == 0) ? count - sentinelsBefore(row, blockStart) : count;
+    }
+
+    uint8_t baseAt(int64_t row) const noexcept {
+        auto const& block = occurrences_[row / BASES_PER_BLOCK];
+        const auto offset = static_cast<size_t>(row % BASES_PER_BLOCK);
+        return static_cast<uint8_t>((block.bases[offset / BASES_PER_WORD] >> (2 * (offset % BASES_PER_WORD))) & 3);
+    }
+
+    bool isSampled(int64_t row) const noexcept {
+        auto const& block = sampledRows_[row / ROWS_PER_SAMPLE_BLOCK];
+        const auto offset = static_cast<size_t>(row % ROWS_PER_SAMPLE_BLOCK);
+        return (block.bits[offset / 64] >> (offset % 64)) & 1;
+    }
+
+    /**
+     * @brief Number of sampled rows before `row`, i.e. the index of row's sample if it is sampled.
+     */
+    uint64_t sampleIndex(int64_t row) const noexcept {
+        auto const& block = sampledRows_[row / ROWS_PER_SAMPLE_BLOCK];
+        const auto offset = static_cast<size_t>(row % ROWS_PER_SAMPLE_BLOCK);
+
+        uint64_t count = block.rank;
+        for (size_t w = 0; w < offset / 64; w += 1) {
+            count += std::popcount(block.bits[w]);
+        }
+        if (offset % 64 != 0) {
+            count += std::popcount(block.bits[offset / 64] & ((uint64_t(1) << (offset % 64)) - 1));
+        }
+        return count;
+    }
+
+    /**
+     * @brief Pack the BWT into occurrence blocks. Blocks are filled in parallel with their own counts, which a
+     * serial scan over the (n / 192) blocks then turns into counts of everything before them.
+     */
+    void buildOccurrences(std::string_view text, std::span<const int32_t> suffixes) {
+        length_ = suffixes.size();
+        const size_t numBlocks = length_ / BASES_PER_BLOCK + 1;
+        std::vector<OccurrenceBlock> blocks(numBlocks);
+        std::vector<uint8_t> hasSentinel(numBlocks, 0);
+
+        #pragma omp parallel for
+        for (size_t b = 0; b < numBlocks; b += 1) {
+            auto &block = blocks[b];
+            block.counts.fill(0);
+            block.bases.fill(0);
+            const size_t end = std::min<size_t>((b + 1) * BASES_PER_BLOCK, length_);
+            for (size_t row = b * BASES_PER_BLOCK; row < end; row += 1) {
+                const auto offset = row - b * BASES_PER_BLOCK;
+                if (isSentinel(text, suffixes[row])) {
+                    hasSentinel[b] = 1;     /* left as the zero code and never counted */
+                    continue;
+                }
+                const uint8_t base = kmer::BASE_CODES[static_cast<uint8_t>(text[suffixes[row] - 1])] & 3;
+                block.bases[offset / BASES_PER_WORD] |= uint64_t(base) << (2 * (offset % BASES_PER_WORD));
+                block.counts[base] += 1;
+            }
+        }
+
+        /* only blocks known to hold one are rescanned, so this stays cheap for any number of records */
+        std::vector<uint64_t> sentinelRows;
+        for (size_t b = 0; b < numBlocks; b += 1) {
+            const size_t end = std::min<size_t>((b + 1) * BASES_PER_BLOCK, length_);
+            for (size_t row = b * BASES_PER_BLOCK; hasSentinel[b] && row < end; row += 1) {
+                if (isSentinel(text, suffixes[row])) {
+                    sentinelRows.push_back(row);
+                }
+            }
+        }
+        sentinelRows_ = indexfile::Storage<uint64_t>(std::move(sentinelRows));
+        markSentinelBlocks();
+
+        std::array<uint32_t, 4> totals{};
+        for (auto &block : blocks) {
+            for (size_t base = 0; base < 4; base += 1) {
+                const auto blockCount = block.counts[base];
+                block.counts[base] = totals[base];
+                totals[base] += blockCount;
+            }
+        }
+
+        cumulative_[0] = sentinelRows_.size();     // the '$' and separator rows sort before everything
+        for (size_t base = 0; base < 4; base += 1) {
+            cumulative_[base + 1] = cumulative_[base] + totals[base];
+        }
+        occurrences_ = indexfile::Storage<OccurrenceBlock>(std::move(blocks));
+    }
+
+    /**
+     * @brief Mark the rows whose suffix starts at a multiple of the sampling rate, or that are sentinels, and keep
+     * their values in row order.
+     */
+    void buildSamples(std::string_view text, std::span<const int32_t> suffixes) {
+        const size_t numBlocks = length_ / ROWS_PER_SAMPLE_BLOCK + 1;
+        std::vector<SampleBlock> blocks(numBlocks);
+
+        #pragma omp parallel for
+        for (size_t b = 0; b < numBlocks; b += 1) {
+            auto &block = blocks[b];
+            block.rank = 0;
+            block.bits.fill(0);
+            const size_t end = std::min<size_t>((b + 1) * ROWS_PER_SAMPLE_BLOCK, length_);
+            for (size_t row = b * ROWS_PER_SAMPLE_BLOCK; row < end; row += 1) {
+                const auto offset = row - b * ROWS_PER_SAMPLE_BLOCK;
+                const uint64_t sampled = (suffixes[row] % sampleRate_) == 0 || isSentinel(text, suffixes[row]);
+                block.bits[offset / 64] |= sampled << (offset % 64);
+                block.rank += sampled;
+            }
+        }
+
+        uint64_t total = 0;
+        for (auto &block : blocks) {
+            const auto blockCount = block.rank;
+            block.rank = total;
+            total += blockCount;
+        }
+
+        std::vector<int32_t> samples(total);
+        #pragma omp parallel for
+        for (size_t b = 0; b < numBlocks; b += 1) {
+            auto idx = blocks[b].rank;
+            const size_t end = std::min<size_t>((b + 1) * ROWS_PER_SAMPLE_BLOCK, length_);
+            for (size_t row = b * ROWS_PER_SAMPLE_BLOCK; row < end; row += 1) {
+                if (suffixes[row] % sampleRate_ == 0 || isSentinel(text, suffixes[row])) {
+                    samples[idx] = suffixes[row];
+                    idx += 1;
+                }
+            }
+        }
+
+        sampledRows_ = indexfile::Storage<SampleBlock>(std::move(blocks));
+        samples_ = indexfile::Storage<int32_t>(std::move(samples));
+    }
+};
+
+}   // namespace suffixarray
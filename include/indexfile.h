@@ -0,0 +1,639 @@
+/**
+ * @file indexfile.h
+ * @author Daniel Nichols
+ * @brief Sectioned on-disk index layout that can be memory mapped and read in place.
+ * @date 2022-04-20
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>    // max, min
+#include <array>        // array
+#include <bit>          // bit_width
+#include <cerrno>       // errno, EINTR
+#include <cstddef>      // byte
+#include <cstdint>      // uint32_t, uint64_t
+#include <cstring>      // memcpy
+#include <exception>    // ios_base::failure
+#include <fstream>      // ifstream, ofstream
+#include <memory>       // shared_ptr
+#include <new>          // bad_alloc
+#include <span>         // span
+#include <stdexcept>    // length_error
+#include <string>       // string
+#include <type_traits>  // is_trivially_copyable, is_integral, is_convertible, is_constructible
+#include <utility>      // swap, pair
+#include <vector>       // vector
+
+/* posix includes */
+#include <fcntl.h>      // open
+#include <sys/mman.h>   // mmap, munmap, madvise
+#include <sys/stat.h>   // fstat
+#include <unistd.h>     // close, sysconf, pwrite, ftruncate
+
+/* zlib includes */
+#include <zlib.h>       // crc32, crc32_combine
+
+namespace indexfile {
+
+/* every section starts on a page boundary so that it can be mapped and advised independently */
+constexpr uint64_t SECTION_ALIGNMENT = 4096;
+constexpr uint32_t MAX_SECTIONS = 32;
+
+/* sections are written, checksummed, and bit packed a block of this many bytes per iteration in parallel */
+constexpr uint64_t BLOCK_SIZE = uint64_t(8) << 20;
+
+/**
+ * @brief How the elements of a section are stored. Raw sections are the elements' bytes and are mapped in place.
+ * BitPacked sections hold non-negative integers at `bitWidth` bits each, least significant bit first, in 64-bit
+ * words; they are decoded into memory when read.
+ */
+enum class Encoding : uint32_t { Raw = 0, BitPacked };
+
+/**
+ * @brief Location of one section within an index file.
+ */
+struct SectionEntry {
+    uint32_t id, elementSize;
+    uint64_t offset, size;          /* stored bytes */
+    uint64_t length;                /* elements */
+    Encoding encoding;
+    uint32_t bitWidth;
+    uint32_t checksum, reserved;    /* CRC-32 of the stored bytes */
+};
+
+/**
+ * @brief Fixed size header at the start of every index file.
+ */
+struct FileHeader {
+    uint32_t magic, version;
+    uint32_t numSections, checksum; /* CRC-32 of the section table */
+    std::array<SectionEntry, MAX_SECTIONS> sections;
+};
+static_assert(std::is_trivial<FileHeader>::value, "FileHeader must be trivially serializable.");
+static_assert(sizeof(FileHeader) <= SECTION_ALIGNMENT, "FileHeader must fit before the first section.");
+
+
+/**
+ * @brief CRC-32 of `length` bytes. Blocks of BLOCK_SIZE are summed in parallel and joined with crc32_combine,
+ * so the result is the same as the serial CRC-32 of the bytes.
+ */
+inline uint32_t checksum(void const* bytes, uint64_t length) {
+    auto const* first = static_cast<Bytef const*>(bytes);
+    const uint64_t numBlocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    std::vector<uLong> blockSums(numBlocks);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (uint64_t block = 0; block < numBlocks; block += 1) {
+        const uint64_t start = block * BLOCK_SIZE;
+        blockSums[block] = ::crc32(0, first + start, static_cast<uInt>(std::min(BLOCK_SIZE, length - start)));
+    }
+
+    uLong sum = ::crc32(0, nullptr, 0);
+    for (uint64_t block = 0; block < numBlocks; block += 1) {
+        const uint64_t start = block * BLOCK_SIZE;
+        sum = ::crc32_combine(sum, blockSums[block], static_cast<z_off_t>(std::min(BLOCK_SIZE, length - start)));
+    }
+    return static_cast<uint32_t>(sum);
+}
+
+/**
+ * @brief Element types that can be stored BitPacked: integers, and types that convert to and from int64_t like
+ * packedint::Int40.
+ */
+template <typename T>
+concept PackableInteger = std::is_integral<T>::value
+    || (std::is_convertible<T, int64_t>::value && std::is_constructible<T, int64_t>::value);
+
+/**
+ * @brief Number of 64-bit words that hold `length` elements packed at `bitWidth` bits. Elements are packed in
+ * groups of 64, each filling exactly `bitWidth` words, so that groups can be packed and unpacked independently.
+ */
+constexpr uint64_t packedWords(uint64_t length, uint32_t bitWidth) noexcept {
+    return (length + 63) / 64 * bitWidth;
+}
+
+/**
+ * @brief Pack non-negative `values` at `bitWidth` bits each, a block of groups per iteration in parallel.
+ * @see Encoding
+ */
+template <PackableInteger T>
+std::vector<uint64_t> pack(std::span<const T> values, uint32_t bitWidth) {
+    std::vector<uint64_t> words(packedWords(values.size(), bitWidth), 0);
+    const uint64_t numGroups = (values.size() + 63) / 64;
+    #pragma omp parallel for schedule(static, BLOCK_SIZE / 512)
+    for (uint64_t group = 0; group < numGroups; group += 1) {
+        const uint64_t last = std::min<uint64_t>(values.size(), (group + 1) * 64);
+        for (uint64_t i = group * 64; i < last; i += 1) {
+            const auto value = static_cast<uint64_t>(static_cast<int64_t>(values[i]));
+            const uint64_t bit = i * bitWidth;
+            const uint64_t shift = bit % 64;
+            words[bit / 64] |= value << shift;
+            if (shift + bitWidth > 64) {
+                words[bit / 64 + 1] |= value >> (64 - shift);
+            }
+        }
+    }
+    return words;
+}
+
+/**
+ * @brief Unpack `length` elements of `bitWidth` bits from `words` into `out`, a block of groups per iteration
+ * in parallel.
+ * @see pack
+ */
+template <PackableInteger T>
+void unpack(uint64_t const* words, uint64_t length, uint32_t bitWidth, T *out) {
+    const uint64_t mask = (bitWidth == 64) ? ~uint64_t(0) : (uint64_t(1) << bitWidth) - 1;
+    #pragma omp parallel for schedule(static, BLOCK_SIZE / 8)
+    for (uint64_t i = 0; i < length; i += 1) {
+        const uint64_t bit = i * bitWidth;
+        const uint64_t shift = bit % 64;
+        uint64_t value = words[bit / 64] >> shift;
+        if (shift + bitWidth > 64) {
+            value |= words[bit / 64 + 1] << (64 - shift);
+        }
+        out[i] = T(static_cast<int64_t>(value & mask));
+    }
+}
+
+
+/**
+ * @brief Magic number of the index file at `path`, so callers can tell index types apart before loading.
+ * @throws std::ios_base::failure if the file cannot be read
+ */
+inline uint32_t readMagic(std::string const& path) {
+    std::ifstream inputFile(path, std::ios::binary);
+    FileHeader header{};
+    if (!inputFile.read(reinterpret_cast<char *>(&header), sizeof(header.magic))) {
+        throw std::ios_base::failure("Could not read index file \"" + path + "\".");
+    }
+    return header.magic;
+}
+
+
+/**
+ * @brief Read-only, shared memory mapping of an entire file. Pages are shared through the page cache
+ * with every other process mapping the same file.
+ */
+class MappedFile {
+public:
+    /**
+     * @brief Map the file at `path` into memory.
+     * @throws std::ios_base::failure if the file cannot be opened or mapped
+     *
+     * @param path file to map
+     * @param populate pre-fault the whole file instead of paging it in on demand
+     */
+    explicit MappedFile(std::string const& path, bool populate=false) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::ios_base::failure("Could not open \"" + path + "\" for loading.");
+        }
+
+        struct stat fileStat;
+        if (::fstat(fd, &fileStat) != 0) {
+            ::close(fd);
+            throw std::ios_base::failure("Could not stat \"" + path + "\".");
+        }
+
+        size_ = static_cast<size_t>(fileStat.st_size);
+        if (size_ != 0) {
+            int flags = MAP_SHARED;
+            #if defined(MAP_POPULATE)
+            if (populate) {
+                flags |= MAP_POPULATE;
+            }
+            #endif
+
+            void *addr = ::mmap(nullptr, size_, PROT_READ, flags, fd, 0);
+            if (addr == MAP_FAILED) {
+                ::close(fd);
+                throw std::ios_base::failure("Could not memory map \"" + path + "\".");
+            }
+            data_ = static_cast<std::byte const*>(addr);
+        }
+        ::close(fd);
+    }
+
+    /**
+     * @brief Private, zero filled, writable memory of `size` bytes that is not backed by a file. Its pages are
+     * only allocated when first written, so a NUMA policy set on the range before then decides where they live.
+     * @throws std::bad_alloc if the memory cannot be mapped
+     */
+    static std::shared_ptr<MappedFile> anonymous(size_t size) {
+        std::shared_ptr<MappedFile> mapping(new MappedFile);
+        mapping->size_ = size;
+        if (size != 0) {
+            void *addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (addr == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            mapping->data_ = static_cast<std::byte const*>(addr);
+        }
+        return mapping;
+    }
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    ~MappedFile() {
+        if (data_ != nullptr) {
+            ::munmap(const_cast<std::byte *>(data_), size_);
+        }
+    }
+
+    std::byte const* data() const noexcept {
+        return data_;
+    }
+
+    size_t size() const noexcept {
+        return size_;
+    }
+
+    /**
+     * @brief The bytes of an anonymous mapping, for filling it in. File mappings are read only.
+     */
+    std::byte *writableData() noexcept {
+        return const_cast<std::byte *>(data_);
+    }
+
+    /**
+     * @brief Hint the kernel about the access pattern of a byte range. Failures are ignored; this is only advice.
+     *
+     * @param offset start of range in bytes
+     * @param length length of range in bytes
+     * @param advice one of the MADV_* constants
+     */
+    void advise(size_t offset, size_t length, int advice) const noexcept {
+        if (data_ == nullptr || length == 0) {
+            return;
+        }
+        const size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        const size_t alignedOffset = offset - (offset % pageSize);
+        ::madvise(const_cast<std::byte *>(data_) + alignedOffset, length + (offset - alignedOffset), advice);
+    }
+
+private:
+    std::byte const* data_ = nullptr;
+    size_t size_ = 0;
+
+    MappedFile() = default;
+};
+
+
+/**
+ * @brief Array that either owns its elements or views elements inside a MappedFile. Either way it is
+ * accessed through the same span so that query code does not care where the index came from.
+ *
+ * @tparam T trivially copyable element type
+ */
+template <typename T>
+class Storage {
+    static_assert(std::is_trivially_copyable<T>::value, "Storage elements must be trivially copyable.");
+
+public:
+    Storage() = default;
+
+    explicit Storage(std::vector<T> &&values) : owned_(std::move(values)), view_(owned_) {}
+
+    Storage(std::span<const T> view, std::shared_ptr<const MappedFile> mapping)
+        : view_(view), mapping_(std::move(mapping)) {}
+
+    Storage(Storage const& other)
+        : owned_(other.owned_), view_(other.isMapped() ? other.view_ : std::span<const T>(owned_)),
+          mapping_(other.mapping_) {}
+
+    Storage(Storage &&other) noexcept
+        : owned_(std::move(other.owned_)), view_(other.view_), mapping_(std::move(other.mapping_)) {
+        other.view_ = {};
+    }
+
+    Storage& operator=(Storage other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    void swap(Storage &other) noexcept {
+        std::swap(owned_, other.owned_);
+        std::swap(view_, other.view_);
+        std::swap(mapping_, other.mapping_);
+    }
+
+    std::span<const T> span() const noexcept { return view_; }
+    T const* data() const noexcept { return view_.data(); }
+    size_t size() const noexcept { return view_.size(); }
+    bool empty() const noexcept { return view_.empty(); }
+    auto begin() const noexcept { return view_.begin(); }
+    auto end() const noexcept { return view_.end(); }
+    T const& operator[](size_t idx) const noexcept { return view_[idx]; }
+
+    /**
+     * @brief Whether the elements live inside a memory mapped file.
+     */
+    bool isMapped() const noexcept {
+        return mapping_ != nullptr;
+    }
+
+private:
+    std::vector<T> owned_;
+    std::span<const T> view_;
+    std::shared_ptr<const MappedFile> mapping_;
+};
+
+
+/**
+ * @brief Collects sections and writes them out as a single aligned, checksummed index file.
+ * Raw sections are not copied, so their memory must outlive the call to `write`.
+ */
+class IndexWriter {
+public:
+    IndexWriter(uint32_t magic, uint32_t version) : magic_(magic), version_(version) {}
+
+    /**
+     * @brief Register a section to be written.
+     * @throws std::length_error if more than MAX_SECTIONS are added
+     *
+     * @tparam T trivially copyable element type
+     * @param id unique section identifier
+     * @param values section contents
+     */
+    template <typename T>
+    void addSection(uint32_t id, std::span<const T> values) {
+        static_assert(std::is_trivially_copyable<T>::value, "Sections must be trivially copyable.");
+        if (sections_.size() == MAX_SECTIONS) {
+            throw std::length_error("Too many sections in index file.");
+        }
+        sections_.push_back({id, sizeof(T), reinterpret_cast<char const*>(values.data()), values.size_bytes(),
+            values.size(), Encoding::Raw, 0, {}});
+    }
+
+    /**
+     * @brief Register a section of integers to be stored BitPacked at the fewest bits that hold the largest of
+     * them. The values are packed into a buffer owned by the writer, so they need not outlive this call. A section
+     * with a negative value is stored Raw instead.
+     * @throws std::length_error if more than MAX_SECTIONS are added
+     *
+     * @tparam T integer element type
+     * @param id unique section identifier
+     * @param values section contents
+     */
+    template <PackableInteger T>
+    void addPackedSection(uint32_t id, std::span<const T> values) {
+        int64_t minimum = 0, maximum = 0;
+        #pragma omp parallel for reduction(min: minimum) reduction(max: maximum)
+        for (size_t i = 0; i < values.size(); i += 1) {
+            const auto value = static_cast<int64_t>(values[i]);
+            minimum = std::min(minimum, value);
+            maximum = std::max(maximum, value);
+        }
+        if (minimum < 0) {
+            addSection(id, values);
+            return;
+        }
+
+        addSection(id, std::span<const T>());
+        const auto bitWidth = std::max(1u, static_cast<uint32_t>(std::bit_width(static_cast<uint64_t>(maximum))));
+        auto &section = sections_.back();
+        section.packed = pack(values, bitWidth);
+        section.size = section.packed.size() * sizeof(uint64_t);
+        section.length = values.size();
+        section.encoding = Encoding::BitPacked;
+        section.bitWidth = bitWidth;
+    }
+
+    /**
+     * @brief Write header and all sections to `fname`. The sections are split into blocks of BLOCK_SIZE that are
+     * checksummed and written with pwrite in parallel; the header goes last, once the checksums are known.
+     * @throws std::ios_base::failure on i/o errors
+     *
+     * @param fname output file
+     */
+    void write(std::string const& fname) const {
+        FileHeader header{};
+        header.magic = magic_;
+        header.version = version_;
+        header.numSections = static_cast<uint32_t>(sections_.size());
+
+        uint64_t offset = alignUp(sizeof(FileHeader)), fileSize = sizeof(FileHeader);
+        std::vector<std::pair<size_t, uint64_t>> blocks;    /* section and start of each block */
+        for (size_t i = 0; i < sections_.size(); i += 1) {
+            auto const& section = sections_.at(i);
+            header.sections.at(i) = {section.id, section.elementSize, offset, section.size, section.length,
+                section.encoding, section.bitWidth, 0, 0};
+            for (uint64_t start = 0; start < section.size; start += BLOCK_SIZE) {
+                blocks.emplace_back(i, start);
+            }
+            fileSize = offset + section.size;
+            offset = alignUp(fileSize);
+        }
+
+        const int fd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::ios_base::failure("Could not open \"" + fname + "\" for saving.");
+        }
+        /* the padding between sections reads back as zeros without being written */
+        bool failed = ::ftruncate(fd, static_cast<off_t>(fileSize)) != 0;
+
+        std::vector<uLong> blockSums(blocks.size());
+        #pragma omp parallel for schedule(dynamic, 1) reduction(||: failed)
+        for (size_t block = 0; block < blocks.size(); block += 1) {
+            const auto [i, start] = blocks[block];
+            char const* bytes = sections_[i].data() + start;
+            const uint64_t length = std::min(BLOCK_SIZE, sections_[i].size - start);
+            blockSums[block] = ::crc32(0, reinterpret_cast<Bytef const*>(bytes), static_cast<uInt>(length));
+            failed = !writeAt(fd, bytes, length, header.sections[i].offset + start) || failed;
+        }
+
+        std::vector<uLong> sums(sections_.size(), ::crc32(0, nullptr, 0));
+        for (size_t block = 0; block < blocks.size(); block += 1) {
+            const auto [i, start] = blocks[block];
+            sums[i] = ::crc32_combine(sums[i], blockSums[block],
+                static_cast<z_off_t>(std::min(BLOCK_SIZE, sections_[i].size - start)));
+        }
+        for (size_t i = 0; i < sections_.size(); i += 1) {
+            header.sections.at(i).checksum = static_cast<uint32_t>(sums[i]);
+        }
+        header.checksum = checksum(header.sections.data(), sizeof(header.sections));
+
+        failed = !writeAt(fd, reinterpret_cast<char const*>(&header), sizeof(header), 0) || failed;
+        failed = (::close(fd) != 0) || failed;
+        if (failed) {
+            throw std::ios_base::failure("Error while writing \"" + fname + "\".");
+        }
+    }
+
+private:
+    struct PendingSection {
+        uint32_t id, elementSize;
+        char const* bytes;
+        uint64_t size, length;
+        Encoding encoding;
+        uint32_t bitWidth;
+        std::vector<uint64_t> packed;   /* contents of BitPacked sections */
+
+        char const* data() const noexcept {
+            return (encoding == Encoding::BitPacked) ? reinterpret_cast<char const*>(packed.data()) : bytes;
+        }
+    };
+
+    uint32_t magic_, version_;
+    std::vector<PendingSection> sections_;
+
+    static uint64_t alignUp(uint64_t value) noexcept {
+        return (value + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+    }
+
+    static bool writeAt(int fd, char const* bytes, uint64_t length, uint64_t offset) noexcept {
+        while (length > 0) {
+            const ssize_t bytesWritten = ::pwrite(fd, bytes, length, static_cast<off_t>(offset));
+            if (bytesWritten < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytesWritten <= 0) {
+                return false;
+            }
+            bytes += bytesWritten;
+            length -= static_cast<uint64_t>(bytesWritten);
+            offset += static_cast<uint64_t>(bytesWritten);
+        }
+        return true;
+    }
+};
+
+
+/**
+ * @brief Maps an index file written by IndexWriter and hands out zero-copy views of its sections.
+ */
+class IndexReader {
+public:
+    /**
+     * @brief Map and validate the index file at `path`.
+     * @throws std::ios_base::failure on i/o errors, bad magic numbers, or unsupported versions
+     *
+     * @param path index file
+     * @param magic expected magic number
+     * @param version expected file format version
+     * @param populate pre-fault the whole file
+     */
+    IndexReader(std::string const& path, uint32_t magic, uint32_t version, bool populate=false)
+        : mapping_(std::make_shared<const MappedFile>(path, populate)) {
+
+        if (mapping_->size() < sizeof(FileHeader)) {
+            throw std::ios_base::failure("Invalid suffix array file.");
+        }
+        std::memcpy(&header_, mapping_->data(), sizeof(FileHeader));
+
+        if (header_.magic != magic) {
+            throw std::ios_base::failure("Invalid suffix array file.");
+        }
+        if (header_.version != version) {
+            throw std::ios_base::failure("Unsupported suffix array file version " + std::to_string(header_.version)
+                + " (expected " + std::to_string(version) + ").");
+        }
+        if (header_.numSections > MAX_SECTIONS
+            || checksum(header_.sections.data(), sizeof(header_.sections)) != header_.checksum) {
+            throw std::ios_base::failure("Corrupt suffix array file header.");
+        }
+        for (uint32_t i = 0; i < header_.numSections; i += 1) {
+            auto const& entry = header_.sections.at(i);
+            if (entry.offset % SECTION_ALIGNMENT != 0 || entry.offset > mapping_->size()
+                || entry.size > mapping_->size() - entry.offset || entry.elementSize == 0
+                || (entry.encoding == Encoding::Raw && entry.size != entry.length * entry.elementSize)
+                || (entry.encoding == Encoding::BitPacked && (entry.bitWidth == 0 || entry.bitWidth > 8 * entry.elementSize
+                    || entry.size != packedWords(entry.length, entry.bitWidth) * sizeof(uint64_t)))
+                || entry.encoding > Encoding::BitPacked) {
+                throw std::ios_base::failure("Corrupt suffix array file section table.");
+            }
+        }
+    }
+
+    /**
+     * @brief Check every section against its checksum. Reads the whole file, so it is only done on request.
+     * @throws std::ios_base::failure naming the first section that does not match
+     */
+    void verify() const {
+        for (uint32_t i = 0; i < header_.numSections; i += 1) {
+            auto const& entry = header_.sections.at(i);
+            if (checksum(mapping_->data() + entry.offset, entry.size) != entry.checksum) {
+                throw std::ios_base::failure("Checksum mismatch in section " + std::to_string(entry.id)
+                    + " of index file.");
+            }
+        }
+    }
+
+    /**
+     * @brief Whether the file contains section `id`.
+     */
+    bool has(uint32_t id) const noexcept {
+        return find(id) != nullptr;
+    }
+
+    /**
+     * @brief Size in bytes of one element of section `id`. 0 if the file has no such section.
+     */
+    uint32_t elementSize(uint32_t id) const noexcept {
+        SectionEntry const* entry = find(id);
+        return (entry == nullptr) ? 0 : entry->elementSize;
+    }
+
+    /**
+     * @brief Whether section `id` is stored BitPacked, i.e. is decoded into memory by `section` instead of mapped.
+     */
+    bool isPacked(uint32_t id) const noexcept {
+        SectionEntry const* entry = find(id);
+        return entry != nullptr && entry->encoding == Encoding::BitPacked;
+    }
+
+    /**
+     * @brief View of section `id` as an array of T. BitPacked sections are unpacked in parallel into memory
+     * owned by the Storage.
+     * @throws std::ios_base::failure if the section is missing or its element type does not match
+     *
+     * @tparam T element type
+     * @param id section identifier
+     * @param advice optional MADV_* access pattern hint for this section; ignored if it is unpacked
+     * @return Storage<T> view into the mapping, which it keeps alive, or the unpacked elements
+     */
+    template <typename T>
+    Storage<T> section(uint32_t id, int advice = MADV_NORMAL) const {
+        SectionEntry const* entry = find(id);
+        if (entry == nullptr) {
+            throw std::ios_base::failure("Missing section " + std::to_string(id) + " in suffix array file.");
+        }
+        if (entry->elementSize != sizeof(T)) {
+            throw std::ios_base::failure("Section " + std::to_string(id) + " has unexpected element size.");
+        }
+
+        if (entry->encoding == Encoding::BitPacked) {
+            if constexpr (PackableInteger<T>) {
+                mapping_->advise(entry->offset, entry->size, MADV_SEQUENTIAL);
+                std::vector<T> values(entry->length);
+                unpack(reinterpret_cast<uint64_t const*>(mapping_->data() + entry->offset), entry->length,
+                    entry->bitWidth, values.data());
+                return Storage<T>(std::move(values));
+            }
+            throw std::ios_base::failure("Section " + std::to_string(id) + " has unexpected encoding.");
+        }
+
+        if (advice != MADV_NORMAL) {
+            mapping_->advise(entry->offset, entry->size, advice);
+        }
+        auto const* first = reinterpret_cast<T const*>(mapping_->data() + entry->offset);
+        return Storage<T>(std::span<const T>(first, entry->length), mapping_);
+    }
+
+private:
+    std::shared_ptr<const MappedFile> mapping_;
+    FileHeader header_;
+
+    SectionEntry const* find(uint32_t id) const noexcept {
+        for (uint32_t i = 0; i < header_.numSections; i += 1) {
+            if (header_.sections.at(i).id == id) {
+                return &header_.sections.at(i);
+            }
+        }
+        return nullptr;
+    }
+};
+
+}   // namespace indexfile
@@ -0,0 +1,144 @@
+/**
+ * @file kmer.h
+ * @author Daniel Nichols
+ * @brief 2-bit packed encoding of nucleotide k-mers.
+ * @date 2022-04-20
+ */
+#pragma once
+
+/* stl includes */
+#include <array>        // array
+#include <cstdint>      // uint8_t, uint64_t
+#include <string>       // string
+#include <string_view>  // string_view
+
+namespace kmer {
+
+/* A < C < G < T in both ASCII and 2-bit code, so packed k-mers sort like the strings they encode */
+constexpr uint8_t INVALID_BASE = 4;
+constexpr size_t MAX_PACKED_LENGTH = 32;    // bases that fit in a uint64_t
+
+/**
+ * @brief Lookup table from character to 2-bit base code. Everything but A, C, G, T maps to INVALID_BASE.
+ */
+constexpr std::array<uint8_t, 256> BASE_CODES = [] {
+    std::array<uint8_t, 256> codes{};
+    codes.fill(INVALID_BASE);
+    codes['A'] = 0;
+    codes['C'] = 1;
+    codes['G'] = 2;
+    codes['T'] = 3;
+    return codes;
+}();
+
+/**
+ * @brief Result of packing a k-mer. `valid` is false if any base was not A, C, G, or T.
+ */
+struct PackedKmer {
+    uint64_t code;
+    bool valid;
+};
+
+/**
+ * @brief Pack the first `k` bases of `sequence` into a 2-bit code. The first base ends up in the most
+ * significant position so codes compare in lexicographic order. No branches on the sequence contents.
+ *
+ * @param sequence sequence of at least k characters
+ * @param k number of bases to pack; at most MAX_PACKED_LENGTH
+ * @return PackedKmer packed code and whether it is a valid k-mer
+ */
+inline PackedKmer encode(std::string_view sequence, size_t k) noexcept {
+    uint64_t code = 0;
+    uint8_t invalid = 0;
+    for (size_t i = 0; i < k; i += 1) {
+        const uint8_t base = BASE_CODES[static_cast<uint8_t>(sequence[i])];
+        invalid |= base;
+        code = (code << 2) | (base & 3);
+    }
+    return {code, (invalid & INVALID_BASE) == 0};
+}
+
+/**
+ * @brief Watson-Crick complement of every character; anything but A, C, G, and T is its own complement.
+ */
+constexpr std::array<char, 256> COMPLEMENTS = [] {
+    std::array<char, 256> complements{};
+    for (size_t c = 0; c < complements.size(); c += 1) {
+        complements[c] = static_cast<char>(c);
+    }
+    complements['A'] = 'T';
+    complements['C'] = 'G';
+    complements['G'] = 'C';
+    complements['T'] = 'A';
+    return complements;
+}();
+
+/**
+ * @brief Write the reverse complement of `sequence` to the `sequence.size()` characters at `out`.
+ */
+inline void reverseComplement(std::string_view sequence, char *out) noexcept {
+    for (size_t i = 0; i < sequence.size(); i += 1) {
+        out[sequence.size() - 1 - i] = COMPLEMENTS[static_cast<uint8_t>(sequence[i])];
+    }
+}
+
+/**
+ * @brief The sequence read off the opposite strand: reversed and complemented.
+ */
+inline std::string reverseComplement(std::string_view sequence) {
+    std::string result(sequence.size(), 'N');
+    reverseComplement(sequence, result.data());
+    return result;
+}
+
+/**
+ * @brief Number of distinct k-mers, i.e. 4^k.
+ */
+constexpr uint64_t numKmers(size_t k) noexcept {
+    return uint64_t(1) << (2 * k);
+}
+
+/* characters packed into an ordered key, 4 bits each */
+constexpr size_t ORDERED_KEY_LENGTH = 16;
+
+/**
+ * @brief Order preserving 4-bit code of every character: A, C, G, T, and the gaps around them, so the '$' and
+ * record separators, or N in a query, still sort correctly. 0 is kept for past the end of a string.
+ */
+constexpr std::array<uint8_t, 256> ORDERED_CODES = [] {
+    std::array<uint8_t, 256> codes{};
+    for (size_t c = 0; c < codes.size(); c += 1) {
+        codes[c] = 1 + 2 * (c > 'A') + 2 * (c > 'C') + 2 * (c > 'G') + 2 * (c > 'T')
+            + (c == 'A' || c == 'C' || c == 'G' || c == 'T');
+    }
+    return codes;
+}();
+
+/**
+ * @brief Pack the first ORDERED_KEY_LENGTH characters of `sequence` so that keys compare like the strings:
+ * a smaller key means a smaller string. Equal keys only say the strings agree up to which gap each
+ * non-ACGT character falls in; for pure DNA they agree exactly.
+ *
+ * A character sorting before A, i.e. a record separator or the '$', ends the key as the end of the string
+ * would. Suffix arrays are only ordered up to the end of each record, e.g. when merged from shards, and the
+ * keys of their suffixes then follow the same order.
+ */
+inline uint64_t orderedKey(std::string_view sequence) noexcept {
+    constexpr uint8_t RECORD_END_CODE = ORDERED_CODES['A'] - 1;
+    uint64_t key = 0;
+    size_t length = 0;
+    const size_t maxLength = (sequence.size() < ORDERED_KEY_LENGTH) ? sequence.size() : ORDERED_KEY_LENGTH;
+    for (; length < maxLength && ORDERED_CODES[static_cast<uint8_t>(sequence[length])] != RECORD_END_CODE; length += 1) {
+        key = (key << 4) | ORDERED_CODES[static_cast<uint8_t>(sequence[length])];
+    }
+    return (length == 0) ? 0 : key << (4 * (ORDERED_KEY_LENGTH - length));
+}
+
+/**
+ * @brief Mask keeping the codes of the first `length` characters of an ordered key.
+ */
+constexpr uint64_t orderedKeyMask(size_t length) noexcept {
+    return (length >= ORDERED_KEY_LENGTH) ? ~uint64_t(0) : ~(~uint64_t(0) >> (4 * length));
+}
+
+}   // namespace kmer
@@ -0,0 +1,162 @@
+/**
+ * @file lcp.h
+ * @author Daniel Nichols
+ * @brief Longest common prefix arrays for LCP accelerated suffix array search.
+ * @date 2022-04-21
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>    // max, min
+#include <cstdint>      // int32_t, int64_t, uint8_t
+#include <span>         // span
+#include <stdexcept>    // runtime_error
+#include <string_view>  // string_view
+#include <vector>       // vector
+
+/* tpl includes */
+#include "libsais.h"    // libsais_plcp, libsais_lcp
+#include "libsais64.h"  // libsais64_plcp, libsais64_lcp
+
+/* local includes */
+#include "fasta.h"      // RECORD_SEPARATOR
+
+namespace lcp {
+
+/* stored LCP values saturate here; searches are exact for queries shorter than this */
+constexpr uint32_t MAX_STORED_LCP = 255;
+
+/**
+ * @brief Manber-Myers LCP-LR arrays. For every midpoint M of the implicit binary search tree over the suffix
+ * array, with bounds (L, R), `left[M] = lcp(L, M)` and `right[M] = lcp(M, R)`.
+ * Bounds outside the array have an LCP of 0.
+ */
+struct LCPLR {
+    std::vector<uint8_t> left, right;
+};
+
+/**
+ * @brief libsais permuted LCP and LCP entry points for 32 and 64-bit suffix arrays.
+ */
+inline int32_t permutedLCP(const uint8_t *text, const int32_t *suffixes, int32_t *plcp, int32_t n) {
+    #if defined(_OPENMP)
+    return libsais_plcp_omp(text, suffixes, plcp, n, 0);
+    #else
+    return libsais_plcp(text, suffixes, plcp, n);
+    #endif
+}
+
+inline int64_t permutedLCP(const uint8_t *text, const int64_t *suffixes, int64_t *plcp, int64_t n) {
+    #if defined(_OPENMP)
+    return libsais64_plcp_omp(text, suffixes, plcp, n, 0);
+    #else
+    return libsais64_plcp(text, suffixes, plcp, n);
+    #endif
+}
+
+inline int32_t unpermuteLCP(const int32_t *plcp, const int32_t *suffixes, int32_t *lcpArray, int32_t n) {
+    #if defined(_OPENMP)
+    return libsais_lcp_omp(plcp, suffixes, lcpArray, n, 0);
+    #else
+    return libsais_lcp(plcp, suffixes, lcpArray, n);
+    #endif
+}
+
+inline int64_t unpermuteLCP(const int64_t *plcp, const int64_t *suffixes, int64_t *lcpArray, int64_t n) {
+    #if defined(_OPENMP)
+    return libsais64_lcp_omp(plcp, suffixes, lcpArray, n, 0);
+    #else
+    return libsais64_lcp(plcp, suffixes, lcpArray, n);
+    #endif
+}
+
+/**
+ * @brief Compute the LCP array, where entry i is the LCP of suffixes i-1 and i in suffix array order.
+ * Goes through the permuted LCP array as libsais does.
+ * @throws std::runtime_error if libsais fails
+ *
+ * @tparam Index int32_t or int64_t suffix array entries
+ * @param text text the suffix array is built on
+ * @param suffixes suffix array of text
+ * @return std::vector<Index> LCP array
+ */
+template <typename Index>
+std::vector<Index> buildLCP(std::string_view text, std::span<const Index> suffixes) {
+    const uint8_t *rawData = reinterpret_cast<const uint8_t*>(text.data());
+    const auto n = static_cast<Index>(suffixes.size());
+    std::vector<Index> plcp(n), lcpArray(n);
+
+    auto result = permutedLCP(rawData, suffixes.data(), plcp.data(), n);
+    result |= unpermuteLCP(plcp.data(), suffixes.data(), lcpArray.data(), n);
+
+    if (result != 0) {
+        throw std::runtime_error("SAISLIB Error -- Could not construct LCP array.");
+    }
+    return lcpArray;
+}
+
+/**
+ * @brief Compute the LCP array of a suffix array that is only ordered up to the end of each suffix's record, as
+ * merged ones are (see merge::mergeSuffixes), by comparing neighbours directly. Entry i is the number of bases
+ * suffixes i-1 and i share before either record ends, which is all a search ever compares, up to `maxLCP`.
+ *
+ * @tparam Index int32_t or int64_t suffix array entries
+ * @param text text the suffix array is built on
+ * @param suffixes suffix array of text
+ * @param maxLCP longest LCP to look for; the LCP-LR arrays keep no more than MAX_STORED_LCP
+ * @return std::vector<Index> LCP array, saturated at maxLCP
+ */
+template <typename Index>
+std::vector<Index> buildRecordLCP(std::string_view text, std::span<const Index> suffixes, uint32_t maxLCP = MAX_STORED_LCP) {
+    const size_t n = suffixes.size();
+    std::vector<Index> lcpArray(n, 0);
+
+    #pragma omp parallel for
+    for (size_t idx = 1; idx < n; idx += 1) {
+        const auto first = static_cast<size_t>(suffixes[idx - 1]), second = static_cast<size_t>(suffixes[idx]);
+        const size_t limit = std::min<size_t>(maxLCP, text.size() - std::max(first, second));
+        size_t length = 0;
+        while (length < limit && text[first + length] == text[second + length]
+            && text[first + length] != fasta::RECORD_SEPARATOR && text[first + length] != '$') {
+            length += 1;
+        }
+        lcpArray[idx] = static_cast<Index>(length);
+    }
+    return lcpArray;
+}
+
+/**
+ * @brief Fill the LCP-LR entries of the subtree with bounds (lower, upper).
+ *
+ * @return uint32_t lcp(lower, upper); 0 if either bound is outside the array
+ */
+template <typename Index>
+uint32_t fillLCPLR(std::span<const Index> lcpArray, int64_t lower, int64_t upper, LCPLR &lcpLR) {
+    const auto n = static_cast<int64_t>(lcpArray.size());
+    const bool outside = lower < 0 || upper >= n;
+    if (upper - lower <= 1) {
+        return outside ? 0 : static_cast<uint32_t>(std::min<Index>(lcpArray[upper], MAX_STORED_LCP));
+    }
+
+    const int64_t mid = (lower + upper) / 2;
+    const uint32_t leftLCP = fillLCPLR(lcpArray, lower, mid, lcpLR);
+    const uint32_t rightLCP = fillLCPLR(lcpArray, mid, upper, lcpLR);
+    lcpLR.left[mid] = static_cast<uint8_t>(std::min(leftLCP, MAX_STORED_LCP));
+    lcpLR.right[mid] = static_cast<uint8_t>(std::min(rightLCP, MAX_STORED_LCP));
+    return outside ? 0 : std::min(leftLCP, rightLCP);
+}
+
+/**
+ * @brief Compute the LCP-LR arrays for the search tree with root bounds (-1, n).
+ *
+ * @param lcpArray LCP array of the suffix array
+ * @return LCPLR LCP-LR arrays
+ */
+template <typename Index>
+LCPLR buildLCPLR(std::span<const Index> lcpArray) {
+    LCPLR lcpLR{std::vector<uint8_t>(lcpArray.size()), std::vector<uint8_t>(lcpArray.size())};
+    fillLCPLR(lcpArray, -1, static_cast<int64_t>(lcpArray.size()), lcpLR);
+    return lcpLR;
+}
+
+}   // namespace lcp
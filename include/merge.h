@@ -0,0 +1,192 @@
+/**
+ * @file merge.h
+ * @author Daniel Nichols
+ * @brief Merging the suffix arrays of separately indexed texts by backward search instead of sorting the joined
+ * text again.
+ * @date 2022-04-30
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>    // min
+#include <array>        // array
+#include <bit>          // popcount
+#include <cstdint>      // int64_t, uint8_t, uint64_t
+#include <span>         // span
+#include <string_view>  // string_view
+#include <vector>       // vector
+
+/* local includes */
+#include "fasta.h"      // RECORD_SEPARATOR
+#include "kmer.h"       // BASE_CODES, INVALID_BASE
+
+namespace merge {
+
+/**
+ * @brief Rank queries over the bases of the BWT of a suffix array: how many of its first `row` rows are suffixes
+ * preceded by `base` in the text. Rows preceded by a record separator, or by nothing, are left out, so that
+ * stepping backward never extends a suffix across a record end.
+ *
+ * Each block of 64 rows keeps the counts of every base before it and the 2-bit code of each row split over two
+ * bit planes, so a rank query is one cache line and a popcount.
+ */
+class BaseRanks {
+public:
+    constexpr static size_t ROWS_PER_BLOCK = 64;
+
+    /**
+     * @param text text the suffix array is built on, ending in '$'; anything but a base counts as a separator
+     * @param suffixes suffix array of text
+     */
+    template <typename Index>
+    BaseRanks(std::string_view text, std::span<const Index> suffixes)
+        : blocks_(suffixes.size() / ROWS_PER_BLOCK + 1) {
+        const size_t numBlocks = blocks_.size();
+
+        #pragma omp parallel for
+        for (size_t block = 0; block < numBlocks; block += 1) {
+            Block &current = blocks_[block];
+            const size_t first = block * ROWS_PER_BLOCK;
+            const size_t last = std::min(first + ROWS_PER_BLOCK, suffixes.size());
+            for (size_t row = first; row < last; row += 1) {
+                const auto suffix = static_cast<int64_t>(suffixes[row]);
+                const uint8_t base = (suffix == 0) ? kmer::INVALID_BASE
+                    : kmer::BASE_CODES[static_cast<uint8_t>(text[static_cast<size_t>(suffix) - 1])];
+                if (base == kmer::INVALID_BASE) {
+                    continue;
+                }
+                const uint64_t bit = uint64_t(1) << (row - first);
+                current.low |= (base & 1) ? bit : 0;
+                current.high |= (base & 2) ? bit : 0;
+                current.valid |= bit;
+                current.counts[base] += 1;
+            }
+        }
+
+        /* turn the counts within each block into counts before it */
+        std::array<uint64_t, 4> totals{};
+        for (auto &block : blocks_) {
+            for (size_t base = 0; base < 4; base += 1) {
+                const uint64_t count = block.counts[base];
+                block.counts[base] = totals[base];
+                totals[base] += count;
+            }
+        }
+
+        /* every suffix that starts with a base is some row's predecessor; the rest start with a separator */
+        cumulative_[0] = suffixes.size() - (totals[0] + totals[1] + totals[2] + totals[3]);
+        for (size_t base = 0; base < 4; base += 1) {
+            cumulative_[base + 1] = cumulative_[base] + totals[base];
+        }
+    }
+
+    /**
+     * @brief Rows before `row` whose suffix is preceded by `base`.
+     */
+    uint64_t rank(uint8_t base, uint64_t row) const noexcept {
+        Block const& block = blocks_[row / ROWS_PER_BLOCK];
+        const uint64_t below = (uint64_t(1) << (row % ROWS_PER_BLOCK)) - 1;
+        const uint64_t matches = ((base & 1) ? block.low : ~block.low) & ((base & 2) ? block.high : ~block.high) & block.valid;
+        return block.counts[base] + static_cast<uint64_t>(std::popcount(matches & below));
+    }
+
+    /**
+     * @brief Rows whose suffix starts with a character smaller than `base`: the separators, which sort before
+     * every base, and the smaller bases.
+     */
+    uint64_t before(uint8_t base) const noexcept {
+        return cumulative_[base];
+    }
+
+private:
+    struct alignas(64) Block {
+        std::array<uint64_t, 4> counts{};   // rows before the block preceded by each base
+        uint64_t low = 0, high = 0;         // bits 0 and 1 of the base code of each row
+        uint64_t valid = 0;                 // rows preceded by a base at all
+    };
+
+    std::vector<Block> blocks_;
+    std::array<uint64_t, 5> cumulative_{};
+};
+
+/**
+ * @brief Merge the suffix arrays of two texts into that of `first` followed by `second`, first's '$' becoming a
+ * record separator at the same position.
+ *
+ * Suffixes are ordered up to the end of their records, which is all a search compares; those equal that far keep
+ * the order of their own suffix array, with first's before second's. Both inputs need only be ordered that far
+ * too, so a merged suffix array can itself be merged again.
+ *
+ * Every suffix of second is ranked among first's by backward search, one LF step over BaseRanks per base from
+ * the end of its record, since a suffix that is only a record end sorts after exactly the rows that start with
+ * a separator. Records are ranked in parallel, and the two suffix arrays are then interleaved by those ranks,
+ * without comparing any suffixes.
+ *
+ * @tparam Position suffix array entries of the result, wide enough for the joined text
+ * @param first text ending in '$', with its suffix array
+ * @param second text ending in '$', with its suffix array
+ * @return std::vector<Position> suffix array of the joined text
+ */
+template <typename Position, typename FirstIndex, typename SecondIndex>
+std::vector<Position> mergeSuffixes(std::string_view first, std::span<const FirstIndex> firstSuffixes,
+    std::string_view second, std::span<const SecondIndex> secondSuffixes) {
+
+    const BaseRanks ranks(first, firstSuffixes);
+    std::vector<size_t> recordEnds;
+    for (size_t position = 0; position < second.size(); position += 1) {
+        if (second[position] == fasta::RECORD_SEPARATOR || position + 1 == second.size()) {
+            recordEnds.push_back(position);
+        }
+    }
+
+    /* rows of first that sort before each suffix of second, by text position */
+    std::vector<uint64_t> secondRanks(second.size());
+    const size_t numRecords = recordEnds.size();
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t record = 0; record < numRecords; record += 1) {
+        const size_t start = (record == 0) ? 0 : recordEnds[record - 1] + 1;
+        uint64_t rank = ranks.before(0);
+        secondRanks[recordEnds[record]] = rank;
+        for (size_t position = recordEnds[record]; position-- > start;) {
+            const uint8_t base = kmer::BASE_CODES[static_cast<uint8_t>(second[position])];
+            rank = (base == kmer::INVALID_BASE) ? ranks.before(0) : ranks.before(base) + ranks.rank(base, rank);
+            secondRanks[position] = rank;
+        }
+    }
+
+    /* ranks never decrease along second's suffix array, so each chunk of it takes the rows of first up to its
+     * own rank and the chunks can be written in parallel */
+    constexpr size_t CHUNK_SIZE = size_t(1) << 16;
+    const size_t numFirst = firstSuffixes.size(), numSecond = secondSuffixes.size();
+    const size_t numChunks = (numSecond + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    auto rankAt = [&](size_t row) {
+        return (row == numSecond) ? numFirst : static_cast<size_t>(secondRanks[static_cast<size_t>(static_cast<int64_t>(secondSuffixes[row]))]);
+    };
+    const auto offset = static_cast<int64_t>(first.size());
+
+    std::vector<Position> merged(numFirst + numSecond);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t chunk = 0; chunk < numChunks; chunk += 1) {
+        const size_t secondStart = chunk * CHUNK_SIZE, secondEnd = std::min(secondStart + CHUNK_SIZE, numSecond);
+        size_t row = (chunk == 0) ? 0 : rankAt(secondStart);
+        const size_t rowEnd = (chunk + 1 == numChunks) ? numFirst : rankAt(secondEnd);
+        size_t out = secondStart + row;
+        for (size_t secondRow = secondStart; secondRow < secondEnd; secondRow += 1) {
+            for (const size_t rank = rankAt(secondRow); row < rank; row += 1) {
+                merged[out++] = static_cast<Position>(static_cast<int64_t>(firstSuffixes[row]));
+            }
+            merged[out++] = static_cast<Position>(offset + static_cast<int64_t>(secondSuffixes[secondRow]));
+        }
+        for (; row < rowEnd; row += 1) {
+            merged[out++] = static_cast<Position>(static_cast<int64_t>(firstSuffixes[row]));
+        }
+    }
+    if (numSecond == 0) {
+        for (size_t row = 0; row < numFirst; row += 1) {
+            merged[row] = static_cast<Position>(static_cast<int64_t>(firstSuffixes[row]));
+        }
+    }
+    return merged;
+}
+
+}   // namespace merge
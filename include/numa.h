@@ -0,0 +1,246 @@
+/**
+ * @file numa.h
+ * @author Daniel Nichols
+ * @brief NUMA nodes and the cpus this process may run on, and copies of index arrays placed on chosen nodes.
+ * Placement uses the mbind system call directly, so nothing needs libnuma; where the kernel has no NUMA support
+ * the copies are simply left wherever the first write puts them.
+ * @date 2022-04-29
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>    // binary_search, max, max_element, min, sort
+#include <charconv>     // from_chars
+#include <cstdint>      // uint64_t
+#include <cstring>      // memcpy
+#include <filesystem>   // directory_iterator, path
+#include <fstream>      // ifstream
+#include <memory>       // shared_ptr
+#include <span>         // span
+#include <stdexcept>    // invalid_argument
+#include <string>       // string, getline
+#include <string_view>  // string_view
+#include <system_error> // errc, error_code
+#include <thread>       // thread::hardware_concurrency
+#include <utility>      // pair
+#include <vector>       // vector
+
+#if defined(__linux__)
+/* linux includes */
+#include <linux/mempolicy.h>    // MPOL_BIND, MPOL_INTERLEAVE
+#include <sched.h>              // sched_getaffinity, cpu_set_t
+#include <sys/syscall.h>        // SYS_mbind
+#include <unistd.h>             // syscall
+#endif
+
+/* local includes */
+#include "indexfile.h"  // BLOCK_SIZE, MappedFile, Storage
+
+namespace numa {
+
+/**
+ * @brief Where the copies made for the searches live. Interleave spreads one copy page by page over every node,
+ * so each node serves an equal share of the random reads; Replicate gives every node a copy of its own, so its
+ * threads only read local memory, at the cost of a copy per node.
+ */
+enum class Placement { Default, Interleave, Replicate };
+
+/**
+ * @throws std::invalid_argument if `name` is not default, interleave, or replicate
+ */
+inline Placement parsePlacement(std::string_view name) {
+    if (name == "default") {
+        return Placement::Default;
+    }
+    if (name == "interleave") {
+        return Placement::Interleave;
+    }
+    if (name == "replicate") {
+        return Placement::Replicate;
+    }
+    throw std::invalid_argument("numa placement must be default, interleave, or replicate");
+}
+
+/**
+ * @brief Cpus of a sysfs cpu list like "0-3,8,10-11". Malformed parts are skipped.
+ */
+inline std::vector<int> parseCpuList(std::string_view list) {
+    std::vector<int> cpus;
+    while (!list.empty()) {
+        const size_t comma = list.find(',');
+        const std::string_view part = list.substr(0, comma);
+        list.remove_prefix((comma == std::string_view::npos) ? list.size() : comma + 1);
+
+        int first = 0, last = 0;
+        const auto dash = part.find('-');
+        const auto firstEnd = part.data() + ((dash == std::string_view::npos) ? part.size() : dash);
+        if (std::from_chars(part.data(), firstEnd, first).ec != std::errc()) {
+            continue;
+        }
+        last = first;
+        if (dash != std::string_view::npos
+            && std::from_chars(firstEnd + 1, part.data() + part.size(), last).ec != std::errc()) {
+            continue;
+        }
+        for (int cpu = first; cpu <= last; cpu += 1) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+/**
+ * @brief The NUMA nodes that have cpus this process may run on, each with those cpus. A machine without NUMA
+ * support, or without /sys, is a single node 0 with every allowed cpu.
+ */
+struct Topology {
+    std::vector<int> nodes;             // node ids in ascending order
+    std::vector<std::vector<int>> cpus; // allowed cpus of each node
+
+    size_t size() const noexcept {
+        return nodes.size();
+    }
+
+    size_t numCpus() const noexcept {
+        size_t count = 0;
+        for (auto const& nodeCpus : cpus) {
+            count += nodeCpus.size();
+        }
+        return count;
+    }
+
+    /**
+     * @brief Read the nodes from /sys/devices/system/node, keeping only the cpus in this process's affinity
+     * mask so that a taskset or cgroup cpuset is respected.
+     */
+    static Topology detect() {
+        std::vector<int> allowed;
+        #if defined(__linux__)
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        if (::sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu += 1) {
+                if (CPU_ISSET(cpu, &mask)) {
+                    allowed.push_back(cpu);
+                }
+            }
+        }
+        #endif
+        if (allowed.empty()) {
+            for (int cpu = 0; cpu < static_cast<int>(std::max(1u, std::thread::hardware_concurrency())); cpu += 1) {
+                allowed.push_back(cpu);
+            }
+        }
+
+        std::vector<std::pair<int, std::vector<int>>> found;
+        std::error_code error;
+        for (auto const& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+            const std::string name = entry.path().filename().string();
+            int node = 0;
+            if (!name.starts_with("node")
+                || std::from_chars(name.data() + 4, name.data() + name.size(), node).ptr != name.data() + name.size()) {
+                continue;
+            }
+            std::ifstream cpulist(entry.path() / "cpulist");
+            std::string list;
+            std::getline(cpulist, list);
+
+            std::vector<int> nodeCpus;
+            for (const int cpu : parseCpuList(list)) {
+                if (std::binary_search(std::begin(allowed), std::end(allowed), cpu)) {
+                    nodeCpus.push_back(cpu);
+                }
+            }
+            if (!nodeCpus.empty()) {
+                found.emplace_back(node, std::move(nodeCpus));
+            }
+        }
+        std::sort(std::begin(found), std::end(found));
+
+        Topology topology;
+        for (auto &[node, nodeCpus] : found) {
+            topology.nodes.push_back(node);
+            topology.cpus.push_back(std::move(nodeCpus));
+        }
+        if (topology.nodes.empty()) {
+            topology.nodes = {0};
+            topology.cpus = {std::move(allowed)};
+        }
+        return topology;
+    }
+};
+
+/**
+ * @brief Set the NUMA policy of the not yet touched pages [address, address + length) to `mode` over `nodes`.
+ * Failures are ignored; the pages are then placed by the default first touch policy.
+ *
+ * @param address page aligned
+ * @param mode MPOL_BIND or MPOL_INTERLEAVE
+ */
+inline void setPolicy([[maybe_unused]] void *address, [[maybe_unused]] size_t length, [[maybe_unused]] int mode,
+    [[maybe_unused]] std::span<const int> nodes) {
+    #if defined(__linux__) && defined(SYS_mbind)
+    if (nodes.empty() || length == 0) {
+        return;
+    }
+    constexpr size_t BITS = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> nodeMask(static_cast<size_t>(*std::max_element(std::begin(nodes), std::end(nodes))) / BITS + 1, 0);
+    for (const int node : nodes) {
+        nodeMask[static_cast<size_t>(node) / BITS] |= 1ul << (static_cast<size_t>(node) % BITS);
+    }
+    /* the kernel reads one bit fewer than maxnode */
+    ::syscall(SYS_mbind, address, length, mode, nodeMask.data(), nodeMask.size() * BITS + 1, 0);
+    #endif
+}
+
+/**
+ * @brief Copy `storage` into fresh memory under the NUMA policy `mode` over `nodes`, BLOCK_SIZE bytes per
+ * iteration in parallel. The policy, not the copying thread, decides where each page lands.
+ */
+template <typename T>
+indexfile::Storage<T> placedCopy(indexfile::Storage<T> const& storage, int mode, std::span<const int> nodes) {
+
+    const uint64_t length = storage.size() * sizeof(T);
+    if (length == 0) {
+        return indexfile::Storage<T>();
+    }
+    auto mapping = indexfile::MappedFile::anonymous(length);
+    std::byte *destination = mapping->writableData();
+    setPolicy(destination, length, mode, nodes);
+
+    auto const* source = reinterpret_cast<std::byte const*>(storage.data());
+    const uint64_t numBlocks = (length + indexfile::BLOCK_SIZE - 1) / indexfile::BLOCK_SIZE;
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (uint64_t block = 0; block < numBlocks; block += 1) {
+        const uint64_t start = block * indexfile::BLOCK_SIZE;
+        std::memcpy(destination + start, source + start, std::min(indexfile::BLOCK_SIZE, length - start));
+    }
+    std::span<const T> view(reinterpret_cast<T const*>(mapping->data()), storage.size());
+    return indexfile::Storage<T>(view, std::move(mapping));
+}
+
+#if defined(__linux__)
+constexpr int INTERLEAVE_POLICY = MPOL_INTERLEAVE;
+constexpr int BIND_POLICY = MPOL_BIND;
+#else
+constexpr int INTERLEAVE_POLICY = 0;
+constexpr int BIND_POLICY = 0;
+#endif
+
+/**
+ * @brief Copy of `storage` spread page by page over every node of `topology`.
+ */
+template <typename T>
+indexfile::Storage<T> interleaved(indexfile::Storage<T> const& storage, Topology const& topology) {
+    return placedCopy(storage, INTERLEAVE_POLICY, std::span<const int>(topology.nodes));
+}
+
+/**
+ * @brief Copy of `storage` entirely on `node`.
+ */
+template <typename T>
+indexfile::Storage<T> boundTo(indexfile::Storage<T> const& storage, int node) {
+    return placedCopy(storage, BIND_POLICY, std::span<const int>(&node, 1));
+}
+
+}   // namespace numa
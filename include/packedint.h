@@ -0,0 +1,43 @@
+/**
+ * @file packedint.h
+ * @author Daniel Nichols
+ * @brief 40-bit integers for suffix arrays too long for 32-bit indices.
+ * @date 2022-04-22
+ */
+#pragma once
+
+/* stl includes */
+#include <array>        // array
+#include <cstdint>      // int64_t, uint8_t, uint64_t
+#include <type_traits>  // is_trivially_copyable
+
+namespace packedint {
+
+/**
+ * @brief Unsigned 40-bit integer stored in 5 bytes with no padding, so arrays of them take 5 bytes per element.
+ * Converts implicitly to and from int64_t; values must lie in [0, MAX].
+ */
+struct Int40 {
+    constexpr static int64_t MAX = (int64_t(1) << 40) - 1;
+
+    std::array<uint8_t, 5> bytes;
+
+    Int40() = default;
+
+    constexpr Int40(int64_t value) noexcept : bytes() {
+        for (size_t i = 0; i < bytes.size(); i += 1) {
+            bytes[i] = static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i));
+        }
+    }
+
+    constexpr operator int64_t() const noexcept {
+        uint64_t value = 0;
+        for (size_t i = 0; i < bytes.size(); i += 1) {
+            value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+        }
+        return static_cast<int64_t>(value);
+    }
+};
+static_assert(sizeof(Int40) == 5 && std::is_trivially_copyable<Int40>::value, "Int40 must be 5 packed bytes.");
+
+}   // namespace packedint
@@ -0,0 +1,366 @@
+/**
+ * @file packedtext.h
+ * @author Daniel Nichols
+ * @brief Nucleotide text stored at 2 bits per base, with record separators and the terminator kept aside.
+ * @date 2022-04-26
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>    // all_of, is_sorted, lower_bound, min
+#include <bit>          // countl_zero, popcount
+#include <cstdint>      // uint64_t
+#include <string>       // string
+#include <string_view>  // string_view
+#include <utility>      // exchange, pair
+#include <vector>       // vector
+
+/* local includes */
+#include "fasta.h"      // RECORD_SEPARATOR
+#include "indexfile.h"  // Storage
+#include "kmer.h"       // encode, MAX_PACKED_LENGTH, PackedKmer
+#include "utilities.h"  // prefetch
+
+namespace suffixarray {
+
+/**
+ * @brief A query packed the same way as PackedText, so it can be compared against the text a word at a time.
+ * `valid` is false if the query has anything but A, C, G, and T, in which case it occurs nowhere in the text.
+ */
+struct PackedQuery {
+    std::string_view sequence;
+    std::vector<uint64_t> words;
+    bool valid;
+
+    size_t size() const noexcept {
+        return sequence.size();
+    }
+};
+
+/**
+ * @brief Text of A, C, G, T, record separators, and a final '$' terminator, stored as kmer::MAX_PACKED_LENGTH
+ * bases per 64-bit word with the first base in the most significant bits, so words compare like the bases
+ * they hold. Separators and the terminator take a placeholder code in the words, and their positions are
+ * listed on the side; the terminator is always the last of them. A bit per position marks them too, stored and
+ * mapped with the rest of the index, so the end of a record is found from the mask words covering the bases
+ * rather than by searching the list.
+ *
+ * A quarter of the size of the character text, so four times as much of it fits in each cache line a
+ * search touches, and a comparison covers 32 bases per step.
+ */
+class PackedText {
+public:
+    PackedText() = default;
+
+    /**
+     * @brief Reassemble a text from its stored parts, e.g. from a memory mapped file.
+     *
+     * @param length number of characters including the terminator
+     * @param words packed bases, plus one word of padding
+     * @param separators sorted positions of every record separator and the terminator
+     * @param separatorMask bit per character set at each of `separators`, first character in the most
+     * significant bit; see separatorMask()
+     */
+    PackedText(size_t length, indexfile::Storage<uint64_t> words, indexfile::Storage<uint64_t> separators,
+        indexfile::Storage<uint64_t> separatorMask)
+        : length_(length), words_(std::move(words)), separators_(std::move(separators)),
+          separatorMask_(std::move(separatorMask)) {}
+
+    /**
+     * @brief Pack a normalized text. Every character that is not a base must be a record separator, except
+     * the last one, which is the terminator.
+     */
+    static PackedText pack(std::string_view text) {
+        std::vector<uint64_t> separators;
+        for (size_t position = text.find(fasta::RECORD_SEPARATOR); position != std::string_view::npos;
+            position = text.find(fasta::RECORD_SEPARATOR, position + 1)) {
+            separators.push_back(position);
+        }
+        if (!text.empty()) {
+            separators.push_back(text.size() - 1);
+        }
+
+        std::vector<uint64_t> words(numWords(text.size()), 0);
+        const size_t numPacked = words.size() - 1;
+        #pragma omp parallel for
+        for (size_t word = 0; word < numPacked; word += 1) {
+            words[word] = packWord(text, word).code;
+        }
+        std::vector<uint64_t> separatorMask(numMaskWords(text.size()), 0);
+        for (const uint64_t separator : separators) {
+            separatorMask[separator / MASK_BITS] |= maskBit(separator);
+        }
+        return PackedText(text.size(), indexfile::Storage<uint64_t>(std::move(words)),
+            indexfile::Storage<uint64_t>(std::move(separators)), indexfile::Storage<uint64_t>(std::move(separatorMask)));
+    }
+
+    /**
+     * @brief Pack a query for comparing against the text.
+     */
+    static PackedQuery packQuery(std::string_view query) {
+        PackedQuery packed{query, std::vector<uint64_t>(numWords(query.size()), 0), true};
+        for (size_t word = 0; word + 1 < packed.words.size(); word += 1) {
+            const auto [code, valid] = packWord(query, word);
+            packed.words[word] = code;
+            packed.valid &= valid;
+        }
+        return packed;
+    }
+
+    /**
+     * @brief Number of characters, including the terminator.
+     */
+    size_t size() const noexcept {
+        return length_;
+    }
+
+    char operator[](size_t position) const noexcept {
+        if (position + 1 == length_) {
+            return '$';
+        }
+        return isSeparator(position) ? fasta::RECORD_SEPARATOR : "ACGT"[baseAt(position)];
+    }
+
+    /**
+     * @brief Unpack the characters [position, position + length).
+     */
+    std::string substr(size_t position, size_t length) const {
+        length = std::min(length, length_ - position);
+        std::string text(length, 'A');
+        unpackInto(text.data(), position, length);
+        return text;
+    }
+
+    /**
+     * @brief Unpack the whole text, a word per iteration in parallel.
+     */
+    std::string unpack() const {
+        std::string text(length_, 'A');
+        const size_t numChunks = (length_ + kmer::MAX_PACKED_LENGTH - 1) / kmer::MAX_PACKED_LENGTH;
+        #pragma omp parallel for
+        for (size_t chunk = 0; chunk < numChunks; chunk += 1) {
+            const size_t position = chunk * kmer::MAX_PACKED_LENGTH;
+            unpackInto(text.data() + position, position, std::min(kmer::MAX_PACKED_LENGTH, length_ - position));
+        }
+        return text;
+    }
+
+    /**
+     * @brief Order the suffix at `position` against `query` on the first query.size() characters, and their
+     * LCP. Compares 32 bases per step, from the word holding base `offset`; the separator mask is only consulted
+     * to cut the suffix short at the end of its record, where it sorts before any base.
+     *
+     * @param query packed query; must be valid
+     * @param offset bases the suffix is already known to share with the query
+     * @return std::pair<int, size_t> negative if the suffix sorts first, 0 if it starts with the query,
+     * positive if it sorts after; and the length of their common prefix
+     */
+    std::pair<int, size_t> comparePrefix(PackedQuery const& query, size_t position, size_t offset = 0) const noexcept {
+        const size_t limit = recordLength(position, query.size());
+
+        for (size_t i = offset - offset % kmer::MAX_PACKED_LENGTH; i < limit; i += kmer::MAX_PACKED_LENGTH) {
+            const uint64_t queryBases = extract(query.words.data(), i);
+            const uint64_t suffixBases = extract(words_.data(), position + i);
+            if (queryBases != suffixBases) {
+                const size_t lcpLength = i + static_cast<size_t>(std::countl_zero(queryBases ^ suffixBases)) / 2;
+                if (lcpLength >= limit) {
+                    break;
+                }
+                if (suffixBases < queryBases) {
+                    return {-1, lcpLength};
+                }
+                return {1, lcpLength};
+            }
+        }
+        if (limit == query.size()) {
+            return {0, limit};
+        }
+        return {-1, limit};
+    }
+
+    /**
+     * @brief Start loading the words comparePrefix reads first for the suffix at `position`; pass the position
+     * plus the comparison's offset when it has one.
+     */
+    void prefetch(size_t position) const noexcept {
+        const size_t word = position / kmer::MAX_PACKED_LENGTH;
+        utilities::prefetch(words_.data() + word);
+        utilities::prefetch(words_.data() + word + 1);
+        utilities::prefetch(separatorMask_.data() + position / MASK_BITS);
+    }
+
+    /**
+     * @brief Code of the k bases starting at `position`, packed like kmer::encode; invalid if a separator or
+     * the terminator comes within them.
+     *
+     * @param k number of bases; between 1 and kmer::MAX_PACKED_LENGTH
+     */
+    kmer::PackedKmer kmerAt(size_t position, size_t k) const noexcept {
+        if (recordLength(position, k) < k) {
+            return {0, false};
+        }
+        return {extract(words_.data(), position) >> (2 * (kmer::MAX_PACKED_LENGTH - k)), true};
+    }
+
+    /**
+     * @brief The kmer::MAX_PACKED_LENGTH bases starting at `position`, first base in the most significant bits,
+     * and how many of them come before the end of the record; bits past that are meaningless.
+     */
+    std::pair<uint64_t, size_t> basesAt(size_t position) const noexcept {
+        return {extract(words_.data(), position), recordLength(position, kmer::MAX_PACKED_LENGTH)};
+    }
+
+    /**
+     * @brief Whether [position, position + length) lies inside one record, with no separator or terminator.
+     */
+    bool withinRecord(size_t position, size_t length) const noexcept {
+        return recordLength(position, length) == length;
+    }
+
+    /**
+     * @brief Mark the characters of `query` that are not bases, in the layout of PackedQuery::words, so that
+     * mismatches() counts them against every base.
+     */
+    static std::vector<uint64_t> ambiguityMask(std::string_view query) {
+        std::vector<uint64_t> mask(numWords(query.size()), 0);
+        for (size_t i = 0; i < query.size(); i += 1) {
+            if (kmer::BASE_CODES[static_cast<uint8_t>(query[i])] == kmer::INVALID_BASE) {
+                mask[i / kmer::MAX_PACKED_LENGTH] |= uint64_t(1) << (62 - 2 * (i % kmer::MAX_PACKED_LENGTH));
+            }
+        }
+        return mask;
+    }
+
+    /**
+     * @brief Hamming distance between query[first, last) and the text aligned so that the query starts at
+     * `position`, 32 bases per step. Stops early once it exceeds `limit`.
+     * @note the aligned text must be within one record; see withinRecord
+     *
+     * @param query packed query
+     * @param ambiguous ambiguityMask of the query, or nullptr if the query is valid
+     * @return size_t number of mismatches, or some number above limit
+     */
+    size_t mismatches(PackedQuery const& query, uint64_t const* ambiguous, size_t first, size_t last, size_t position,
+        size_t limit) const noexcept {
+
+        constexpr uint64_t LOW_BITS = 0x5555555555555555;
+        size_t count = 0;
+        for (size_t i = first; i < last; i += kmer::MAX_PACKED_LENGTH) {
+            /* a base differs if either bit of its code does; fold both onto the low bit of its pair */
+            uint64_t diff = extract(query.words.data(), i) ^ extract(words_.data(), position + i);
+            diff = (diff | (diff >> 1)) & LOW_BITS;
+            if (ambiguous != nullptr) {
+                diff |= extract(ambiguous, i);
+            }
+            const size_t length = std::min(kmer::MAX_PACKED_LENGTH, last - i);
+            if (length < kmer::MAX_PACKED_LENGTH) {
+                diff &= ~(~uint64_t(0) >> (2 * length));
+            }
+            count += static_cast<size_t>(std::popcount(diff));
+            if (count > limit) {
+                break;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief Sanity check a text read from disk. Checks the mask has every separator's bit, not that it has no
+     * others, which would take a pass over the whole mask.
+     */
+    bool isConsistent() const noexcept {
+        return words_.size() == numWords(length_) && separatorMask_.size() == numMaskWords(length_)
+            && !separators_.empty() && std::is_sorted(std::begin(separators_), std::end(separators_))
+            && separators_[separators_.size() - 1] + 1 == length_
+            && std::all_of(std::begin(separators_), std::end(separators_), [this](uint64_t separator) {
+                return (separatorMask_[separator / MASK_BITS] & maskBit(separator)) != 0;
+            });
+    }
+
+    indexfile::Storage<uint64_t> const& words() const noexcept { return words_; }
+    indexfile::Storage<uint64_t> const& separators() const noexcept { return separators_; }
+    indexfile::Storage<uint64_t> const& separatorMask() const noexcept { return separatorMask_; }
+
+private:
+    size_t length_ = 0;
+    indexfile::Storage<uint64_t> words_;        // one word of padding past the last base
+    indexfile::Storage<uint64_t> separators_;   // ends with the terminator
+    indexfile::Storage<uint64_t> separatorMask_;    // separators_ as bits, first position in the most significant bit
+
+    constexpr static size_t MASK_BITS = 64;
+
+    static size_t numMaskWords(size_t length) noexcept {
+        return (length + MASK_BITS - 1) / MASK_BITS;
+    }
+
+    static uint64_t maskBit(size_t position) noexcept {
+        return uint64_t(1) << (MASK_BITS - 1 - position % MASK_BITS);
+    }
+
+    /* the padding word lets extract read the word after any base without a bounds check */
+    static size_t numWords(size_t length) noexcept {
+        return (length + kmer::MAX_PACKED_LENGTH - 1) / kmer::MAX_PACKED_LENGTH + 1;
+    }
+
+    /**
+     * @brief 2-bit codes of the `word`-th kmer::MAX_PACKED_LENGTH bases of `sequence`, padded with A past its
+     * end. Anything but a base also packs as A and makes the result invalid.
+     */
+    static kmer::PackedKmer packWord(std::string_view sequence, size_t word) noexcept {
+        const size_t start = word * kmer::MAX_PACKED_LENGTH;
+        const size_t length = std::min(kmer::MAX_PACKED_LENGTH, sequence.size() - start);
+        const auto packed = kmer::encode(sequence.substr(start), length);
+        return {(length == 0) ? 0 : packed.code << (2 * (kmer::MAX_PACKED_LENGTH - length)), packed.valid};
+    }
+
+    /**
+     * @brief Write the characters [position, position + length) to `out`.
+     */
+    void unpackInto(char *out, size_t position, size_t length) const noexcept {
+        for (size_t i = 0; i < length; i += 1) {
+            out[i] = "ACGT"[baseAt(position + i)];
+        }
+        for (auto separator = std::lower_bound(std::begin(separators_), std::end(separators_), position);
+            separator != std::end(separators_) && *separator < position + length; ++separator) {
+            out[*separator - position] = (*separator + 1 == length_) ? '$' : fasta::RECORD_SEPARATOR;
+        }
+    }
+
+    bool isSeparator(size_t position) const noexcept {
+        return (separatorMask_[position / MASK_BITS] << (position % MASK_BITS)) >> (MASK_BITS - 1);
+    }
+
+    /**
+     * @brief Number of characters from `position` to the first separator or the terminator, capped at `length`.
+     * Reads a mask word per 64 characters, and stops at the terminator's word at the latest.
+     */
+    size_t recordLength(size_t position, size_t length) const noexcept {
+        size_t word = position / MASK_BITS;
+        uint64_t bits = separatorMask_[word] << (position % MASK_BITS);
+        size_t scanned = 0, covered = MASK_BITS - position % MASK_BITS;
+        while (bits == 0 && covered < length) {
+            bits = separatorMask_[++word];
+            scanned = std::exchange(covered, covered + MASK_BITS);
+        }
+        if (bits == 0) {
+            return length;
+        }
+        return std::min(length, scanned + static_cast<size_t>(std::countl_zero(bits)));
+    }
+
+    uint8_t baseAt(size_t position) const noexcept {
+        return static_cast<uint8_t>(extract(words_.data(), position) >> 62);
+    }
+
+    /**
+     * @brief The 32 bases starting at `position`, straddling two words when it is not word aligned.
+     */
+    static uint64_t extract(uint64_t const* words, size_t position) noexcept {
+        const size_t word = position / kmer::MAX_PACKED_LENGTH;
+        const size_t shift = 2 * (position % kmer::MAX_PACKED_LENGTH);
+        /* shifting in two steps keeps the shift below 64 when the position is word aligned */
+        return (words[word] << shift) | ((words[word + 1] >> 1) >> (63 - shift));
+    }
+};
+
+}   // namespace suffixarray
@@ -0,0 +1,144 @@
+/**
+ * @file pipeline.h
+ * @author Daniel Nichols
+ * @brief Bounded three stage producer/consumer pipeline.
+ * @date 2022-04-27
+ */
+#pragma once
+
+/* stl includes */
+#include <condition_variable> // condition_variable
+#include <cstddef>      // size_t
+#include <deque>        // deque
+#include <exception>    // exception_ptr, current_exception, rethrow_exception
+#include <mutex>        // mutex, unique_lock
+#include <optional>     // optional, nullopt
+#include <thread>       // thread
+#include <utility>      // move
+
+namespace pipeline {
+
+/**
+ * @brief FIFO queue of at most `capacity` items. push blocks while it is full and pop while it is empty, until
+ * the queue is closed.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+    /**
+     * @brief Append an item, waiting for room.
+     *
+     * @return false if the queue was closed first, in which case the item is dropped
+     */
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return items_.size() < capacity_ || closed_; });
+        if (closed_) {
+            return false;
+        }
+        items_.push_back(std::move(item));
+        changed_.notify_all();
+        return true;
+    }
+
+    /**
+     * @brief Remove the oldest item, waiting for one.
+     *
+     * @return std::optional<T> the item; empty once the queue is closed and drained
+     */
+    std::optional<T> pop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return !items_.empty() || closed_; });
+        if (items_.empty()) {
+            return std::nullopt;
+        }
+        T item = std::move(items_.front());
+        items_.pop_front();
+        changed_.notify_all();
+        return item;
+    }
+
+    /**
+     * @brief No more items will be pushed. Items already queued can still be popped.
+     */
+    void close() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        closed_ = true;
+        changed_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::deque<T> items_;
+    bool closed_ = false;
+};
+
+/**
+ * @brief Run read, process, and write over a stream of items concurrently. `read` runs on its own thread until
+ * it returns nothing, `process` runs on the calling thread, free to start its own parallel regions, and `write`
+ * runs on a third thread and sees the items in the order they were read. At most `depth` items wait between
+ * each pair of stages, so memory stays bounded however long the stream is.
+ * @throws whatever a stage threw first; the other stages stop at their next item
+ *
+ * @param read returns std::optional<Item>; empty at the end of the stream
+ * @param process called with Item &
+ * @param write called with Item &
+ * @param depth items queued between stages
+ */
+template <typename Item, typename Read, typename Process, typename Write>
+void run(Read &&read, Process &&process, Write &&write, size_t depth = 2) {
+    BoundedQueue<Item> readItems(depth), processedItems(depth);
+    std::exception_ptr readError, processError, writeError;
+
+    /* a failed stage closes both queues so that neither neighbour waits on it forever */
+    auto fail = [&readItems, &processedItems](std::exception_ptr &error) {
+        error = std::current_exception();
+        readItems.close();
+        processedItems.close();
+    };
+
+    std::thread reader([&] {
+        try {
+            for (std::optional<Item> item = read(); item && readItems.push(std::move(*item)); item = read()) {}
+            readItems.close();
+        } catch (...) {
+            fail(readError);
+        }
+    });
+    std::thread writer([&] {
+        try {
+            for (std::optional<Item> item = processedItems.pop(); item; item = processedItems.pop()) {
+                write(*item);
+            }
+        } catch (...) {
+            fail(writeError);
+        }
+    });
+
+    try {
+        for (std::optional<Item> item = readItems.pop(); item; item = readItems.pop()) {
+            process(*item);
+            if (!processedItems.push(std::move(*item))) {
+                break;
+            }
+        }
+        processedItems.close();
+    } catch (...) {
+        fail(processError);
+    }
+    readItems.close();
+    reader.join();
+    writer.join();
+
+    for (auto const& error : {readError, processError, writeError}) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+}   // namespace pipeline
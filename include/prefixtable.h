@@ -0,0 +1,559 @@
+/**
+ * @file prefixtable.h
+ * @author Daniel Nichols
+ * @brief Lookup table from k-mer prefix to its range in a suffix array.
+ * @date 2022-04-20
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>    // is_sorted, lower_bound, min
+#include <array>        // array
+#include <bit>          // countl_zero
+#include <cstdint>      // int32_t, int64_t, uint64_t
+#include <numeric>      // accumulate, exclusive_scan
+#include <span>         // span
+#include <string_view>  // string_view
+#include <utility>      // pair
+#include <vector>       // vector
+
+/* local includes */
+#include "counters.h"   // add
+#include "indexfile.h"  // Storage
+#include "kmer.h"       // encode, numKmers
+#include "packedtext.h" // PackedText
+#include "utilities.h"  // prefetch
+
+namespace suffixarray {
+
+/**
+ * @brief Maps the first k bases of a query to the range of the suffix array that can contain it.
+ *
+ * For small k the table is direct indexed: `starts[code]` is the first suffix whose k-mer is at least `code`
+ * and the range ends at `starts[code+1]`, so a lookup is one encode and two loads. For larger k the dense
+ * table would be mostly empty, so only the k-mers present are stored as sorted packed keys alongside their
+ * starts and found with a binary search. Ranges may include a few suffixes shorter than k, which are
+ * harmless to the binary search that follows.
+ *
+ * Repeats leave a direct table with a few huge buckets however long k is. A two level table keeps a short
+ * direct top level and refines only the buckets of more than MAX_BUCKET_SIZE suffixes by a longer prefix,
+ * so memory goes where the ranges are large; see Refinement and buildAuto.
+ *
+ * @tparam Index suffix array element type, also used to store the starts
+ */
+template <typename Index>
+class BasicPrefixTable {
+public:
+    /* 4^14 starts is 1 GiB; beyond this the sorted table is always smaller */
+    constexpr static size_t MAX_DIRECT_LENGTH = 14;
+
+    /* buckets of more suffixes than this are split by the refined prefix of a two level table */
+    constexpr static size_t MAX_BUCKET_SIZE = 64;
+
+    /**
+     * @brief Second level of a two level table: the distinct longer prefixes of the suffixes in each oversized
+     * bucket, as sorted keys with their starts. A bucket's entries are [offsets[code], offsets[code+1]), so
+     * they are found with two loads, and buckets that were not refined have none. An entry's range ends at
+     * the next entry's start, or the bucket's end for its last one.
+     */
+    struct Refinement {
+        size_t length = 0;  // refined prefix length; 0 for a single level table
+        indexfile::Storage<Index> offsets;
+        indexfile::Storage<uint64_t> keys;
+        indexfile::Storage<Index> starts;
+    };
+
+    BasicPrefixTable() = default;
+
+    /**
+     * @brief Reassemble a table from its stored arrays, e.g. from a memory mapped file.
+     *
+     * @param k prefix length
+     * @param starts bucket starts
+     * @param keys sorted packed keys; empty for a direct indexed table
+     * @param refinement second level of a direct indexed table; empty for none
+     */
+    BasicPrefixTable(size_t k, indexfile::Storage<Index> starts, indexfile::Storage<uint64_t> keys,
+        Refinement refinement = {})
+        : k_(k), starts_(std::move(starts)), keys_(std::move(keys)), refinement_(std::move(refinement)) {}
+
+    /**
+     * @brief Build a prefix table over a suffix array.
+     * @note k is capped at kmer::MAX_PACKED_LENGTH so that every key fits in 64 bits.
+     *
+     * @param text packed text the suffix array is built on
+     * @param suffixes suffix array of text
+     * @param k prefix length
+     * @param refinedLength if longer than k, refine the buckets over MAX_BUCKET_SIZE by this many bases; only
+     * direct indexed tables are refined
+     * @return BasicPrefixTable table over all k-mers of text
+     */
+    static BasicPrefixTable build(PackedText const& text, std::span<const Index> suffixes, size_t k,
+        size_t refinedLength = 0) {
+        k = std::min(k, kmer::MAX_PACKED_LENGTH);
+        refinedLength = std::min(refinedLength, kmer::MAX_PACKED_LENGTH);
+        if (useDirect(k, suffixes.size())) {
+            auto starts = buildDirect(text, suffixes, k);
+            Refinement refinement;
+            if (refinedLength > k) {
+                refinement = refine(text, suffixes, k, refinedLength, starts, oversizedBuckets(starts));
+            }
+            return BasicPrefixTable(k, indexfile::Storage<Index>(std::move(starts)), {}, std::move(refinement));
+        }
+
+        std::vector<Index> starts;
+        std::vector<uint64_t> keys;
+        buildSorted(text, suffixes, k, starts, keys);
+        return BasicPrefixTable(k, indexfile::Storage<Index>(std::move(starts)), indexfile::Storage<uint64_t>(std::move(keys)));
+    }
+
+    /**
+     * @brief Build the table that narrows searches the most within `budget` bytes.
+     *
+     * Lookups in a direct table are O(1) while a sorted one needs a binary search as long as a short suffix array
+     * search, so the top level is the longest direct table that fits in half the budget along with its
+     * refinement offsets. If that leaves buckets over MAX_BUCKET_SIZE, one pass over just those buckets measures
+     * their prefixes of every length at once, from how many bases each suffix shares with the one before it,
+     * and picks the shortest refined length at which a query drawn from those buckets lands in a range of at
+     * most MAX_BUCKET_SIZE suffixes on average, or else the longest whose keys fit in the rest of the budget; a
+     * short refined length keeps it usable by short queries. Without oversized buckets or room to refine them,
+     * the whole budget goes to the longest direct table.
+     *
+     * @param budget most bytes the table may take
+     * @return BasicPrefixTable empty if no table fits
+     */
+    static BasicPrefixTable buildAuto(PackedText const& text, std::span<const Index> suffixes, size_t budget) {
+        const size_t numSuffixes = suffixes.size();
+        auto longestDirect = [numSuffixes](size_t limit) {
+            size_t k = 0;
+            while (k < MAX_DIRECT_LENGTH && useDirect(k + 1, numSuffixes) && directBytes(k + 1) <= limit) {
+                k += 1;
+            }
+            return k;
+        };
+
+        const size_t topLength = longestDirect(budget / 2);
+        if (topLength == 0) {
+            return BasicPrefixTable();
+        }
+
+        auto starts = buildDirect(text, suffixes, topLength);
+        const auto buckets = oversizedBuckets(starts);
+        size_t refinedLength = 0;
+        if (!buckets.empty() && 2 * directBytes(topLength) <= budget) {
+            std::vector<std::pair<size_t, size_t>> ranges;
+            size_t numRefined = 0;
+            for (const uint64_t code : buckets) {
+                ranges.push_back(bucketRange(starts, code));
+                numRefined += ranges.back().second - ranges.back().first;
+            }
+            const auto stats = prefixStats(text, suffixes, ranges);
+            const size_t remaining = budget - 2 * directBytes(topLength);
+            for (size_t k = topLength + 1; k <= kmer::MAX_PACKED_LENGTH; k += 1) {
+                if (stats.keys[k] * (sizeof(uint64_t) + sizeof(Index)) > remaining) {
+                    break;
+                }
+                refinedLength = k;
+                if (stats.squares[k] <= MAX_BUCKET_SIZE * numRefined) {
+                    break;
+                }
+            }
+        }
+
+        if (refinedLength == 0) {
+            const size_t k = longestDirect(budget);
+            return (k == topLength) ? BasicPrefixTable(k, indexfile::Storage<Index>(std::move(starts)), {})
+                : build(text, suffixes, k);
+        }
+        auto refinement = refine(text, suffixes, topLength, refinedLength, starts, buckets);
+        return BasicPrefixTable(topLength, indexfile::Storage<Index>(std::move(starts)), {}, std::move(refinement));
+    }
+
+    /**
+     * @brief Range of suffixes that can start with the first k bases of `query`.
+     *
+     * @param query query of at least k bases
+     * @return std::pair<int64_t, int64_t> [start, end) in the suffix array; empty if the prefix does not occur
+     */
+    std::pair<int64_t, int64_t> range(std::string_view query) const noexcept {
+        const auto [code, valid] = kmer::encode(query, k_);
+        if (!valid) {
+            return {0, 0};
+        }
+
+        if (isDirect()) {
+            if (refinement_.length != 0 && query.size() >= refinement_.length) {
+                const size_t first = static_cast<size_t>(static_cast<int64_t>(refinement_.offsets[code]));
+                const size_t last = static_cast<size_t>(static_cast<int64_t>(refinement_.offsets[code + 1]));
+                if (first != last) {
+                    counters::add(counters::PrefixTableRefinements);
+                    return refinedRange(query, first, last, starts_[code + 1]);
+                }
+            }
+            return {starts_[code], starts_[code + 1]};
+        }
+
+        const auto key = std::lower_bound(std::begin(keys_), std::end(keys_), code);
+        if (key == std::end(keys_) || *key != code) {
+            return {0, 0};
+        }
+        const auto idx = std::distance(std::begin(keys_), key);
+        return {starts_[idx], starts_[idx + 1]};
+    }
+
+    /**
+     * @brief Start loading the bucket range() reads first for `query`. Only direct indexed tables know where it
+     * is without a search.
+     */
+    void prefetch(std::string_view query) const noexcept {
+        if (!isDirect() || query.size() < k_) {
+            return;
+        }
+        const auto [code, valid] = kmer::encode(query, k_);
+        if (valid) {
+            utilities::prefetch(starts_.data() + code);
+            if (refinement_.length != 0 && query.size() >= refinement_.length) {
+                utilities::prefetch(refinement_.offsets.data() + code);
+            }
+        }
+    }
+
+    /**
+     * @brief Prefix length k. 0 if there is no table.
+     */
+    size_t length() const noexcept {
+        return k_;
+    }
+
+    bool empty() const noexcept {
+        return k_ == 0;
+    }
+
+    /**
+     * @brief Refined prefix length of a two level table. 0 for a single level one.
+     */
+    size_t refinedLength() const noexcept {
+        return refinement_.length;
+    }
+
+    /**
+     * @brief Bytes taken by all of the table's arrays.
+     */
+    size_t sizeBytes() const noexcept {
+        return (starts_.size() + refinement_.offsets.size() + refinement_.starts.size()) * sizeof(Index)
+            + (keys_.size() + refinement_.keys.size()) * sizeof(uint64_t);
+    }
+
+    /**
+     * @brief Whether the table is direct indexed by k-mer code rather than a sorted key list.
+     */
+    bool isDirect() const noexcept {
+        return keys_.empty();
+    }
+
+    /**
+     * @brief Sanity check a table read from disk against the suffix array it indexes.
+     *
+     * @param numSuffixes length of the suffix array
+     * @return true if the arrays have the expected sizes and every range is inside the suffix array
+     */
+    bool isConsistent(size_t numSuffixes) const noexcept {
+        const size_t expectedStarts = isDirect() ? kmer::numKmers(k_) + 1 : keys_.size() + 1;
+        auto ascending = [](int64_t a, int64_t b) { return a < b; };
+        const bool refinementConsistent = refinement_.length == 0
+            || (isDirect() && refinement_.length > k_ && refinement_.length <= kmer::MAX_PACKED_LENGTH
+                && refinement_.offsets.size() == expectedStarts && refinement_.keys.size() == refinement_.starts.size()
+                && std::is_sorted(std::begin(refinement_.offsets), std::end(refinement_.offsets), ascending)
+                && static_cast<int64_t>(refinement_.offsets[expectedStarts - 1]) == static_cast<int64_t>(refinement_.keys.size())
+                && std::is_sorted(std::begin(refinement_.keys), std::end(refinement_.keys))
+                && std::is_sorted(std::begin(refinement_.starts), std::end(refinement_.starts), ascending));
+        return k_ <= kmer::MAX_PACKED_LENGTH && (!isDirect() || k_ <= MAX_DIRECT_LENGTH)
+            && starts_.size() == expectedStarts
+            && std::is_sorted(std::begin(starts_), std::end(starts_), ascending)
+            && static_cast<int64_t>(starts_[starts_.size() - 1]) == static_cast<int64_t>(numSuffixes)
+            && refinementConsistent;
+    }
+
+    indexfile::Storage<Index> const& starts() const noexcept { return starts_; }
+    indexfile::Storage<uint64_t> const& keys() const noexcept { return keys_; }
+    Refinement const& refinement() const noexcept { return refinement_; }
+
+private:
+    size_t k_ = 0;
+    indexfile::Storage<Index> starts_;
+    indexfile::Storage<uint64_t> keys_;
+    Refinement refinement_;
+
+    /**
+     * @brief For each prefix length k, how many distinct k-mers a set of suffixes has and the sum of the squared
+     * sizes of their ranges. A query drawn from the text lands in a range of mean size squares / suffixes.
+     */
+    struct PrefixStats {
+        std::array<uint64_t, kmer::MAX_PACKED_LENGTH + 1> keys{}, squares{};
+
+        PrefixStats &operator+=(PrefixStats const& other) noexcept {
+            for (size_t k = 0; k <= kmer::MAX_PACKED_LENGTH; k += 1) {
+                keys[k] += other.keys[k];
+                squares[k] += other.squares[k];
+            }
+            return *this;
+        }
+    };
+
+    static size_t directBytes(size_t k) noexcept {
+        return (kmer::numKmers(k) + 1) * sizeof(Index);
+    }
+
+    /**
+     * @brief PrefixStats of the suffixes in `ranges` of the suffix array, every length in one pass, in parallel
+     * over the ranges. Each suffix either extends the current range of every k up to the number of bases it
+     * shares with the one before it, or ends it and starts a new one if it has room for k bases.
+     *
+     * @param ranges [first, last) index ranges, each starting new ranges at every length
+     */
+    static PrefixStats prefixStats(PackedText const& text, std::span<const Index> suffixes,
+        std::vector<std::pair<size_t, size_t>> const& ranges) {
+
+        auto positionAt = [&suffixes](size_t idx) { return static_cast<size_t>(static_cast<int64_t>(suffixes[idx])); };
+        std::vector<PrefixStats> partials(NUM_CHUNKS);
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t chunk = 0; chunk < NUM_CHUNKS; chunk += 1) {
+            auto &stats = partials[chunk];
+            for (size_t r = chunkStart(chunk, ranges.size()); r < chunkStart(chunk + 1, ranges.size()); r += 1) {
+                const auto [first, last] = ranges[r];
+                std::array<uint64_t, kmer::MAX_PACKED_LENGTH + 1> runs{};
+                uint64_t previousBases = 0;
+                size_t previousRoom = 0;
+                for (size_t i = first; i < last; i += 1) {
+                    const auto [bases, room] = text.basesAt(positionAt(i));
+                    const size_t shared = std::min({static_cast<size_t>(std::countl_zero(bases ^ previousBases)) / 2,
+                        room, previousRoom});
+                    for (size_t k = shared + 1; k <= kmer::MAX_PACKED_LENGTH; k += 1) {
+                        stats.squares[k] += runs[k] * runs[k];
+                        runs[k] = (k <= room) ? 1 : 0;
+                        stats.keys[k] += (k <= room) ? 1 : 0;
+                    }
+                    for (size_t k = 1; k <= shared; k += 1) {
+                        runs[k] += 1;
+                    }
+                    previousBases = bases;
+                    previousRoom = room;
+                }
+                for (size_t k = 1; k <= kmer::MAX_PACKED_LENGTH; k += 1) {
+                    stats.squares[k] += runs[k] * runs[k];
+                }
+            }
+        }
+
+        PrefixStats total;
+        for (auto const& stats : partials) {
+            total += stats;
+        }
+        return total;
+    }
+
+    static std::pair<size_t, size_t> bucketRange(std::vector<Index> const& starts, uint64_t code) noexcept {
+        return {static_cast<size_t>(static_cast<int64_t>(starts[code])), static_cast<size_t>(static_cast<int64_t>(starts[code + 1]))};
+    }
+
+    /**
+     * @brief Codes of the buckets of a direct table holding more than MAX_BUCKET_SIZE suffixes, in order.
+     */
+    static std::vector<uint64_t> oversizedBuckets(std::vector<Index> const& starts) {
+        std::vector<uint64_t> buckets;
+        for (uint64_t code = 0; code + 1 < starts.size(); code += 1) {
+            const auto [first, last] = bucketRange(starts, code);
+            if (last - first > MAX_BUCKET_SIZE) {
+                buckets.push_back(code);
+            }
+        }
+        return buckets;
+    }
+
+    /**
+     * @brief Refine `buckets` of the direct table `starts`, built for k, by their `refinedLength`-mers. Like
+     * buildSorted, one pass counts each bucket's keys and a second writes them in place, both in parallel over
+     * the buckets. Each bucket's first key is always a transition, since the suffix before it has another k-mer.
+     */
+    static Refinement refine(PackedText const& text, std::span<const Index> suffixes, size_t k, size_t refinedLength,
+        std::vector<Index> const& starts, std::vector<uint64_t> const& buckets) {
+
+        std::vector<size_t> keyOffsets(buckets.size() + 1, 0);
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (size_t b = 0; b < buckets.size(); b += 1) {
+            const auto [first, last] = bucketRange(starts, buckets[b]);
+            size_t count = 0;
+            forEachTransition(text, suffixes, refinedLength, first, last, [&count](int64_t, int64_t, size_t) { count += 1; });
+            keyOffsets[b] = count;
+        }
+        std::exclusive_scan(std::begin(keyOffsets), std::end(keyOffsets), std::begin(keyOffsets), size_t(0));
+
+        const size_t numKeys = keyOffsets.back();
+        std::vector<uint64_t> keys(numKeys);
+        std::vector<Index> keyStarts(numKeys);
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (size_t b = 0; b < buckets.size(); b += 1) {
+            const auto [first, last] = bucketRange(starts, buckets[b]);
+            size_t offset = keyOffsets[b];
+            forEachTransition(text, suffixes, refinedLength, first, last,
+                [&keys, &keyStarts, &offset](int64_t, int64_t code, size_t idx) {
+                    keys[offset] = static_cast<uint64_t>(code);
+                    keyStarts[offset] = Index(static_cast<int64_t>(idx));
+                    offset += 1;
+                });
+        }
+
+        /* every code before a bucket's own gets the offset of its first key */
+        const size_t numCodes = kmer::numKmers(k);
+        std::vector<Index> offsets(numCodes + 1);
+        size_t next = 0;
+        for (size_t code = 0; code <= numCodes; code += 1) {
+            offsets[code] = Index(static_cast<int64_t>(keyOffsets[next]));
+            if (next < buckets.size() && buckets[next] == code) {
+                next += 1;
+            }
+        }
+        return {refinedLength, indexfile::Storage<Index>(std::move(offsets)), indexfile::Storage<uint64_t>(std::move(keys)),
+            indexfile::Storage<Index>(std::move(keyStarts))};
+    }
+
+    /**
+     * @brief Range of the refined entries [first, last) of a bucket ending at `bucketEnd` matching the query.
+     */
+    std::pair<int64_t, int64_t> refinedRange(std::string_view query, size_t first, size_t last, int64_t bucketEnd) const noexcept {
+        const auto [code, valid] = kmer::encode(query, refinement_.length);
+        if (!valid) {
+            return {0, 0};
+        }
+        const auto begin = std::next(std::begin(refinement_.keys), static_cast<std::ptrdiff_t>(first));
+        const auto end = std::next(std::begin(refinement_.keys), static_cast<std::ptrdiff_t>(last));
+        const auto key = std::lower_bound(begin, end, code);
+        if (key == end || *key != code) {
+            return {0, 0};
+        }
+        const auto idx = static_cast<size_t>(std::distance(std::begin(refinement_.keys), key));
+        return {refinement_.starts[idx], (idx + 1 < last) ? static_cast<int64_t>(refinement_.starts[idx + 1]) : bucketEnd};
+    }
+
+    /**
+     * @brief Direct tables cost 4 bytes per possible k-mer and sorted tables 12 bytes per occurring k-mer, so
+     * prefer direct indexing whenever it can't be much larger.
+     */
+    static bool useDirect(size_t k, size_t numSuffixes) noexcept {
+        return k <= MAX_DIRECT_LENGTH && kmer::numKmers(k) <= 3 * static_cast<uint64_t>(numSuffixes);
+    }
+
+    /* transitions are found in this many slices of the suffix array, each scanned by one thread */
+    #if defined(_OPENMP)
+    constexpr static size_t NUM_CHUNKS = 128;
+    #else
+    constexpr static size_t NUM_CHUNKS = 1;
+    #endif
+
+    /**
+     * @brief Packed k-mer of the `idx`-th suffix; invalid if it reaches the end of its record within k bases.
+     */
+    static kmer::PackedKmer kmerAt(PackedText const& text, std::span<const Index> suffixes, size_t k, size_t idx) noexcept {
+        return text.kmerAt(static_cast<size_t>(static_cast<int64_t>(suffixes[idx])), k);
+    }
+
+    /**
+     * @brief Code of the last suffix before `idx` that has a full k-mer. -1 if there is none.
+     */
+    static int64_t previousCode(PackedText const& text, std::span<const Index> suffixes, size_t k, size_t idx) {
+        while (idx > 0) {
+            idx -= 1;
+            const auto [code, valid] = kmerAt(text, suffixes, k, idx);
+            if (valid) {
+                return static_cast<int64_t>(code);
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * @brief Visit each position in [rangeStart, rangeEnd) of the suffix array where the k-mer changes.
+     *
+     * @param visit called with (previous code, new code, suffix array index)
+     */
+    template <typename Visitor>
+    static void forEachTransition(PackedText const& text, std::span<const Index> suffixes, size_t k,
+        size_t rangeStart, size_t rangeEnd, Visitor &&visit) {
+
+        int64_t prevCode = previousCode(text, suffixes, k, rangeStart);
+        for (size_t i = rangeStart; i < rangeEnd; i += 1) {
+            const auto [code, valid] = kmerAt(text, suffixes, k, i);
+            if (valid && static_cast<int64_t>(code) != prevCode) {
+                visit(prevCode, static_cast<int64_t>(code), i);
+                prevCode = static_cast<int64_t>(code);
+            }
+        }
+    }
+
+    /**
+     * @brief Build the dense 4^k + 1 start array. Each transition fills the starts of every code between the
+     * previous and new k-mer, so chunks write disjoint ranges of the one table and can run in parallel.
+     */
+    static std::vector<Index> buildDirect(PackedText const& text, std::span<const Index> suffixes, size_t k) {
+        const auto numCodes = kmer::numKmers(k);
+        std::vector<Index> starts(numCodes + 1, Index(static_cast<int64_t>(suffixes.size())));
+
+        auto fill = [&starts](int64_t prevCode, int64_t code, size_t idx) {
+            std::fill(std::next(std::begin(starts), prevCode + 1), std::next(std::begin(starts), code + 1),
+                Index(static_cast<int64_t>(idx)));
+        };
+
+        const size_t numSuffixes = suffixes.size();
+        #pragma omp parallel for
+        for (size_t i = 0; i < NUM_CHUNKS; i += 1) {
+            forEachTransition(text, suffixes, k, chunkStart(i, numSuffixes), chunkStart(i + 1, numSuffixes), fill);
+        }
+        return starts;
+    }
+
+    /**
+     * @brief Build the sorted key and start arrays. Keys come out in suffix array order, which is already
+     * sorted, so one pass counts each chunk's k-mers and a second writes them straight to their offsets in
+     * arrays of the final size; nothing is buffered or merged.
+     */
+    static void buildSorted(PackedText const& text, std::span<const Index> suffixes, size_t k,
+        std::vector<Index> &starts, std::vector<uint64_t> &keys) {
+
+        const size_t numSuffixes = suffixes.size();
+        std::array<size_t, NUM_CHUNKS> offsets{};
+        #pragma omp parallel for
+        for (size_t i = 0; i < NUM_CHUNKS; i += 1) {
+            size_t count = 0;
+            forEachTransition(text, suffixes, k, chunkStart(i, numSuffixes), chunkStart(i + 1, numSuffixes),
+                [&count](int64_t, int64_t, size_t) { count += 1; });
+            offsets[i] = count;
+        }
+        const size_t numKeys = std::accumulate(std::begin(offsets), std::end(offsets), size_t(0));
+        std::exclusive_scan(std::begin(offsets), std::end(offsets), std::begin(offsets), size_t(0));
+
+        keys.resize(numKeys);
+        starts.resize(numKeys + 1);
+        #pragma omp parallel for
+        for (size_t i = 0; i < NUM_CHUNKS; i += 1) {
+            size_t offset = offsets[i];
+            forEachTransition(text, suffixes, k, chunkStart(i, numSuffixes), chunkStart(i + 1, numSuffixes),
+                [&starts, &keys, &offset](int64_t, int64_t code, size_t idx) {
+                    keys[offset] = static_cast<uint64_t>(code);
+                    starts[offset] = Index(static_cast<int64_t>(idx));
+                    offset += 1;
+                });
+        }
+        starts[numKeys] = Index(static_cast<int64_t>(numSuffixes));
+    }
+
+    /**
+     * @brief First suffix array index of a chunk; chunk NUM_CHUNKS ends the last one.
+     */
+    static size_t chunkStart(size_t chunk, size_t numSuffixes) noexcept {
+        return chunk * numSuffixes / NUM_CHUNKS;
+    }
+};
+
+using PrefixTable = BasicPrefixTable<int32_t>;
+
+}   // namespace suffixarray
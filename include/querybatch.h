@@ -0,0 +1,228 @@
+/**
+ * @file querybatch.h
+ * @author Daniel Nichols
+ * @brief Query batches that view their titles and sequences in one read buffer and keep their results in a
+ * shared pool, so a batch of queries costs a handful of allocations rather than several per query.
+ * @date 2022-05-01
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>    // copy, copy_n, fill, max
+#include <atomic>       // atomic
+#include <cstdint>      // int64_t, uint64_t
+#include <iterator>     // distance
+#include <memory>       // unique_ptr, make_unique, make_unique_for_overwrite
+#include <mutex>        // mutex, lock_guard
+#include <string_view>  // string_view
+#include <utility>      // exchange, move
+#include <vector>       // vector
+
+namespace querybatch {
+
+/**
+ * @brief Storage for the result positions of every query in a batch. Each thread takes CHUNK_SIZE positions at
+ * a time from the pool, under a lock, and hands them out to the lists it fills without one; a list longer than
+ * a quarter chunk gets a chunk of its own. Nothing is freed before the pool is.
+ *
+ * @tparam Position result position type
+ */
+template <typename Position>
+class PositionPool {
+public:
+    /* positions a thread takes from the pool at a time */
+    constexpr static size_t CHUNK_SIZE = size_t(1) << 16;
+
+    PositionPool() : generation_(nextGeneration()) {}
+    PositionPool(PositionPool const&) = delete;
+    PositionPool &operator=(PositionPool const&) = delete;
+
+    /**
+     * @brief Room for `count` consecutive positions, from the calling thread's chunk.
+     */
+    Position *allocate(size_t count) {
+        Cursor &cursor = cursor_;
+        if (cursor.generation == generation_ && count <= static_cast<size_t>(cursor.end - cursor.next)) {
+            return std::exchange(cursor.next, cursor.next + count);
+        }
+        if (count > CHUNK_SIZE / 4) {
+            return newChunk(count);
+        }
+        Position *chunk = newChunk(CHUNK_SIZE);
+        cursor = {generation_, chunk + count, chunk + CHUNK_SIZE};
+        return chunk;
+    }
+
+    /**
+     * @brief Grow the calling thread's last allocation, which ends at `end`, by `extra` positions in place.
+     * @return false if it is not the last one or its chunk is full
+     */
+    bool extend(Position const* end, size_t extra) noexcept {
+        Cursor &cursor = cursor_;
+        if (cursor.generation != generation_ || end != cursor.next || extra > static_cast<size_t>(cursor.end - cursor.next)) {
+            return false;
+        }
+        cursor.next += extra;
+        return true;
+    }
+
+private:
+    /* unused part of a thread's current chunk, and the pool it belongs to; pools may come and go under it */
+    struct Cursor {
+        uint64_t generation = 0;
+        Position *next = nullptr, *end = nullptr;
+    };
+    static inline thread_local Cursor cursor_;
+
+    uint64_t generation_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Position[]>> chunks_;
+
+    static uint64_t nextGeneration() noexcept {
+        static std::atomic<uint64_t> generations{0};
+        return generations.fetch_add(1) + 1;
+    }
+
+    Position *newChunk(size_t size) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        chunks_.push_back(std::make_unique_for_overwrite<Position[]>(size));
+        return chunks_.back().get();
+    }
+};
+
+/**
+ * @brief List of result positions allocated from a PositionPool, with the parts of the std::vector interface
+ * that searches use. Growing a list that is not the last one its thread allocated copies it to a new place and
+ * leaves the old one unused.
+ */
+template <typename Position>
+class PooledPositions {
+public:
+    using value_type = Position;
+    using iterator = Position *;
+    using const_iterator = Position const*;
+
+    /* positions a list starts with once it grows */
+    constexpr static size_t MIN_CAPACITY = 4;
+
+    PooledPositions() = default;
+    explicit PooledPositions(PositionPool<Position> *pool) noexcept : pool_(pool) {}
+
+    template <typename Iterator>
+    void assign(Iterator first, Iterator last) {
+        const auto count = static_cast<size_t>(std::distance(first, last));
+        size_ = 0;
+        reserve(count);
+        std::copy(first, last, data_);
+        size_ = count;
+    }
+
+    void push_back(Position position) {
+        if (size_ == capacity_) {
+            reserve(std::max(2 * capacity_, MIN_CAPACITY));
+        }
+        data_[size_++] = position;
+    }
+
+    void reserve(size_t capacity) {
+        if (capacity <= capacity_) {
+            return;
+        }
+        if (!pool_->extend(data_ + capacity_, capacity - capacity_)) {
+            Position *grown = pool_->allocate(capacity);
+            std::copy_n(data_, size_, grown);
+            data_ = grown;
+        }
+        capacity_ = capacity;
+    }
+
+    /**
+     * @brief Change the size to `size`; new positions are 0.
+     */
+    void resize(size_t size) {
+        reserve(size);
+        if (size > size_) {
+            std::fill(data_ + size_, data_ + size, Position{});
+        }
+        size_ = size;
+    }
+
+    void clear() noexcept { size_ = 0; }
+
+    size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+    Position *data() noexcept { return data_; }
+    Position const* data() const noexcept { return data_; }
+    Position *begin() noexcept { return data_; }
+    Position *end() noexcept { return data_ + size_; }
+    Position const* begin() const noexcept { return data_; }
+    Position const* end() const noexcept { return data_ + size_; }
+    Position &operator[](size_t i) noexcept { return data_[i]; }
+    Position const& operator[](size_t i) const noexcept { return data_[i]; }
+
+private:
+    PositionPool<Position> *pool_ = nullptr;
+    Position *data_ = nullptr;
+    size_t size_ = 0, capacity_ = 0;
+};
+
+/**
+ * @brief A query of a QueryBatch. Same fields as BasicSuffixArray::Query, so every index searches it the same way.
+ */
+template <typename Position>
+struct BatchQuery {
+    std::string_view title, query;
+    PooledPositions<Position> result;
+    int64_t count = 0;
+    size_t reverseResults = 0;
+};
+
+/**
+ * @brief Queries whose titles and sequences are views of one text buffer, usually the bytes read from the query
+ * file, and whose results share one PositionPool. Moving a batch keeps its views and results valid.
+ *
+ * @tparam Position result position type of the index searched
+ */
+template <typename Position>
+class QueryBatch {
+public:
+    using Query = BatchQuery<Position>;
+    using position_type = Position;
+
+    /**
+     * @param text buffer the queries view
+     */
+    explicit QueryBatch(std::vector<char> text = {})
+        : text_(std::move(text)), pool_(std::make_unique<PositionPool<Position>>()) {}
+
+    /**
+     * @brief Append a query viewing `title` and `query`, which must outlive the batch, e.g. by lying in text().
+     */
+    void add(std::string_view title, std::string_view query) {
+        queries_.push_back({title, query, PooledPositions<Position>(pool_.get())});
+    }
+
+    void reserve(size_t numQueries) {
+        queries_.reserve(numQueries);
+    }
+
+    std::string_view text() const noexcept {
+        return std::string_view(text_.data(), text_.size());
+    }
+
+    size_t size() const noexcept { return queries_.size(); }
+    bool empty() const noexcept { return queries_.empty(); }
+    auto begin() noexcept { return std::begin(queries_); }
+    auto end() noexcept { return std::end(queries_); }
+    auto begin() const noexcept { return std::begin(queries_); }
+    auto end() const noexcept { return std::end(queries_); }
+    Query &operator[](size_t i) noexcept { return queries_[i]; }
+    Query const& operator[](size_t i) const noexcept { return queries_[i]; }
+
+private:
+    std::vector<char> text_;
+    std::unique_ptr<PositionPool<Position>> pool_;
+    std::vector<Query> queries_;
+};
+
+}   // namespace querybatch
@@ -0,0 +1,303 @@
+/**
+ * @file queryserver.h
+ * @author Daniel Nichols
+ * @brief Long running query service over stdin/stdout or a Unix socket, so the index is loaded once.
+ * @date 2022-04-27
+ */
+#pragma once
+
+/* stl includes */
+#include <array>        // array
+#include <cerrno>       // errno, EINTR, ECONNABORTED
+#include <chrono>       // milliseconds
+#include <csignal>      // signal, raise, SIGPIPE, SIGINT, SIGTERM, SIGHUP
+#include <cstring>      // memchr, strerror
+#include <exception>    // ios_base::failure
+#include <functional>   // function
+#include <future>       // promise
+#include <iostream>     // cerr
+#include <sstream>      // ostringstream
+#include <string>       // string
+#include <string_view>  // string_view
+#include <thread>       // thread, sleep_for
+#include <vector>       // vector
+
+/* posix includes */
+#include <sys/socket.h> // socket, bind, listen, accept
+#include <sys/stat.h>   // lstat, S_ISSOCK
+#include <sys/un.h>     // sockaddr_un
+#include <unistd.h>     // read, write, close, unlink
+
+/* local includes */
+#include "contigs.h"    // ContigTable
+#include "pipeline.h"   // BoundedQueue
+#include "results.h"    // ResultWriter
+
+namespace server {
+
+/* line that ends a batch of queries from the client, and each batch of results from the server */
+constexpr std::string_view BATCH_END = "//";
+
+/**
+ * @brief Buffered line reader over a file descriptor. Line ends may be LF or CRLF.
+ */
+class LineReader {
+public:
+    explicit LineReader(int fd) : fd_(fd) {}
+
+    /**
+     * @brief Read the next line without its line end.
+     * @throws std::ios_base::failure on a read error
+     *
+     * @return false at the end of input with nothing left to return
+     */
+    bool getline(std::string &line) {
+        line.clear();
+        while (true) {
+            char const* first = buffer_.data() + start_;
+            char const* newline = static_cast<char const*>(std::memchr(first, '\n', end_ - start_));
+            if (newline != nullptr) {
+                line.append(first, static_cast<size_t>(newline - first));
+                start_ = static_cast<size_t>(newline - buffer_.data()) + 1;
+                break;
+            }
+            line.append(first, end_ - start_);
+            start_ = end_ = 0;
+
+            const ssize_t bytesRead = ::read(fd_, buffer_.data(), buffer_.size());
+            if (bytesRead < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytesRead < 0) {
+                throw std::ios_base::failure(std::string("Could not read queries: ") + std::strerror(errno));
+            }
+            if (bytesRead == 0) {
+                if (line.empty()) {
+                    return false;
+                }
+                break;
+            }
+            end_ = static_cast<size_t>(bytesRead);
+        }
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        return true;
+    }
+
+private:
+    int fd_;
+    std::array<char, 1 << 16> buffer_;
+    size_t start_ = 0, end_ = 0;
+};
+
+/**
+ * @brief Write all of `data` to `fd`.
+ * @throws std::ios_base::failure if the descriptor is closed or fails
+ */
+inline void writeAll(int fd, std::string_view data) {
+    while (!data.empty()) {
+        const ssize_t bytesWritten = ::write(fd, data.data(), data.size());
+        if (bytesWritten < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesWritten <= 0) {
+            throw std::ios_base::failure(std::string("Could not write results: ") + std::strerror(errno));
+        }
+        data.remove_prefix(static_cast<size_t>(bytesWritten));
+    }
+}
+
+/**
+ * @brief Read FASTA records up to the next BATCH_END line or the end of input. Records without a sequence are
+ * skipped.
+ *
+ * @return false at the end of input if no records were read
+ */
+template <typename Query>
+bool readBatch(LineReader &reader, std::vector<Query> &queries) {
+    queries.clear();
+    std::string line, title, sequence;
+    bool open = false;
+    auto finishRecord = [&] {
+        if (open && !sequence.empty()) {
+            queries.push_back({std::move(title), std::move(sequence), {}});
+        }
+        title.clear();
+        sequence.clear();
+        open = false;
+    };
+
+    while (reader.getline(line)) {
+        if (line == BATCH_END) {
+            finishRecord();
+            return true;
+        }
+        if (line.starts_with('>')) {
+            finishRecord();
+            title.assign(line, 1);
+        } else {
+            sequence += line;
+        }
+        open = true;
+    }
+    finishRecord();
+    return !queries.empty();
+}
+
+/**
+ * @brief Answers batches of FASTA queries with the already loaded index behind `search`.
+ *
+ * Clients send FASTA records and end each batch with a BATCH_END line. The server answers with the text results
+ * of that batch, in the querysa output format, followed by its own BATCH_END line, so a client can wait for each
+ * reply. Any number of clients may be connected; each has a thread for its reads and writes, and their batches
+ * are searched one at a time on a single dispatcher thread, so every search gets the whole OpenMP thread pool.
+ *
+ * @tparam Query query type of the index
+ */
+template <typename Query>
+class QueryServer {
+public:
+    /* batches waiting for the dispatcher before clients block */
+    constexpr static size_t MAX_PENDING_BATCHES = 64;
+
+    /**
+     * @param search fills in the results of a batch of queries; only ever called from one thread at a time
+     * @param coords write positions as `contig:offset` with this table; nullptr for text offsets
+     * @param stranded mark each position with its strand
+     */
+    QueryServer(std::function<void(std::vector<Query> &)> search, suffixarray::ContigTable const* coords,
+        bool stranded = false)
+        : search_(std::move(search)), coords_(coords), stranded_(stranded), requests_(MAX_PENDING_BATCHES),
+          dispatcher_([this] { dispatch(); }) {}
+
+    ~QueryServer() {
+        requests_.close();
+        dispatcher_.join();
+    }
+
+    QueryServer(QueryServer const&) = delete;
+    QueryServer &operator=(QueryServer const&) = delete;
+
+    /**
+     * @brief Answer one client reading from `inFd` and writing to `outFd` until its input ends.
+     * @throws std::ios_base::failure if reading or writing fails
+     */
+    void serve(int inFd, int outFd) {
+        LineReader reader(inFd);
+        std::vector<Query> queries;
+        while (readBatch(reader, queries)) {
+            Request request{&queries, {}};
+            auto done = request.done.get_future();
+            if (!requests_.push(&request)) {
+                return;
+            }
+            done.get();
+
+            std::ostringstream reply;
+            results::ResultWriter writer(reply, results::Format::Text, coords_, stranded_);
+            writer.write(queries);
+            writer.flush();
+            reply << BATCH_END << '\n';
+            writeAll(outFd, reply.view());
+        }
+    }
+
+    /**
+     * @brief Accept clients on a Unix socket at `path` until interrupted, serving each on its own thread. A
+     * stale socket at `path` is replaced, and the socket is removed when SIGINT, SIGTERM, or SIGHUP ends the
+     * server.
+     * @throws std::ios_base::failure if `path` names anything but a socket, or the socket cannot be created
+     */
+    [[noreturn]] void listen(std::string const& path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            throw std::ios_base::failure("Socket path \"" + path + "\" is too long.");
+        }
+        path.copy(address.sun_path, path.size());
+
+        /* a mistyped path must not cost the user the file it names */
+        struct stat status{};
+        if (::lstat(path.c_str(), &status) == 0) {
+            if (!S_ISSOCK(status.st_mode)) {
+                throw std::ios_base::failure("Refusing to replace non-socket \"" + path + "\".");
+            }
+            ::unlink(path.c_str());
+        }
+
+        /* a client hanging up mid reply should only end its own connection */
+        std::signal(SIGPIPE, SIG_IGN);
+        const int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) != 0
+            || ::listen(listener, SOMAXCONN) != 0) {
+            throw std::ios_base::failure("Could not listen on \"" + path + "\": " + std::strerror(errno));
+        }
+        path.copy(socketPath_, path.size());
+        for (const int number : {SIGINT, SIGTERM, SIGHUP}) {
+            std::signal(number, removeSocket);
+        }
+        std::cerr << "Listening on " << path << "\n";
+
+        while (true) {
+            const int client = ::accept(listener, nullptr, nullptr);
+            if (client < 0) {
+                /* running out of descriptors or memory lasts until some client leaves, so wait rather than spin */
+                if (errno != EINTR && errno != ECONNABORTED) {
+                    std::cerr << "Could not accept a client: " << std::strerror(errno) << "\n";
+                    std::this_thread::sleep_for(ACCEPT_RETRY_DELAY);
+                }
+                continue;
+            }
+            std::thread([this, client] {
+                try {
+                    serve(client, client);
+                } catch (std::exception const& e) {
+                    std::cerr << "Dropped client: " << e.what() << "\n";
+                }
+                ::close(client);
+            }).detach();
+        }
+    }
+
+private:
+    /* socket the signal handler removes; sized like sockaddr_un::sun_path, and written before it is installed */
+    static inline char socketPath_[sizeof(sockaddr_un::sun_path)] = {};
+
+    /**
+     * @brief Remove the listening socket, then end the process the way signal `number` would have without this
+     * handler.
+     */
+    static void removeSocket(int number) noexcept {
+        ::unlink(socketPath_);
+        std::signal(number, SIG_DFL);
+        std::raise(number);
+    }
+
+    /* pause before accepting again after an accept failure other than an interrupt or an aborted connection */
+    constexpr static std::chrono::milliseconds ACCEPT_RETRY_DELAY{100};
+
+    struct Request {
+        std::vector<Query> *queries;
+        std::promise<void> done;
+    };
+
+    std::function<void(std::vector<Query> &)> search_;
+    suffixarray::ContigTable const* coords_;
+    bool stranded_;
+    pipeline::BoundedQueue<Request *> requests_;
+    std::thread dispatcher_;
+
+    void dispatch() {
+        for (auto request = requests_.pop(); request; request = requests_.pop()) {
+            try {
+                search_(*(*request)->queries);
+                (*request)->done.set_value();
+            } catch (...) {
+                (*request)->done.set_exception(std::current_exception());
+            }
+        }
+    }
+};
+
+}   // namespace server
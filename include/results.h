@@ -0,0 +1,298 @@
+/**
+ * @file results.h
+ * @author Daniel Nichols
+ * @brief Buffered text and binary writers for query results, and a reader for the binary format.
+ * @date 2022-04-27
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>    // max_element, sort
+#include <array>        // array
+#include <bit>          // bit_width
+#include <charconv>     // to_chars
+#include <cstdint>      // uint8_t, uint32_t, uint64_t, int64_t
+#include <cstring>      // memcpy
+#include <exception>    // ios_base::failure
+#include <istream>      // istream
+#include <ostream>      // ostream
+#include <span>         // span
+#include <string>       // string
+#include <string_view>  // string_view
+#include <vector>       // vector
+
+/* local includes */
+#include "contigs.h"    // ContigTable, ContigPosition
+
+namespace results {
+
+/**
+ * @brief Text is one tab separated line per query: title, count, and each stored position. Binary is a header
+ * followed by one record per query: its index in the query file, its count, the number of stored positions,
+ * and the positions in ascending order as a first value and successive gaps, every field a LEB128 varint.
+ * Stranded results mark each position with its strand: a `+` or `-` suffix in text, and the position doubled
+ * plus 1 for the reverse strand in binary.
+ */
+enum class Format { Text, Binary };
+
+constexpr uint32_t BINARY_MAGIC = 0x5e571175;
+constexpr uint32_t BINARY_VERSION = 2;
+
+/* binary header flags */
+constexpr uint32_t STRANDED_FLAG = 1;
+
+/**
+ * @brief One query's results read back from the binary format.
+ */
+struct BinaryRecord {
+    uint64_t queryIndex;
+    int64_t count;
+    std::vector<int64_t> positions;
+    std::vector<uint8_t> reverse;   // 1 for each position on the reverse strand; empty unless stranded
+};
+
+/**
+ * @brief Formats results into a large buffer and hands it to the stream a few MiB at a time, so writing costs
+ * a memcpy per field instead of a formatted stream insertion. Integers are formatted with std::to_chars.
+ */
+class ResultWriter {
+public:
+    /* bytes buffered before they are written out */
+    constexpr static size_t FLUSH_SIZE = size_t(4) << 20;
+
+    /**
+     * @param output stream to write to
+     * @param format output format
+     * @param coords write text positions as `contig:offset` with this table; ignored by the binary format, which
+     * always stores positions in the text
+     * @param stranded mark each position with its strand, from the queries' `reverseResults`
+     */
+    ResultWriter(std::ostream &output, Format format, suffixarray::ContigTable const* coords = nullptr,
+        bool stranded = false) : output_(output), format_(format), coords_(coords), stranded_(stranded) {
+        buffer_.reserve(FLUSH_SIZE + FLUSH_SIZE / 4);
+        if (format_ == Format::Binary) {
+            appendRaw(BINARY_MAGIC);
+            appendRaw(BINARY_VERSION);
+            appendRaw(stranded_ ? STRANDED_FLAG : 0);
+        }
+    }
+
+    /**
+     * @brief Write the results of the next queries of the query file.
+     *
+     * @tparam Batch range of queries with `title`, `count`, `result`, and `reverseResults`, e.g. a
+     * std::vector of them or a querybatch::QueryBatch
+     */
+    template <typename Batch>
+    void write(Batch const& queries) {
+        for (auto const& q : queries) {
+            const size_t numForward = stranded_ ? q.result.size() - q.reverseResults : q.result.size();
+            if (format_ == Format::Binary) {
+                appendBinary(q.count, std::span(q.result), numForward);
+            } else {
+                appendText(q.title, q.count, std::span(q.result), numForward);
+            }
+            nextQueryIndex_ += 1;
+            if (buffer_.size() >= FLUSH_SIZE) {
+                flush();
+            }
+        }
+    }
+
+    /**
+     * @brief Write out everything buffered so far.
+     * @throws std::ios_base::failure if the stream fails
+     */
+    void flush() {
+        output_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        buffer_.clear();
+        if (!output_) {
+            throw std::ios_base::failure("Could not write query results.");
+        }
+    }
+
+private:
+    std::ostream &output_;
+    Format format_;
+    suffixarray::ContigTable const* coords_;
+    bool stranded_;
+    std::string buffer_;
+    uint64_t nextQueryIndex_ = 0;
+    std::vector<suffixarray::ContigPosition> contigPositions_;
+    std::vector<uint64_t> sortedPositions_, radixScratch_;
+
+    /**
+     * @brief One text line. Positions from `numForward` on are on the reverse strand.
+     */
+    template <typename Position>
+    void appendText(std::string_view title, int64_t count, std::span<const Position> positions, size_t numForward) {
+        buffer_.append(title);
+        buffer_.push_back('\t');
+        appendInteger(count);
+        if (coords_) {
+            contigPositions_.resize(positions.size());
+            coords_->lookup(positions, std::span(contigPositions_));
+        }
+        for (size_t i = 0; i < positions.size(); i += 1) {
+            buffer_.push_back('\t');
+            if (coords_) {
+                const auto [contig, offset] = contigPositions_[i];
+                const auto name = coords_->name(contig);
+                if (name.empty()) {
+                    appendInteger(contig);
+                } else {
+                    buffer_.append(name);
+                }
+                buffer_.push_back(':');
+                appendInteger(offset);
+            } else {
+                appendInteger(static_cast<int64_t>(positions[i]));
+            }
+            if (stranded_) {
+                buffer_.push_back((i < numForward) ? '+' : '-');
+            }
+        }
+        buffer_.push_back('\n');
+    }
+
+    /**
+     * @brief One binary record. Positions from `numForward` on are on the reverse strand.
+     */
+    template <typename Position>
+    void appendBinary(int64_t count, std::span<const Position> positions, size_t numForward) {
+        sortedPositions_.resize(positions.size());
+        for (size_t i = 0; i < positions.size(); i += 1) {
+            const auto position = static_cast<uint64_t>(positions[i]);
+            sortedPositions_[i] = stranded_ ? 2 * position + (i >= numForward) : position;
+        }
+        sortPositions();
+
+        appendVarint(nextQueryIndex_);
+        appendVarint(static_cast<uint64_t>(count));
+        appendVarint(sortedPositions_.size());
+        uint64_t previous = 0;
+        for (const uint64_t position : sortedPositions_) {
+            appendVarint(position - previous);
+            previous = position;
+        }
+    }
+
+    /**
+     * @brief Sort sortedPositions_. Repetitive queries have thousands of hits, so large lists take an LSD radix
+     * sort with only as many byte passes as the largest position needs.
+     */
+    void sortPositions() {
+        constexpr size_t RADIX_THRESHOLD = 256;
+        if (sortedPositions_.size() < RADIX_THRESHOLD) {
+            std::sort(std::begin(sortedPositions_), std::end(sortedPositions_));
+            return;
+        }
+
+        const uint64_t maxPosition = *std::max_element(std::begin(sortedPositions_), std::end(sortedPositions_));
+        radixScratch_.resize(sortedPositions_.size());
+        for (uint32_t shift = 0; shift < static_cast<uint32_t>(std::bit_width(maxPosition)); shift += 8) {
+            std::array<size_t, 257> offsets{};
+            for (const uint64_t position : sortedPositions_) {
+                offsets[((position >> shift) & 0xff) + 1] += 1;
+            }
+            for (size_t digit = 1; digit < offsets.size(); digit += 1) {
+                offsets[digit] += offsets[digit - 1];
+            }
+            for (const uint64_t position : sortedPositions_) {
+                radixScratch_[offsets[(position >> shift) & 0xff]++] = position;
+            }
+            sortedPositions_.swap(radixScratch_);
+        }
+    }
+
+    void appendInteger(int64_t value) {
+        std::array<char, 20> digits;
+        const auto end = std::to_chars(digits.data(), digits.data() + digits.size(), value).ptr;
+        buffer_.append(digits.data(), end);
+    }
+
+    void appendVarint(uint64_t value) {
+        while (value >= 0x80) {
+            buffer_.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        buffer_.push_back(static_cast<char>(value));
+    }
+
+    void appendRaw(uint32_t value) {
+        std::array<char, sizeof(value)> bytes;
+        std::memcpy(bytes.data(), &value, sizeof(value));
+        buffer_.append(bytes.data(), bytes.size());
+    }
+};
+
+/**
+ * @brief Reads the binary result format back one query at a time.
+ */
+class BinaryResultReader {
+public:
+    /**
+     * @throws std::ios_base::failure if the stream does not start with a binary result header
+     */
+    explicit BinaryResultReader(std::istream &input) : input_(input) {
+        std::array<uint32_t, 3> header{};
+        input_.read(reinterpret_cast<char *>(header.data()), sizeof(header));
+        if (!input_ || header[0] != BINARY_MAGIC || header[1] != BINARY_VERSION) {
+            throw std::ios_base::failure("Not a binary query result file.");
+        }
+        stranded_ = (header[2] & STRANDED_FLAG) != 0;
+    }
+
+    /**
+     * @brief Whether the records mark the strand of each position.
+     */
+    bool stranded() const noexcept {
+        return stranded_;
+    }
+
+    /**
+     * @brief Read the next record.
+     * @throws std::ios_base::failure if the stream ends inside a record
+     *
+     * @return false at the end of the stream
+     */
+    bool next(BinaryRecord &record) {
+        if (input_.peek() == std::istream::traits_type::eof()) {
+            return false;
+        }
+        record.queryIndex = readVarint();
+        record.count = static_cast<int64_t>(readVarint());
+        record.positions.resize(readVarint());
+        record.reverse.assign(stranded_ ? record.positions.size() : 0, 0);
+        uint64_t previous = 0;
+        for (size_t i = 0; i < record.positions.size(); i += 1) {
+            previous += readVarint();
+            record.positions[i] = static_cast<int64_t>(stranded_ ? previous / 2 : previous);
+            if (stranded_) {
+                record.reverse[i] = static_cast<uint8_t>(previous % 2);
+            }
+        }
+        return true;
+    }
+
+private:
+    std::istream &input_;
+    bool stranded_ = false;
+
+    uint64_t readVarint() {
+        uint64_t value = 0;
+        for (uint32_t shift = 0; shift < 64; shift += 7) {
+            const int byte = input_.get();
+            if (byte == std::istream::traits_type::eof()) {
+                throw std::ios_base::failure("Truncated binary query result file.");
+            }
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        throw std::ios_base::failure("Corrupt varint in binary query result file.");
+    }
+};
+
+}   // namespace results
@@ -0,0 +1,164 @@
+/**
+ * @file sampletree.h
+ * @author Daniel Nichols
+ * @brief Cache resident search tree over evenly spaced samples of a suffix array.
+ * @date 2022-04-25
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>    // is_sorted, min
+#include <bit>          // bit_width, has_single_bit
+#include <cstdint>      // int64_t, uint64_t
+#include <span>         // span
+#include <string_view>  // string_view
+#include <utility>      // pair
+#include <vector>       // vector
+
+/* local includes */
+#include "indexfile.h"  // Storage
+#include "kmer.h"       // orderedKey, orderedKeyMask
+#include "utilities.h"  // prefetch
+
+namespace suffixarray {
+
+/**
+ * @brief The first levels of the suffix array binary search, answered from a small array instead of the
+ * suffix array and text.
+ *
+ * 2^levels - 1 evenly spaced suffixes are sampled and the first kmer::ORDERED_KEY_LENGTH characters of each
+ * are stored as an ordered key, laid out in Eytzinger (breadth first) order. Searching it touches one key per
+ * level, the top levels of every search share the same few cache lines, and the keys a few levels down are
+ * prefetched while the current one is compared. Keys that equal the query's on its first characters are
+ * inconclusive, so the tree only narrows the range; the binary search over the suffix array finishes it.
+ *
+ * At 20 levels the tree is 8 MiB and leaves about n / 2^20 suffixes for the full search.
+ */
+class SampleTree {
+public:
+    /* 2^26 keys is 512 MiB, past which the tree would no longer be any closer to the cpu than the suffix array */
+    constexpr static size_t MAX_LEVELS = 26;
+
+    SampleTree() = default;
+
+    /**
+     * @brief Reassemble a tree from its stored keys, e.g. from a memory mapped file.
+     *
+     * @param numSuffixes length of the suffix array the tree samples
+     * @param keys keys in Eytzinger order, starting at index 1
+     */
+    SampleTree(size_t numSuffixes, indexfile::Storage<uint64_t> keys) : numSuffixes_(numSuffixes), keys_(std::move(keys)) {}
+
+    /**
+     * @brief Sample a suffix array.
+     * @note levels is capped at MAX_LEVELS and so that every sampled row is distinct.
+     *
+     * @param text text the suffix array is built on
+     * @param suffixes suffix array of text
+     * @param levels depth of the tree
+     * @return SampleTree tree over 2^levels - 1 suffixes
+     */
+    template <typename Index>
+    static SampleTree build(std::string_view text, std::span<const Index> suffixes, size_t levels) {
+        levels = std::min(levels, MAX_LEVELS);
+        while (levels > 0 && (size_t(1) << levels) > suffixes.size()) {
+            levels -= 1;
+        }
+        if (levels == 0) {
+            return SampleTree();
+        }
+
+        const size_t numKeys = size_t(1) << levels;
+        std::vector<uint64_t> keys(numKeys, 0);
+
+        #pragma omp parallel for
+        for (size_t node = 1; node < numKeys; node += 1) {
+            const auto suffix = static_cast<int64_t>(suffixes[row(sortedIndex(node, numKeys), numKeys, suffixes.size())]);
+            keys[node] = kmer::orderedKey(text.substr(suffix));
+        }
+        return SampleTree(suffixes.size(), indexfile::Storage<uint64_t>(std::move(keys)));
+    }
+
+    /**
+     * @brief Range of suffixes that can start with `query`. Every suffix before it sorts before the query
+     * and every suffix after it sorts after.
+     *
+     * @return std::pair<int64_t, int64_t> [start, end) in the suffix array
+     */
+    std::pair<int64_t, int64_t> range(std::string_view query) const noexcept {
+        const uint64_t mask = kmer::orderedKeyMask(query.size());
+        const uint64_t key = kmer::orderedKey(query);
+        const size_t numKeys = keys_.size();
+        uint64_t const* keys = keys_.data();
+
+        /* after the descent `less` is the leaf past the samples smaller than the query, `notGreater` past
+         * those no greater, so subtracting the first leaf counts them */
+        size_t less = 1, notGreater = 1;
+        while (less < numKeys) {
+            utilities::prefetch(keys + PREFETCH_DISTANCE * less);
+            utilities::prefetch(keys + PREFETCH_DISTANCE * notGreater);
+            less = 2 * less + ((keys[less] & mask) < key);
+            notGreater = 2 * notGreater + ((keys[notGreater] & mask) <= key);
+        }
+        less -= numKeys;
+        notGreater -= numKeys;
+
+        const int64_t start = (less == 0) ? 0 : row(less - 1, numKeys, numSuffixes_) + 1;
+        const int64_t end = (notGreater == numKeys - 1) ? static_cast<int64_t>(numSuffixes_) : row(notGreater, numKeys, numSuffixes_);
+        return {start, end};
+    }
+
+    /**
+     * @brief Depth of the tree. 0 if there is none.
+     */
+    size_t levels() const noexcept {
+        return keys_.empty() ? 0 : std::bit_width(keys_.size()) - 1;
+    }
+
+    bool empty() const noexcept {
+        return keys_.empty();
+    }
+
+    /**
+     * @brief Sanity check a tree read from disk against the suffix array it samples.
+     */
+    bool isConsistent(size_t numSuffixes) const {
+        if (empty()) {
+            return true;
+        }
+        std::vector<uint64_t> sorted(keys_.size() - 1);
+        for (size_t node = 1; node < keys_.size(); node += 1) {
+            sorted[sortedIndex(node, keys_.size())] = keys_[node];
+        }
+        return numSuffixes == numSuffixes_ && std::has_single_bit(keys_.size()) && levels() <= MAX_LEVELS
+            && keys_.size() <= numSuffixes && std::is_sorted(std::begin(sorted), std::end(sorted));
+    }
+
+    indexfile::Storage<uint64_t> const& keys() const noexcept { return keys_; }
+
+private:
+    /* nodes 3 levels below share a cache line of 8 keys */
+    constexpr static size_t PREFETCH_DISTANCE = 8;
+
+    size_t numSuffixes_ = 0;
+    indexfile::Storage<uint64_t> keys_;     // index 0 unused
+
+    /**
+     * @brief Suffix array row of the i-th of numKeys - 1 samples in sorted order.
+     */
+    static int64_t row(size_t i, size_t numKeys, size_t numSuffixes) noexcept {
+        /* (i + 1) * numSuffixes could overflow for 40-bit suffix arrays */
+        return static_cast<int64_t>((i + 1) * (numSuffixes / numKeys) + (i + 1) * (numSuffixes % numKeys) / numKeys);
+    }
+
+    /**
+     * @brief In order position of an Eytzinger node in the perfect tree of numKeys - 1 nodes.
+     */
+    static size_t sortedIndex(size_t node, size_t numKeys) noexcept {
+        const size_t depth = std::bit_width(node) - 1;
+        const size_t height = std::bit_width(numKeys) - 1 - depth;
+        return ((2 * (node - (size_t(1) << depth)) + 1) << (height - 1)) - 1;
+    }
+};
+
+}   // namespace suffixarray
@@ -5,8 +5,15 @@
  * @date 2022-04-13
  */
 #pragma once
-#include <cstdint>
-#include <type_traits>
+
+/* stl includes */
+#include <concepts>     // regular, swappable, same_as
+#include <cstdint>      // uint64_t
+#include <fstream>      // ifstream, ofstream
+#include <iterator>     // forward_iterator, iterator_traits
+#include <ranges>       // contiguous_range, data
+#include <stdexcept>    // runtime_error
+#include <type_traits>  // is_trivial, is_trivially_copyable
 
 namespace serial {
 
@@ -49,6 +56,14 @@ concept Resizable = requires(T a, size_t size) {
     { a.resize(size) } -> std::same_as<void>;
 };
 
+/**
+ * @brief Concept resolves if T stores trivially copyable values contiguously, e.g. std::vector<int32_t> or
+ * std::string, so that all of its values can be transferred as one block of bytes.
+ */
+template <typename T>
+concept ContiguousTrivialContainer = Container<T> && std::ranges::contiguous_range<T>
+    && std::is_trivially_copyable<typename T::value_type>::value;
+
 /**
  * @brief Concept resolves if T implements a serialize and deserialize function.
  */
@@ -72,7 +87,8 @@ concept Serializable = std::is_trivial<T>::value || Container<T> || SerializeOve
 /**
  * @brief Serialize an objects bytes into an ofstream. If trivial (POD, bare struct with simple extant, etc...), 
  *        then this will just write out the data. If DataType is a container, then serialize will be recursively called
- *        on each value. If DataType::serialize exists, then this will be used.
+ *        on each value, or the values are written in one block if they are contiguous and trivially copyable.
+ *        If DataType::serialize exists, then this will be used.
  * @see deserialize
  * 
  * @tparam DataType serializable
@@ -84,6 +100,12 @@ void serialize(DataType const& data, std::ofstream &outputStream) {
 
     if constexpr (SerializeOverloads<DataType>) {
         data.serialize(outputStream);
+    } else if constexpr (ContiguousTrivialContainer<DataType>) {
+        /* same bytes as the element by element branch, in one write the stream hands straight to the file */
+        const auto size = data.size();
+        outputStream.write(reinterpret_cast<char const*>(&size), sizeof(size));
+        outputStream.write(reinterpret_cast<char const*>(std::ranges::data(data)),
+            static_cast<std::streamsize>(size * sizeof(typename DataType::value_type)));
     } else if constexpr (Container<DataType>) {
         const auto size = data.size();
         outputStream.write(reinterpret_cast<char const*>(&size), sizeof(size));
@@ -99,7 +121,8 @@ void serialize(DataType const& data, std::ofstream &outputStream) {
 /**
  * @brief Deserialize bytes from an ifstream into data object. If trivial (POD, bare struct with simple extant, etc...), 
  *        then this will just read in the data. If DataType is a container, then deserialize will be recursively called
- *        on each value. If DataType::deserialize exists, then it will be used. Expects the format/ordering used 
+ *        on each value, or the values are read in one block if they are contiguous and trivially copyable.
+ *        If DataType::deserialize exists, then it will be used. Expects the format/ordering used 
  *        by `serialize` for containers.
  * @see serialize
  * 
@@ -128,8 +151,13 @@ void deserialize(DataType &data, std::ifstream &inputStream) {
             }
         }
 
-        for (auto &value : data) {
-            deserialize(value, inputStream);
+        if constexpr (ContiguousTrivialContainer<DataType>) {
+            inputStream.read(reinterpret_cast<char *>(std::ranges::data(data)),
+                static_cast<std::streamsize>(size * sizeof(typename DataType::value_type)));
+        } else {
+            for (auto &value : data) {
+                deserialize(value, inputStream);
+            }
         }
     } else {
         inputStream.read(reinterpret_cast<char *>(&data), sizeof(data));
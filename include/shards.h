@@ -0,0 +1,360 @@
+/**
+ * @file shards.h
+ * @author Daniel Nichols
+ * @brief Suffix arrays built separately over parts of a reference and searched together as one index of the
+ * joined text.
+ * @date 2022-04-30
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>    // all_of, max, min
+#include <cstdint>      // int64_t, uint32_t, uint64_t
+#include <exception>    // ios_base::failure
+#include <filesystem>   // path
+#include <fstream>      // ifstream, ofstream
+#include <iterator>     // distance, next
+#include <stdexcept>    // invalid_argument
+#include <string>       // string, getline
+#include <string_view>  // string_view
+#include <vector>       // vector
+
+/* local includes */
+#include "contigs.h"    // ContigTable
+#include "querybatch.h" // QueryBatch
+#include "suffixarray.h"// SuffixArray64
+
+namespace suffixarray {
+
+/**
+ * @brief Suffix arrays of several texts, "shards", searched as one index over the texts joined in order, the way
+ * BasicSuffixArray::merged joins them: a position in shard i is reported moved by the sizes of the shards before
+ * it, and the contig table covers the records of every shard. A reference that grows is indexed a shard at a
+ * time instead of rebuilding one index over all of it, and the shards can later be merged without sorting again.
+ *
+ * A batch is fanned out over the shards: each run of SHARD_RUN queries on each shard is a task of its own, so
+ * every thread stays busy however many shards there are, and the hits of every shard are then gathered into each
+ * query, in shard order.
+ *
+ * Shards are listed in a manifest, a text file whose first line is MANIFEST_HEADER followed by the path of one
+ * index per line; relative paths are relative to the manifest.
+ *
+ * @tparam Shard BasicSuffixArray type of every shard
+ */
+template <typename Shard>
+class ShardedIndex {
+    using ShardBatch = querybatch::QueryBatch<typename Shard::position_type>;
+
+public:
+    using QueryMode = typename Shard::QueryMode;
+    constexpr static QueryMode Naive = Shard::Naive;
+    constexpr static QueryMode SimpleAccelerant = Shard::SimpleAccelerant;
+    constexpr static QueryMode LCPAccelerated = Shard::LCPAccelerated;
+
+    /* positions in the joined text need not fit the shards' own suffix type */
+    using position_type = int64_t;
+    using Query = SuffixArray64::Query;
+
+    constexpr static int64_t ALL_RESULTS = Shard::ALL_RESULTS;
+    constexpr static std::string_view MANIFEST_HEADER = "#shards";
+
+    /* queries each task of queries() searches on one shard */
+    constexpr static size_t SHARD_RUN = Shard::INTERLEAVED_RUN;
+
+    /**
+     * @param shards in text order
+     * @throws std::invalid_argument if there are none
+     */
+    explicit ShardedIndex(std::vector<Shard> shards) : shards_(std::move(shards)) {
+        if (shards_.empty()) {
+            throw std::invalid_argument("A sharded index needs at least one shard.");
+        }
+        std::vector<ContigTable> contigs;
+        for (auto const& shard : shards_) {
+            offsets_.push_back(size_);
+            contigs.push_back(shard.contigs());
+            size_ += shard.size();
+        }
+        contigs_ = ContigTable::joined(contigs, offsets_);
+    }
+
+    /**
+     * @brief Load every shard listed in the manifest `path`, memory mapped like BasicSuffixArray::fromSave.
+     * @throws std::ios_base::failure if the manifest or a shard cannot be read, or the shards differ in width
+     *
+     * @param populate pre-fault every shard rather than paging them in lazily
+     * @param verify check every section of every shard against its checksum first
+     */
+    static ShardedIndex fromSave(std::string const& path, bool populate=false, bool verify=false) {
+        const auto shardPaths = readManifest(path);
+        const uint32_t width = Shard::savedSuffixWidth(shardPaths.front());
+        std::vector<Shard> shards;
+        for (auto const& shardPath : shardPaths) {
+            if (Shard::savedSuffixWidth(shardPath) != width) {
+                throw std::ios_base::failure("Shard \"" + shardPath + "\" has a different index width from the first shard.");
+            }
+            shards.push_back(Shard::fromSave(shardPath, populate, verify));
+        }
+        return ShardedIndex(std::move(shards));
+    }
+
+    /**
+     * @brief Whether `path` is a shard manifest rather than an index file.
+     */
+    static bool isManifest(std::string const& path) {
+        std::ifstream input(path);
+        std::string header;
+        return std::getline(input, header) && header == MANIFEST_HEADER;
+    }
+
+    /**
+     * @brief Paths of the shards listed in the manifest `path`, relative ones resolved against its directory.
+     * @throws std::ios_base::failure if `path` is not a manifest or lists no shards
+     */
+    static std::vector<std::string> readManifest(std::string const& path) {
+        std::ifstream input(path);
+        std::string line;
+        if (!std::getline(input, line) || line != MANIFEST_HEADER) {
+            throw std::ios_base::failure("\"" + path + "\" is not a shard manifest.");
+        }
+        const auto directory = std::filesystem::path(path).parent_path();
+        std::vector<std::string> shardPaths;
+        while (std::getline(input, line)) {
+            if (!line.empty()) {
+                const std::filesystem::path shardPath(line);
+                shardPaths.push_back(shardPath.is_absolute() ? line : (directory / shardPath).string());
+            }
+        }
+        if (shardPaths.empty()) {
+            throw std::ios_base::failure("Shard manifest \"" + path + "\" lists no shards.");
+        }
+        return shardPaths;
+    }
+
+    /**
+     * @brief Write a manifest listing `shardPaths`, in text order.
+     * @throws std::ios_base::failure if it cannot be written
+     */
+    static void writeManifest(std::string const& path, std::vector<std::string> const& shardPaths) {
+        std::ofstream output(path);
+        output << MANIFEST_HEADER << "\n";
+        for (auto const& shardPath : shardPaths) {
+            output << shardPath << "\n";
+        }
+        if (!output) {
+            throw std::ios_base::failure("Could not write shard manifest \"" + path + "\".");
+        }
+    }
+
+    /**
+     * @brief Bytes per suffix of the shards listed in the manifest `path`, i.e. which Shard type can load them.
+     */
+    static uint32_t savedSuffixWidth(std::string const& path) {
+        return Shard::savedSuffixWidth(readManifest(path).front());
+    }
+
+    /**
+     * @brief Query every shard. Same semantics as BasicSuffixArray::query, over the joined text.
+     */
+    template <typename QueryType>
+    void query(QueryType &q, QueryMode mode = Naive, int64_t maxResults = ALL_RESULTS) const {
+        serialQueries(&q, &q + 1, mode, maxResults);
+    }
+
+    /**
+     * @brief Perform a set of queries on every shard in parallel.
+     * @see BasicSuffixArray::queries
+     */
+    template <typename Iterator>
+    void queries(Iterator begin, Iterator end, QueryMode mode = Naive, int64_t maxResults = ALL_RESULTS) const {
+        searchShards(begin, end, maxResults, true, [mode, maxResults](Shard const& shard, auto first, auto last) {
+            shard.serialQueries(first, last, mode, maxResults); });
+    }
+
+    /**
+     * @brief Perform a set of queries on every shard on the calling thread, e.g. an executor worker's.
+     * @see BasicSuffixArray::serialQueries
+     */
+    template <typename Iterator>
+    void serialQueries(Iterator begin, Iterator end, QueryMode mode = Naive, int64_t maxResults = ALL_RESULTS) const {
+        searchShards(begin, end, maxResults, false, [mode, maxResults](Shard const& shard, auto first, auto last) {
+            shard.serialQueries(first, last, mode, maxResults); });
+    }
+
+    /**
+     * @brief Search the whole set of queries on one shard after another with BasicSuffixArray::sortedQueries, so
+     * that each shard sorts them all once.
+     */
+    template <typename Iterator>
+    void sortedQueries(Iterator begin, Iterator end, QueryMode mode = Naive, int64_t maxResults = ALL_RESULTS) const {
+        const auto numQueries = static_cast<size_t>(std::distance(begin, end));
+        auto found = shardBatches(begin, numQueries);
+        for (size_t shard = 0; shard < shards_.size(); shard += 1) {
+            auto &batch = found[shard];
+            shards_[shard].sortedQueries(std::begin(batch), std::end(batch), mode, maxResults);
+        }
+        #pragma omp parallel for
+        for (size_t i = 0; i < numQueries; i += 1) {
+            gather(*std::next(begin, i), found, i, maxResults);
+        }
+    }
+
+    /**
+     * @brief Query every shard for occurrences with up to `maxMismatches` mismatches.
+     * @see BasicSuffixArray::approximateQuery
+     */
+    template <typename QueryType>
+    void approximateQuery(QueryType &q, uint32_t maxMismatches, QueryMode mode = Naive, int64_t maxResults = ALL_RESULTS) const {
+        searchShards(&q, &q + 1, maxResults, false,
+            [maxMismatches, mode, maxResults](Shard const& shard, auto first, [[maybe_unused]] auto last) {
+                shard.approximateQuery(*first, maxMismatches, mode, maxResults); });
+    }
+
+    /**
+     * @brief Perform a set of approximate queries on every shard in parallel.
+     * @see approximateQuery
+     */
+    template <typename Iterator>
+    void approximateQueries(Iterator begin, Iterator end, uint32_t maxMismatches, QueryMode mode = Naive,
+        int64_t maxResults = ALL_RESULTS) const {
+        searchShards(begin, end, maxResults, true, [maxMismatches, mode, maxResults](Shard const& shard, auto first, auto last) {
+            for (; first != last; ++first) {
+                shard.approximateQuery(*first, maxMismatches, mode, maxResults);
+            }
+        });
+    }
+
+    /**
+     * @brief Copy of this index with every shard replaced by its BasicSuffixArray::copied, e.g. to place them
+     * on chosen NUMA nodes.
+     */
+    template <typename Copy>
+    ShardedIndex copied(Copy &&copy) const {
+        std::vector<Shard> shards;
+        for (auto const& shard : shards_) {
+            shards.push_back(shard.copied(copy));
+        }
+        return ShardedIndex(std::move(shards));
+    }
+
+    /**
+     * @brief Length of the joined text, including every shard's '$'.
+     */
+    size_t size() const noexcept {
+        return size_;
+    }
+
+    /**
+     * @brief Records of every shard, at their positions in the joined text.
+     */
+    ContigTable const& contigs() const noexcept {
+        return contigs_;
+    }
+
+    std::vector<Shard> const& shards() const noexcept {
+        return shards_;
+    }
+
+    /**
+     * @brief Position of the first character of `shard` in the joined text.
+     */
+    uint64_t offset(size_t shard) const noexcept {
+        return offsets_[shard];
+    }
+
+    /**
+     * @brief Prefix length of the first shard's prefix table.
+     */
+    size_t getPrefixTableSize() const noexcept {
+        return shards_.front().getPrefixTableSize();
+    }
+
+    /**
+     * @brief Largest suffix sampling rate of any shard, which queries need at least as many bases as.
+     */
+    size_t getSuffixSampling() const noexcept {
+        size_t sampling = 1;
+        for (auto const& shard : shards_) {
+            sampling = std::max(sampling, shard.getSuffixSampling());
+        }
+        return sampling;
+    }
+
+    /**
+     * @brief Whether every shard has the LCP-LR arrays; the others fall back to SimpleAccelerant.
+     */
+    bool hasLCP() const noexcept {
+        return std::all_of(std::begin(shards_), std::end(shards_), [](auto const& shard) { return shard.hasLCP(); });
+    }
+
+private:
+    std::vector<Shard> shards_;
+    std::vector<uint64_t> offsets_;
+    uint64_t size_ = 0;
+    ContigTable contigs_;
+
+    /**
+     * @brief A batch per shard viewing the query strings from `begin`, each shard's hits in a pool of its own.
+     */
+    template <typename Iterator>
+    std::vector<ShardBatch> shardBatches(Iterator begin, size_t numQueries) const {
+        std::vector<ShardBatch> batches(shards_.size());
+        for (auto &batch : batches) {
+            batch.reserve(numQueries);
+            for (size_t i = 0; i < numQueries; i += 1) {
+                batch.add({}, std::next(begin, i)->query);
+            }
+        }
+        return batches;
+    }
+
+    /**
+     * @brief Call `search(shard, first, last)` on runs of SHARD_RUN of each shard's batch of the queries, one task
+     * per run and shard, and gather the results.
+     *
+     * @param parallel run the tasks on the OpenMP threads rather than the calling thread
+     */
+    template <typename Iterator, typename Search>
+    void searchShards(Iterator begin, Iterator end, int64_t maxResults, [[maybe_unused]] bool parallel, Search &&search) const {
+        const auto numQueries = static_cast<size_t>(std::distance(begin, end));
+        const size_t numShards = shards_.size();
+        const size_t numRuns = (numQueries + SHARD_RUN - 1) / SHARD_RUN;
+        auto found = shardBatches(begin, numQueries);
+
+        #pragma omp parallel for schedule(dynamic, 1) if(parallel)
+        for (size_t task = 0; task < numRuns * numShards; task += 1) {
+            const size_t shard = task % numShards;
+            const size_t first = (task / numShards) * SHARD_RUN, last = std::min(first + SHARD_RUN, numQueries);
+            auto &batch = found[shard];
+            search(shards_[shard], std::next(std::begin(batch), first), std::next(std::begin(batch), last));
+        }
+
+        #pragma omp parallel for if(parallel)
+        for (size_t i = 0; i < numQueries; i += 1) {
+            gather(*std::next(begin, i), found, i, maxResults);
+        }
+    }
+
+    /**
+     * @brief Sum the counts of query `idx` over the shards and append their positions, moved to the joined text,
+     * up to `maxResults` of them.
+     */
+    template <typename QueryType>
+    void gather(QueryType &q, std::vector<ShardBatch> const& found, size_t idx, int64_t maxResults) const {
+        q.count = 0;
+        q.result.clear();
+        q.reverseResults = 0;
+        for (size_t shard = 0; shard < shards_.size(); shard += 1) {
+            auto const& hits = found[shard][idx];
+            q.count += hits.count;
+            for (const auto position : hits.result) {
+                if (maxResults >= 0 && static_cast<int64_t>(q.result.size()) >= maxResults) {
+                    break;
+                }
+                q.result.push_back(static_cast<int64_t>(offsets_[shard]) + static_cast<int64_t>(position));
+            }
+        }
+    }
+};
+
+}   // namespace suffixarray
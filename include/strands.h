@@ -0,0 +1,107 @@
+/**
+ * @file strands.h
+ * @author Daniel Nichols
+ * @brief Searching queries on both strands of an index built over one.
+ * @date 2022-04-28
+ */
+#pragma once
+
+/* stl includes */
+#include <algorithm>    // max, min
+#include <cstdint>      // int64_t
+#include <iterator>     // begin, end
+#include <utility>      // move
+#include <vector>       // vector
+
+/* local includes */
+#include "kmer.h"       // reverseComplement
+#include "querybatch.h" // QueryBatch
+
+namespace suffixarray {
+
+/**
+ * @brief Append the hits of `reverse` to those of `forward`, at most `maxResults` in all, and count both strands.
+ */
+template <typename Query>
+void appendReverseStrand(Query &forward, Query const& reverse, int64_t maxResults) {
+    const size_t room = (maxResults < 0) ? reverse.result.size()
+        : static_cast<size_t>(std::max<int64_t>(0, maxResults - static_cast<int64_t>(forward.result.size())));
+    const size_t numReverse = std::min(room, reverse.result.size());
+    for (size_t i = 0; i < numReverse; i += 1) {
+        forward.result.push_back(reverse.result[i]);
+    }
+    forward.count += reverse.count;
+    forward.reverseResults = numReverse;
+}
+
+/**
+ * @brief Search every query and its reverse complement, and merge the two into the query. Reads come off either
+ * strand, and a read of the reverse strand occurs in the indexed forward strand as its reverse complement, at
+ * the position a forward aligner would report.
+ *
+ * Each query and its reverse complement sit next to each other in one batch of twice the size, so `search` sees
+ * a single batch and any work it shares across a batch (threads, sorting, the server's dispatch) covers both
+ * strands.
+ *
+ * @tparam Query query type with `reverseResults`
+ * @param queries queries; afterwards `count` covers both strands and `result` holds the forward hits followed by
+ * `reverseResults` reverse strand hits, at most `maxResults` in all
+ * @param maxResults most positions to keep per query; 0 only counts and ALL_RESULTS keeps every one
+ * @param search fills in the results of a std::vector<Query> batch
+ */
+template <typename Query, typename Search>
+void searchBothStrands(std::vector<Query> &queries, int64_t maxResults, Search &&search) {
+    const size_t numQueries = queries.size();
+    std::vector<Query> strands(2 * numQueries);
+    #pragma omp parallel for
+    for (size_t i = 0; i < numQueries; i += 1) {
+        strands[2 * i + 1].query = kmer::reverseComplement(queries[i].query);
+        strands[2 * i] = std::move(queries[i]);
+    }
+
+    search(strands);
+
+    #pragma omp parallel for
+    for (size_t i = 0; i < numQueries; i += 1) {
+        appendReverseStrand(strands[2 * i], strands[2 * i + 1], maxResults);
+        queries[i] = std::move(strands[2 * i]);
+    }
+}
+
+/**
+ * @brief searchBothStrands for a querybatch::QueryBatch. The reverse complements are written to one buffer, and
+ * the merged results are copied back into the batch's own pool.
+ */
+template <typename Position, typename Search>
+void searchBothStrands(querybatch::QueryBatch<Position> &queries, int64_t maxResults, Search &&search) {
+    const size_t numQueries = queries.size();
+    std::vector<size_t> starts(numQueries + 1, 0);
+    for (size_t i = 0; i < numQueries; i += 1) {
+        starts[i + 1] = starts[i] + queries[i].query.size();
+    }
+    std::vector<char> reversed(starts.back());
+    #pragma omp parallel for
+    for (size_t i = 0; i < numQueries; i += 1) {
+        kmer::reverseComplement(queries[i].query, reversed.data() + starts[i]);
+    }
+
+    querybatch::QueryBatch<Position> strands(std::move(reversed));
+    strands.reserve(2 * numQueries);
+    for (size_t i = 0; i < numQueries; i += 1) {
+        strands.add(queries[i].title, queries[i].query);
+        strands.add({}, strands.text().substr(starts[i], starts[i + 1] - starts[i]));
+    }
+
+    search(strands);
+
+    #pragma omp parallel for
+    for (size_t i = 0; i < numQueries; i += 1) {
+        auto &forward = strands[2 * i];
+        appendReverseStrand(forward, strands[2 * i + 1], maxResults);
+        queries[i].result.assign(std::begin(forward.result), std::end(forward.result));
+        queries[i].count = forward.count;
+        queries[i].reverseResults = forward.reverseResults;
+    }
+}
+
+}   // namespace suffixarray
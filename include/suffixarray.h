@@ -8,35 +8,105 @@
 #pragma once
 
 /* stl include */
-#include <algorithm>    // find, find_if_not
+#include <algorithm>    // find, find_if_not, sort
 #include <array>        // array
 #include <exception>    // ios_base::failure
 #include <execution>    // execution::par_unseq
-#include <filesystem>   // file_size
-#include <fstream>      // ifstream
+#include <iterator>     // distance
+#include <limits>       // numeric_limits
+#include <numeric>      // partial_sum
 #include <ostream>      // ostream
-#include <random>       // mt19937, random_device, uniform_int_distribution
+#include <span>         // span
+#include <stdexcept>    // length_error, runtime_error, invalid_argument
 #include <string>       // string
-#include <unordered_map>// unordered_map
+#include <string_view>  // string_view
+#include <tuple>        // tie
+#include <type_traits>  // conditional_t, is_same_v
+#include <vector>       // vector
 
 /* tpl includes */
 #include "libsais.h"    // libsais, libsais_omp
+#include "libsais64.h"  // libsais64, libsais64_omp
 
 /* local includes */
-#include "serial.h"     // serialize, deserialize
-#include "utilities.h"  // Timer
+#include "contigs.h"    // ContigTable
+#include "counters.h"   // add
+#include "fasta.h"      // read, toUpper, RECORD_SEPARATOR
+#include "indexfile.h"  // IndexReader, IndexWriter, Storage
+#include "kmer.h"       // BASE_CODES, INVALID_BASE, orderedKey
+#include "lcp.h"        // buildLCP, buildLCPLR, buildRecordLCP
+#include "merge.h"      // mergeSuffixes
+#include "packedint.h"  // Int40
+#include "packedtext.h" // PackedText, PackedQuery
+#include "prefixtable.h"// PrefixTable
+#include "sampletree.h" // SampleTree
+#include "utilities.h"  // mix64, Timer
 
 
 namespace suffixarray {
 
-class SuffixArray {
+/**
+ * @brief What to do with characters of the reference that are neither bases nor record separators, e.g. N.
+ * Random replaces each by a base derived from its position, so rebuilding gives the same index. Collapse turns
+ * each run of them into a single separator, see ContigTable::withCollapsedRuns.
+ */
+enum class AmbiguousBases { Random, Collapse };
+
+/* BuildOptions::prefixTableLength that sizes the prefix table to BuildOptions::prefixTableBudget */
+constexpr int32_t AUTO_PREFIX_TABLE = -1;
+
+/**
+ * @brief Optional structures to build alongside the suffix array.
+ */
+struct BuildOptions {
+    int32_t prefixTableLength = 0;  // build a prefix table for all k size prefixes; 0 for none, AUTO_PREFIX_TABLE to choose
+    bool lcp = false;               // build LCP-LR arrays for QueryMode::LCPAccelerated
+    int32_t sampleTreeLevels = 0;   // levels of the sampled search tree over the suffix array; 0 for none
+    AmbiguousBases ambiguousBases = AmbiguousBases::Random;
+    int32_t refinedPrefixLength = 0; // refine oversized prefix table buckets by this many bases; 0 for none
+    uint64_t prefixTableBudget = 0; // bytes for an AUTO_PREFIX_TABLE; 0 for a quarter of the suffix array
+    int32_t suffixSampling = 1;     // keep only the suffixes starting at multiples of this; 1 for all of them
+};
+
+/**
+ * @brief Suffix array over a nucleotide text.
+ *
+ * @tparam SuffixType element type of the stored suffix array: int32_t for texts below 2^31 bases,
+ * packedint::Int40 (5 bytes per suffix) or int64_t for longer ones. Wide suffix arrays are built with
+ * libsais64 and report positions as int64_t.
+ */
+template <typename SuffixType>
+class BasicSuffixArray {
     constexpr static uint32_t FILE_MAGIC = 0xabeefdad;
-    typedef std::unordered_map<std::string, std::pair<int32_t, int32_t>> PrefixTable;
+    constexpr static uint32_t FILE_VERSION = 9;
+
+    enum SectionId : uint32_t { MetadataSection = 0, TextSection, SuffixesSection, PrefixTableSection, PrefixKeysSection,
+        LCPLeftSection, LCPRightSection, ContigStartsSection, ContigNamesSection, SampleTreeSection, SeparatorsSection,
+        GapStartsSection, GapShiftsSection, RefinedOffsetsSection, RefinedKeysSection, RefinedStartsSection,
+        SeparatorMaskSection };
+    struct IndexMetadata { uint64_t textLength, prefixTableSize, refinedPrefixLength, suffixSampling; };
 
 public:
-    enum QueryMode { Naive, SimpleAccelerant };
-    struct Query { std::string title, query; std::vector<int32_t> result; };
-    
+    using position_type = std::conditional_t<std::is_same_v<SuffixType, int32_t>, int32_t, int64_t>;
+
+    enum QueryMode { Naive, SimpleAccelerant, LCPAccelerated };
+    /* `reverseResults` counts the trailing entries of `result` found on the reverse strand; see searchBothStrands */
+    struct Query { std::string title, query; std::vector<position_type> result; int64_t count = 0; size_t reverseResults = 0; };
+
+    /* longest text, including the '$' terminator, that SuffixType can index */
+    constexpr static int64_t MAX_LENGTH = std::is_same_v<SuffixType, int32_t> ? std::numeric_limits<int32_t>::max()
+        : std::is_same_v<SuffixType, packedint::Int40> ? packedint::Int40::MAX : std::numeric_limits<int64_t>::max();
+
+    /* pass as maxResults to report every occurrence */
+    constexpr static int64_t ALL_RESULTS = -1;
+
+    /* sorted queries searched together by one thread in sortedQueries, sharing the bounds of their searches */
+    constexpr static size_t SORTED_QUERY_RUN = 1024;
+
+    /* searches advanced in turn by serialQueries, and the queries each thread of queries() takes at a time */
+    constexpr static size_t INTERLEAVED_SEARCHES = 16;
+    constexpr static size_t INTERLEAVED_RUN = 1024;
+
 
     /**
      * @brief Creates and returns a SuffixArray from the specified path.
@@ -44,35 +114,34 @@ public:
      * @see fromString
      * 
      * @param path path to FASTA formatted file
-     * @param prefixTableLength build a prefix table for all k size prefixes
+     * @param options which auxiliary structures to build
      * @return SuffixArray A SuffixArray object constructed on this path
      */
-    static SuffixArray fromFASTAFile(std::string const& path, int32_t prefixTableLength=0) {
-        std::ifstream inputFile(path);
-        if (!inputFile) {
-            throw std::ios_base::failure("File \"" + path + "\" could not be opened.");
-        }
+    static BasicSuffixArray fromFASTAFile(std::string const& path, BuildOptions const& options = {}) {
+        return fromReference(fasta::read(path), options);
+    }
 
-        std::string sequence, line;
-        sequence.reserve(std::filesystem::file_size(path)); // reserve roughly the number of bytes in the file
-        while (std::getline(inputFile, line)) {
-            if (line.starts_with(">")) {
-                continue;
-            }
-            sequence += line;
-        }
-        return SuffixArray(sequence, prefixTableLength);
+    /**
+     * @brief Creates and returns a SuffixArray with a prefix table from the specified path.
+     * @see fromFASTAFile
+     */
+    static BasicSuffixArray fromFASTAFile(std::string const& path, int32_t prefixTableLength) {
+        return fromFASTAFile(path, BuildOptions{.prefixTableLength = prefixTableLength});
     }
 
     /**
-     * @brief Load a SuffixArray from a previously save SuffixArray
+     * @brief Load a SuffixArray from a previously save SuffixArray. The file is memory mapped and queried
+     * in place, so loading only costs the page faults of whatever is later touched.
+     * @see load
      * 
      * @param path file path to saved SuffixArray
+     * @param populate pre-fault the whole file rather than paging it in lazily
+     * @param verify check every section of the file against its checksum first
      * @return SuffixArray the suffix array from the specified file
      */
-    static SuffixArray fromSave(std::string const& path) {
-        SuffixArray sa("");
-        sa.load(path);
+    static BasicSuffixArray fromSave(std::string const& path, bool populate=false, bool verify=false) {
+        BasicSuffixArray sa;
+        sa.load(path, populate, verify);
         return sa;
     }
 
@@ -81,143 +150,563 @@ public:
      * @see fromFile
      * 
      * @param values sequence of characters to construct array on
-     * @param prefixTableLength build a prefix table for all k size prefixes
+     * @param options which auxiliary structures to build
      * @return SuffixArray A SuffixArray object constructed on this string
      */
-    static SuffixArray fromString(std::string const& values, int32_t prefixTableLength=0) {
-        return SuffixArray(values, prefixTableLength);
+    static BasicSuffixArray fromString(std::string const& values, BuildOptions const& options = {}) {
+        std::vector<char> text;
+        text.reserve(values.size() + 1);
+        text.resize(values.size());
+        std::transform(utilities::executionPolicy, std::begin(values), std::end(values), std::begin(text), fasta::toUpper);
+        return BasicSuffixArray(std::move(text), ContigTable(), options);
+    }
+
+    /**
+     * @brief Creates and returns a SuffixArray with a prefix table from the given string.
+     * @see fromString
+     */
+    static BasicSuffixArray fromString(std::string const& values, int32_t prefixTableLength) {
+        return fromString(values, BuildOptions{.prefixTableLength = prefixTableLength});
+    }
+
+    /**
+     * @brief Creates and returns a SuffixArray that takes over an already parsed FASTA file, e.g. from
+     * fasta::read, without copying its sequence.
+     * @see fromFASTAFile
+     * 
+     * @param reference parsed records; the sequence ideally has spare capacity for the terminator
+     * @param options which auxiliary structures to build
+     * @return SuffixArray A SuffixArray object constructed on these records
+     */
+    static BasicSuffixArray fromReference(fasta::Reference &&reference, BuildOptions const& options = {}) {
+        return BasicSuffixArray(std::move(reference.sequence), ContigTable::fromRecords(reference.records), options);
+    }
+
+    /**
+     * @brief Merge suffix arrays built separately, e.g. over the references of a growing panel, into one over their
+     * texts joined in order, each '$' but the last becoming a record separator. The suffixes are not sorted again:
+     * each shard is merged into those before it by backward search, see merge::mergeSuffixes, and only the
+     * structures `options` asks for are built over the result. A position in shard i moves by the sizes of the
+     * shards before it, just as ShardedIndex reports it.
+     * @note the shards' texts were normalized when they were built, so options.ambiguousBases does not apply
+     * @throws std::invalid_argument if there are no shards, one is sparse, or the suffix sampling rate is not positive
+     * @throws std::length_error if the joined text is too long for SuffixType
+     *
+     * @tparam Shard any BasicSuffixArray
+     * @param shards full suffix arrays to merge, in text order
+     * @param options which auxiliary structures to build; suffixSampling may make the result sparse
+     * @return SuffixArray A SuffixArray object over the joined texts
+     */
+    template <typename Shard>
+    static BasicSuffixArray merged(std::span<const Shard> shards, BuildOptions const& options = {}) {
+        if (shards.empty()) {
+            throw std::invalid_argument("No suffix arrays to merge.");
+        }
+        uint64_t totalLength = 0;
+        for (auto const& shard : shards) {
+            if (shard.getSuffixSampling() != 1) {
+                throw std::invalid_argument("Sparse suffix arrays cannot be merged; every suffix is needed.");
+            }
+            totalLength += shard.size();
+        }
+        if (totalLength > static_cast<uint64_t>(MAX_LENGTH)) {
+            throw std::length_error("Text of " + std::to_string(totalLength - 1) + " bases is too long for a "
+                + std::to_string(8 * sizeof(SuffixType)) + "-bit suffix array.");
+        }
+
+        utilities::Timer timer;
+        timer.start();
+        std::vector<char> text;
+        text.reserve(totalLength);
+        std::vector<position_type> suffixes;
+        std::vector<ContigTable> contigs;
+        std::vector<uint64_t> offsets;
+        for (auto const& shard : shards) {
+            const std::string shardText = shard.data();
+            if (text.empty()) {
+                suffixes.resize(shard.suffixes().size());
+                std::transform(utilities::executionPolicy, std::begin(shard.suffixes()), std::end(shard.suffixes()),
+                    std::begin(suffixes), [](auto idx) { return static_cast<position_type>(static_cast<int64_t>(idx)); });
+            } else {
+                suffixes = merge::mergeSuffixes<position_type>(std::string_view(text.data(), text.size()),
+                    std::span<const position_type>(suffixes), shardText, shard.suffixes());
+                text.back() = fasta::RECORD_SEPARATOR;
+            }
+            offsets.push_back(text.size());
+            contigs.push_back(shard.contigs());
+            text.insert(std::end(text), std::begin(shardText), std::end(shardText));
+        }
+        timer.stop();
+        return BasicSuffixArray(std::move(text), ContigTable::joined(contigs, offsets), std::move(suffixes), options,
+            timer.millisecondsElapsed());
+    }
+
+    /**
+     * @brief Bytes per suffix of the suffix array saved in `path`, i.e. which SuffixType can load it.
+     * @throws std::ios_base::failure if the file is not a saved suffix array
+     */
+    static uint32_t savedSuffixWidth(std::string const& path) {
+        indexfile::IndexReader reader(path, FILE_MAGIC, FILE_VERSION);
+        return reader.elementSize(SuffixesSection);
     }
 
     /**
      * @brief Query the SuffixArray for the specific Query. Query object specifies the query string
      * and will hold the result of the query.
      * If a prefix table exists, then it will be used to accelerate the query.
+     * LCPAccelerated needs the LCP-LR arrays and queries shorter than lcp::MAX_STORED_LCP, otherwise
+     * it falls back to SimpleAccelerant.
      * 
-     * @param q Query object. Also receives the query results.
-     * @param mode Whether to use Naive or SimpleAccelerant method.
-     */
-    void query(Query &q, QueryMode mode = QueryMode::Naive) const {
-        auto searchStart = std::begin(suffixes_);
-        auto searchEnd = std::end(suffixes_);
-
-        /* narrow range with prefix table if possible */
-        if (!prefixTable_.empty() && q.query.size() >= prefixTableSize_) {
-            const auto subQuery = q.query.substr(prefixTableSize_);
-            if (prefixTable_.contains(subQuery)) {
-                searchStart = std::next(std::begin(suffixes_), prefixTable_.at(subQuery).first);
-                searchEnd = std::next(std::begin(suffixes_), prefixTable_.at(subQuery).second);
-            }
+     * A sparse suffix array searches once per sampled alignment of the query, see forEachOccurrence; queries
+     * shorter than its sampling rate may miss occurrences.
+     * 
+     * @tparam QueryType Query, or anything with its fields such as querybatch::BatchQuery
+     * @param q Query object. Also receives the query results. `count` is always the total number of
+     * occurrences, while `result` holds at most `maxResults` of them.
+     * @param mode Whether to use Naive, SimpleAccelerant, or LCPAccelerated method.
+     * @param maxResults Most positions to store in `q.result`. 0 only counts; ALL_RESULTS stores every one.
+     */
+    template <typename QueryType>
+    void query(QueryType &q, QueryMode mode = QueryMode::Naive, int64_t maxResults = ALL_RESULTS) const {
+        if (sampling_ == 1) {
+            storeResults(q, equalRange(q.query, mode), maxResults);
+            return;
         }
+        q.result.clear();
+        q.count = forEachOccurrence(q.query, mode, [&q, maxResults](size_t position) {
+            if (maxResults < 0 || static_cast<int64_t>(q.result.size()) < maxResults) {
+                q.result.push_back(static_cast<position_type>(position));
+            }
+        });
+    }
 
-        /*  unfortunately std::equal_ranges won't work here because the search object has to 
-            have the same type as the container; i.e. you can't search on a well-ordered predicate, but have to 
-            search for a value; boost::transform_iterator's would make this a lot cleaner */
+    /**
+     * @brief Call `visit` with the text position of every occurrence of `query`, and return how many there are.
+     * Positions come in suffix array order for a full suffix array.
+     *
+     * A sparse suffix array finds an occurrence at t through the sampled suffix at the next multiple of the
+     * sampling rate, t + j with j below the rate: that suffix starts with query[j, m), and the j bases in front
+     * of it are compared with the packed text. Every occurrence has exactly one such j, so searching for each j
+     * finds it once. Queries shorter than the rate cannot reach the sample of every occurrence and may miss some.
+     *
+     * @param query query string
+     * @param mode Whether to use Naive, SimpleAccelerant, or LCPAccelerated method.
+     * @param visit called with each position as a size_t
+     * @return int64_t number of occurrences
+     */
+    template <typename Visit>
+    int64_t forEachOccurrence(std::string_view query, QueryMode mode, Visit &&visit) const {
+        if (sampling_ == 1) {
+            const auto [lower, upper] = equalRange(query, mode);
+            for (int64_t idx = lower; idx < upper; idx += 1) {
+                visit(static_cast<size_t>(static_cast<position_type>(suffixes_[idx])));
+            }
+            return upper - lower;
+        }
 
-        /* lower_bound */
-        auto [lower, upper] = std::tuple(searchStart, searchEnd);
-        auto range = std::distance(lower, upper);
-        uint32_t lowerLCP = 0, upperLCP = 0;
-        if (mode == SimpleAccelerant) {
-            lowerLCP = utilities::LCPLength(std::cbegin(q.query), std::cend(q.query), std::next(std::begin(data_), *lower));
-            upperLCP = utilities::LCPLength(std::cbegin(q.query), std::cend(q.query), std::next(std::begin(data_), *std::next(lower, range/2)));
+        const PackedQuery packed = PackedText::packQuery(query);
+        if (!packed.valid) {
+            return 0;
         }
-        size_t searchOffset = 0;
-        while (range > 0) {
-            auto iter = lower;
-            auto step = range / 2;
-            std::advance(iter, step);
+        int64_t total = 0;
+        const size_t numAlignments = std::min(sampling_, query.size());
+        for (size_t offset = 0; offset < numAlignments; offset += 1) {
+            const auto [lower, upper] = equalRange(query.substr(offset), mode);
+            for (int64_t idx = lower; idx < upper; idx += 1) {
+                const auto sample = static_cast<size_t>(static_cast<position_type>(suffixes_[idx]));
+                if (sample < offset) {
+                    continue;
+                }
+                const size_t start = sample - offset;
+                if (offset != 0 && (!text_.withinRecord(start, offset)
+                    || text_.mismatches(packed, nullptr, 0, offset, start, 0) != 0)) {
+                    continue;
+                }
+                visit(start);
+                total += 1;
+            }
+        }
+        return total;
+    }
 
-            searchOffset = (mode == SimpleAccelerant) ? std::min(lowerLCP, upperLCP) : 0;
-            const auto searchLength = q.query.size() - searchOffset;
+    /**
+     * @brief Find every position where `q.query` occurs with at most `maxMismatches` substituted bases. Characters
+     * of the query that are not bases mismatch everything.
+     *
+     * Pigeonhole seeding: the query is cut into maxMismatches + 1 seeds, at least one of which must occur exactly
+     * in any such match, so each seed is searched exactly with `mode` and every hit is verified against the packed
+     * text 32 bases at a time. A candidate is only kept by the first seed that matches it exactly, so no position
+     * is reported twice and nothing needs sorting. Matches never span a record boundary.
+     * @note seeds shorter than a few bases hit much of the text, so keep maxMismatches well below the query length;
+     * on a sparse suffix array seeds must also be at least the sampling rate long to find every match
+     * @see query
+     *
+     * @param q Query object. `count` receives the number of matches and `result` at most `maxResults` of them,
+     * in no particular order.
+     * @param maxMismatches most substitutions allowed; 0 is an exact search
+     * @param mode Search method for the seeds.
+     * @param maxResults Most positions to store in `q.result`. 0 only counts; ALL_RESULTS stores every one.
+     */
+    template <typename QueryType>
+    void approximateQuery(QueryType &q, uint32_t maxMismatches, QueryMode mode = QueryMode::Naive,
+        int64_t maxResults = ALL_RESULTS) const {
+
+        const size_t length = q.query.size(), numSeeds = maxMismatches + 1;
+        const PackedQuery packed = PackedText::packQuery(q.query);
+        const std::vector<uint64_t> ambiguous = packed.valid ? std::vector<uint64_t>() : PackedText::ambiguityMask(q.query);
+        auto seedStart = [length, numSeeds](size_t seed) { return seed * length / numSeeds; };
+
+        q.count = 0;
+        q.result.clear();
+        for (size_t seed = 0; seed < numSeeds; seed += 1) {
+            const size_t offset = seedStart(seed);
+            const auto seedQuery = std::string_view(q.query).substr(offset, seedStart(seed + 1) - offset);
+            forEachOccurrence(seedQuery, mode, [&](size_t hit) {
+                if (hit < offset || !text_.withinRecord(hit - offset, length)) {
+                    return;
+                }
+                if (countMismatches(packed, ambiguous, hit - offset, seed, numSeeds, seedStart) <= maxMismatches) {
+                    q.count += 1;
+                    if (maxResults < 0 || static_cast<int64_t>(q.result.size()) < maxResults) {
+                        q.result.push_back(static_cast<position_type>(hit - offset));
+                    }
+                }
+            });
+        }
+    }
 
-            if (data_.compare((*iter)+searchOffset, searchLength, q.query, searchOffset, searchLength) < 0) {  /* true if data_[] < queryStr */
-                lower = ++iter;
-                range -= step + 1;
+    /**
+     * @brief Number of occurrences of `query`. Only searches for the range; no positions are copied.
+     * @see equalRange
+     * 
+     * @param query query string
+     * @param mode Whether to use Naive, SimpleAccelerant, or LCPAccelerated method.
+     * @return int64_t number of occurrences
+     */
+    int64_t count(std::string_view query, QueryMode mode = QueryMode::Naive) const {
+        if (sampling_ != 1) {
+            return forEachOccurrence(query, mode, [](size_t) {});
+        }
+        const auto [lowerIndex, upperIndex] = equalRange(query, mode);
+        return upperIndex - lowerIndex;
+    }
 
-                if (mode == SimpleAccelerant) {
-                    lowerLCP = utilities::LCPLength(std::cbegin(q.query), std::cend(q.query), std::next(std::begin(data_), *lower), searchOffset);
-                    upperLCP = utilities::LCPLength(std::cbegin(q.query), std::cend(q.query), std::next(std::begin(data_), *std::next(lower, range/2)));
+    /**
+     * @brief Write the first occurrences of `query` into a caller provided buffer. Positions are in
+     * suffix array order, not text order; for a sparse suffix array, in the order forEachOccurrence finds them.
+     * @see equalRange
+     * 
+     * @param query query string
+     * @param positions buffer receiving up to positions.size() occurrences
+     * @param mode Whether to use Naive, SimpleAccelerant, or LCPAccelerated method.
+     * @return int64_t total number of occurrences; min(total, positions.size()) of them were written
+     */
+    int64_t locate(std::string_view query, std::span<position_type> positions, QueryMode mode = QueryMode::Naive) const {
+        if (sampling_ != 1) {
+            size_t numWritten = 0;
+            return forEachOccurrence(query, mode, [&positions, &numWritten](size_t position) {
+                if (numWritten < positions.size()) {
+                    positions[numWritten++] = static_cast<position_type>(position);
                 }
-            } else {
-                range = step;
+            });
+        }
+        const auto [lowerIndex, upperIndex] = equalRange(query, mode);
+        const auto total = upperIndex - lowerIndex;
+        const auto numResults = std::min<int64_t>(total, positions.size());
 
-                if (mode == SimpleAccelerant) {
-                    upperLCP = utilities::LCPLength(std::cbegin(q.query), std::cend(q.query), std::next(std::begin(data_), *std::next(lower, range/2)), searchOffset);
-                }
-            }
+        const auto first = std::next(std::begin(suffixes()), lowerIndex);
+        std::copy(first, std::next(first, numResults), std::begin(positions));
+        return total;
+    }
+
+    /**
+     * @brief Range of the suffix array whose suffixes have `query` as a prefix. A sparse suffix array only
+     * holds the sampled suffixes, so this is not every occurrence; see forEachOccurrence.
+     * @see query
+     * 
+     * @param query query string
+     * @param mode Whether to use Naive, SimpleAccelerant, or LCPAccelerated method.
+     * @return std::pair<int64_t, int64_t> [lower, upper) indices into suffixes()
+     */
+    std::pair<int64_t, int64_t> equalRange(std::string_view query, QueryMode mode = QueryMode::Naive) const {
+        return equalRangeWithin(query, mode, 0, static_cast<int64_t>(suffixes_.size()));
+    }
+
+    /**
+     * @brief Perform a set of queries. If enabled, will do them in parallel. Built with SEARCH_COUNTERS, every
+     * search also counts its steps, comparisons, and prefix table lookups on its thread; see counters::snapshot.
+     * Each thread takes INTERLEAVED_RUN queries at a time and searches them with serialQueries.
+     * @see query
+     * 
+     * @tparam Iterator random access iterator which returns BasicSuffixArray::Query objects, or ones with the same fields.
+     * @param begin Start of query range.
+     * @param end End of query range.
+     * @param mode Querying method.
+     * @param maxResults Most positions to store per query. 0 only counts; ALL_RESULTS stores every one.
+     */
+    template <typename Iterator>
+    void queries(Iterator begin, Iterator end, QueryMode mode = QueryMode::Naive, int64_t maxResults = ALL_RESULTS) const {
+        const auto numQueries = static_cast<size_t>(std::distance(begin, end));
+        const size_t numRuns = (numQueries + INTERLEAVED_RUN - 1) / INTERLEAVED_RUN;
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t run = 0; run < numRuns; run += 1) {
+            const size_t runBegin = run * INTERLEAVED_RUN, runEnd = std::min(runBegin + INTERLEAVED_RUN, numQueries);
+            serialQueries(std::next(begin, runBegin), std::next(begin, runEnd), mode, maxResults);
+        }
+    }
+
+    /**
+     * @brief queries() on the calling thread alone, for callers that bring threads of their own, e.g. an
+     * executor::Executor.
+     *
+     * INTERLEAVED_SEARCHES searches are advanced in turn, so the memory latency of each is hidden behind the
+     * others. A binary search step is two dependent loads, the suffix at the midpoint and then the text it points
+     * to, and in a large index both miss the cache; instead of waiting, a search prefetches the next one and
+     * yields to the next search, and by the time its turn comes back the line has usually arrived. This is
+     * asynchronous memory access chaining (AMAC), with a small state machine per search; see InterleavedSearch.
+     * The prefix table bucket of each query is prefetched the same way before its search starts.
+     * About twice the throughput of searching one query at a time once the index is much larger than the cache,
+     * with the same results. Sparse suffix arrays search each query's alignments separately, so they search one
+     * query at a time.
+     * @see queries
+     *
+     * @tparam Iterator random access iterator which returns BasicSuffixArray::Query objects, or ones with the same fields.
+     */
+    template <typename Iterator>
+    void serialQueries(Iterator begin, Iterator end, QueryMode mode = QueryMode::Naive,
+        int64_t maxResults = ALL_RESULTS) const {
+
+        if (sampling_ != 1) {
+            std::for_each(begin, end, [this, mode, maxResults](auto &q) { this->query(q, mode, maxResults); });
+            return;
+        }
+        if (mode == LCPAccelerated && !hasLCP()) {
+            mode = SimpleAccelerant;
+        }
+        const auto numQueries = static_cast<size_t>(std::distance(begin, end));
+        switch (mode) {
+            case Naive: searchInterleaved<Naive>(begin, 0, numQueries, maxResults); break;
+            case SimpleAccelerant: searchInterleaved<SimpleAccelerant>(begin, 0, numQueries, maxResults); break;
+            case LCPAccelerated: searchInterleaved<LCPAccelerated>(begin, 0, numQueries, maxResults); break;
+        }
+    }
+
+    /**
+     * @brief Same results as queries(), but searched in lexicographic order of the query strings. Neighbouring
+     * queries then walk nearly the same path through the suffix array and text, so their pages and cache lines
+     * are still resident. The sorted queries are cut into runs of SORTED_QUERY_RUN, each searched by one thread;
+     * a run searches its middle query first and then each half within the bounds that query left, so most
+     * searches start a few steps from their answer. Repeated queries are only searched once.
+     * Worth it for large batches of short reads when the prefix table is short or absent; otherwise the sort
+     * costs more than it saves. Sparse suffix arrays search each query's alignments separately, so they just
+     * search the queries in parallel like queries().
+     * @see queries
+     *
+     * @tparam Iterator random access iterator which returns BasicSuffixArray::Query objects, or ones with the same fields.
+     * @param begin Start of query range.
+     * @param end End of query range.
+     * @param mode Querying method. LCPAccelerated searches keep their full bounds and only gain locality.
+     * @param maxResults Most positions to store per query. 0 only counts; ALL_RESULTS stores every one.
+     */
+    template <typename Iterator>
+    void sortedQueries(Iterator begin, Iterator end, QueryMode mode = QueryMode::Naive, int64_t maxResults = ALL_RESULTS) const {
+        if (sampling_ != 1) {
+            std::for_each(utilities::executionPolicy, begin, end, [this, mode, maxResults](auto &q) {
+                this->query(q, mode, maxResults); });
+            return;
         }
-        const auto lowerIndex = lower;
 
-        /* upper_bound */
-        std::tie(lower, upper) = std::tuple(searchStart, searchEnd);
-        range = std::distance(lower, upper);
-        if (mode == SimpleAccelerant) {
-            lowerLCP = utilities::LCPLength(std::cbegin(q.query), std::cend(q.query), std::next(std::begin(data_), *lower));
-            upperLCP = utilities::LCPLength(std::cbegin(q.query), std::cend(q.query), std::next(std::begin(data_), *std::next(lower, range/2)));
+        /* bucket on the top bits of each query's ordered key, then sort the buckets; only ties compare strings */
+        const auto numQueries = static_cast<size_t>(std::distance(begin, end));
+        std::vector<uint64_t> keys(numQueries);
+        #pragma omp parallel for
+        for (size_t i = 0; i < numQueries; i += 1) {
+            keys[i] = kmer::orderedKey(begin[i].query);
         }
-        while (range > 0) {
-            auto iter = lower;
-            auto step = range / 2;
-            std::advance(iter, step);
 
-            searchOffset = (mode == SimpleAccelerant) ? std::min(lowerLCP, upperLCP) : 0;
-            const auto searchLength = q.query.size() - searchOffset; 
+        std::vector<size_t> bucketStarts((size_t(1) << SORT_BUCKET_BITS) + 1, 0);
+        for (const uint64_t key : keys) {
+            bucketStarts[(key >> (64 - SORT_BUCKET_BITS)) + 1] += 1;
+        }
+        std::partial_sum(std::begin(bucketStarts), std::end(bucketStarts), std::begin(bucketStarts));
+        std::vector<std::pair<uint64_t, size_t>> order(numQueries);
+        {
+            std::vector<size_t> next(std::begin(bucketStarts), std::prev(std::end(bucketStarts)));
+            for (size_t i = 0; i < numQueries; i += 1) {
+                order[next[keys[i] >> (64 - SORT_BUCKET_BITS)]++] = {keys[i], i};
+            }
+        }
 
-            if (q.query.compare(searchOffset, searchLength, data_, (*iter)+searchOffset, searchLength) >= 0) {
-                lower = ++iter;
-                range -= step + 1;
+        const size_t numBuckets = bucketStarts.size() - 1;
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (size_t bucket = 0; bucket < numBuckets; bucket += 1) {
+            std::sort(std::next(std::begin(order), bucketStarts[bucket]), std::next(std::begin(order), bucketStarts[bucket + 1]),
+                [begin](auto const& a, auto const& b) {
+                    return (a.first != b.first) ? a.first < b.first : begin[a.second].query < begin[b.second].query; });
+        }
 
-                if (mode == SimpleAccelerant) {
-                    lowerLCP = utilities::LCPLength(std::cbegin(q.query), std::cend(q.query), std::next(std::begin(data_), *lower), searchOffset);
-                    upperLCP = utilities::LCPLength(std::cbegin(q.query), std::cend(q.query), std::next(std::begin(data_), *std::next(lower, range/2)));
+        const size_t numRuns = (numQueries + SORTED_QUERY_RUN - 1) / SORTED_QUERY_RUN;
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t run = 0; run < numRuns; run += 1) {
+            const size_t runBegin = run * SORTED_QUERY_RUN, runEnd = std::min(runBegin + SORTED_QUERY_RUN, numQueries);
+            auto queryAt = [begin, &order](size_t i) -> std::string_view { return begin[order[i].second].query; };
+
+            std::vector<size_t> distinct;
+            size_t minLength = std::numeric_limits<size_t>::max();
+            for (size_t i = runBegin; i < runEnd; i += 1) {
+                if (i == runBegin || queryAt(i) != queryAt(i - 1)) {
+                    distinct.push_back(i);
+                    minLength = std::min(minLength, queryAt(i).size());
                 }
-            } else {
-                range = step;
+            }
 
-                if (mode == SimpleAccelerant) {
-                    upperLCP = utilities::LCPLength(std::cbegin(q.query), std::cend(q.query), std::next(std::begin(data_), *std::next(lower, range/2)), searchOffset);
+            std::vector<std::pair<int64_t, int64_t>> ranges(distinct.size());
+            searchSorted([&queryAt, &distinct](size_t d) { return queryAt(distinct[d]); }, mode, minLength,
+                0, distinct.size(), 0, static_cast<int64_t>(suffixes_.size()), ranges);
+
+            for (size_t d = 0; d < distinct.size(); d += 1) {
+                const size_t groupEnd = (d + 1 < distinct.size()) ? distinct[d + 1] : runEnd;
+                for (size_t i = distinct[d]; i < groupEnd; i += 1) {
+                    storeResults(begin[order[i].second], ranges[d], maxResults);
                 }
             }
         }
-        const auto upperIndex = lower;
-
-        q.result = std::vector<int32_t>(lowerIndex, upperIndex);
     }
 
     /**
-     * @brief Perform a set of queries. If enabled, will do them in parallel.
-     * @see query
-     * 
-     * @tparam Iterator iterator which returns SuffixArray::Query objects.
+     * @brief approximateQuery for a set of queries, in parallel if enabled.
+     * @see approximateQuery
+     *
+     * @tparam Iterator iterator which returns BasicSuffixArray::Query objects, or ones with the same fields.
      * @param begin Start of query range.
      * @param end End of query range.
-     * @param mode Querying method.
+     * @param maxMismatches most substitutions allowed per query
+     * @param mode Search method for the seeds.
+     * @param maxResults Most positions to store per query. 0 only counts; ALL_RESULTS stores every one.
      */
     template <typename Iterator>
-    void queries(Iterator begin, Iterator end, QueryMode mode = QueryMode::Naive) {
-        std::for_each(utilities::executionPolicy, begin, end, [this, mode](auto &q) { this->query(q, mode); });
+    void approximateQueries(Iterator begin, Iterator end, uint32_t maxMismatches, QueryMode mode = QueryMode::Naive,
+        int64_t maxResults = ALL_RESULTS) const {
+        std::for_each(utilities::executionPolicy, begin, end, [this, maxMismatches, mode, maxResults](auto &q) {
+            this->approximateQuery(q, maxMismatches, mode, maxResults); });
     }
 
     /**
-     * @brief The underlying string data.
+     * @brief The underlying string data, unpacked from the 2-bit text into a copy.
+     * @see text
      * 
-     * @return std::string const& data that the suffix array represents.
+     * @return std::string data that the suffix array represents.
+     */
+    std::string data() const {
+        return text_.unpack();
+    }
+
+    /**
+     * @brief The packed text that the suffix array is searched against.
+     */
+    PackedText const& text() const noexcept {
+        return text_;
+    }
+
+    /**
+     * @brief Length of the text, including the '$' terminator.
      */
-    std::string const& data() const noexcept {
-        return data_;
+    size_t size() const noexcept {
+        return text_.size();
     }
 
     /**
-     * @brief Returns the underlying suffix array.
+     * @brief Returns the underlying suffix array. For a sparse suffix array, only the sampled suffixes.
      * 
-     * @return std::vector<int32_t> const& Array of indices into string for each suffix.
+     * @return std::span<const SuffixType> Array of indices into string for each suffix.
+     */
+    std::span<const SuffixType> suffixes() const noexcept {
+        return suffixes_.span();
+    }
+
+    /**
+     * @brief Every how many text positions a suffix is kept; 1 for a full suffix array. Queries need at least
+     * this many bases to find every occurrence.
      */
-    std::vector<int32_t> const& suffixes() const noexcept {
-        return suffixes_;
+    size_t getSuffixSampling() const noexcept {
+        return sampling_;
+    }
+
+    /**
+     * @brief Boundaries of the records of the indexed text, for mapping positions to (contig, offset).
+     */
+    ContigTable const& contigs() const noexcept {
+        return contigs_;
     }
 
     size_t getPrefixTableSize() const noexcept {
-        return prefixTableSize_;
+        return prefixTable_.length();
+    }
+
+    /**
+     * @brief Refined prefix length of a two level prefix table. 0 if the table has a single level.
+     */
+    size_t getRefinedPrefixLength() const noexcept {
+        return prefixTable_.refinedLength();
+    }
+
+    /**
+     * @brief Bytes taken by the prefix table.
+     */
+    size_t getPrefixTableBytes() const noexcept {
+        return prefixTable_.sizeBytes();
+    }
+
+    /**
+     * @brief Levels of the sample tree searched before the suffix array. 0 if there is none.
+     */
+    size_t getSampleTreeLevels() const noexcept {
+        return sampleTree_.levels();
+    }
+
+    /**
+     * @brief Whether the LCP-LR arrays needed by QueryMode::LCPAccelerated are available.
+     */
+    bool hasLCP() const noexcept {
+        return !lcpLeft_.empty();
+    }
+
+    /**
+     * @brief Whether this SuffixArray is backed by a memory mapped index file rather than owned memory.
+     */
+    bool isMapped() const noexcept {
+        return suffixes_.isMapped();
+    }
+
+    /**
+     * @brief Copy of this suffix array whose text, suffixes, prefix table, LCP-LR arrays, and sample tree are each
+     * replaced by `copy` of them, e.g. a copy on a chosen NUMA node; see numa::boundTo. The contig table, which
+     * searches do not read, is shared.
+     *
+     * @param copy called with each indexfile::Storage and returns the Storage to use in its place
+     */
+    template <typename Copy>
+    BasicSuffixArray copied(Copy &&copy) const {
+        BasicSuffixArray result;
+        result.text_ = PackedText(text_.size(), copy(text_.words()), copy(text_.separators()), copy(text_.separatorMask()));
+        result.sampling_ = sampling_;
+        result.suffixArrayBuildTime_ = suffixArrayBuildTime_;
+        result.prefixTableBuildTime_ = prefixTableBuildTime_;
+        result.suffixes_ = copy(suffixes_);
+        if (!prefixTable_.empty()) {
+            auto const& refinement = prefixTable_.refinement();
+            result.prefixTable_ = BasicPrefixTable<SuffixType>(prefixTable_.length(), copy(prefixTable_.starts()),
+                copy(prefixTable_.keys()), {refinement.length, copy(refinement.offsets), copy(refinement.keys),
+                copy(refinement.starts)});
+        }
+        result.lcpLeft_ = copy(lcpLeft_);
+        result.lcpRight_ = copy(lcpRight_);
+        if (!sampleTree_.empty()) {
+            result.sampleTree_ = SampleTree(suffixes_.size(), copy(sampleTree_.keys()));
+        }
+        result.contigs_ = contigs_;
+        result.histogram_ = histogram_;
+        return result;
     }
 
     /**
@@ -240,96 +729,125 @@ public:
     }
 
     /**
-     * @brief Saves the SuffixArray to the file `fname`.
+     * @brief Saves the SuffixArray to the file `fname`. The packed text, suffixes, and prefix table are each
+     * written as a page aligned, checksummed section so that `load` can map them without copying.
      * @throws std::ios_base::failure on i/o errors
      * @see load
      * 
      * @param fname File to save data to.
+     * @param compress bit pack the suffixes and prefix table starts to the ceil(log2 n) bits they need. The file
+     * shrinks, by 20% to 45% depending on the text length and SuffixType, but `load` has to unpack them into
+     * memory instead of mapping them.
      */
-    void save(std::string const& fname) const {
-        std::ofstream outputFile(fname);
-        if (!outputFile) {
-            throw std::ios_base::failure("Could not open \"" + fname + "\" for saving.");
-        }
-
-        serial::serialize(SuffixArray::FILE_MAGIC, outputFile);
-        serial::serialize(*this, outputFile);
+    void save(std::string const& fname, bool compress=false) const {
+        const IndexMetadata metadata{text_.size(), prefixTable_.length(), prefixTable_.refinedLength(), sampling_};
 
-        outputFile.close();
+        indexfile::IndexWriter writer(BasicSuffixArray::FILE_MAGIC, BasicSuffixArray::FILE_VERSION);
+        auto addPositions = [&writer, compress](SectionId id, std::span<const SuffixType> positions) {
+            if (compress) {
+                writer.addPackedSection(id, positions);
+            } else {
+                writer.addSection(id, positions);
+            }
+        };
+        writer.addSection(MetadataSection, std::span<const IndexMetadata>(&metadata, 1));
+        writer.addSection(TextSection, text_.words().span());
+        writer.addSection(SeparatorsSection, text_.separators().span());
+        writer.addSection(SeparatorMaskSection, text_.separatorMask().span());
+        addPositions(SuffixesSection, suffixes_.span());
+        if (!prefixTable_.empty()) {
+            addPositions(PrefixTableSection, prefixTable_.starts().span());
+            if (!prefixTable_.isDirect()) {
+                writer.addSection(PrefixKeysSection, prefixTable_.keys().span());
+            }
+            if (prefixTable_.refinedLength() != 0) {
+                addPositions(RefinedOffsetsSection, prefixTable_.refinement().offsets.span());
+                writer.addSection(RefinedKeysSection, prefixTable_.refinement().keys.span());
+                addPositions(RefinedStartsSection, prefixTable_.refinement().starts.span());
+            }
+        }
+        if (hasLCP()) {
+            writer.addSection(LCPLeftSection, lcpLeft_.span());
+            writer.addSection(LCPRightSection, lcpRight_.span());
+        }
+        if (!sampleTree_.empty()) {
+            writer.addSection(SampleTreeSection, sampleTree_.keys().span());
+        }
+        writer.addSection(ContigStartsSection, contigs_.starts().span());
+        writer.addSection(ContigNamesSection, contigs_.names().span());
+        writer.addSection(GapStartsSection, contigs_.gapStarts().span());
+        writer.addSection(GapShiftsSection, contigs_.gapShifts().span());
+        writer.write(fname);
     }
 
     /**
      * @brief Loads a SuffixArray from a file. Expects the format outputted by SuffixArray::save.
-     * @throws std::ios_base::failure on i/o errors
+     * The file is mapped read-only and shared, so processes querying the same index share the page cache;
+     * only sections saved compressed are unpacked into memory of their own.
+     * @throws std::ios_base::failure on i/o errors, or if `verify` finds a corrupt section
      * @see save
      * 
      * @param fname File to load data from.
+     * @param populate pre-fault the whole file rather than paging it in lazily
+     * @param verify check every section against its checksum first, which reads the whole file
      */
-    void load(std::string const& fname) {
-        std::ifstream inputFile(fname);
-        if (!inputFile) {
-            throw std::ios_base::failure("Could not open \"" + fname + "\" for loading.");
+    void load(std::string const& fname, bool populate=false, bool verify=false) {
+        indexfile::IndexReader reader(fname, BasicSuffixArray::FILE_MAGIC, BasicSuffixArray::FILE_VERSION, populate);
+        if (verify) {
+            reader.verify();
         }
 
-        uint32_t tmpMagic;
-        serial::deserialize(tmpMagic, inputFile);
-        if (tmpMagic != SuffixArray::FILE_MAGIC) {
+        const auto metadata = reader.section<IndexMetadata>(MetadataSection);
+        if (metadata.size() != 1 || metadata[0].suffixSampling == 0) {
             throw std::ios_base::failure("Invalid suffix array file.");
         }
+        sampling_ = metadata[0].suffixSampling;
+
+        /* binary search touches pages in no particular order, so readahead only wastes i/o */
+        text_ = PackedText(metadata[0].textLength, reader.section<uint64_t>(TextSection, MADV_RANDOM),
+            reader.section<uint64_t>(SeparatorsSection, MADV_WILLNEED),
+            reader.section<uint64_t>(SeparatorMaskSection, MADV_RANDOM));
+        suffixes_ = reader.section<SuffixType>(SuffixesSection, MADV_RANDOM);
+        if (!text_.isConsistent() || suffixes_.size() != (text_.size() + sampling_ - 1) / sampling_) {
+            throw std::ios_base::failure("Corrupt suffix array file.");
+        }
 
-        serial::deserialize(*this, inputFile);
+        prefixTable_ = BasicPrefixTable<SuffixType>();
+        if (metadata[0].prefixTableSize != 0) {
+            typename BasicPrefixTable<SuffixType>::Refinement refinement;
+            if (metadata[0].refinedPrefixLength != 0) {
+                refinement = {metadata[0].refinedPrefixLength, reader.section<SuffixType>(RefinedOffsetsSection, MADV_WILLNEED),
+                    reader.section<uint64_t>(RefinedKeysSection, MADV_WILLNEED), reader.section<SuffixType>(RefinedStartsSection, MADV_WILLNEED)};
+            }
+            prefixTable_ = BasicPrefixTable<SuffixType>(metadata[0].prefixTableSize, reader.section<SuffixType>(PrefixTableSection, MADV_WILLNEED),
+                reader.has(PrefixKeysSection) ? reader.section<uint64_t>(PrefixKeysSection, MADV_WILLNEED) : indexfile::Storage<uint64_t>(),
+                std::move(refinement));
+        }
+        if (!prefixTable_.empty() && !prefixTable_.isConsistent(suffixes_.size())) {
+            throw std::ios_base::failure("Corrupt prefix table in suffix array file.");
+        }
 
-        inputFile.close();
-    }
+        lcpLeft_ = reader.has(LCPLeftSection) ? reader.section<uint8_t>(LCPLeftSection, MADV_RANDOM) : indexfile::Storage<uint8_t>();
+        lcpRight_ = reader.has(LCPRightSection) ? reader.section<uint8_t>(LCPRightSection, MADV_RANDOM) : indexfile::Storage<uint8_t>();
+        if (lcpLeft_.size() != lcpRight_.size() || (hasLCP() && lcpLeft_.size() != suffixes_.size())) {
+            throw std::ios_base::failure("Corrupt LCP arrays in suffix array file.");
+        }
 
-    /**
-     * @brief Serializes this object into a stream.
-     * @see deserialize
-     * 
-     * @param ostream stream to send serialized data
-     */
-    void serialize(std::ofstream &ostream) const {
-        serial::serialize(data_, ostream);
-        serial::serialize(suffixes_, ostream);
-        serial::serialize(prefixTableSize_, ostream);
-        if (prefixTableSize_ != 0) {
-            /* manually serialize std::map elements -- templates got a little hairy trying to extend serialize */
-            serial::serialize(prefixTable_.size(), ostream);
-            for (auto const& [key, value] : prefixTable_) {
-                auto const& [start, end] = value;
-                serial::serialize(key, ostream);
-                serial::serialize(start, ostream);
-                serial::serialize(end, ostream);
-            }
+        /* every search walks the top of the tree, so keep all of it resident */
+        sampleTree_ = reader.has(SampleTreeSection)
+            ? SampleTree(suffixes_.size(), reader.section<uint64_t>(SampleTreeSection, MADV_WILLNEED)) : SampleTree();
+        if (!sampleTree_.isConsistent(suffixes_.size())) {
+            throw std::ios_base::failure("Corrupt sample tree in suffix array file.");
         }
-    }
-    
-    /**
-     * @brief Deserializes a SuffixArray from a stream. Expects the serial format used by SuffixArray::serialize.
-     * @see serialize
-     * 
-     * @param istream stream to get serial data from
-     */
-    void deserialize(std::ifstream &istream) {
-        serial::deserialize(data_, istream);
-        serial::deserialize(suffixes_, istream);
-        serial::deserialize(this->prefixTableSize_, istream);
-        if (prefixTableSize_ != 0) {    /* manually deserialize std::map elements */
-            prefixTable_.clear();
-
-            size_t tmpSize;
-            serial::deserialize(tmpSize, istream);
-            for (size_t i = 0; i < tmpSize; i += 1) {
-                std::string key;
-                int32_t start, end;
-
-                serial::deserialize(key, istream);
-                serial::deserialize(start, istream);
-                serial::deserialize(end, istream);
-
-                prefixTable_.insert({key, {start, end}});
-            }
+
+        contigs_ = reader.has(ContigStartsSection) ? ContigTable(reader.section<uint64_t>(ContigStartsSection, MADV_WILLNEED),
+            reader.section<char>(ContigNamesSection), reader.section<uint64_t>(GapStartsSection, MADV_WILLNEED),
+            reader.section<uint64_t>(GapShiftsSection, MADV_WILLNEED)) : ContigTable();
+        if (!contigs_.isConsistent(text_.size())) {
+            throw std::ios_base::failure("Corrupt contig table in suffix array file.");
         }
+        suffixArrayBuildTime_ = 0.0;
+        prefixTableBuildTime_ = 0.0;
     }
 
     /**
@@ -339,11 +857,12 @@ public:
      * @param sa a suffix array
      * @return std::ostream& stream with suffix array data placed in it
      */
-    friend std::ostream& operator<<(std::ostream& oss, SuffixArray const& sa) {
+    friend std::ostream& operator<<(std::ostream& oss, BasicSuffixArray const& sa) {
         oss << "i\tA[i]\tS[A[i],N]\n";
-        int32_t counter = 0;
-        for (auto const& idx : sa.suffixes_) {
-            oss << counter << "\t" << idx << "\t" << sa.data_.substr(idx) << "\n";
+        const std::string text = sa.data();
+        int64_t counter = 0;
+        for (position_type idx : sa.suffixes_) {
+            oss << counter << "\t" << idx << "\t" << std::string_view(text).substr(idx) << "\n";
             counter += 1; 
         }
         return oss;
@@ -351,150 +870,688 @@ public:
 
 
 private:
-    std::string data_;
-    size_t prefixTableSize_;
+    PackedText text_;
+    size_t sampling_ = 1;
     double suffixArrayBuildTime_, prefixTableBuildTime_;
 
-    std::vector<int32_t> suffixes_;
-    PrefixTable prefixTable_;
-    std::array<int32_t, 256> histogram_;
+    indexfile::Storage<SuffixType> suffixes_;
+    BasicPrefixTable<SuffixType> prefixTable_;
+    indexfile::Storage<uint8_t> lcpLeft_, lcpRight_;
+    SampleTree sampleTree_;
+    ContigTable contigs_;
+    std::array<position_type, 256> histogram_;
+
+    /**
+     * @brief Construct an empty SuffixArray. Only used as the target of `load`.
+     */
+    BasicSuffixArray() : suffixArrayBuildTime_(0.0), prefixTableBuildTime_(0.0) {}
 
     /**
-     * @brief Construct a new Suffix Array object from a string.
+     * @brief Construct a new Suffix Array object from a sequence.
      * 
-     * @param data string to conduct suffix array on. 
-     * @param prefixTableSize build a `k` prefix table. 0 for none.
-     */
-    SuffixArray(std::string const& data, size_t prefixTableSize=0)
-        : data_(data), prefixTableSize_(prefixTableSize), suffixes_(data_.size()+1) {
-
-        std::random_device dev;
-        std::mt19937 rng(dev());
-        std::uniform_int_distribution<uint8_t> dist(0,3);
-        const char ALPHABET[4] = {'A', 'T', 'G', 'C'};
-        std::for_each(utilities::executionPolicy, std::begin(data_), std::end(data_), [&dist,&rng,&ALPHABET](auto &c) {
-            c = std::toupper(c);
-            if (c != 'A' && c != 'T' && c != 'G' && c != 'C') {
-                c = ALPHABET[dist(rng)];
-            }
-        });
-        data_.push_back('$');
+     * @param text upper case sequence to conduct suffix array on; taken over without copying.
+     * @param contigs start and name of every record in text
+     * @param options which auxiliary structures to build.
+     * @throws std::length_error if the text is too long for SuffixType
+     * @throws std::invalid_argument if the suffix sampling rate is not positive
+     */
+    BasicSuffixArray(std::vector<char> &&text, ContigTable contigs, BuildOptions const& options)
+        : contigs_(std::move(contigs)) {
+        if (options.suffixSampling < 1) {
+            throw std::invalid_argument("Suffix sampling rate must be at least 1.");
+        }
+        sampling_ = static_cast<size_t>(options.suffixSampling);
+        if (options.ambiguousBases == AmbiguousBases::Collapse) {
+            contigs_ = contigs_.withCollapsedRuns(text);
+        } else {
+            randomizeAmbiguousBases(text);
+        }
+        if (static_cast<int64_t>(text.size()) >= MAX_LENGTH) {
+            throw std::length_error("Text of " + std::to_string(text.size()) + " bases is too long for a "
+                + std::to_string(8 * sizeof(SuffixType)) + "-bit suffix array.");
+        }
+        text.push_back('$');
+        const std::string_view textView(text.data(), text.size());
 
         utilities::Timer timer;
         timer.start();
-        this->buildSuffixArray();
+        auto suffixes = this->buildSuffixArray(textView);
         timer.stop();
         suffixArrayBuildTime_ = timer.millisecondsElapsed();
 
-        prefixTableBuildTime_ = 0.0;
-        if (prefixTableSize_ != 0) {
+        /* only the LCP-LR arrays are kept; the full LCP array is just scratch space for building them */
+        std::vector<position_type> lcpArray;
+        if (options.lcp) {
+            lcpArray = lcp::buildLCP<position_type>(textView, suffixes);
+        }
+        buildFromSuffixes(textView, std::move(suffixes), std::move(lcpArray), options);
+    }
+
+    /**
+     * @brief Construct a new Suffix Array object over a text whose suffixes are already sorted, at least up to the
+     * end of each record, such as merged shards. The LCP-LR arrays come from the LCPs within records.
+     *
+     * @param text normalized text ending in '$'; taken over without copying
+     * @param contigs start and name of every record in text
+     * @param suffixes suffix array of text
+     * @param options which auxiliary structures to build; ambiguousBases does not apply
+     * @param buildTime milliseconds it took to sort the suffixes
+     * @throws std::invalid_argument if the suffix sampling rate is not positive
+     */
+    BasicSuffixArray(std::vector<char> &&text, ContigTable contigs, std::vector<position_type> &&suffixes,
+        BuildOptions const& options, double buildTime)
+        : suffixArrayBuildTime_(buildTime), contigs_(std::move(contigs)) {
+        if (options.suffixSampling < 1) {
+            throw std::invalid_argument("Suffix sampling rate must be at least 1.");
+        }
+        sampling_ = static_cast<size_t>(options.suffixSampling);
+        histogram_.fill(0);
+        const std::string_view textView(text.data(), text.size());
+
+        std::vector<position_type> lcpArray;
+        if (options.lcp) {
+            lcpArray = lcp::buildRecordLCP<position_type>(textView, suffixes);
+        }
+        buildFromSuffixes(textView, std::move(suffixes), std::move(lcpArray), options);
+    }
+
+    /**
+     * @brief Sample, store, and pack the sorted suffixes and text, and build the structures `options` asks for
+     * over them.
+     *
+     * @param lcpArray LCP array of the suffixes if options.lcp, otherwise empty
+     */
+    void buildFromSuffixes(std::string_view textView, std::vector<position_type> &&suffixes,
+        std::vector<position_type> &&lcpArray, BuildOptions const& options) {
+        utilities::Timer timer;
+        if (sampling_ != 1) {
             timer.start();
+            sampleSuffixes(suffixes, lcpArray);
+            timer.stop();
+            suffixArrayBuildTime_ += timer.millisecondsElapsed();
+        }
+        if (options.lcp) {
+            auto lcpLR = lcp::buildLCPLR<position_type>(lcpArray);
+            lcpArray = {};
+            lcpLeft_ = indexfile::Storage<uint8_t>(std::move(lcpLR.left));
+            lcpRight_ = indexfile::Storage<uint8_t>(std::move(lcpLR.right));
+        }
 
-            #if defined(_OPENMP)
-            buildPrefixTableParallel();
-            #else
-            buildPrefixTable(std::begin(suffixes_), std::end(suffixes_), prefixTable_);
-            #endif
-            
+        timer.start();
+        this->storeSuffixes(std::move(suffixes));
+        timer.stop();
+        suffixArrayBuildTime_ += timer.millisecondsElapsed();
+
+        if (options.sampleTreeLevels != 0) {
+            sampleTree_ = SampleTree::build(textView, this->suffixes(), options.sampleTreeLevels);
+        }
+
+        /* everything built from the character text is done with it, so only the packed text is kept */
+        timer.start();
+        text_ = PackedText::pack(textView);
+        timer.stop();
+        suffixArrayBuildTime_ += timer.millisecondsElapsed();
+
+        /* k-mers come straight out of the packed words, a load or two per suffix instead of k characters */
+        prefixTableBuildTime_ = 0.0;
+        if (options.prefixTableLength == AUTO_PREFIX_TABLE) {
+            const uint64_t budget = (options.prefixTableBudget != 0) ? options.prefixTableBudget
+                : suffixes_.size() * sizeof(SuffixType) / 4;
+            timer.start();
+            prefixTable_ = BasicPrefixTable<SuffixType>::buildAuto(text_, this->suffixes(), budget);
+            timer.stop();
+            prefixTableBuildTime_ = timer.millisecondsElapsed();
+        } else if (options.prefixTableLength > 0) {
+            timer.start();
+            prefixTable_ = BasicPrefixTable<SuffixType>::build(text_, this->suffixes(), options.prefixTableLength,
+                static_cast<size_t>(std::max(options.refinedPrefixLength, 0)));
             timer.stop();
             prefixTableBuildTime_ = timer.millisecondsElapsed();
         }
     }
 
     /**
-     * @brief Builds the suffix array into internal storage.
-     * @throws runtime_error if `saislib` returns a non-zero error code.
+     * @brief Replace every character that is neither a base nor a separator with a base hashed from its
+     * position, so that the same reference always gives the same text.
      */
-    void buildSuffixArray() {
-        const uint8_t *rawData = reinterpret_cast<const uint8_t*>(data_.c_str());
+    static void randomizeAmbiguousBases(std::vector<char> &text) {
+        const size_t length = text.size();
+        #pragma omp parallel for
+        for (size_t i = 0; i < length; i += 1) {
+            if (kmer::BASE_CODES[static_cast<uint8_t>(text[i])] == kmer::INVALID_BASE && text[i] != fasta::RECORD_SEPARATOR) {
+                text[i] = "ACGT"[utilities::mix64(i) >> 62];
+            }
+        }
+    }
 
+    /**
+     * @brief libsais entry points for 32 and 64-bit suffix arrays.
+     */
+    static int32_t sortSuffixes(const uint8_t *text, int32_t *suffixes, int32_t n, int32_t *freq) {
         #if defined(_OPENMP)
-        auto result = libsais_omp(rawData, suffixes_.data(), data_.size(), 0, histogram_.data(), 0);
+        return libsais_omp(text, suffixes, n, 0, freq, 0);
         #else
-        auto result = libsais(rawData, suffixes_.data(), data_.size(), 0, histogram_.data());
+        return libsais(text, suffixes, n, 0, freq);
         #endif
+    }
+
+    static int64_t sortSuffixes(const uint8_t *text, int64_t *suffixes, int64_t n, int64_t *freq) {
+        #if defined(_OPENMP)
+        return libsais64_omp(text, suffixes, n, 0, freq, 0);
+        #else
+        return libsais64(text, suffixes, n, 0, freq);
+        #endif
+    }
+
+    /**
+     * @brief Builds the unpacked suffix array of `text`.
+     * @throws runtime_error if `saislib` returns a non-zero error code.
+     */
+    std::vector<position_type> buildSuffixArray(std::string_view text) {
+        const uint8_t *rawData = reinterpret_cast<const uint8_t*>(text.data());
+        std::vector<position_type> suffixes(text.size());
 
+        auto result = sortSuffixes(rawData, suffixes.data(), static_cast<position_type>(text.size()), histogram_.data());
         if (result != 0) {
             throw std::runtime_error("SAISLIB Error -- Could not construct suffix array.");
         }
+        return suffixes;
+    }
+
+    /**
+     * @brief Keep only the suffixes starting at multiples of the sampling rate, in suffix array order. An LCP
+     * array, if not empty, becomes that of the kept suffixes: the LCP of two neighbours is the minimum of the
+     * full LCP array over the suffixes between them.
+     */
+    void sampleSuffixes(std::vector<position_type> &suffixes, std::vector<position_type> &lcpArray) const {
+        const bool hasLCPArray = !lcpArray.empty();
+        size_t numKept = 0;
+        position_type minLCP = 0;
+        for (size_t idx = 0; idx < suffixes.size(); idx += 1) {
+            if (hasLCPArray) {
+                minLCP = std::min(minLCP, lcpArray[idx]);
+            }
+            if (static_cast<size_t>(suffixes[idx]) % sampling_ != 0) {
+                continue;
+            }
+            suffixes[numKept] = suffixes[idx];
+            if (hasLCPArray) {
+                lcpArray[numKept] = (numKept == 0) ? 0 : minLCP;
+                minLCP = std::numeric_limits<position_type>::max();
+            }
+            numKept += 1;
+        }
+        suffixes.resize(numKept);
+        suffixes.shrink_to_fit();
+        if (hasLCPArray) {
+            lcpArray.resize(numKept);
+            lcpArray.shrink_to_fit();
+        }
     }
 
     /**
-     * @brief Builds an internal prefix table. Allows instant jumping to the range containing any prefix of length k.
+     * @brief Move the suffix array into internal storage, packing it down to SuffixType if that is narrower.
+     */
+    void storeSuffixes(std::vector<position_type> &&suffixes) {
+        if constexpr (std::is_same_v<SuffixType, position_type>) {
+            suffixes_ = indexfile::Storage<SuffixType>(std::move(suffixes));
+        } else {
+            std::vector<SuffixType> packed(suffixes.size());
+            std::transform(utilities::executionPolicy, std::begin(suffixes), std::end(suffixes), std::begin(packed),
+                [](position_type idx) { return SuffixType(idx); });
+            suffixes = {};
+            suffixes_ = indexfile::Storage<SuffixType>(std::move(packed));
+        }
+    }
+
+    /* top bits of a query's ordered key that sortedQueries buckets on before sorting */
+    constexpr static size_t SORT_BUCKET_BITS = 16;
+
+    /**
+     * @brief Copy the count and up to `maxResults` positions of the suffix array range into `q`.
+     */
+    template <typename QueryType>
+    void storeResults(QueryType &q, std::pair<int64_t, int64_t> range, int64_t maxResults) const {
+        q.count = range.second - range.first;
+        const auto numResults = (maxResults < 0) ? q.count : std::min(q.count, maxResults);
+        const auto first = std::next(std::begin(suffixes()), range.first);
+        q.result.assign(first, std::next(first, numResults));
+    }
+
+    /**
+     * @brief Mismatches of the query aligned at `start`, seed by seed, for a candidate found by seed `found`.
+     * Returns more than any mismatch bound if an earlier seed also matches exactly, since that seed finds the
+     * same candidate first.
+     */
+    template <typename SeedStart>
+    size_t countMismatches(PackedQuery const& packed, std::vector<uint64_t> const& ambiguous, size_t start,
+        size_t found, size_t numSeeds, SeedStart &&seedStart) const noexcept {
+
+        const size_t limit = numSeeds - 1;
+        uint64_t const* ambiguousWords = ambiguous.empty() ? nullptr : ambiguous.data();
+        size_t total = 0;
+        for (size_t seed = 0; seed < numSeeds && total <= limit; seed += 1) {
+            if (seed == found) {
+                continue;
+            }
+            const size_t seedMismatches = text_.mismatches(packed, ambiguousWords, seedStart(seed), seedStart(seed + 1),
+                start, limit - total);
+            if (seed < found && seedMismatches == 0) {
+                return std::numeric_limits<size_t>::max();
+            }
+            total += seedMismatches;
+        }
+        return total;
+    }
+
+    /**
+     * @brief equalRange, given that the query's range lies within [lowerBound, upperBound).
+     */
+    std::pair<int64_t, int64_t> equalRangeWithin(std::string_view query, QueryMode mode, int64_t lowerBound, int64_t upperBound) const {
+        /* the text only holds bases between its separators, so nothing else, separators included, can match */
+        const PackedQuery packed = PackedText::packQuery(query);
+        if (!packed.valid) {
+            return {0, 0};
+        }
+        counters::add(counters::Searches);
+        if (mode == LCPAccelerated && !(hasLCP() && query.size() < lcp::MAX_STORED_LCP)) {
+            mode = SimpleAccelerant;
+        }
+
+        switch (mode) {
+            case Naive: return searchEqualRange<Naive>(packed, lowerBound, upperBound);
+            case SimpleAccelerant: return searchEqualRange<SimpleAccelerant>(packed, lowerBound, upperBound);
+            case LCPAccelerated: return searchEqualRange<LCPAccelerated>(packed, lowerBound, upperBound);
+        }
+        return {0, 0};
+    }
+
+    /**
+     * @brief Search the distinct, sorted queries [first, last), all of whose ranges lie within [lowerBound, upperBound).
+     * 
+     * Ranges of sorted queries are ordered too, except that a query's range contains those of the queries it
+     * is a prefix of. So the queries before the middle one end by its lower bound unless one of them is a
+     * prefix of it, which needs an LCP of at least `minLength` with its predecessor. The queries after it start
+     * after its range unless it is a prefix of its successor, and at its lower bound either way.
      * 
-     * @param rangeStart Beginning of range to build from.
-     * @param rangeEnd end of range to build from.
-     * @param prefixTable what table to build into.
+     * @param queryAt maps an index in [first, last) to its query
+     * @param minLength length of the shortest query
+     * @param ranges receives the range of each query
+     */
+    template <typename QueryAt>
+    void searchSorted(QueryAt const& queryAt, QueryMode mode, size_t minLength, size_t first, size_t last,
+        int64_t lowerBound, int64_t upperBound, std::span<std::pair<int64_t, int64_t>> ranges) const {
+
+        if (first >= last) {
+            return;
+        }
+        const size_t mid = first + (last - first) / 2;
+        const std::string_view query = queryAt(mid);
+        const auto range = ranges[mid] = equalRangeWithin(query, mode, lowerBound, upperBound);
+        if (range.first == range.second) {
+            /* the prefix table and base checks rule out absent queries without finding where they would be */
+            searchSorted(queryAt, mode, minLength, first, mid, lowerBound, upperBound, ranges);
+            searchSorted(queryAt, mode, minLength, mid + 1, last, lowerBound, upperBound, ranges);
+            return;
+        }
+
+        auto commonPrefix = [](std::string_view a, std::string_view b) {
+            return utilities::mismatchLength(a.data(), b.data(), std::min(a.size(), b.size()));
+        };
+        const bool prefixBefore = mid > first && commonPrefix(queryAt(mid - 1), query) >= minLength;
+        const bool prefixAfter = mid + 1 < last && commonPrefix(query, queryAt(mid + 1)) == query.size();
+        searchSorted(queryAt, mode, minLength, first, mid, lowerBound, prefixBefore ? upperBound : range.first, ranges);
+        searchSorted(queryAt, mode, minLength, mid + 1, last, prefixAfter ? range.first : range.second, upperBound, ranges);
+    }
+
+    /* order of a suffix relative to the query, looking only at the first m characters of the suffix */
+    enum Order { Less, Equal, Greater };
+
+    /**
+     * @brief Open bounds of a binary search over the suffix array. The answer lies in (lower, upper] and the
+     * LCPs are those of the query with the suffixes at lower and upper; 0 for bounds outside the array.
      */
-    void buildPrefixTable(std::vector<int32_t>::iterator rangeStart, std::vector<int32_t>::iterator rangeEnd, 
-        PrefixTable &prefixTable) {
-        const uint32_t k = this->prefixTableSize_;
-        const size_t dataLen = data_.size();
-        auto const& data = data_;   /* local reference for lambda capture */
-        
-        /* find if two strings have same prefix; done in-place on data_ and with early exit */
-        auto hasSamePrefix = [&data, k](int32_t idx1, int32_t idx2) -> bool { 
-                return data.compare(idx1, k, data, idx2, k) == 0; };
+    struct SearchState {
+        int64_t lower, upper;
+        uint32_t lowerLCP, upperLCP;
+    };
 
-        /* find first string with prefix length >= k */
-        auto iter = std::find_if(rangeStart, rangeEnd, [k, dataLen](auto offset) { return (dataLen-offset) >= k; });
+    /**
+     * @brief Compare the query with the suffix at `idx`, which is known to share its first `offset` bases.
+     * 
+     * @return std::pair<Order, uint32_t> order of the suffix and its LCP with the query
+     */
+    std::pair<Order, uint32_t> compareAt(PackedQuery const& query, int64_t idx, size_t offset = 0) const {
+        const auto [order, lcpLength] = text_.comparePrefix(query, static_cast<size_t>(static_cast<position_type>(suffixes_[idx])), offset);
+        counters::add(counters::Comparisons);
+        counters::add(counters::BasesCompared, std::min(lcpLength + 1, query.size()) - std::min(offset, lcpLength));
+        if (order == 0) {
+            return {Equal, static_cast<uint32_t>(lcpLength)};
+        }
+        if (order < 0) {
+            return {Less, static_cast<uint32_t>(lcpLength)};
+        }
+        return {Greater, static_cast<uint32_t>(lcpLength)};
+    }
 
-        while (std::distance(iter, rangeEnd) > 0) { // iter < rangeEnd
-            std::string prefix = data_.substr(*iter, k);
+    /**
+     * @brief Order the suffix at `mid` against the query.
+     * 
+     * Naive and SimpleAccelerant compare from the first base. SimpleAccelerant used to skip the
+     * min(lowerLCP, upperLCP) characters every suffix between the bounds shares with the query, but the packed
+     * text is compared 32 bases at a time, so that saves a step at most, and starting the load of a suffix
+     * from the previous probe's LCP would keep it from overlapping the previous probe's load.
+     * LCPAccelerated is the Manber-Myers rule: it decides from lcp(lower, mid) or lcp(mid, upper) alone unless
+     * that equals the larger bound LCP, and only then compares, starting from the word holding the first base
+     * past that LCP. A comparison raises the larger bound LCP to the LCP it finds, and that never shrinks, so a
+     * search costs O(m / 32 + log n) word comparisons; it does require `mid` to be the midpoint the LCP-LR
+     * arrays were built for.
+     * An Equal suffix may be reported as Less when lowerLCP == m, or Greater when upperLCP == m; the search
+     * moves the same way for both.
+     * 
+     * @return std::pair<Order, uint32_t> order of the suffix and its LCP with the query
+     */
+    template <QueryMode Mode>
+    std::pair<Order, uint32_t> probe(PackedQuery const& query, SearchState const& state, int64_t mid) const {
+        counters::add(counters::SearchSteps);
+        if constexpr (Mode == LCPAccelerated) {
+            if (state.lowerLCP >= state.upperLCP) {
+                const uint32_t midLCP = lcpLeft_[mid];  /* lcp(lower, mid) */
+                if (midLCP > state.lowerLCP) {
+                    counters::add(counters::LCPDecisions);
+                    return {Less, state.lowerLCP};
+                } else if (midLCP < state.lowerLCP) {
+                    counters::add(counters::LCPDecisions);
+                    return {Greater, midLCP};
+                }
+            } else {
+                const uint32_t midLCP = lcpRight_[mid]; /* lcp(mid, upper) */
+                if (midLCP > state.upperLCP) {
+                    counters::add(counters::LCPDecisions);
+                    return {Greater, state.upperLCP};
+                } else if (midLCP < state.upperLCP) {
+                    counters::add(counters::LCPDecisions);
+                    return {Less, midLCP};
+                }
+            }
+            return compareAt(query, mid, std::max(state.lowerLCP, state.upperLCP));
+        } else {
+            counters::add(counters::SkippableBases, std::min(state.lowerLCP, state.upperLCP));
+        }
+        return compareAt(query, mid);
+    }
 
-            const auto endOfRange = std::find_if_not(iter, std::end(suffixes_), [&hasSamePrefix, &iter](auto idx) { 
-                    return hasSamePrefix(*iter, idx); });
+    /**
+     * @brief Finish the search for one bound once the lower and upper bound searches have split.
+     * 
+     * @tparam Mode query method
+     * @tparam Upper search for the first suffix greater than the query instead of the first not less than it
+     * @param state bounds to search between
+     * @return int64_t index of the bound
+     */
+    template <QueryMode Mode, bool Upper>
+    int64_t finishBound(PackedQuery const& query, SearchState state) const {
+        while (state.upper - state.lower > 1) {
+            const int64_t mid = (state.lower + state.upper) / 2;
+            const auto [order, lcpLength] = probe<Mode>(query, state, mid);
+            if (order == Less || (Upper && order == Equal)) {
+                state.lower = mid;
+                state.lowerLCP = lcpLength;
+            } else {
+                state.upper = mid;
+                state.upperLCP = lcpLength;
+            }
+        }
+        return state.upper;
+    }
 
-            const auto start = std::distance(std::begin(suffixes_), iter);
-            const auto end = std::distance(std::begin(suffixes_), endOfRange) - 1;
-            prefixTable.insert({prefix, {start, end}});
+    /**
+     * @brief Initial bounds of a search, narrowed by the prefix table and sample tree if there are any.
+     * 
+     * The LCP-LR arrays only describe the midpoints of the search tree rooted at (-1, n), so LCPAccelerated
+     * walks down that tree past the levels lying outside the narrowed range and then computes the exact
+     * LCPs of the bounds it stopped at. The other modes start right at the range and treat the unknown bound
+     * LCPs as 0. When the query occurs every suffix outside the range differs from it; when it doesn't the
+     * search never finds an Equal suffix, so either way the bounds are safe.
+     * 
+     * @return SearchState initial bounds; empty if the prefix table rules out every suffix
+     */
+    template <QueryMode Mode>
+    SearchState initialState(PackedQuery const& query) const {
+        const auto n = static_cast<int64_t>(suffixes_.size());
+        int64_t rangeStart = 0, rangeEnd = n;
+        if (!prefixTable_.empty() && query.size() >= prefixTable_.length()) {
+            std::tie(rangeStart, rangeEnd) = prefixTable_.range(query.sequence);
+            if (rangeStart >= rangeEnd) {
+                counters::add(counters::PrefixTableMisses);
+                return {rangeStart - 1, rangeStart, 0, 0};
+            }
+            counters::add(counters::PrefixTableHits);
+        } else if (!prefixTable_.empty()) {
+            counters::add(counters::PrefixTableBypasses);
+        }
+        if (!sampleTree_.empty()) {
+            const auto [sampleStart, sampleEnd] = sampleTree_.range(query.sequence);
+            rangeStart = std::max(rangeStart, sampleStart);
+            rangeEnd = std::min(rangeEnd, sampleEnd);
+        }
+        if (rangeStart == 0 && rangeEnd == n) {
+            return {-1, n, 0, 0};
+        }
+        if constexpr (Mode != LCPAccelerated) {
+            return {rangeStart - 1, std::max(rangeStart, rangeEnd), 0, 0};
+        }
 
-            iter = endOfRange;
+        SearchState state{-1, n, 0, 0};
+        while (state.upper - state.lower > 1) {
+            const int64_t mid = (state.lower + state.upper) / 2;
+            if (mid < rangeStart) {
+                state.lower = mid;
+            } else if (mid >= rangeEnd) {
+                state.upper = mid;
+            } else {
+                break;
+            }
         }
+        state.lowerLCP = (state.lower < 0) ? 0 : compareAt(query, state.lower).second;
+        state.upperLCP = (state.upper >= n) ? 0 : compareAt(query, state.upper).second;
+        return state;
     }
 
     /**
-     * @brief Builds prefix table using multiple threads.
-     * @note This could be vastly improved by a thread-safe hash table implementation.
+     * @brief Find the lower and upper bound of the query in a single pass. Both bounds share the search path
+     * until a suffix equal to the query is found; there the path splits and the two halves are finished
+     * separately, each keeping the LCPs gathered so far.
      * 
+     * @tparam Mode query method
+     * @param query packed query
+     * @param lowerBound, upperBound bounds of the query's range from other searches; ignored by LCPAccelerated,
+     * whose bounds must stay on the search tree the LCP-LR arrays describe
+     * @return std::pair<int64_t, int64_t> [lower, upper) indices into the suffix array
      */
-    void buildPrefixTableParallel() {
-        constexpr uint32_t NUM_CHUNKS = 128;
-        std::array<PrefixTable, NUM_CHUNKS> tables;
+    template <QueryMode Mode>
+    std::pair<int64_t, int64_t> searchEqualRange(PackedQuery const& query, int64_t lowerBound, int64_t upperBound) const {
+        SearchState state = initialState<Mode>(query);
+        if constexpr (Mode != LCPAccelerated) {
+            /* only LCPAccelerated reads the bound LCPs */
+            state.lower = std::max(state.lower, lowerBound - 1);
+            state.upper = std::min(state.upper, upperBound);
+        }
 
-        const uint32_t k = this->prefixTableSize_;
-        auto const& data = data_;   /* local reference for lambda capture */
-        auto hasSamePrefix = [&data, k](int32_t idx1, int32_t idx2) -> bool { 
-                return data.compare(idx1, k, data, idx2, k) == 0; };
+        while (state.upper - state.lower > 1) {
+            const int64_t mid = (state.lower + state.upper) / 2;
+            const auto [order, lcpLength] = probe<Mode>(query, state, mid);
 
-        prefixTable_.reserve(suffixes_.size());
-        for (auto &tab : tables) {
-            tab.reserve((suffixes_.size()-k+1) / NUM_CHUNKS);
+            if (order == Less) {
+                state.lower = mid;
+                state.lowerLCP = lcpLength;
+            } else if (order == Greater) {
+                state.upper = mid;
+                state.upperLCP = lcpLength;
+            } else {
+                const int64_t lowerIndex = finishBound<Mode, false>(query, {state.lower, mid, state.lowerLCP, lcpLength});
+                const int64_t upperIndex = finishBound<Mode, true>(query, {mid, state.upper, lcpLength, state.upperLCP});
+                return {lowerIndex, upperIndex};
+            }
         }
+        return {state.upper, state.upper};
+    }
 
-        #pragma omp parallel for
-        for (uint32_t i = 0; i < NUM_CHUNKS; i += 1) {
+    /**
+     * @brief A search of serialQueries that is resumed one step at a time. Starting computes the initial
+     * state, whose prefix table bucket was prefetched when the search started. Each probe of the binary search
+     * then takes two turns: the first reads the suffix at `mid`, prefetched on the turn before, and prefetches
+     * its text; the second compares. An LCPAccelerated probe the LCP-LR arrays settle needs no text and takes
+     * one. Joint, LowerBound, and UpperBound are the shared path and the two bounds of searchEqualRange,
+     * finished one after the other.
+     */
+    struct InterleavedSearch {
+        enum Phase { Starting, Joint, LowerBound, UpperBound };
+
+        size_t queryIndex;
+        PackedQuery query;
+        Phase phase;
+        bool textPrefetched;        // whether the text of the suffix at mid has been prefetched
+        int64_t mid, lowerIndex;    // lowerIndex is the finished lower bound during UpperBound
+        SearchState state, upperState;
+        std::pair<int64_t, int64_t> range;
+    };
 
-            /* compute starting range */
-            auto iter = std::next(std::begin(suffixes_), i * suffixes_.size() / NUM_CHUNKS);
-            auto endOfRange = std::next(std::begin(suffixes_), (i+1) * suffixes_.size() / NUM_CHUNKS);
+    /**
+     * @brief Search the queries [first, last) from `begin`, INTERLEAVED_SEARCHES at a time in turn.
+     * @see serialQueries
+     */
+    template <QueryMode Mode, typename Iterator>
+    void searchInterleaved(Iterator begin, size_t first, size_t last, int64_t maxResults) const {
+        std::array<InterleavedSearch, INTERLEAVED_SEARCHES> searches;
+        size_t next = first;
+
+        /* start the next query that needs a search in `search`; false once there are none left */
+        auto startNext = [&](InterleavedSearch &search) {
+            while (next < last) {
+                auto &q = begin[next];
+                search.queryIndex = next;
+                next += 1;
+                search.query = PackedText::packQuery(q.query);
+                if (!search.query.valid) {
+                    storeResults(q, {0, 0}, maxResults);
+                    continue;
+                }
+                counters::add(counters::Searches);
+                if (Mode == LCPAccelerated && q.query.size() >= lcp::MAX_STORED_LCP) {
+                    storeResults(q, searchEqualRange<SimpleAccelerant>(search.query, 0,
+                        static_cast<int64_t>(suffixes_.size())), maxResults);
+                    continue;
+                }
+                search.phase = InterleavedSearch::Starting;
+                prefixTable_.prefetch(q.query);
+                return true;
+            }
+            return false;
+        };
 
-            /* check if this is in an existing region -- if so seek to next region */
-            if (i != 0 && hasSamePrefix(*iter, *std::prev(iter))) {
-                iter = std::find_if_not(iter, endOfRange, [&hasSamePrefix, &iter](auto idx) { 
-                    return hasSamePrefix(*iter, idx); });
+        size_t numActive = 0;
+        while (numActive < searches.size() && startNext(searches[numActive])) {
+            numActive += 1;
+        }
+        while (numActive != 0) {
+            for (size_t i = 0; i < numActive;) {
+                InterleavedSearch &search = searches[i];
+                if (!stepInterleaved<Mode>(search)) {
+                    i += 1;
+                    continue;
+                }
+                storeResults(begin[search.queryIndex], search.range, maxResults);
+                if (startNext(search)) {
+                    i += 1;
+                    continue;
+                }
+                /* keep the active searches in front; the one swapped in takes its turn now */
+                numActive -= 1;
+                std::swap(search, searches[numActive]);
             }
+        }
+    }
 
-            /* build out table */
-            this->buildPrefixTable(iter, endOfRange, tables.at(i));
+    /**
+     * @brief Take one turn of `search`.
+     * @return true once its range is found
+     */
+    template <QueryMode Mode>
+    bool stepInterleaved(InterleavedSearch &search) const {
+        using Phase = typename InterleavedSearch::Phase;
+        if (search.phase == Phase::Starting) {
+            search.state = initialState<Mode>(search.query);
+            search.phase = Phase::Joint;
+            return settleInterleaved<Mode>(search);
+        }
+        SearchState &state = search.state;
+        if (!search.textPrefetched && !(Mode == LCPAccelerated && decidedByLCP(state, search.mid))) {
+            /* LCPAccelerated compares from the larger bound LCP on */
+            const size_t offset = (Mode == LCPAccelerated) ? std::max(state.lowerLCP, state.upperLCP) : 0;
+            text_.prefetch(static_cast<size_t>(static_cast<position_type>(suffixes_[search.mid])) + offset);
+            search.textPrefetched = true;
+            return false;
         }
 
-        /* rejoin tables */
-        for (auto const& tab : tables) {
-            prefixTable_.insert(std::begin(tab), std::end(tab));
+        const auto [order, lcpLength] = probe<Mode>(search.query, state, search.mid);
+        if (search.phase == Phase::Joint && order == Equal) {
+            search.upperState = {search.mid, state.upper, lcpLength, state.upperLCP};
+            state = {state.lower, search.mid, state.lowerLCP, lcpLength};
+            search.phase = Phase::LowerBound;
+        } else if (order == Less || (search.phase == Phase::UpperBound && order == Equal)) {
+            state.lower = search.mid;
+            state.lowerLCP = lcpLength;
+        } else {
+            state.upper = search.mid;
+            state.upperLCP = lcpLength;
         }
+        return settleInterleaved<Mode>(search);
+    }
+
+    /**
+     * @brief Whether the LCPAccelerated probe of `mid` is settled from the LCP-LR arrays without comparing text.
+     * @see probe
+     */
+    bool decidedByLCP(SearchState const& state, int64_t mid) const noexcept {
+        if (state.lowerLCP >= state.upperLCP) {
+            return lcpLeft_[mid] != state.lowerLCP;
+        }
+        return lcpRight_[mid] != state.upperLCP;
+    }
+
+    /**
+     * @brief Move `search` on to its next bound once the current one is found, and prefetch its next probe.
+     * @return true once its range is found
+     */
+    template <QueryMode Mode>
+    bool settleInterleaved(InterleavedSearch &search) const noexcept {
+        using Phase = typename InterleavedSearch::Phase;
+        SearchState &state = search.state;
+        while (state.upper - state.lower <= 1) {
+            if (search.phase != Phase::LowerBound) {
+                search.range = {(search.phase == Phase::UpperBound) ? search.lowerIndex : state.upper, state.upper};
+                return true;
+            }
+            search.lowerIndex = state.upper;
+            state = search.upperState;
+            search.phase = Phase::UpperBound;
+        }
+
+        search.mid = (state.lower + state.upper) / 2;
+        search.textPrefetched = false;
+        utilities::prefetch(suffixes_.data() + search.mid);
+        if constexpr (Mode == LCPAccelerated) {
+            utilities::prefetch(lcpLeft_.data() + search.mid);
+            utilities::prefetch(lcpRight_.data() + search.mid);
+        }
+        return false;
     }
 
 };
 
+using SuffixArray = BasicSuffixArray<int32_t>;
+using SuffixArray40 = BasicSuffixArray<packedint::Int40>;
+using SuffixArray64 = BasicSuffixArray<int64_t>;
+
 }   // namespace suffixarray
\ No newline at end of file
@@ -7,8 +7,20 @@
 #pragma once
 
 /* stl includes */
+#include <algorithm>    // min
+#include <bit>          // countl_zero, countr_one, countr_zero, endian
 #include <chrono>
+#include <cstdint>      // uint8_t, uint32_t, uint64_t
+#include <cstring>      // memcpy
 #include <execution>
+#include <string_view>  // string_view
+#include <utility>      // pair
+
+#if defined(__AVX2__)
+#include <immintrin.h>  // _mm256_cmpeq_epi8, _mm256_loadu_si256, _mm256_movemask_epi8
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>   // vceqq_u8, vld1q_u8, vshrn_n_u16
+#endif
 
 /* tpl includes */
 #include "libsais.h"
@@ -22,6 +34,28 @@ constexpr auto executionPolicy = std::execution::seq;
 #endif
 
 
+/**
+ * @brief Hint that `address` will be read soon. Never faults, so it may point past the end of an array.
+ */
+inline void prefetch(const void *address) noexcept {
+    #if defined(__GNUC__)
+    __builtin_prefetch(address);
+    #else
+    (void)address;
+    #endif
+}
+
+/**
+ * @brief splitmix64 finalizer: a cheap, well mixed hash of a 64-bit integer.
+ */
+constexpr uint64_t mix64(uint64_t x) noexcept {
+    x += 0x9e3779b97f4a7c15;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+
 class Timer {
 public:
     void start() {
@@ -37,22 +71,103 @@ public:
         return std::chrono::duration_cast<DurationType>(end_ - begin_).count();
     }
 
+    /* fractional, so that short phases do not truncate to 0 */
     double secondsElapsed() {
-        return elapsed<std::chrono::seconds>();
+        return elapsed<std::chrono::duration<double>>();
     }
 
     double millisecondsElapsed() {
-        return elapsed<std::chrono::milliseconds>();
+        return elapsed<std::chrono::duration<double, std::milli>>();
+    }
+
+    double nanosecondsElapsed() {
+        return elapsed<std::chrono::duration<double, std::nano>>();
     }
 
 private:
     std::chrono::time_point<std::chrono::high_resolution_clock> begin_, end_;
 };
 
-template <typename Iterator1, typename Iterator2>
-inline auto LCPLength(Iterator1 sBegin, Iterator1 sEnd, Iterator2 tBegin, size_t offset=0) {
-    auto const& [s, t] = std::mismatch(std::next(sBegin, offset), sEnd, std::next(tBegin, offset));
-    return std::min(std::distance(sBegin, s), std::distance(tBegin, t));
+/**
+ * @brief Length of the common prefix of s[0, n) and t[0, n), given that the first `offset` characters match.
+ *
+ * Compares 32 characters at a time with AVX2 or 16 with NEON, then 8 at a time as 64-bit words, then one at a
+ * time for the tail, so a typical read takes a handful of compares instead of a loop over every character.
+ * Never reads past s + n or t + n.
+ */
+inline size_t mismatchLength(const char *s, const char *t, size_t n, size_t offset = 0) noexcept {
+    size_t i = offset;
+    #if defined(__AVX2__)
+    for (; i + 32 <= n; i += 32) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(t + i));
+        const auto equal = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+        if (equal != ~uint32_t(0)) {
+            return i + std::countr_one(equal);
+        }
+    }
+    #elif defined(__ARM_NEON)
+    for (; i + 16 <= n; i += 16) {
+        /* narrow the byte mask to 4 bits per character */
+        const uint8x16_t equal = vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(s + i)), vld1q_u8(reinterpret_cast<const uint8_t*>(t + i)));
+        const uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+        if (bits != ~uint64_t(0)) {
+            return i + std::countr_one(bits) / 4;
+        }
+    }
+    #endif
+    for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+        uint64_t a, b;
+        std::memcpy(&a, s + i, sizeof(a));
+        std::memcpy(&b, t + i, sizeof(b));
+        if (a != b) {
+            if constexpr (std::endian::native == std::endian::little) {
+                return i + std::countr_zero(a ^ b) / 8;
+            } else {
+                return i + std::countl_zero(a ^ b) / 8;
+            }
+        }
+    }
+    for (; i < n && s[i] == t[i]; i += 1) {}
+    return i;
+}
+
+/* characters comparePrefix checks one at a time before switching to mismatchLength */
+constexpr size_t BYTEWISE_PREFIX_LENGTH = 8;
+
+/**
+ * @brief Order `suffix` against `query` on the first query.size() characters, and their LCP, in one pass.
+ *
+ * Most binary search probes land on a cold suffix that differs within a character or two, so the first few
+ * characters are compared one at a time: a wide load there would wait on the rest of the line, or the next
+ * one, to learn what the first byte already says. Only a suffix that gets past them is handed to
+ * mismatchLength. The order is decided with branches rather than selects, so the cpu can speculate into the
+ * next probe's loads while this one's are outstanding.
+ *
+ * @param offset leading characters already known to match
+ * @return std::pair<int, size_t> negative if the suffix sorts first, 0 if it starts with the query, positive
+ * if it sorts after; and the length of their common prefix
+ */
+inline std::pair<int, size_t> comparePrefix(std::string_view query, std::string_view suffix, size_t offset = 0) noexcept {
+    const size_t n = std::min(query.size(), suffix.size());
+    const size_t head = std::min(n, offset + BYTEWISE_PREFIX_LENGTH);
+    size_t lcpLength = offset;
+    while (lcpLength < head && query[lcpLength] == suffix[lcpLength]) {
+        lcpLength += 1;
+    }
+    if (lcpLength == head) {
+        lcpLength = mismatchLength(query.data(), suffix.data(), n, head);
+    }
+    if (lcpLength == query.size()) {
+        return {0, lcpLength};
+    }
+    if (lcpLength == suffix.size()) {
+        return {-1, lcpLength};
+    }
+    if (static_cast<uint8_t>(suffix[lcpLength]) < static_cast<uint8_t>(query[lcpLength])) {
+        return {-1, lcpLength};
+    }
+    return {1, lcpLength};
 }
 
 
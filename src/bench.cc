@@ -0,0 +1,341 @@
+/**
+ * @file bench.cc
+ * @author Daniel Nichols
+ * @brief Microbenchmarks of the build, load, and query hot paths, in the spirit of Google Benchmark: every
+ * benchmark runs a warm-up and then a number of timed repetitions, and reports nanoseconds per item.
+ * @date 2022-04-28
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>         // getpid
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#include "parseargs.h"      // ParseArgs
+#include "prefixtable.h"    // PrefixTable
+#include "suffixarray.h"    // SuffixArray
+#include "utilities.h"      // Timer, comparePrefix, mismatchLength
+
+/* results fold into this so the compiler cannot drop the benchmarked work */
+volatile uint64_t sink = 0;
+
+/**
+ * @brief Runs benchmarks whose name contains the filter and prints a row per benchmark.
+ */
+class Bench {
+public:
+    Bench(size_t repetitions, std::string filter) : repetitions_(std::max<size_t>(repetitions, 1)),
+        filter_(std::move(filter)) {}
+
+    bool enabled(std::string const& name) const {
+        return name.find(filter_) != std::string::npos;
+    }
+
+    static void printHeader() {
+        std::cout << std::left << std::setw(NAME_WIDTH) << "Benchmark" << std::right << std::setw(6) << "Reps"
+            << std::setw(14) << "Mean ns" << std::setw(14) << "Median ns" << std::setw(14) << "Stddev ns"
+            << std::setw(14) << "Min ns" << std::setw(14) << "Items/s" << "\n"
+            << std::string(NAME_WIDTH + 6 + 5 * 14, '-') << "\n";
+    }
+
+    /**
+     * @brief Time `body` once to warm up and then `repetitions` times, and report the time per item.
+     *
+     * @param items items `body` handles per call, e.g. bases built or queries searched
+     */
+    template <typename Body>
+    void run(std::string const& name, size_t items, Body &&body) {
+        if (!enabled(name)) {
+            return;
+        }
+        body();
+        std::vector<double> samples;
+        for (size_t repetition = 0; repetition < repetitions_; repetition += 1) {
+            utilities::Timer timer;
+            timer.start();
+            body();
+            timer.stop();
+            samples.push_back(timer.nanosecondsElapsed() / static_cast<double>(std::max<size_t>(items, 1)));
+        }
+
+        std::sort(std::begin(samples), std::end(samples));
+        double mean = 0.0, variance = 0.0;
+        for (const double sample : samples) {
+            mean += sample / static_cast<double>(samples.size());
+        }
+        for (const double sample : samples) {
+            variance += (sample - mean) * (sample - mean) / static_cast<double>(std::max<size_t>(samples.size() - 1, 1));
+        }
+        const double median = percentile(samples, 0.5);
+        std::cout << std::left << std::setw(NAME_WIDTH) << name << std::right << std::setw(6) << samples.size()
+            << std::fixed << std::setprecision(2) << std::setw(14) << mean << std::setw(14) << median
+            << std::setw(14) << std::sqrt(variance) << std::setw(14) << samples.front()
+            << std::setprecision(0) << std::setw(14) << 1e9 / median << "\n";
+    }
+
+    /**
+     * @brief Report the distribution of single item times, e.g. per query latencies, in nanoseconds.
+     */
+    void latency(std::string const& name, std::vector<double> samples) const {
+        if (!enabled(name) || samples.empty()) {
+            return;
+        }
+        std::sort(std::begin(samples), std::end(samples));
+        std::cout << std::left << std::setw(NAME_WIDTH) << name << std::right << std::fixed << std::setprecision(0)
+            << "  p50 " << percentile(samples, 0.5) << "  p90 " << percentile(samples, 0.9)
+            << "  p99 " << percentile(samples, 0.99) << "  p99.9 " << percentile(samples, 0.999)
+            << "  max " << samples.back() << " ns\n";
+    }
+
+private:
+    constexpr static int NAME_WIDTH = 48;
+    size_t repetitions_;
+    std::string filter_;
+
+    static double percentile(std::vector<double> const& sorted, double p) {
+        return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * static_cast<double>(sorted.size())))];
+    }
+};
+
+/**
+ * @brief Random bases, or a mix of random bases and repeated copies of earlier stretches, so that some queries
+ * have many hits the way real genomes do.
+ */
+std::string syntheticReference(size_t length, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::string text;
+    text.reserve(length);
+    while (text.size() < length) {
+        if (text.size() > 100000 && rng() % 8 == 0) {
+            const size_t repeatLength = std::min<size_t>(300 + rng() % 5000, length - text.size());
+            const size_t source = rng() % (text.size() - repeatLength);
+            text.append(text, source, repeatLength);
+        } else {
+            for (size_t i = 0; i < 1000 && text.size() < length; i += 1) {
+                text.push_back("ACGT"[rng() % 4]);
+            }
+        }
+    }
+    return text;
+}
+
+/**
+ * @brief Queries of `length` bases: half taken from the text, so they occur, and half random ones. Texts
+ * shorter than a query only get random ones.
+ */
+std::vector<suffixarray::SuffixArray::Query> makeQueries(suffixarray::SuffixArray const& sa, size_t numQueries,
+    size_t length, uint64_t seed) {
+
+    std::mt19937_64 rng(seed);
+    std::vector<suffixarray::SuffixArray::Query> queries;
+    queries.reserve(numQueries);
+    while (queries.size() < numQueries) {
+        std::string sequence;
+        if (queries.size() % 2 == 0 && sa.size() > length + 1) {
+            const size_t position = rng() % (sa.size() - length);
+            if (!sa.text().withinRecord(position, length)) {
+                continue;
+            }
+            sequence = sa.text().substr(position, length);
+        } else {
+            for (size_t i = 0; i < length; i += 1) {
+                sequence.push_back("ACGT"[rng() % 4]);
+            }
+        }
+        queries.push_back({std::to_string(queries.size()), std::move(sequence), {}});
+    }
+    return queries;
+}
+
+/**
+ * @brief Every benchmark over one reference.
+ *
+ * @param label reference name used as the first part of each benchmark name
+ * @param reference bases of the reference; ignored if `referencePath` is set
+ * @param referencePath FASTA file to index instead of `reference`
+ */
+void benchmarkReference(Bench &bench, std::string const& label, std::string const& reference,
+    std::string const& referencePath, size_t numQueries, size_t queryLength) {
+
+    using suffixarray::SuffixArray;
+    auto build = [&](suffixarray::BuildOptions const& options) {
+        return referencePath.empty() ? SuffixArray::fromString(reference, options)
+            : SuffixArray::fromFASTAFile(referencePath, options);
+    };
+
+    /* one full index serves everything after the build benchmarks */
+    const suffixarray::BuildOptions fullOptions{12, true, 0};
+    SuffixArray sa = build(fullOptions);
+    const size_t n = sa.size();
+    std::cout << "\n" << label << ": " << n << " bases\n";
+
+    /* build */
+    bench.run(label + "/build/suffixes", n, [&] { sink = sink + build({}).size(); });
+    bench.run(label + "/build/suffixes+lcp", n, [&] { sink = sink + build({0, true}).size(); });
+    for (const size_t k : {12, 20}) {
+        bench.run(label + "/build/prefixtable/k:" + std::to_string(k), n, [&] {
+            sink = sink + suffixarray::PrefixTable::build(sa.text(), sa.suffixes(), k).length(); });
+    }
+    bench.run(label + "/build/suffixes+sampletree:12", n, [&] {
+        sink = sink + build({0, false, 12}).getSampleTreeLevels(); });
+
+    /* save, and load either as a lazy mapping or read fully into memory */
+    const std::string indexPath = (std::filesystem::temp_directory_path() / ("bench-" + std::to_string(::getpid())
+        + ".sa")).string();
+    sa.save(indexPath);
+    const size_t fileSize = std::filesystem::file_size(indexPath);
+    bench.run(label + "/save/bytes", fileSize, [&] { sa.save(indexPath); });
+    bench.run(label + "/load/mapped/bytes", fileSize, [&] {
+        sink = sink + SuffixArray::fromSave(indexPath, false).size(); });
+    bench.run(label + "/load/preloaded/bytes", fileSize, [&] {
+        sink = sink + SuffixArray::fromSave(indexPath, true).size(); });
+    bench.run(label + "/load/verified/bytes", fileSize, [&] {
+        sink = sink + SuffixArray::fromSave(indexPath, false, true).size(); });
+
+    /* bit packed suffixes; rates are per byte of the uncompressed file so that they compare directly */
+    sa.save(indexPath, true);
+    if (bench.enabled(label + "/save/compressed/bytes") || bench.enabled(label + "/load/compressed/bytes")) {
+        std::cout << label << ": compressed index is " << std::filesystem::file_size(indexPath) << " of " << fileSize
+            << " bytes\n";
+    }
+    bench.run(label + "/save/compressed/bytes", fileSize, [&] { sa.save(indexPath, true); });
+    bench.run(label + "/load/compressed/bytes", fileSize, [&] {
+        sink = sink + SuffixArray::fromSave(indexPath, false).size(); });
+    std::filesystem::remove(indexPath);
+
+    /* comparison kernels and prefix table lookups, against where each query came from or a random suffix */
+    auto queries = makeQueries(sa, numQueries, queryLength, n);
+    const std::string text = sa.text().unpack();
+    std::mt19937_64 rng(n + 1);
+    std::vector<size_t> positions(queries.size());
+    std::vector<suffixarray::PackedQuery> packed;
+    std::vector<std::string> copies;
+    for (size_t i = 0; i < queries.size(); i += 1) {
+        positions[i] = sa.suffixes()[rng() % n];
+        packed.push_back(suffixarray::PackedText::packQuery(queries[i].query));
+        copies.push_back(queries[i].query);
+    }
+    const std::string length = std::to_string(queryLength);
+    bench.run(label + "/kernel/comparePrefix/chars:" + length, queries.size(), [&] {
+        for (size_t i = 0; i < queries.size(); i += 1) {
+            sink = sink + utilities::comparePrefix(queries[i].query, std::string_view(text).substr(positions[i])).second;
+        } });
+    bench.run(label + "/kernel/comparePrefix/packed:" + length, queries.size(), [&] {
+        for (size_t i = 0; i < queries.size(); i += 1) {
+            sink = sink + sa.text().comparePrefix(packed[i], positions[i]).second;
+        } });
+    bench.run(label + "/kernel/mismatchLength/equal:" + length, queries.size(), [&] {
+        for (size_t i = 0; i < queries.size(); i += 1) {
+            sink = sink + utilities::mismatchLength(queries[i].query.data(), copies[i].data(), queryLength);
+        } });
+    for (const size_t k : {8, 12, 20}) {
+        const auto table = suffixarray::PrefixTable::build(sa.text(), sa.suffixes(), k);
+        bench.run(label + "/prefixtable/range/k:" + std::to_string(k), queries.size(), [&] {
+            for (auto const& q : queries) {
+                sink = sink + static_cast<uint64_t>(table.range(q.query).second);
+            } });
+    }
+
+    /* queries: throughput and single query latency per mode */
+    const std::vector<std::pair<std::string, SuffixArray::QueryMode>> modes{{"naive", SuffixArray::Naive},
+        {"simpleaccel", SuffixArray::SimpleAccelerant}, {"lcpaccel", SuffixArray::LCPAccelerated}};
+    for (auto const& [modeName, mode] : modes) {
+        const std::string name = label + "/query/" + modeName;
+        bench.run(name, queries.size(), [&] { sa.queries(std::begin(queries), std::end(queries), mode); });
+        /* one search at a time per thread, without the interleaving of queries() */
+        bench.run(name + "/independent", queries.size(), [&] {
+            std::for_each(utilities::executionPolicy, std::begin(queries), std::end(queries), [&](auto &q) {
+                sa.query(q, mode); }); });
+
+        std::vector<double> latencies;
+        if (bench.enabled(name + "/latency")) {
+            for (auto &q : queries) {
+                utilities::Timer timer;
+                timer.start();
+                sa.query(q, mode);
+                timer.stop();
+                latencies.push_back(timer.nanosecondsElapsed());
+            }
+        }
+        bench.latency(name + "/latency", std::move(latencies));
+    }
+
+    /* queries per second as threads are added */
+    #if defined(_OPENMP)
+    const int maxThreads = omp_get_max_threads();
+    for (int threads = 1; ; threads = std::min(2 * threads, maxThreads)) {
+        omp_set_num_threads(threads);
+        bench.run(label + "/query/simpleaccel/threads:" + std::to_string(threads), queries.size(), [&] {
+            sa.queries(std::begin(queries), std::end(queries), SuffixArray::SimpleAccelerant); });
+        if (threads == maxThreads) {
+            break;
+        }
+    }
+    omp_set_num_threads(maxThreads);
+    #endif
+}
+
+/**
+ * @brief Comma separated sizes, each with an optional K or M suffix.
+ */
+std::vector<size_t> parseSizes(std::string const& list) {
+    std::vector<size_t> sizes;
+    std::istringstream stream(list);
+    for (std::string item; std::getline(stream, item, ',');) {
+        size_t end = 0;
+        size_t size = std::stoul(item, &end);
+        const std::string suffix = item.substr(end);
+        if (suffix == "K" || suffix == "k") {
+            size <<= 10;
+        } else if (suffix == "M" || suffix == "m") {
+            size <<= 20;
+        } else if (!suffix.empty()) {
+            throw std::invalid_argument("Bad size " + item);
+        }
+        sizes.push_back(size);
+    }
+    return sizes;
+}
+
+int main(int argc, char **argv) {
+    parseargs::ParseArgs args(argc, argv);
+
+    size_t repetitions, numQueries, queryLength;
+    std::string filter, referencePath;
+    std::vector<size_t> sizes;
+    try {
+        repetitions = static_cast<size_t>(args.getInteger("repetitions", 5));
+        numQueries = static_cast<size_t>(args.getInteger("queries", 100000));
+        queryLength = static_cast<size_t>(args.getInteger("query-length", 50));
+        filter = args.getString("filter", "");
+        referencePath = args.getString("reference", "");
+        sizes = parseSizes(args.getString("sizes", "1M,16M"));
+    } catch (std::invalid_argument const& e) {
+        std::cerr << "Usage: " << argv[0] << " <?--repetitions N> <?--filter substring> <?--sizes 1M,16M> "
+            << "<?--reference fasta> <?--queries N> <?--query-length L>\n";
+        std::exit(1);
+    }
+
+    Bench bench(repetitions, filter);
+    Bench::printHeader();
+    for (const size_t size : sizes) {
+        const std::string label = "random/" + (size % (1 << 20) == 0 ? std::to_string(size >> 20) + "M"
+            : std::to_string(size));
+        benchmarkReference(bench, label, syntheticReference(size, size), "", numQueries, queryLength);
+    }
+    if (!referencePath.empty()) {
+        benchmarkReference(bench, std::filesystem::path(referencePath).filename().string(), "", referencePath,
+            numQueries, queryLength);
+    }
+}
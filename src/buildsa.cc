@@ -8,33 +8,112 @@
 
 /* stl includes */
 #include <cstdlib>      // exit
-#include <exception>    // invalid_argument
+#include <exception>    // exception, invalid_argument
 #include <filesystem>   // file_size
 #include <iostream>     // cerr, cout
 #include <string>       // string
+#include <vector>       // vector
 
 /* local includes */
+#include "fasta.h"          // read, Reference
+#include "fmindex.h"        // FMIndex
 #include "parseargs.h"      // ParseArgs
-#include "suffixarray.h"    // SuffixArray
+#include "suffixarray.h"    // SuffixArray, SuffixArray40, SuffixArray64
 
-int main(int argc, char **argv) {
+/**
+ * @brief Build a suffix array of type SA over the records of `reference`, save it, and print its build statistics.
+ */
+template <typename SA>
+void buildAndSave(fasta::Reference &&reference, suffixarray::BuildOptions const& options, std::string const& outputPath,
+    bool compress) {
+    auto suffixArray = SA::fromReference(std::move(reference), options);
+    suffixArray.save(outputPath, compress);
+
+    if (suffixArray.getRefinedPrefixLength() != 0 || options.prefixTableLength == suffixarray::AUTO_PREFIX_TABLE) {
+        std::cerr << "Prefix table: k=" << suffixArray.getPrefixTableSize() << ", buckets over "
+            << suffixarray::PrefixTable::MAX_BUCKET_SIZE << " refined to k="
+            << suffixArray.getRefinedPrefixLength() << ", " << suffixArray.getPrefixTableBytes() << " bytes\n";
+    }
+    if (suffixArray.getSuffixSampling() != 1) {
+        std::cerr << "Sparse suffix array: every " << suffixArray.getSuffixSampling() << "th suffix, "
+            << suffixArray.suffixes().size() << " of " << suffixArray.size() << "; queries need at least "
+            << suffixArray.getSuffixSampling() << " bases\n";
+    }
+    std::cout << suffixArray.size() << "," << suffixArray.getPrefixTableSize() << "," << suffixArray.getSuffixArrayBuildTime()
+        << "," << suffixArray.getPrefixTableBuildTime() << "," << std::filesystem::file_size(outputPath) << "\n";
+}
+
+int main(int argc, char **argv) try {
     parseargs::ParseArgs args(argc, argv, {"reference", "output"});
 
-    int preftab;
+    int preftab, preftabRefine, preftabBudget, sampleRate, indexWidth, sampleTree, sparse;
+    bool lcp, fm, collapseN, compress;
     std::string referencePath, outputPath;
     try {
-        preftab = args.getInteger("preftab", 0);
+        const std::string preftabStr = args.getString("preftab", "0");
+        preftab = (preftabStr == "auto") ? suffixarray::AUTO_PREFIX_TABLE : std::stoi(preftabStr);
+        preftabRefine = args.getInteger("preftab-refine", 0);
+        preftabBudget = args.getInteger("preftab-budget", 0);
+        if (preftabBudget < 0) {
+            throw std::invalid_argument("preftab-budget must not be negative");
+        }
+        sampleTree = args.getInteger("sample-tree", 0);
+        sparse = args.getInteger("sparse", 1);
+        if (sparse < 1) {
+            throw std::invalid_argument("sparse must be positive");
+        }
+        lcp = args.has("lcp");
+        fm = args.has("fm");
+        collapseN = args.has("collapse-n");
+        compress = args.has("compress");
+        sampleRate = args.getInteger("sample-rate", suffixarray::FMIndex::DEFAULT_SAMPLE_RATE);
+        indexWidth = args.getInteger("index-width", 0);
         referencePath = args.getString("reference");
         outputPath = args.getString("output");
     } catch (std::invalid_argument const& e) {
-        std::cerr << "Usage: " << argv[0] << " reference output <?--preftab>\n";
+        std::cerr << "Usage: " << argv[0] << " reference output <?--preftab K|auto> <?--preftab-refine K2> <?--preftab-budget MiB> <?--lcp> <?--sample-tree L> <?--sparse Q> <?--collapse-n> <?--fm> <?--sample-rate S> <?--index-width 32|40|64> <?--compress>\n";
         std::exit(1);
     }
 
+    auto reference = fasta::read(referencePath);
+    if (indexWidth == 0) {
+        /* 32-bit indices whenever they fit, otherwise 5 bytes per suffix */
+        indexWidth = (static_cast<int64_t>(reference.sequence.size()) < suffixarray::SuffixArray::MAX_LENGTH) ? 32 : 40;
+    }
 
-    auto suffixArray = suffixarray::SuffixArray::fromFASTAFile(referencePath, preftab);
-    suffixArray.save(outputPath);
 
-    std::cout << suffixArray.data().size() << "," << preftab << "," << suffixArray.getSuffixArrayBuildTime()
-        << "," << suffixArray.getPrefixTableBuildTime() << "," << std::filesystem::file_size(outputPath) << "\n";
+    const auto ambiguousBases = collapseN ? suffixarray::AmbiguousBases::Collapse : suffixarray::AmbiguousBases::Random;
+    if (fm) {
+        /* only the FM-index is written; the suffix array is just the input to building it */
+        auto suffixArray = suffixarray::SuffixArray::fromReference(std::move(reference), {.ambiguousBases = ambiguousBases});
+        auto fmIndex = suffixarray::FMIndex::fromSuffixArray(suffixArray, sampleRate);
+        if (compress) {
+            std::cerr << "Warning: FM-index samples are not compressed; ignoring --compress.\n";
+        }
+        if (sparse != 1) {
+            std::cerr << "Warning: FM-indexes sample their suffix array with --sample-rate; ignoring --sparse.\n";
+        }
+        fmIndex.save(outputPath);
+
+        std::cout << fmIndex.size() << "," << 0 << "," << suffixArray.getSuffixArrayBuildTime()
+            << "," << fmIndex.getBuildTime() << "," << std::filesystem::file_size(outputPath) << "\n";
+        return 0;
+    }
+
+    const suffixarray::BuildOptions options{.prefixTableLength = preftab, .lcp = lcp, .sampleTreeLevels = sampleTree,
+        .ambiguousBases = ambiguousBases, .refinedPrefixLength = preftabRefine,
+        .prefixTableBudget = static_cast<uint64_t>(preftabBudget) << 20, .suffixSampling = sparse};
+    if (indexWidth == 32) {
+        buildAndSave<suffixarray::SuffixArray>(std::move(reference), options, outputPath, compress);
+    } else if (indexWidth == 40) {
+        buildAndSave<suffixarray::SuffixArray40>(std::move(reference), options, outputPath, compress);
+    } else if (indexWidth == 64) {
+        buildAndSave<suffixarray::SuffixArray64>(std::move(reference), options, outputPath, compress);
+    } else {
+        std::cerr << "Unsupported --index-width " << indexWidth << "; expected 32, 40, or 64.\n";
+        std::exit(1);
+    }
+} catch (std::exception const& e) {
+    std::cerr << e.what() << "\n";
+    return 1;
 }
\ No newline at end of file
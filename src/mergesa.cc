@@ -0,0 +1,105 @@
+/**
+ * @file mergesa.cc
+ * @author Daniel Nichols
+ * @brief Merge the suffix array shards listed in a manifest into a single index without sorting them again.
+ * @date 2022-04-30
+ */
+
+/* stl includes */
+#include <cstdlib>      // exit
+#include <exception>    // exception, invalid_argument
+#include <filesystem>   // file_size
+#include <iostream>     // cerr, cout
+#include <span>         // span
+#include <string>       // string
+
+/* local includes */
+#include "parseargs.h"      // ParseArgs
+#include "shards.h"         // ShardedIndex
+#include "suffixarray.h"    // SuffixArray, SuffixArray40, SuffixArray64
+
+/**
+ * @brief Merge `shards` into a suffix array of type SA, save it, and print its build statistics.
+ */
+template <typename SA, typename Shard>
+void mergeAndSave(std::vector<Shard> const& shards, suffixarray::BuildOptions const& options, std::string const& outputPath,
+    bool compress) {
+    auto suffixArray = SA::merged(std::span<const Shard>(shards), options);
+    suffixArray.save(outputPath, compress);
+
+    std::cout << suffixArray.size() << "," << suffixArray.getPrefixTableSize() << "," << suffixArray.getSuffixArrayBuildTime()
+        << "," << suffixArray.getPrefixTableBuildTime() << "," << std::filesystem::file_size(outputPath) << "\n";
+}
+
+/**
+ * @brief Load the shards of the manifest at `shardsPath`, saved with Shard's width, and merge them into an index
+ * `indexWidth` bits wide; 0 for the narrowest that fits.
+ */
+template <typename Shard>
+void mergeShards(std::string const& shardsPath, suffixarray::BuildOptions const& options, std::string const& outputPath,
+    bool compress, int indexWidth) {
+    using namespace suffixarray;
+
+    const auto sharded = ShardedIndex<Shard>::fromSave(shardsPath);
+    if (indexWidth == 0) {
+        indexWidth = (static_cast<int64_t>(sharded.size()) <= SuffixArray::MAX_LENGTH) ? 32 : 40;
+    }
+    if (indexWidth == 32) {
+        mergeAndSave<SuffixArray>(sharded.shards(), options, outputPath, compress);
+    } else if (indexWidth == 40) {
+        mergeAndSave<SuffixArray40>(sharded.shards(), options, outputPath, compress);
+    } else if (indexWidth == 64) {
+        mergeAndSave<SuffixArray64>(sharded.shards(), options, outputPath, compress);
+    } else {
+        std::cerr << "Unsupported --index-width " << indexWidth << "; expected 32, 40, or 64.\n";
+        std::exit(1);
+    }
+}
+
+int main(int argc, char **argv) try {
+    using namespace suffixarray;
+
+    parseargs::ParseArgs args(argc, argv, {"shards", "output"});
+
+    int preftab, preftabRefine, preftabBudget, indexWidth, sampleTree, sparse;
+    bool lcp, compress;
+    std::string shardsPath, outputPath;
+    try {
+        const std::string preftabStr = args.getString("preftab", "0");
+        preftab = (preftabStr == "auto") ? AUTO_PREFIX_TABLE : std::stoi(preftabStr);
+        preftabRefine = args.getInteger("preftab-refine", 0);
+        preftabBudget = args.getInteger("preftab-budget", 0);
+        if (preftabBudget < 0) {
+            throw std::invalid_argument("preftab-budget must not be negative");
+        }
+        sampleTree = args.getInteger("sample-tree", 0);
+        sparse = args.getInteger("sparse", 1);
+        if (sparse < 1) {
+            throw std::invalid_argument("sparse must be positive");
+        }
+        lcp = args.has("lcp");
+        compress = args.has("compress");
+        indexWidth = args.getInteger("index-width", 0);
+        shardsPath = args.getString("shards");
+        outputPath = args.getString("output");
+    } catch (std::invalid_argument const& e) {
+        std::cerr << "Usage: " << argv[0] << " shards output <?--preftab K|auto> <?--preftab-refine K2> <?--preftab-budget MiB> <?--lcp> <?--sample-tree L> <?--sparse Q> <?--index-width 32|40|64> <?--compress>\n";
+        std::exit(1);
+    }
+
+    const BuildOptions options{.prefixTableLength = preftab, .lcp = lcp, .sampleTreeLevels = sampleTree,
+        .refinedPrefixLength = preftabRefine, .prefixTableBudget = static_cast<uint64_t>(preftabBudget) << 20,
+        .suffixSampling = sparse};
+    /* the shards' width decides which SuffixArray type can map them; the merged index may be wider */
+    switch (ShardedIndex<SuffixArray>::savedSuffixWidth(shardsPath)) {
+        case sizeof(int32_t): mergeShards<SuffixArray>(shardsPath, options, outputPath, compress, indexWidth); break;
+        case sizeof(packedint::Int40): mergeShards<SuffixArray40>(shardsPath, options, outputPath, compress, indexWidth); break;
+        case sizeof(int64_t): mergeShards<SuffixArray64>(shardsPath, options, outputPath, compress, indexWidth); break;
+        default:
+            std::cerr << "Unsupported suffix width in the shards of \"" << shardsPath << "\".\n";
+            std::exit(1);
+    }
+} catch (std::exception const& e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+}
@@ -6,86 +6,390 @@
  * 
  */
 
+#include <algorithm>
+#include <exception>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <ranges>
 
+#include "contigs.h"        // ContigTable
+#include "counters.h"       // Snapshot, snapshot, ENABLED
+#include "executor.h"       // Executor, Worker
+#include "fasta.h"          // QueryReader
+#include "fmindex.h"        // FMIndex
+#include "numa.h"           // Placement, Topology, interleaved, boundTo
 #include "parseargs.h"      // ParseArgs
-#include "suffixarray.h"    // SuffixArray
-#include "utilities.h"      // parseFastaQueries
+#include "pipeline.h"       // run
+#include "querybatch.h"     // QueryBatch
+#include "queryserver.h"    // QueryServer
+#include "results.h"        // Format, ResultWriter
+#include "shards.h"         // ShardedIndex
+#include "strands.h"        // searchBothStrands
+#include "suffixarray.h"    // SuffixArray, SuffixArray40, SuffixArray64
+#include "utilities.h"      // Timer
+
+/* queries read, searched, and written at a time */
+constexpr size_t DEFAULT_BATCH_SIZE = size_t(1) << 16;
+
+/* exact queries an executor worker searches together, a few rounds of interleaved searches */
+constexpr size_t INTERLEAVED_GROUP = 64;
+
+/**
+ * @brief Everything from the command line besides the index.
+ */
+struct QueryOptions {
+    std::string queriesPath, queryModeStr, outputPath;
+    results::Format format;
+    int64_t maxResults;
+    uint32_t maxMismatches;
+    bool preload, verify, coords, sortQueries, bothStrands, serve, counters;
+    size_t batchSize;
+    /* --threads, --pin, and --numa search on an executor::Executor instead of the OpenMP thread pool */
+    bool useExecutor, pin;
+    size_t numThreads;  // 0 for one per allowed cpu
+    numa::Placement placement;
+    numa::Topology topology;
+};
 
 /* forward declarations */
-std::vector<suffixarray::SuffixArray::Query> parseFastaQueries(std::string const& fname);
+template <typename Query, typename Batch, typename Search> void runQueries(QueryOptions const& options,
+    suffixarray::ContigTable const& contigs, size_t indexSize, size_t prefixTableSize, Search &&search);
+template <typename Batch, typename Search> std::pair<size_t, double> streamQueries(std::string const& queriesPath,
+    std::string const& outputPath, results::Format format, suffixarray::ContigTable const* coords, bool stranded,
+    size_t batchSize, Search &&search);
+void printStats(size_t indexSize, size_t prefixTableSize, std::string const& queryModeStr, size_t numQueries, double duration);
+
+/**
+ * @brief Copies of `suffixArray` for the executor's workers to search: none for Placement::Default, one
+ * interleaved over every node, or one bound to each node that worker.node indexes.
+ */
+template <typename SA>
+std::vector<SA> placeIndex(SA const& suffixArray, numa::Placement placement, numa::Topology const& topology) {
+    std::vector<SA> copies;
+    if (placement == numa::Placement::Interleave) {
+        copies.push_back(suffixArray.copied([&topology](auto const& storage) {
+            return numa::interleaved(storage, topology); }));
+    } else if (placement == numa::Placement::Replicate) {
+        for (const int node : topology.nodes) {
+            copies.push_back(suffixArray.copied([node](auto const& storage) { return numa::boundTo(storage, node); }));
+        }
+    }
+    return copies;
+}
+
+/**
+ * @brief Run every query against a saved suffix array of type SA, or a ShardedIndex of them, print the timing,
+ * and write the results.
+ */
+template <typename SA>
+void querySuffixArray(std::string const& indexPath, QueryOptions const& options) {
+    /* index is memory mapped; --preload faults it all in up front instead of during the first queries */
+    auto suffixArray = SA::fromSave(indexPath, options.preload, options.verify);
+    typename SA::QueryMode queryMode = SA::SimpleAccelerant;
+    if (options.queryModeStr == "naive") {
+        queryMode = SA::Naive;
+    } else if (options.queryModeStr == "lcpaccel") {
+        queryMode = SA::LCPAccelerated;
+        if (!suffixArray.hasLCP()) {
+            std::cerr << "Warning: index was built without --lcp; using simpleaccel instead.\n";
+        }
+    }
+
+    std::unique_ptr<executor::Executor> pool;
+    std::vector<SA> replicas;
+    if (options.useExecutor) {
+        pool = std::make_unique<executor::Executor>(options.numThreads, options.pin, options.topology);
+        replicas = placeIndex(suffixArray, options.placement, options.topology);
+    }
+
+    /* a sparse index cannot see every occurrence of a query, or approximate seed, shorter than its sampling rate */
+    size_t numShort = 0;
+    const size_t minLength = (options.maxMismatches + 1) * suffixArray.getSuffixSampling();
+    runQueries<typename SA::Query, querybatch::QueryBatch<typename SA::position_type>>(options, suffixArray.contigs(), suffixArray.size(), suffixArray.getPrefixTableSize(),
+        [&](auto &queries) {
+            if (suffixArray.getSuffixSampling() != 1) {
+                numShort += static_cast<size_t>(std::count_if(std::begin(queries), std::end(queries),
+                    [minLength](auto const& q) { return q.query.size() < minLength; }));
+            }
+            auto indexFor = [&](executor::Worker const& worker) -> SA const& {
+                return replicas.empty() ? suffixArray : replicas[worker.node % replicas.size()];
+            };
+            if (pool && options.maxMismatches != 0) {
+                pool->run(queries.size(), [&](size_t i, executor::Worker const& worker) {
+                    indexFor(worker).approximateQuery(queries[i], options.maxMismatches, queryMode, options.maxResults);
+                });
+            } else if (pool) {
+                /* groups of queries, so that each can interleave its searches */
+                const size_t numGroups = (queries.size() + INTERLEAVED_GROUP - 1) / INTERLEAVED_GROUP;
+                pool->run(numGroups, [&](size_t group, executor::Worker const& worker) {
+                    const auto first = std::next(std::begin(queries), group * INTERLEAVED_GROUP);
+                    const auto last = std::next(first, std::min(INTERLEAVED_GROUP, queries.size() - group * INTERLEAVED_GROUP));
+                    indexFor(worker).serialQueries(first, last, queryMode, options.maxResults);
+                });
+            } else if (options.maxMismatches != 0) {
+                suffixArray.approximateQueries(std::begin(queries), std::end(queries), options.maxMismatches, queryMode,
+                    options.maxResults);
+            } else if (options.sortQueries) {
+                suffixArray.sortedQueries(std::begin(queries), std::end(queries), queryMode, options.maxResults);
+            } else {
+                suffixArray.queries(std::begin(queries), std::end(queries), queryMode, options.maxResults);
+            }
+        });
+    if (numShort != 0) {
+        std::cerr << "Warning: " << numShort << " searches had fewer than " << minLength << " bases, which an index of every "
+            << suffixArray.getSuffixSampling() << "th suffix needs to find every occurrence; their results may be incomplete.\n";
+    }
+}
 
-int main(int argc, char **argv) {
+/**
+ * @brief Run every query against a saved FM-index. FM-indexes have a single search method, so there is no mode.
+ */
+void queryFMIndex(std::string const& indexPath, QueryOptions options) {
+    if (options.maxMismatches != 0) {
+        std::cerr << "--mismatches needs the text to verify candidates, which an FM-index does not keep.\n";
+        std::exit(1);
+    }
+    auto fmIndex = suffixarray::FMIndex::fromSave(indexPath, options.preload, options.verify);
+    options.queryModeStr = "fm";
+    std::unique_ptr<executor::Executor> pool;
+    if (options.useExecutor) {
+        pool = std::make_unique<executor::Executor>(options.numThreads, options.pin, options.topology);
+    }
+    runQueries<suffixarray::FMIndex::Query, querybatch::QueryBatch<suffixarray::SuffixArray::position_type>>(options, fmIndex.contigs(), fmIndex.size(), 0, [&](auto &queries) {
+        if (pool) {
+            pool->run(queries.size(), [&](size_t i, executor::Worker const&) {
+                fmIndex.query(queries[i], options.maxResults); });
+        } else {
+            fmIndex.queries(std::begin(queries), std::end(queries), options.maxResults);
+        }
+    });
+}
+
+int main(int argc, char **argv) try {
     using namespace suffixarray;
 
     parseargs::ParseArgs args(argc, argv, {"index", "queries", "query mode", "output"});
 
-    std::string indexPath, queriesPath, queryModeStr, outputPath;
+    std::string indexPath;
+    QueryOptions options;
     try {
         indexPath = args.getString("index");
-        queriesPath = args.getString("queries");
-        queryModeStr = args.getString("query mode");
-        outputPath = args.getString("output");
+        options.queriesPath = args.getString("queries");
+        options.queryModeStr = args.getString("query mode");
+        options.serve = args.has("serve");
+        options.outputPath = options.serve ? args.getString("output", "+") : args.getString("output");
+        options.maxResults = args.has("count") ? 0 : args.getInteger("limit", SuffixArray::ALL_RESULTS);
+        const int32_t maxMismatches = args.getInteger("mismatches", 0);
+        if (maxMismatches < 0) {
+            throw std::invalid_argument("mismatches must not be negative");
+        }
+        options.maxMismatches = static_cast<uint32_t>(maxMismatches);
+        const int32_t batchSize = args.getInteger("batch-size", static_cast<int32_t>(DEFAULT_BATCH_SIZE));
+        if (batchSize <= 0) {
+            throw std::invalid_argument("batch-size must be positive");
+        }
+        options.batchSize = static_cast<size_t>(batchSize);
+        const std::string formatStr = args.getString("format", "text");
+        if (formatStr != "text" && formatStr != "binary") {
+            throw std::invalid_argument("format must be text or binary");
+        }
+        options.format = (formatStr == "binary") ? results::Format::Binary : results::Format::Text;
+        const int32_t numThreads = args.getInteger("threads", 0);
+        if (numThreads < 0) {
+            throw std::invalid_argument("threads must not be negative");
+        }
+        options.numThreads = static_cast<size_t>(numThreads);
+        options.placement = numa::parsePlacement(args.getString("numa", "default"));
     } catch (std::invalid_argument const& e) {
-        std::cerr << "Usage: " << argv[0] << " index queries query-mode output\n";
+        std::cerr << "Usage: " << argv[0] << " index queries query-mode output <?--preload> <?--verify> <?--count> <?--limit N> <?--coords> <?--sort-queries> <?--mismatches K> <?--both-strands> <?--batch-size N> <?--format text|binary> <?--counters> <?--threads N> <?--pin> <?--numa interleave|replicate>\n"
+            << "       " << argv[0] << " index stdin|socket-path query-mode --serve <?--preload> <?--verify> <?--count> <?--limit N> <?--coords> <?--sort-queries> <?--mismatches K> <?--both-strands> <?--threads N> <?--pin> <?--numa interleave|replicate>\n";
         std::exit(1);
     }
+    options.preload = args.has("preload");
+    options.verify = args.has("verify");
+    options.coords = args.has("coords");
+    options.sortQueries = args.has("sort-queries");
+    options.bothStrands = args.has("both-strands");
+    options.counters = args.has("counters");
+    options.pin = args.has("pin");
+    options.useExecutor = args.has("threads") || options.pin || options.placement != numa::Placement::Default;
+    options.topology = numa::Topology::detect();
+    if (options.coords && options.format == results::Format::Binary) {
+        std::cerr << "Warning: binary results always store text positions; ignoring --coords.\n";
+    }
+    if (options.sortQueries && options.maxMismatches != 0) {
+        std::cerr << "Warning: approximate queries are searched seed by seed; ignoring --sort-queries.\n";
+    }
+    if (options.serve && options.format == results::Format::Binary) {
+        std::cerr << "Warning: the query server only answers in text; ignoring --format binary.\n";
+    }
+    if (options.counters && !counters::ENABLED) {
+        std::cerr << "Warning: querysa was built without COUNTERS=1; ignoring --counters.\n";
+    }
 
-    auto suffixArray = SuffixArray::fromSave(indexPath);
-    SuffixArray::QueryMode queryMode = (queryModeStr == "naive") ? SuffixArray::Naive : SuffixArray::SimpleAccelerant;
-    utilities::Timer timer;
-
-    /* perform queries */
-    auto queries = parseFastaQueries(queriesPath);
-    timer.start();
-    suffixArray.queries(std::begin(queries), std::end(queries), queryMode);
-    timer.stop();
-    const auto duration = timer.millisecondsElapsed();
-    const auto avgDuration = duration / queries.size();
-    std::cout << suffixArray.data().size() << "," << suffixArray.getPrefixTableSize() << ","
-        << queryModeStr << "," << queries.size() << "," << duration << "," << avgDuration << "\n";
-    
-    if (outputPath != "+") {
-        std::ofstream outputFile(outputPath);
-        for (auto const& q : queries) {
-            outputFile << q.title << '\t' << q.result.size();
-            for (auto const& index : q.result) {
-                outputFile << '\t' << index;
-            }
-            outputFile << '\n';
+    if (options.useExecutor && options.sortQueries && options.maxMismatches == 0) {
+        std::cerr << "Warning: sorted queries are searched in runs on the OpenMP threads; ignoring --sort-queries.\n";
+        options.sortQueries = false;
+    }
+    if (options.placement != numa::Placement::Default && options.topology.size() == 1) {
+        std::cerr << "Warning: the allowed cpus are all on one NUMA node; ignoring --numa.\n";
+        options.placement = numa::Placement::Default;
+    }
+
+    if (ShardedIndex<SuffixArray>::isManifest(indexPath)) {
+        /* shards all have the same width, which decides the SuffixArray type of each */
+        switch (ShardedIndex<SuffixArray>::savedSuffixWidth(indexPath)) {
+            case sizeof(int32_t): querySuffixArray<ShardedIndex<SuffixArray>>(indexPath, options); break;
+            case sizeof(packedint::Int40): querySuffixArray<ShardedIndex<SuffixArray40>>(indexPath, options); break;
+            case sizeof(int64_t): querySuffixArray<ShardedIndex<SuffixArray64>>(indexPath, options); break;
+            default:
+                std::cerr << "Unsupported suffix width in the shards of \"" << indexPath << "\".\n";
+                std::exit(1);
         }
-        outputFile.flush();
-        outputFile.close();
+        return 0;
+    }
+
+    if (FMIndex::isIndexFile(indexPath)) {
+        if (options.placement != numa::Placement::Default) {
+            std::cerr << "Warning: FM-indexes are searched where they are mapped; ignoring --numa.\n";
+            options.placement = numa::Placement::Default;
+        }
+        queryFMIndex(indexPath, options);
+        return 0;
     }
+
+    /* the width of the stored suffixes decides which SuffixArray type can map the file */
+    switch (SuffixArray::savedSuffixWidth(indexPath)) {
+        case sizeof(int32_t): querySuffixArray<SuffixArray>(indexPath, options); break;
+        case sizeof(packedint::Int40): querySuffixArray<SuffixArray40>(indexPath, options); break;
+        case sizeof(int64_t): querySuffixArray<SuffixArray64>(indexPath, options); break;
+        default:
+            std::cerr << "Unsupported suffix width in \"" << indexPath << "\".\n";
+            std::exit(1);
+    }
+} catch (std::exception const& e) {
+    /* failures reading or writing files, or running out of memory, end the run like a usage error */
+    std::cerr << e.what() << "\n";
+    return 1;
 }
 
 
-std::vector<suffixarray::SuffixArray::Query> parseFastaQueries(std::string const& fname) {
-    std::ifstream inputFile(fname);
-    if (!inputFile) {
-        throw std::ios_base::failure("Could not open " + fname + " for reading.");
+/**
+ * @brief Answer the queries with `search`: stream the query file through it and print the timing, or with
+ * --serve keep answering batches from stdin or a Unix socket. With --both-strands every batch is searched
+ * alongside its reverse complements. With --counters the search counters of the streamed batches are written to
+ * stderr at the end.
+ *
+ * @tparam Query query type of the server's std::vector<Query> batches
+ * @tparam Batch querybatch::QueryBatch type the query file is read into
+ * @param search called with each batch, of either type, to fill in its results
+ */
+template <typename Query, typename Batch, typename Search>
+void runQueries(QueryOptions const& options, suffixarray::ContigTable const& contigs, size_t indexSize,
+    size_t prefixTableSize, Search &&singleStrandSearch) {
+
+    auto search = [&options, &singleStrandSearch](auto &queries) {
+        if (options.bothStrands) {
+            suffixarray::searchBothStrands(queries, options.maxResults, singleStrandSearch);
+        } else {
+            singleStrandSearch(queries);
+        }
+    };
+    suffixarray::ContigTable const* coords = options.coords ? &contigs : nullptr;
+    if (options.serve) {
+        server::QueryServer<Query> queryServer(search, coords, options.bothStrands);
+        if (options.queriesPath == "stdin") {
+            queryServer.serve(STDIN_FILENO, STDOUT_FILENO);
+        } else {
+            queryServer.listen(options.queriesPath);
+        }
+        return;
     }
-    
-    std::vector<suffixarray::SuffixArray::Query> queries;
 
-    std::string line, currentTitle, currentQuery;
-    while (std::getline(inputFile, line)) {
-        if (line.starts_with('>')) {
-            // flush previous query
-            if (currentQuery != "") {
-                queries.push_back({currentTitle, currentQuery, {}});
-                currentQuery = "";
+    /* only the searches count, not loading the index or reading and writing batches */
+    counters::Snapshot searchCounters;
+    auto countedSearch = [&search, &searchCounters](Batch &queries) {
+        const auto before = counters::snapshot();
+        search(queries);
+        searchCounters += counters::snapshot() - before;
+    };
+    const auto [numQueries, duration] = streamQueries<Batch>(options.queriesPath, options.outputPath, options.format,
+        coords, options.bothStrands, options.batchSize, countedSearch);
+    printStats(indexSize, prefixTableSize, options.queryModeStr, numQueries, duration);
+    if (options.counters && counters::ENABLED) {
+        searchCounters.print(std::cerr);
+    }
+}
+
+
+void printStats(size_t indexSize, size_t prefixTableSize, std::string const& queryModeStr, size_t numQueries, double duration) {
+    const auto avgDuration = duration / numQueries;
+    std::cout << indexSize << "," << prefixTableSize << ","
+        << queryModeStr << "," << numQueries << "," << duration << "," << avgDuration << "\n";
+}
+
+
+/**
+ * @brief Search a query file in batches of `batchSize`, overlapping the reading of the next batch and the writing
+ * of the last one with each search, so memory stays bounded by a few batches however many queries there are.
+ * Results are written in the order of the query file. Each batch views its queries in the bytes it was read
+ * into and keeps their results in one pool, so it costs a few allocations however many queries it holds.
+ * @throws std::ios_base::failure if the query file cannot be read or the output file cannot be written
+ *
+ * @param format text or binary results
+ * @param coords contig table to write text positions as `contig:offset`, or nullptr for plain offsets
+ * @param stranded mark each position with its strand
+ * @param search called with each Batch to fill in its results
+ * @return std::pair<size_t, double> number of queries and the milliseconds spent searching them
+ */
+template <typename Batch, typename Search>
+std::pair<size_t, double> streamQueries(std::string const& queriesPath, std::string const& outputPath,
+    results::Format format, suffixarray::ContigTable const* coords, bool stranded, size_t batchSize, Search &&search) {
+
+    fasta::QueryReader reader(queriesPath);
+    std::ofstream outputFile;
+    const bool writeOutput = outputPath != "+";
+    if (writeOutput) {
+        outputFile.open(outputPath, std::ios::binary);
+        if (!outputFile) {
+            throw std::ios_base::failure("Could not open " + outputPath + " for writing.");
+        }
+    }
+    results::ResultWriter writer(outputFile, format, coords, stranded);
+
+    size_t numQueries = 0;
+    double duration = 0.0;
+    pipeline::run<Batch>(
+        [&reader, batchSize]() -> std::optional<Batch> {
+            auto queries = reader.nextBatch<Batch>(batchSize);
+            if (queries.empty()) {
+                return std::nullopt;
+            }
+            return queries;
+        },
+        [&search, &numQueries, &duration](Batch &queries) {
+            utilities::Timer timer;
+            timer.start();
+            search(queries);
+            timer.stop();
+            numQueries += queries.size();
+            duration += timer.millisecondsElapsed();
+        },
+        [&writer, writeOutput](Batch const& queries) {
+            if (writeOutput) {
+                writer.write(queries);
             }
+        });
 
-            // read title
-            currentTitle = line.substr(1);
-        } else {
-            // append to current fasta query
-            currentQuery += line;
+    if (writeOutput) {
+        writer.flush();
+        outputFile.close();
+        if (!outputFile) {
+            throw std::ios_base::failure("Could not write " + outputPath + ".");
         }
     }
-    queries.push_back({currentTitle, currentQuery, {}});
-    
-    return queries;
-}
\ No newline at end of file
+    return {numQueries, duration};
+}
+
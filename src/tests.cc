@@ -5,8 +5,32 @@
  * @date 2022-04-18
  */
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <thread>
 
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "counters.h"
+#include "executor.h"
+#include "fmindex.h"
+#include "numa.h"
+#include "pipeline.h"
+#include "querybatch.h"
+#include "queryserver.h"
+#include "results.h"
+#include "serial.h"
+#include "shards.h"
+#include "strands.h"
 #include "suffixarray.h"
 
 constexpr void ASSERT_EQUAL(auto a, auto b, std::string const& msg) {
@@ -16,10 +40,85 @@ constexpr void ASSERT_EQUAL(auto a, auto b, std::string const& msg) {
     }
 }
 
+/**
+ * @brief Random bases in runs of 40, where about one run in `repeatEvery` is instead a copy of 10 to 199 bases of
+ * `source`, or of the text so far if `source` is empty, and about one run in `separatorEvery` ends its record.
+ * A rate of 0 turns repeats or separators off.
+ */
+std::string repetitiveText(std::mt19937 &rng, size_t length, size_t repeatEvery, size_t separatorEvery,
+    std::string_view source = {}) {
+    std::string text;
+    while (text.size() < length) {
+        const std::string_view from = source.empty() ? std::string_view(text) : source;
+        if (repeatEvery != 0 && rng() % repeatEvery == 0 && from.size() > 200) {
+            const std::string repeat(from.substr(rng() % (from.size() - 200), 10 + rng() % 190));
+            text += repeat;
+        } else {
+            for (size_t i = 0; i < 40; i += 1) {
+                text.push_back("ACGT"[rng() % 4]);
+            }
+        }
+        if (separatorEvery != 0 && rng() % separatorEvery == 0) {
+            text.push_back(fasta::RECORD_SEPARATOR);
+        }
+    }
+    return text;
+}
+
 void test_loadsave();
+void test_queries();
+void test_countlocate();
+void test_fmindex();
+void test_wideindex();
+void test_fasta();
+void test_contigs();
+void test_sortedqueries();
+void test_sampletree();
+void test_compareprefix();
+void test_packedtext();
+void test_ambiguousbases();
+void test_querystream();
+void test_results();
+void test_queryserver();
+void test_approximate();
+void test_strands();
+void test_counters();
+void test_refinedprefixtable();
+void test_indexsections();
+void test_serial();
+void test_sparse();
+void test_executor();
+void test_interleaved();
+void test_shards();
+void test_querybatch();
 
 int main() {
     test_loadsave();
+    test_queries();
+    test_countlocate();
+    test_fmindex();
+    test_wideindex();
+    test_fasta();
+    test_contigs();
+    test_sortedqueries();
+    test_sampletree();
+    test_compareprefix();
+    test_packedtext();
+    test_ambiguousbases();
+    test_querystream();
+    test_results();
+    test_queryserver();
+    test_approximate();
+    test_strands();
+    test_counters();
+    test_refinedprefixtable();
+    test_indexsections();
+    test_serial();
+    test_sparse();
+    test_executor();
+    test_interleaved();
+    test_shards();
+    test_querybatch();
 
     std::cout << "Tests successful!" << std::endl;
 }
@@ -28,12 +127,1466 @@ void test_loadsave() {
     using namespace suffixarray;
 
     {   // load file -- save -- reload compare -- NO prefixtable
-        SuffixArray sa1 = SuffixArray::fromFASTAFile("inputs/banana.fa");
+        SuffixArray sa1 = SuffixArray::fromFASTAFile("inputs/banana.fasta");
         sa1.save("tmp.sa");
         SuffixArray sa2 = SuffixArray::fromSave("tmp.sa");
         std::remove("tmp.sa");
         
         ASSERT_EQUAL(sa1.data(), sa2.data(), "Data not equal after load.");
-        ASSERT_EQUAL(sa1.suffixes(), sa2.suffixes(), "Suffixes not equal after load.");
+        ASSERT_EQUAL(std::ranges::equal(sa1.suffixes(), sa2.suffixes()), true, "Suffixes not equal after load.");
+        ASSERT_EQUAL(sa2.isMapped(), true, "Loaded suffix array is not memory mapped.");
+    }
+
+    {   // load file -- save -- reload compare -- WITH prefixtable
+        SuffixArray sa1 = SuffixArray::fromFASTAFile("inputs/example.fasta", 3);
+        sa1.save("tmp.sa");
+        SuffixArray sa2 = SuffixArray::fromSave("tmp.sa");
+        std::remove("tmp.sa");  // mapping stays valid after unlink
+
+        ASSERT_EQUAL(sa1.data(), sa2.data(), "Data not equal after load.");
+        ASSERT_EQUAL(std::ranges::equal(sa1.suffixes(), sa2.suffixes()), true, "Suffixes not equal after load.");
+        ASSERT_EQUAL(sa1.getPrefixTableSize(), sa2.getPrefixTableSize(), "Prefix table size not equal after load.");
+    }
+}
+
+void test_queries() {
+    using namespace suffixarray;
+
+    /* every query result is checked against a brute force scan of the text */
+    auto bruteForce = [](std::string_view text, std::string const& query) {
+        std::vector<int32_t> result;
+        for (size_t pos = text.find(query); pos != std::string_view::npos; pos = text.find(query, pos+1)) {
+            result.push_back(static_cast<int32_t>(pos));
+        }
+        return result;
+    };
+
+    for (int32_t preftab : {0, 1, 2, 4, 8, 16, 40}) {
+        SuffixArray built = SuffixArray::fromFASTAFile("inputs/example.fasta", {.prefixTableLength = preftab, .lcp = true});
+        built.save("tmp.sa");
+        SuffixArray const loaded = SuffixArray::fromSave("tmp.sa");
+        std::remove("tmp.sa");
+        ASSERT_EQUAL(loaded.hasLCP(), true, "LCP arrays missing after load.");
+
+        const std::string text = built.data();
+        for (size_t length : {1, 2, 3, 5, 8, 13, 21}) {
+            for (size_t start = 0; start + length < text.size(); start += 7) {
+                for (auto mode : {SuffixArray::Naive, SuffixArray::SimpleAccelerant, SuffixArray::LCPAccelerated}) {
+                    SuffixArray::Query q{"", std::string(text.substr(start, length)), {}};
+                    loaded.query(q, mode);
+                    std::sort(std::begin(q.result), std::end(q.result));
+                    ASSERT_EQUAL(q.result, bruteForce(text, q.query), "Query result does not match brute force.");
+                }
+            }
+        }
+
+        for (auto mode : {SuffixArray::Naive, SuffixArray::SimpleAccelerant, SuffixArray::LCPAccelerated}) {
+            SuffixArray::Query q{"", "GATTACAGATTACA", {}};
+            loaded.query(q, mode);
+            ASSERT_EQUAL(q.result.size(), bruteForce(text, q.query).size(), "Query for absent string found matches.");
+        }
+    }
+}
+
+void test_countlocate() {
+    using namespace suffixarray;
+
+    SuffixArray sa = SuffixArray::fromString("ACATACA");
+    ASSERT_EQUAL(sa.count("ACA"), int64_t(2), "Wrong count for ACA.");
+    ASSERT_EQUAL(sa.count("ACATACA"), int64_t(1), "Wrong count for ACATACA.");
+    ASSERT_EQUAL(sa.count("TT"), int64_t(0), "Wrong count for absent TT.");
+
+    std::array<int32_t, 2> positions{-1, -1};
+    ASSERT_EQUAL(sa.locate("A", positions), int64_t(4), "Wrong total from locate.");
+    for (auto pos : positions) {
+        ASSERT_EQUAL(sa.data().at(pos), 'A', "Located position is not an occurrence.");
+    }
+
+    SuffixArray::Query q{"", "ACA", {}};
+    sa.query(q, SuffixArray::SimpleAccelerant, 1);
+    ASSERT_EQUAL(q.count, int64_t(2), "Wrong count with result limit.");
+    ASSERT_EQUAL(q.result.size(), size_t(1), "Result limit not applied.");
+    sa.query(q, SuffixArray::SimpleAccelerant, 0);
+    ASSERT_EQUAL(q.result.empty(), true, "Count only query stored results.");
+}
+
+void test_fmindex() {
+    using namespace suffixarray;
+
+    const SuffixArray sa = SuffixArray::fromFASTAFile("inputs/example.fasta");
+    for (uint32_t sampleRate : {1, 4, 32, 1000}) {
+        FMIndex::fromSuffixArray(sa, sampleRate).save("tmp.fm");
+        ASSERT_EQUAL(FMIndex::isIndexFile("tmp.fm"), true, "Saved FM-index not recognized.");
+        FMIndex const fm = FMIndex::fromSave("tmp.fm");
+        std::remove("tmp.fm");
+        ASSERT_EQUAL(fm.size(), sa.size(), "FM-index size does not match text.");
+
+        for (size_t row = 0; row < sa.suffixes().size(); row += 1) {
+            ASSERT_EQUAL(fm.suffixAt(row), sa.suffixes()[row], "FM-index suffix does not match suffix array.");
+        }
+
+        /* rows come out in suffix array order, so results match the suffix array exactly */
+        const std::string text = sa.data();
+        for (size_t length : {1, 2, 3, 5, 8, 13, 21}) {
+            for (size_t start = 0; start + length < text.size(); start += 7) {
+                SuffixArray::Query expected{"", std::string(text.substr(start, length)), {}};
+                sa.query(expected);
+                FMIndex::Query q{"", expected.query, {}};
+                fm.query(q);
+                ASSERT_EQUAL(q.count, expected.count, "FM-index count does not match suffix array.");
+                ASSERT_EQUAL(q.result, expected.result, "FM-index locate does not match suffix array.");
+            }
+        }
+        ASSERT_EQUAL(fm.count("GATTACAGATTACA"), sa.count("GATTACAGATTACA"), "FM-index count wrong for absent string.");
+        ASSERT_EQUAL(fm.count("ACGN"), int64_t(0), "FM-index matched an invalid base.");
+    }
+
+    const auto fm = FMIndex::fromSuffixArray(SuffixArray::fromString("ACATACA"), 3);
+    std::array<int32_t, 2> positions{-1, -1};
+    ASSERT_EQUAL(fm.locate("ACA", positions), int64_t(2), "Wrong total from FM-index locate.");
+    std::sort(std::begin(positions), std::end(positions));
+    ASSERT_EQUAL(positions, std::array<int32_t, 2>{0, 4}, "Wrong positions from FM-index locate.");
+    ASSERT_EQUAL(FMIndex::isIndexFile("inputs/example.fasta"), false, "FASTA file recognized as FM-index.");
+}
+
+template <typename WideSA>
+void checkWideIndex(suffixarray::SuffixArray const& narrow, uint32_t expectedWidth) {
+    using namespace suffixarray;
+
+    /* rebuild on the already normalized text so both suffix arrays index exactly the same string */
+    const std::string text = narrow.data();
+    WideSA built = WideSA::fromString(std::string(text.substr(0, text.size() - 1)), {.prefixTableLength = 6, .lcp = true});
+    ASSERT_EQUAL(built.data(), text, "Wide suffix array text differs.");
+    ASSERT_EQUAL(std::ranges::equal(built.suffixes(), narrow.suffixes(), [](int64_t a, int64_t b) { return a == b; }), true,
+        "Wide suffix array differs from 32-bit suffix array.");
+
+    built.save("tmp.sa");
+    ASSERT_EQUAL(SuffixArray::savedSuffixWidth("tmp.sa"), expectedWidth, "Wrong saved suffix width.");
+    WideSA const loaded = WideSA::fromSave("tmp.sa");
+    std::remove("tmp.sa");
+    ASSERT_EQUAL(loaded.getPrefixTableSize(), size_t(6), "Wide prefix table missing after load.");
+
+    for (size_t length : {1, 4, 9, 17}) {
+        for (size_t start = 0; start + length < text.size(); start += 11) {
+            for (auto mode : {SuffixArray::Naive, SuffixArray::SimpleAccelerant, SuffixArray::LCPAccelerated}) {
+                SuffixArray::Query expected{"", std::string(text.substr(start, length)), {}};
+                narrow.query(expected, mode);
+                typename WideSA::Query q{"", expected.query, {}};
+                loaded.query(q, static_cast<typename WideSA::QueryMode>(mode));
+                ASSERT_EQUAL(std::ranges::equal(q.result, expected.result), true, "Wide query result differs.");
+            }
+        }
+    }
+}
+
+void test_wideindex() {
+    using namespace suffixarray;
+
+    const SuffixArray narrow = SuffixArray::fromFASTAFile("inputs/example.fasta", {.prefixTableLength = 6, .lcp = true});
+    narrow.save("tmp.sa");
+    ASSERT_EQUAL(SuffixArray::savedSuffixWidth("tmp.sa"), uint32_t(4), "Wrong saved suffix width.");
+    std::remove("tmp.sa");
+
+    checkWideIndex<SuffixArray40>(narrow, 5);
+    checkWideIndex<SuffixArray64>(narrow, 8);
+
+    for (int64_t value : {int64_t(0), int64_t(1) << 31, packedint::Int40::MAX}) {
+        ASSERT_EQUAL(static_cast<int64_t>(packedint::Int40(value)), value, "Int40 does not round trip.");
+    }
+}
+
+void test_fasta() {
+    /* mixed case, CRLF line ends, blank lines, and lines long enough to straddle parser chunks */
+    std::mt19937 rng(858);
+    std::string contents, expected;
+    std::vector<uint64_t> expectedStarts;
+    for (int record = 0; record < 40; record += 1) {
+        if (record != 0) {
+            expected.push_back(fasta::RECORD_SEPARATOR);
+        }
+        expectedStarts.push_back(expected.size());
+        contents += ">record" + std::to_string(record) + " some description\n";
+        for (int line = 0; line < 20; line += 1) {
+            std::string bases(rng() % 200, 'A');
+            for (auto &c : bases) {
+                c = "ACGTacgtN"[rng() % 9];
+                expected.push_back(static_cast<char>(std::toupper(c)));
+            }
+            contents += bases + ((line % 3 == 0) ? "\r\n" : "\n");
+            if (line % 7 == 0) {
+                contents += "\n";
+            }
+        }
+    }
+
+    {
+        std::ofstream outputFile("tmp.fasta", std::ios::binary);
+        outputFile << contents;
+    }
+    const auto plain = fasta::read("tmp.fasta");
+    std::remove("tmp.fasta");
+    ASSERT_EQUAL(std::string(std::begin(plain.sequence), std::end(plain.sequence)), expected, "Plain FASTA parsed incorrectly.");
+    ASSERT_EQUAL(plain.sequence.capacity() > plain.sequence.size(), true, "No room left for the terminator.");
+    ASSERT_EQUAL(plain.records.size(), expectedStarts.size(), "Wrong number of plain FASTA records.");
+    for (size_t i = 0; i < plain.records.size(); i += 1) {
+        ASSERT_EQUAL(plain.records[i].name, "record" + std::to_string(i), "Wrong record name.");
+        ASSERT_EQUAL(plain.records[i].start, expectedStarts[i], "Wrong record start.");
+    }
+
+    gzFile compressed = gzopen("tmp.fasta.gz", "wb");
+    gzwrite(compressed, contents.data(), static_cast<unsigned>(contents.size()));
+    gzclose(compressed);
+    const auto unzipped = fasta::read("tmp.fasta.gz");
+    std::remove("tmp.fasta.gz");
+    ASSERT_EQUAL(std::string(std::begin(unzipped.sequence), std::end(unzipped.sequence)), expected, "Gzip FASTA parsed incorrectly.");
+    ASSERT_EQUAL(unzipped.records.size(), plain.records.size(), "Wrong number of gzip FASTA records.");
+    for (size_t i = 0; i < unzipped.records.size(); i += 1) {
+        ASSERT_EQUAL(unzipped.records[i].name, plain.records[i].name, "Gzip record name differs.");
+        ASSERT_EQUAL(unzipped.records[i].start, plain.records[i].start, "Gzip record start differs.");
+    }
+
+    /* pipes cannot be mapped nor peeked at, compressed or not */
+    for (bool gzip : {false, true}) {
+        ::mkfifo("tmp.fifo", 0600);
+        std::thread writer([&] {
+            if (gzip) {
+                gzFile piped = gzopen("tmp.fifo", "wb");
+                gzwrite(piped, contents.data(), static_cast<unsigned>(contents.size()));
+                gzclose(piped);
+            } else {
+                std::ofstream("tmp.fifo", std::ios::binary) << contents;
+            }
+        });
+        const auto piped = fasta::read("tmp.fifo");
+        writer.join();
+        std::remove("tmp.fifo");
+        ASSERT_EQUAL(std::string(std::begin(piped.sequence), std::end(piped.sequence)), expected, "Piped FASTA parsed incorrectly.");
+        ASSERT_EQUAL(piped.records.size(), plain.records.size(), "Wrong number of piped FASTA records.");
+    }
+
+    const auto banana = fasta::read("inputs/banana.fasta").sequence;
+    ASSERT_EQUAL(std::string(std::begin(banana), std::end(banana)), std::string("BANANA"), "banana.fasta parsed incorrectly.");
+}
+
+void test_contigs() {
+    using namespace suffixarray;
+
+    {
+        std::ofstream outputFile("tmp.fasta");
+        outputFile << ">chr1 first\nACGTAC\nGT\n>chr2\nTTACGTA\n>chr3\nACGTACGT\n";
+    }
+    const SuffixArray sa = SuffixArray::fromFASTAFile("tmp.fasta", {.prefixTableLength = 2, .lcp = true});
+    std::remove("tmp.fasta");
+    ASSERT_EQUAL(sa.data(), std::string_view("ACGTACGT#TTACGTA#ACGTACGT$"), "Records not joined by separators.");
+
+    /* "GTTT" only exists across the chr1/chr2 boundary */
+    for (auto mode : {SuffixArray::Naive, SuffixArray::SimpleAccelerant, SuffixArray::LCPAccelerated}) {
+        SuffixArray::Query q{"", "GTTT", {}};
+        sa.query(q, mode);
+        ASSERT_EQUAL(q.count, int64_t(0), "Query matched across a record boundary.");
+    }
+
+    sa.save("tmp.sa");
+    const SuffixArray loaded = SuffixArray::fromSave("tmp.sa");
+    std::remove("tmp.sa");
+    const auto fm = FMIndex::fromSuffixArray(sa, 4);
+    fm.save("tmp.fm");
+    const FMIndex fmLoaded = FMIndex::fromSave("tmp.fm");
+    std::remove("tmp.fm");
+
+    for (ContigTable const* table : {&loaded.contigs(), &fmLoaded.contigs()}) {
+        ASSERT_EQUAL(table->size(), size_t(3), "Wrong number of contigs after load.");
+        ASSERT_EQUAL(table->name(0), std::string_view("chr1"), "Wrong contig name.");
+        ASSERT_EQUAL(table->name(2), std::string_view("chr3"), "Wrong contig name.");
+    }
+
+    for (auto const& query : {"ACGT", "GTA", "T", "GTTT", "T#T"}) {
+        SuffixArray::Query expected{"", query, {}};
+        sa.query(expected);
+        FMIndex::Query q{"", query, {}};
+        fmLoaded.query(q);
+        ASSERT_EQUAL(q.count, expected.count, "FM-index count does not match suffix array across records.");
+        ASSERT_EQUAL(q.result, expected.result, "FM-index locate does not match suffix array across records.");
+
+        std::vector<ContigPosition> positions(expected.result.size());
+        loaded.contigs().lookup(std::span<const int32_t>(expected.result), std::span(positions));
+        for (size_t i = 0; i < positions.size(); i += 1) {
+            const auto [contig, offset] = positions[i];
+            ASSERT_EQUAL(static_cast<int64_t>(loaded.contigs().start(contig)) + offset, int64_t(expected.result[i]), "Contig offset wrong.");
+            ASSERT_EQUAL(sa.data().substr(loaded.contigs().start(contig), offset).find('#'), std::string_view::npos,
+                "Position mapped to the wrong contig.");
+        }
+    }
+    ASSERT_EQUAL(sa.count("T#T"), int64_t(0), "Separator matched by a query.");
+    ASSERT_EQUAL(loaded.contigs().lookup(17).contig, uint32_t(2), "Wrong contig for the first base of chr3.");
+    ASSERT_EQUAL(loaded.contigs().lookup(17).offset, int64_t(0), "Wrong offset for the first base of chr3.");
+}
+
+void test_sortedqueries() {
+    using namespace suffixarray;
+
+    /* overlapping, repeated, nested, absent, and too-short-for-the-prefix-table queries in no particular order */
+    const SuffixArray sa = SuffixArray::fromFASTAFile("inputs/example.fasta", {.prefixTableLength = 4, .lcp = true});
+    const std::string text = sa.data();
+    std::mt19937 rng(858);
+    std::vector<SuffixArray::Query> queries;
+    for (size_t i = 0; i < 5000; i += 1) {
+        const size_t length = 1 + rng() % 24;
+        std::string query(text.substr(rng() % (text.size() - length), length));
+        if (i % 5 == 0) {
+            query[rng() % length] = "ACGTN"[rng() % 5];
+        }
+        queries.push_back({"", query, {}});
+        if (i % 7 == 0) {
+            queries.push_back({"", query, {}});
+        }
+    }
+
+    for (auto mode : {SuffixArray::Naive, SuffixArray::SimpleAccelerant, SuffixArray::LCPAccelerated}) {
+        auto sorted = queries;
+        sa.sortedQueries(std::begin(sorted), std::end(sorted), mode, 3);
+        for (size_t i = 0; i < queries.size(); i += 1) {
+            SuffixArray::Query expected = queries[i];
+            sa.query(expected, mode, 3);
+            ASSERT_EQUAL(sorted[i].count, expected.count, "Sorted query count differs.");
+            ASSERT_EQUAL(sorted[i].result, expected.result, "Sorted query result differs.");
+        }
+    }
+
+    /* an absent query ruled out by the prefix table must not bound the searches next to it */
+    std::vector<SuffixArray::Query> aroundAbsent{{"", "AAAA", {}}, {"", "ACGN", {}}, {"", "CCCC", {}}, {"", "GGGG", {}}};
+    sa.sortedQueries(std::begin(aroundAbsent), std::end(aroundAbsent), SuffixArray::SimpleAccelerant);
+    for (auto const& q : aroundAbsent) {
+        ASSERT_EQUAL(q.count, sa.count(q.query), "Sorted query next to an absent one differs.");
+    }
+}
+
+void test_sampletree() {
+    using namespace suffixarray;
+
+    const SuffixArray plain = SuffixArray::fromFASTAFile("inputs/example.fasta");
+    const std::string text = plain.data();
+    for (int32_t levels : {1, 4, 9, 30}) {
+        for (int32_t preftab : {0, 3}) {
+            /* rebuild on the already normalized text so both suffix arrays index exactly the same string */
+            SuffixArray::fromString(std::string(text.substr(0, text.size() - 1)),
+                {.prefixTableLength = preftab, .lcp = true, .sampleTreeLevels = levels}).save("tmp.sa");
+            SuffixArray const sa = SuffixArray::fromSave("tmp.sa");
+            std::remove("tmp.sa");
+            ASSERT_EQUAL(sa.getSampleTreeLevels(), std::min<size_t>(levels, std::bit_width(text.size()) - 1),
+                "Wrong number of sample tree levels after load.");
+
+            /* short and long queries, present and absent, with and without bases the keys can't tell apart */
+            for (size_t length : {1, 2, 5, 15, 16, 17, 30}) {
+                for (size_t start = 0; start + length < text.size(); start += 13) {
+                    std::string query(text.substr(start, length));
+                    if (start % 3 == 0) {
+                        query[start % length] = "ACGTN"[start % 5];
+                    }
+                    for (auto mode : {SuffixArray::Naive, SuffixArray::SimpleAccelerant, SuffixArray::LCPAccelerated}) {
+                        SuffixArray::Query expected{"", query, {}};
+                        plain.query(expected, mode);
+                        SuffixArray::Query q{"", query, {}};
+                        sa.query(q, mode);
+                        ASSERT_EQUAL(q.result, expected.result, "Sample tree changed a query result.");
+                    }
+                }
+            }
+        }
+    }
+}
+
+void test_compareprefix() {
+    /* every mismatch position within and across the vector and word widths, against a character loop */
+    std::mt19937 rng(858);
+    for (size_t length = 0; length < 80; length += 1) {
+        for (size_t trial = 0; trial < 50; trial += 1) {
+            std::string query(length, 'A'), suffix(rng() % 90, 'A');
+            for (auto &c : query) { c = "ACGT"[rng() % 4]; }
+            for (size_t i = 0; i < suffix.size(); i += 1) {
+                suffix[i] = (i < query.size() && rng() % 40 != 0) ? query[i] : "ACGT$"[rng() % 5];
+            }
+
+            size_t expectedLCP = 0;
+            while (expectedLCP < query.size() && expectedLCP < suffix.size() && query[expectedLCP] == suffix[expectedLCP]) {
+                expectedLCP += 1;
+            }
+            const int expectedOrder = (expectedLCP == query.size()) ? 0
+                : (expectedLCP == suffix.size() || suffix[expectedLCP] < query[expectedLCP]) ? -1 : 1;
+
+            const size_t offset = (expectedLCP == 0) ? 0 : rng() % expectedLCP;
+            const auto [order, lcpLength] = utilities::comparePrefix(query, suffix, offset);
+            ASSERT_EQUAL(lcpLength, expectedLCP, "Wrong LCP from comparePrefix.");
+            ASSERT_EQUAL(order, expectedOrder, "Wrong order from comparePrefix.");
+        }
+    }
+}
+
+void test_packedtext() {
+    using namespace suffixarray;
+
+    /* lengths around the word size, separators anywhere, compared against the character text */
+    std::mt19937 rng(26);
+    for (size_t length : {1, 2, 31, 32, 33, 64, 65, 200, 600}) {
+        /* the long text has records spanning several separator mask words */
+        const size_t separatorEvery = (length > 200) ? 150 : 16;
+        std::string text(length - 1, 'A');
+        for (auto &c : text) { c = (rng() % separatorEvery == 0) ? '#' : "ACGT"[rng() % 4]; }
+        text.push_back('$');
+
+        const PackedText packed = PackedText::pack(text);
+        ASSERT_EQUAL(packed.size(), text.size(), "Wrong packed text length.");
+        ASSERT_EQUAL(packed.unpack(), text, "Packed text does not unpack to the original.");
+        ASSERT_EQUAL(packed.isConsistent(), true, "Packed text is not consistent.");
+        for (size_t i = 0; i < text.size(); i += 1) {
+            ASSERT_EQUAL(packed[i], text[i], "Wrong character in packed text.");
+            ASSERT_EQUAL(packed.substr(i, 40), text.substr(i, 40), "Wrong substring of packed text.");
+            for (size_t k : {1, 5, 32}) {
+                const auto expected = (text.size() - i < k) ? kmer::PackedKmer{0, false} : kmer::encode(text.substr(i, k), k);
+                const auto kmer = packed.kmerAt(i, k);
+                ASSERT_EQUAL(kmer.valid, expected.valid, "Wrong k-mer validity in packed text.");
+                ASSERT_EQUAL(kmer.valid ? kmer.code : 0, expected.valid ? expected.code : 0, "Wrong k-mer in packed text.");
+            }
+            for (size_t k : {1, 40, 130}) {
+                const bool expected = text.find_first_of("#$", i) >= i + k;
+                ASSERT_EQUAL(packed.withinRecord(i, k), expected, "Wrong record check in packed text.");
+            }
+        }
+
+        for (size_t trial = 0; trial < 500; trial += 1) {
+            const size_t position = rng() % text.size();
+            std::string query = text.substr(position, rng() % 80);
+            for (auto &c : query) {
+                if (c == '#' || c == '$' || rng() % 50 == 0) { c = "ACGT"[rng() % 4]; }
+            }
+            const auto expected = utilities::comparePrefix(query, std::string_view(text).substr(position));
+            const auto packedQuery = PackedText::packQuery(query);
+            ASSERT_EQUAL(packed.comparePrefix(packedQuery, position), expected,
+                "Packed comparison does not match character comparison.");
+            for (size_t offset : {expected.second / 2, expected.second}) {
+                ASSERT_EQUAL(packed.comparePrefix(packedQuery, position, offset), expected,
+                    "Packed comparison from a known common prefix does not match character comparison.");
+            }
+        }
+    }
+    ASSERT_EQUAL(PackedText::packQuery("ACGN").valid, false, "Query with N packed as valid.");
+}
+
+void test_ambiguousbases() {
+    using namespace suffixarray;
+
+    const auto first = SuffixArray::fromString("ACGNNNNTTNA"), second = SuffixArray::fromString("ACGNNNNTTNA");
+    ASSERT_EQUAL(first.data(), second.data(), "Random base replacement is not reproducible.");
+    ASSERT_EQUAL(first.data().find('N'), std::string::npos, "Ambiguous base left in the text.");
+
+    {
+        std::ofstream outputFile("tmp.fasta");
+        outputFile << ">chr1\nACGTNNNNNNACGTA\n>chr2\nNNNGGCATN\n";
+    }
+    const SuffixArray sa = SuffixArray::fromFASTAFile("tmp.fasta", {.prefixTableLength = 2, .ambiguousBases = AmbiguousBases::Collapse});
+    std::remove("tmp.fasta");
+    ASSERT_EQUAL(sa.data(), std::string_view("ACGT#ACGTA##GGCAT#$"), "Ambiguous runs not collapsed.");
+    ASSERT_EQUAL(sa.count("GTAC"), int64_t(0), "Query matched across a collapsed run.");
+
+    sa.save("tmp.sa");
+    const SuffixArray loaded = SuffixArray::fromSave("tmp.sa");
+    std::remove("tmp.sa");
+    FMIndex::fromSuffixArray(sa, 4).save("tmp.fm");
+    const FMIndex fm = FMIndex::fromSave("tmp.fm");
+    std::remove("tmp.fm");
+
+    /* offsets count the collapsed bases of the original records */
+    const std::vector<std::pair<std::string, ContigPosition>> expected{{"ACGTA", {0, 10}}, {"GGCAT", {1, 3}}, {"AT", {1, 6}}};
+    for (auto const& [query, position] : expected) {
+        SuffixArray::Query q{"", query, {}};
+        loaded.query(q);
+        ASSERT_EQUAL(q.result.size(), size_t(1), "Wrong number of hits in collapsed text.");
+        for (ContigTable const* table : {&loaded.contigs(), &fm.contigs()}) {
+            const auto [contig, offset] = table->lookup(q.result[0]);
+            ASSERT_EQUAL(contig, position.contig, "Wrong contig after collapsing runs.");
+            ASSERT_EQUAL(offset, position.offset, "Wrong offset after collapsing runs.");
+        }
+    }
+}
+
+void test_querystream() {
+    using namespace suffixarray;
+
+    /* query files are read in batches that join back into the whole file */
+    {
+        std::ofstream outputFile("tmp.fasta");
+        outputFile << ">q0\nACG\nT\n>empty\n>q1\nGATTACA\n>q2\nA\n";
+    }
+    for (size_t batchSize : {1, 2, 3, 10}) {
+        fasta::QueryReader reader("tmp.fasta");
+        std::vector<std::string> titles, sequences;
+        for (auto batch = reader.next<SuffixArray::Query>(batchSize); !batch.empty(); batch = reader.next<SuffixArray::Query>(batchSize)) {
+            ASSERT_EQUAL(batch.size() <= batchSize, true, "Query batch too large.");
+            for (auto const& q : batch) {
+                titles.push_back(q.title);
+                sequences.push_back(q.query);
+            }
+        }
+        ASSERT_EQUAL(titles, std::vector<std::string>{"q0", "q1", "q2"}, "Wrong query titles from batched reader.");
+        ASSERT_EQUAL(sequences, std::vector<std::string>{"ACGT", "GATTACA", "A"}, "Wrong queries from batched reader.");
+    }
+    std::remove("tmp.fasta");
+
+    /* items reach the writer in order, and a failing stage stops the others and rethrows */
+    for (int failAt : {-1, 0, 37}) {
+        int next = 0;
+        std::vector<int> written;
+        bool threw = false;
+        try {
+            pipeline::run<int>(
+                [&next]() -> std::optional<int> { return (next < 100) ? std::optional<int>(next++) : std::nullopt; },
+                [failAt](int &item) {
+                    if (item == failAt) {
+                        throw std::runtime_error("process failed");
+                    }
+                    item *= 2;
+                },
+                [&written](int const& item) { written.push_back(item); });
+        } catch (std::runtime_error const&) {
+            threw = true;
+        }
+        ASSERT_EQUAL(threw, failAt >= 0, "Pipeline stage error not rethrown.");
+        const size_t expectedSize = (failAt < 0) ? 100 : static_cast<size_t>(failAt);
+        ASSERT_EQUAL(written.size() <= expectedSize, true, "Pipeline wrote items past a failure.");
+        for (size_t i = 0; i < written.size(); i += 1) {
+            ASSERT_EQUAL(written[i], 2 * static_cast<int>(i), "Pipeline wrote items out of order.");
+        }
+        if (failAt < 0) {
+            ASSERT_EQUAL(written.size(), size_t(100), "Pipeline dropped items.");
+        }
+    }
+}
+
+void test_results() {
+    using namespace suffixarray;
+
+    /* hit lists short and long, with positions beyond 32 bits, against stream formatting and back from binary */
+    std::mt19937_64 rng(1717);
+    std::vector<SuffixArray64::Query> queries;
+    for (size_t numHits : {0, 1, 5, 255, 256, 3000}) {
+        SuffixArray64::Query q{"query" + std::to_string(numHits), "ACGT", {}, static_cast<int64_t>(numHits) + 7};
+        for (size_t i = 0; i < numHits; i += 1) {
+            q.result.push_back(static_cast<int64_t>(rng() >> ((i % 2 == 0) ? 24 : 44)));
+        }
+        queries.push_back(std::move(q));
+    }
+
+    std::ostringstream text, expectedText;
+    results::ResultWriter textWriter(text, results::Format::Text);
+    textWriter.write(queries);
+    textWriter.flush();
+    for (auto const& q : queries) {
+        expectedText << q.title << '\t' << q.count;
+        for (const auto position : q.result) {
+            expectedText << '\t' << position;
+        }
+        expectedText << '\n';
+    }
+    ASSERT_EQUAL(text.str(), expectedText.str(), "Text results differ from stream formatting.");
+
+    std::stringstream binary;
+    results::ResultWriter binaryWriter(binary, results::Format::Binary);
+    binaryWriter.write(queries);
+    binaryWriter.write(std::vector<SuffixArray64::Query>(std::begin(queries), std::begin(queries) + 2));
+    binaryWriter.flush();
+
+    results::BinaryResultReader reader(binary);
+    results::BinaryRecord record;
+    uint64_t numRecords = 0;
+    while (reader.next(record)) {
+        auto const& q = queries[numRecords % queries.size()];
+        auto expected = q.result;
+        std::sort(std::begin(expected), std::end(expected));
+        ASSERT_EQUAL(record.queryIndex, numRecords, "Wrong query index in binary results.");
+        ASSERT_EQUAL(record.count, q.count, "Wrong count in binary results.");
+        ASSERT_EQUAL(record.positions, expected, "Wrong positions in binary results.");
+        numRecords += 1;
+    }
+    ASSERT_EQUAL(numRecords, uint64_t(queries.size() + 2), "Wrong number of binary result records.");
+}
+
+void test_queryserver() {
+    using namespace suffixarray;
+
+    /* batches in, one framed reply per batch out, matching the file writer */
+    auto sa = SuffixArray::fromString("ACGTACGTTTACGA");
+    auto search = [&sa](std::vector<SuffixArray::Query> &queries) {
+        sa.queries(std::begin(queries), std::end(queries), SuffixArray::SimpleAccelerant);
+    };
+    auto expectedReply = [&search](std::vector<SuffixArray::Query> queries) {
+        search(queries);
+        std::ostringstream reply;
+        results::ResultWriter writer(reply, results::Format::Text);
+        writer.write(queries);
+        writer.flush();
+        return reply.str() + "//\n";
+    };
+
+    std::array<int, 2> requestPipe{}, replyPipe{};
+    ASSERT_EQUAL(pipe(requestPipe.data()) == 0 && pipe(replyPipe.data()) == 0, true, "Could not create pipes.");
+    server::writeAll(requestPipe[1], ">a\r\nACG\r\n>b\nTT\nT\n//\n>skipped\n//\n>c\nACGA\n");
+    close(requestPipe[1]);
+    {
+        server::QueryServer<SuffixArray::Query> queryServer(search, nullptr);
+        queryServer.serve(requestPipe[0], replyPipe[1]);
+    }
+    close(requestPipe[0]);
+    close(replyPipe[1]);
+
+    std::string replies;
+    server::LineReader reader(replyPipe[0]);
+    for (std::string line; reader.getline(line);) {
+        replies += line + "\n";
+    }
+    close(replyPipe[0]);
+    ASSERT_EQUAL(replies, expectedReply({{"a", "ACG", {}}, {"b", "TTT", {}}}) + expectedReply({})
+        + expectedReply({{"c", "ACGA", {}}}), "Wrong replies from query server.");
+}
+
+void test_approximate() {
+    using namespace suffixarray;
+
+    /* mutated reads over several records, against a scan of every alignment inside a record */
+    std::mt19937 rng(4242);
+    std::string reference;
+    for (int record = 0; record < 5; record += 1) {
+        reference += ">r" + std::to_string(record) + "\n";
+        for (size_t i = 0; i < 300; i += 1) {
+            reference.push_back("ACGT"[(i % 40 < 20) ? i % 4 : rng() % 4]);
+        }
+        reference += "\n";
+    }
+    {
+        std::ofstream outputFile("tmp.fasta");
+        outputFile << reference;
+    }
+    SuffixArray sa = SuffixArray::fromFASTAFile("tmp.fasta", {.prefixTableLength = 3, .lcp = true});
+    std::remove("tmp.fasta");
+    const std::string text = sa.data();
+
+    auto bruteForce = [&text](std::string const& query, uint32_t maxMismatches) {
+        std::vector<int32_t> result;
+        for (size_t start = 0; start + query.size() < text.size(); start += 1) {
+            uint32_t mismatches = 0;
+            bool inRecord = true;
+            for (size_t i = 0; i < query.size(); i += 1) {
+                inRecord &= text[start + i] != fasta::RECORD_SEPARATOR;
+                mismatches += (text[start + i] != query[i]) ? 1 : 0;
+            }
+            if (inRecord && mismatches <= maxMismatches) {
+                result.push_back(static_cast<int32_t>(start));
+            }
+        }
+        return result;
+    };
+
+    for (uint32_t maxMismatches : {0, 1, 2, 4}) {
+        for (size_t trial = 0; trial < 60; trial += 1) {
+            const size_t length = 10 + rng() % 60;
+            const size_t start = rng() % (text.size() - length);
+            std::string query = text.substr(start, length);
+            for (auto &c : query) {
+                if (c == fasta::RECORD_SEPARATOR || c == '$' || rng() % 12 == 0) {
+                    c = "ACGTN"[rng() % 5];
+                }
+            }
+            const auto expected = bruteForce(query, maxMismatches);
+            for (auto mode : {SuffixArray::Naive, SuffixArray::SimpleAccelerant, SuffixArray::LCPAccelerated}) {
+                SuffixArray::Query q{"", query, {}};
+                sa.approximateQuery(q, maxMismatches, mode);
+                std::sort(std::begin(q.result), std::end(q.result));
+                ASSERT_EQUAL(q.result, expected, "Approximate query does not match brute force.");
+                ASSERT_EQUAL(q.count, static_cast<int64_t>(expected.size()), "Wrong approximate match count.");
+            }
+        }
+    }
+
+    std::vector<SuffixArray::Query> queries{{"", text.substr(5, 30), {}}, {"", text.substr(700, 25), {}}};
+    sa.approximateQueries(std::begin(queries), std::end(queries), 2, SuffixArray::Naive, 1);
+    for (auto const& q : queries) {
+        ASSERT_EQUAL(q.count, static_cast<int64_t>(bruteForce(q.query, 2).size()), "Wrong batched approximate count.");
+        ASSERT_EQUAL(q.result.size(), size_t(1), "Approximate results not limited.");
+    }
+}
+
+void test_strands() {
+    using namespace suffixarray;
+
+    ASSERT_EQUAL(kmer::reverseComplement("AACGTN#"), std::string("#NACGTT"), "Wrong reverse complement.");
+
+    /* both strands in one batch against two separate searches */
+    SuffixArray sa = SuffixArray::fromString("ACCGTTTACGGTAAACGTTAGG");
+    auto search = [&sa](std::vector<SuffixArray::Query> &queries) {
+        sa.queries(std::begin(queries), std::end(queries), SuffixArray::SimpleAccelerant);
+    };
+    for (int64_t maxResults : {int64_t(-1), int64_t(0), int64_t(1), int64_t(3)}) {
+        std::vector<SuffixArray::Query> queries{{"a", "ACG", {}}, {"b", "CGT", {}}, {"c", "TTT", {}}, {"d", "GGGG", {}}};
+        const auto original = queries;
+        searchBothStrands(queries, maxResults, [&sa, maxResults](std::vector<SuffixArray::Query> &batch) {
+            sa.queries(std::begin(batch), std::end(batch), SuffixArray::SimpleAccelerant, maxResults);
+        });
+        for (size_t i = 0; i < queries.size(); i += 1) {
+            std::vector<SuffixArray::Query> separate{original[i], {"", kmer::reverseComplement(original[i].query), {}}};
+            search(separate);
+            auto const& q = queries[i];
+            ASSERT_EQUAL(q.title, original[i].title, "Title lost searching both strands.");
+            ASSERT_EQUAL(q.count, separate[0].count + separate[1].count, "Wrong count over both strands.");
+            const size_t numForward = q.result.size() - q.reverseResults;
+            ASSERT_EQUAL(std::vector<int32_t>(std::begin(q.result), std::begin(q.result) + static_cast<std::ptrdiff_t>(numForward)),
+                std::vector<int32_t>(std::begin(separate[0].result), std::begin(separate[0].result) + static_cast<std::ptrdiff_t>(numForward)),
+                "Wrong forward strand results.");
+            ASSERT_EQUAL(std::vector<int32_t>(std::begin(q.result) + static_cast<std::ptrdiff_t>(numForward), std::end(q.result)),
+                std::vector<int32_t>(std::begin(separate[1].result), std::begin(separate[1].result) + static_cast<std::ptrdiff_t>(q.reverseResults)),
+                "Wrong reverse strand results.");
+            const auto expectedSize = (maxResults < 0) ? q.count : std::min(q.count, maxResults);
+            ASSERT_EQUAL(static_cast<int64_t>(q.result.size()), expectedSize, "Wrong number of results over both strands.");
+        }
+    }
+
+    /* strands survive both output formats */
+    std::vector<SuffixArray::Query> queries{{"a", "ACG", {}}};
+    searchBothStrands(queries, SuffixArray::ALL_RESULTS, search);
+    std::ostringstream text;
+    results::ResultWriter textWriter(text, results::Format::Text, nullptr, true);
+    textWriter.write(queries);
+    textWriter.flush();
+    std::string expectedText = "a\t" + std::to_string(queries[0].count);
+    for (size_t i = 0; i < queries[0].result.size(); i += 1) {
+        expectedText += "\t" + std::to_string(queries[0].result[i]) + ((i + queries[0].reverseResults < queries[0].result.size()) ? "+" : "-");
+    }
+    ASSERT_EQUAL(text.str(), expectedText + "\n", "Wrong stranded text results.");
+
+    std::stringstream binary;
+    results::ResultWriter binaryWriter(binary, results::Format::Binary, nullptr, true);
+    binaryWriter.write(queries);
+    binaryWriter.flush();
+    results::BinaryResultReader reader(binary);
+    results::BinaryRecord record;
+    ASSERT_EQUAL(reader.stranded() && reader.next(record), true, "Stranded binary record missing.");
+    std::vector<std::pair<int64_t, uint8_t>> expected, actual;
+    for (size_t i = 0; i < queries[0].result.size(); i += 1) {
+        expected.push_back({queries[0].result[i], (i + queries[0].reverseResults < queries[0].result.size()) ? 0 : 1});
+        actual.push_back({record.positions[i], record.reverse[i]});
+    }
+    std::sort(std::begin(expected), std::end(expected));
+    ASSERT_EQUAL(actual, expected, "Wrong stranded binary results.");
+}
+
+void test_counters() {
+    using namespace suffixarray;
+    if constexpr (!counters::ENABLED) {
+        return;
+    }
+
+    std::mt19937 rng(2202);
+    std::string text;
+    for (size_t i = 0; i < 5000; i += 1) {
+        text.push_back("ACGT"[rng() % 4]);
+    }
+    SuffixArray sa = SuffixArray::fromString(text, {4, true, 0});
+
+    /* queries from the text, random ones, ones shorter than the prefix table, and one that is never searched */
+    std::vector<SuffixArray::Query> queries;
+    size_t expectedMisses = 0, expectedBypasses = 0;
+    for (size_t i = 0; i < 300; i += 1) {
+        std::string query;
+        if (i % 3 == 0) {
+            query = text.substr(rng() % (text.size() - 20), 20);
+        } else {
+            for (size_t j = 0, length = (i % 3 == 1) ? 12 : 3; j < length; j += 1) {
+                query.push_back("ACGT"[rng() % 4]);
+            }
+        }
+        expectedMisses += (query.size() >= 4 && text.find(query.substr(0, 4)) == std::string::npos);
+        expectedBypasses += (query.size() < 4);
+        queries.push_back({"", query, {}});
+    }
+    queries.push_back({"", "ACGN", {}});
+
+    for (auto mode : {SuffixArray::Naive, SuffixArray::SimpleAccelerant, SuffixArray::LCPAccelerated}) {
+        auto batch = queries;
+        const auto before = counters::snapshot();
+        /* counts of threads that have exited are kept */
+        std::thread([&] { sa.queries(std::begin(batch), std::end(batch), mode); }).join();
+        const auto counted = counters::snapshot() - before;
+
+        ASSERT_EQUAL(counted.events[counters::Searches], uint64_t(queries.size() - 1), "Wrong number of searches counted.");
+        ASSERT_EQUAL(counted.events[counters::PrefixTableMisses], uint64_t(expectedMisses), "Wrong prefix table misses.");
+        ASSERT_EQUAL(counted.events[counters::PrefixTableBypasses], uint64_t(expectedBypasses), "Wrong prefix table bypasses.");
+        ASSERT_EQUAL(counted.events[counters::PrefixTableHits] + expectedMisses + expectedBypasses,
+            uint64_t(queries.size() - 1), "Wrong prefix table hits.");
+        ASSERT_EQUAL(counted.events[counters::SearchSteps] > 0, true, "No search steps counted.");
+        ASSERT_EQUAL(counted.events[counters::BasesCompared] >= counted.events[counters::Comparisons], true,
+            "Fewer bases than comparisons counted.");
+        ASSERT_EQUAL(counted.events[counters::LCPDecisions] > 0, mode == SuffixArray::LCPAccelerated,
+            "LCP decisions counted in the wrong mode.");
+    }
+}
+
+void test_refinedprefixtable() {
+    using namespace suffixarray;
+
+    /* random records with many copies of parts of one element, so a few buckets are far larger than the rest */
+    std::mt19937 rng(2303);
+    std::string element;
+    for (size_t i = 0; i < 300; i += 1) {
+        element.push_back("ACGT"[rng() % 4]);
+    }
+    const std::string text = repetitiveText(rng, 60000, 3, 50, element);
+
+    std::vector<std::string> queries;
+    for (size_t i = 0; i < 3000; i += 1) {
+        const size_t length = 1 + rng() % 40;
+        const size_t position = rng() % (text.size() - length);
+        queries.push_back((i % 4 == 0) ? std::string(length, "ACGT"[rng() % 4]) : text.substr(position, length));
+    }
+
+    const SuffixArray plain = SuffixArray::fromString(text);
+    auto check = [&](SuffixArray const& sa, std::string const& msg) {
+        /* absent queries may come back as any empty range */
+        for (auto const& query : queries) {
+            const auto expected = plain.equalRange(query, SuffixArray::Naive);
+            const auto range = sa.equalRange(query, SuffixArray::SimpleAccelerant);
+            ASSERT_EQUAL((expected.first == expected.second) ? range.first == range.second : range == expected, true,
+                msg + " gives the wrong range for " + query + ".");
+        }
+    };
+
+    {   // explicit refinement; every range still holds every suffix starting with the query
+        SuffixArray sa = SuffixArray::fromString(text, {.prefixTableLength = 4, .refinedPrefixLength = 16});
+        ASSERT_EQUAL(sa.getRefinedPrefixLength(), size_t(16), "Prefix table was not refined.");
+        auto table = PrefixTable::build(sa.text(), sa.suffixes(), 4, 16);
+        for (auto const& query : queries) {
+            if (query.size() < 4) {
+                continue;
+            }
+            const auto [first, last] = plain.equalRange(query);
+            const auto [start, end] = table.range(query);
+            ASSERT_EQUAL(first == last || (start <= first && last <= end), true, "Refined range misses a suffix.");
+        }
+        check(sa, "Refined prefix table");
+
+        sa.save("tmp.sa");
+        const SuffixArray loaded = SuffixArray::fromSave("tmp.sa");
+        std::remove("tmp.sa");
+        ASSERT_EQUAL(loaded.getRefinedPrefixLength(), size_t(16), "Refinement lost after load.");
+        ASSERT_EQUAL(loaded.getPrefixTableBytes(), sa.getPrefixTableBytes(), "Prefix table size changed after load.");
+        check(loaded, "Loaded refined prefix table");
+    }
+
+    /* automatic tables stay within their budget and refine the repeat's buckets when there is room */
+    for (const uint64_t budget : {uint64_t(64), uint64_t(5000), uint64_t(50000), uint64_t(1) << 20}) {
+        const SuffixArray sa = SuffixArray::fromString(text, {.prefixTableLength = AUTO_PREFIX_TABLE,
+            .prefixTableBudget = budget});
+        ASSERT_EQUAL(sa.getPrefixTableBytes() <= budget, true, "Automatic prefix table is over budget.");
+        ASSERT_EQUAL(sa.getPrefixTableSize() > 0, true, "No automatic prefix table was built.");
+        check(sa, "Automatic prefix table");
+        if (budget >= 50000) {
+            ASSERT_EQUAL(sa.getRefinedPrefixLength() > sa.getPrefixTableSize(), true, "Repeat buckets were not refined.");
+        }
+    }
+}
+
+void test_indexsections() {
+    using namespace indexfile;
+
+    /* large enough to span several blocks, so the parallel checksum and writes have to join up */
+    std::mt19937_64 rng(2404);
+    std::vector<uint32_t> wide(3000000);
+    for (auto &value : wide) {
+        value = static_cast<uint32_t>(rng() % (uint32_t(1) << 27));
+    }
+    ASSERT_EQUAL(checksum(wide.data(), wide.size() * sizeof(uint32_t)),
+        static_cast<uint32_t>(crc32(0, reinterpret_cast<Bytef const*>(wide.data()), static_cast<uInt>(wide.size() * sizeof(uint32_t)))),
+        "Blocked checksum differs from the serial CRC-32.");
+
+    const std::vector<int64_t> large{0, 1, int64_t(1) << 40, (int64_t(1) << 62) + 12345, 7};
+    const std::vector<packedint::Int40> int40s{packedint::Int40(5), packedint::Int40(packedint::Int40::MAX), packedint::Int40(0)};
+    const std::vector<int32_t> negative{3, -1, 4};
+    const std::vector<uint8_t> ones(100, 1);
+    const std::string names = "chr1\nchr2";
+    {
+        IndexWriter writer(0x1234, 1);
+        writer.addPackedSection(0, std::span<const uint32_t>(wide));
+        writer.addPackedSection(1, std::span<const int64_t>(large));
+        writer.addPackedSection(2, std::span<const packedint::Int40>(int40s));
+        writer.addPackedSection(3, std::span<const int32_t>(negative));
+        writer.addPackedSection(4, std::span<const uint8_t>(ones));
+        writer.addPackedSection(5, std::span<const uint32_t>());
+        writer.addSection(6, std::span<const char>(names.data(), names.size()));
+        writer.write("tmp.idx");
+    }
+    {
+        IndexReader reader("tmp.idx", 0x1234, 1);
+        reader.verify();
+        ASSERT_EQUAL(reader.isPacked(0) && reader.isPacked(1) && reader.isPacked(2) && reader.isPacked(4), true,
+            "Integer section was not bit packed.");
+        ASSERT_EQUAL(reader.isPacked(3) || reader.isPacked(6), false, "Negative or character section was bit packed.");
+        ASSERT_EQUAL(std::ranges::equal(reader.section<uint32_t>(0), wide), true, "Packed 27-bit section differs.");
+        ASSERT_EQUAL(std::ranges::equal(reader.section<int64_t>(1), large), true, "Packed 63-bit section differs.");
+        ASSERT_EQUAL(std::ranges::equal(reader.section<packedint::Int40>(2), int40s,
+            [](int64_t a, int64_t b) { return a == b; }), true, "Packed Int40 section differs.");
+        ASSERT_EQUAL(std::ranges::equal(reader.section<int32_t>(3), negative), true, "Raw negative section differs.");
+        ASSERT_EQUAL(std::ranges::equal(reader.section<uint8_t>(4), ones), true, "Packed 1-bit section differs.");
+        ASSERT_EQUAL(reader.section<uint32_t>(5).empty(), true, "Empty packed section is not empty.");
+        ASSERT_EQUAL(std::string(reader.section<char>(6).data(), names.size()), names, "Raw section differs.");
+    }
+
+    /* flip a byte of a section, then of the section table */
+    auto corruptByte = [](uint64_t offset) {
+        std::fstream file("tmp.idx", std::ios::binary | std::ios::in | std::ios::out);
+        file.seekg(static_cast<std::streamoff>(offset));
+        const char byte = static_cast<char>(file.get() ^ 0x10);
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.put(byte);
+    };
+    corruptByte(SECTION_ALIGNMENT + 1000);
+    bool detected = false;
+    try {
+        IndexReader("tmp.idx", 0x1234, 1).verify();
+    } catch (std::ios_base::failure const&) {
+        detected = true;
+    }
+    ASSERT_EQUAL(detected, true, "Corrupt section passed verification.");
+    corruptByte(offsetof(FileHeader, sections) + 8);
+    detected = false;
+    try {
+        IndexReader("tmp.idx", 0x1234, 1);
+    } catch (std::ios_base::failure const&) {
+        detected = true;
     }
-}
\ No newline at end of file
+    ASSERT_EQUAL(detected, true, "Corrupt section table was accepted.");
+    std::remove("tmp.idx");
+
+    /* compressed suffix arrays answer like the mapped ones they were built from */
+    using namespace suffixarray;
+    const SuffixArray sa = SuffixArray::fromFASTAFile("inputs/example.fasta", {.prefixTableLength = 4, .lcp = true,
+        .refinedPrefixLength = 8});
+    sa.save("tmp.sa");
+    const auto rawSize = std::filesystem::file_size("tmp.sa");
+    sa.save("tmp.sa", true);
+    ASSERT_EQUAL(std::filesystem::file_size("tmp.sa") <= rawSize, true, "Compressed suffix array file is larger.");
+    const SuffixArray loaded = SuffixArray::fromSave("tmp.sa", false, true);
+    std::remove("tmp.sa");
+    ASSERT_EQUAL(loaded.isMapped(), false, "Compressed suffixes were not unpacked into memory.");
+    ASSERT_EQUAL(std::ranges::equal(loaded.suffixes(), sa.suffixes()), true, "Suffixes differ after compressed load.");
+    ASSERT_EQUAL(loaded.getPrefixTableBytes(), sa.getPrefixTableBytes(), "Prefix table differs after compressed load.");
+    const std::string text = sa.data();
+    for (size_t length : {2, 5, 12}) {
+        for (size_t start = 0; start + length < text.size(); start += 7) {
+            for (auto mode : {SuffixArray::Naive, SuffixArray::SimpleAccelerant, SuffixArray::LCPAccelerated}) {
+                SuffixArray::Query expected{"", text.substr(start, length), {}}, q{"", text.substr(start, length), {}};
+                sa.query(expected, mode);
+                loaded.query(q, mode);
+                ASSERT_EQUAL(std::ranges::equal(q.result, expected.result), true, "Compressed query result differs.");
+            }
+        }
+    }
+}
+
+void test_serial() {
+    std::vector<int32_t> values(100000);
+    std::iota(std::begin(values), std::end(values), -50);
+    const std::string text = "ACGT$";
+    const std::vector<std::vector<uint16_t>> nested{{1, 2}, {}, {3}};
+    {
+        std::ofstream output("tmp.bin", std::ios::binary);
+        serial::serialize(values, output);
+        serial::serialize(text, output);
+        serial::serialize(nested, output);
+    }
+
+    /* the bulk path must keep the element by element layout: the size, then each value's bytes */
+    const size_t sizeBytes = sizeof(values.size());
+    ASSERT_EQUAL(std::filesystem::file_size("tmp.bin"), 6 * sizeBytes + values.size() * sizeof(int32_t) + text.size()
+        + 3 * sizeof(uint16_t), "Serialized containers have the wrong layout.");
+
+    std::vector<int32_t> valuesIn(3, 7);
+    std::string textIn;
+    std::vector<std::vector<uint16_t>> nestedIn;
+    {
+        std::ifstream input("tmp.bin", std::ios::binary);
+        serial::deserialize(valuesIn, input);
+        serial::deserialize(textIn, input);
+        serial::deserialize(nestedIn, input);
+        ASSERT_EQUAL(static_cast<bool>(input), true, "Deserializing containers failed.");
+    }
+    std::remove("tmp.bin");
+    ASSERT_EQUAL(valuesIn == values, true, "Vector differs after deserialization.");
+    ASSERT_EQUAL(textIn, text, "String differs after deserialization.");
+    ASSERT_EQUAL(nestedIn == nested, true, "Nested vector differs after deserialization.");
+}
+
+void test_sparse() {
+    using namespace suffixarray;
+
+    /* random records with repeats, so queries have many occurrences at every alignment */
+    std::mt19937 rng(2606);
+    const std::string text = repetitiveText(rng, 30000, 4, 40);
+
+    const SuffixArray full = SuffixArray::fromString(text);
+    auto sortedResults = [](SuffixArray::Query q) {
+        std::sort(std::begin(q.result), std::end(q.result));
+        return q.result;
+    };
+
+    for (const int32_t sampling : {2, 3, 8}) {
+        SuffixArray sparse = SuffixArray::fromString(text, {.prefixTableLength = 4, .lcp = true, .sampleTreeLevels = 6,
+            .suffixSampling = sampling});
+        ASSERT_EQUAL(sparse.getSuffixSampling(), size_t(sampling), "Wrong suffix sampling rate.");
+        ASSERT_EQUAL(sparse.suffixes().size(), (sparse.size() + sampling - 1) / sampling, "Wrong number of sampled suffixes.");
+        sparse.save("tmp.sa");
+        const SuffixArray loaded = SuffixArray::fromSave("tmp.sa");
+        std::remove("tmp.sa");
+        ASSERT_EQUAL(loaded.getSuffixSampling(), size_t(sampling), "Suffix sampling rate lost after load.");
+
+        std::vector<SuffixArray::Query> queries, sorted;
+        for (size_t i = 0; i < 400; i += 1) {
+            const size_t length = static_cast<size_t>(sampling) + rng() % 30;
+            const size_t position = rng() % (text.size() - length);
+            queries.push_back({"", (i % 5 == 0) ? std::string(length, "ACGT"[rng() % 4]) : text.substr(position, length), {}});
+        }
+        sorted = queries;
+        loaded.sortedQueries(std::begin(sorted), std::end(sorted), SuffixArray::SimpleAccelerant);
+
+        for (size_t i = 0; i < queries.size(); i += 1) {
+            SuffixArray::Query expected = queries[i];
+            full.query(expected);
+            for (auto mode : {SuffixArray::Naive, SuffixArray::SimpleAccelerant, SuffixArray::LCPAccelerated}) {
+                SuffixArray::Query q = queries[i];
+                loaded.query(q, mode);
+                ASSERT_EQUAL(q.count, expected.count, "Sparse query count differs.");
+                ASSERT_EQUAL(sortedResults(q) == sortedResults(expected), true, "Sparse query positions differ.");
+            }
+            ASSERT_EQUAL(loaded.count(queries[i].query), expected.count, "Sparse count differs.");
+            ASSERT_EQUAL(sortedResults(sorted[i]) == sortedResults(expected), true, "Sorted sparse query positions differ.");
+
+            if (queries[i].query.size() >= 2 * static_cast<size_t>(sampling) + 1) {
+                SuffixArray::Query approximate = queries[i], approximateExpected = queries[i];
+                loaded.approximateQuery(approximate, 1, SuffixArray::SimpleAccelerant);
+                full.approximateQuery(approximateExpected, 1, SuffixArray::SimpleAccelerant);
+                ASSERT_EQUAL(sortedResults(approximate) == sortedResults(approximateExpected), true,
+                    "Sparse approximate query positions differ.");
+            }
+        }
+    }
+}
+
+void test_executor() {
+    using namespace suffixarray;
+
+    ASSERT_EQUAL(numa::parseCpuList("0-2,5,7-8") == std::vector<int>{0, 1, 2, 5, 7, 8}, true, "Wrong cpu list.");
+    ASSERT_EQUAL(numa::parseCpuList("").empty(), true, "Empty cpu list has cpus.");
+    const auto topology = numa::Topology::detect();
+    ASSERT_EQUAL(topology.size() != 0 && topology.numCpus() != 0, true, "Topology has no cpus.");
+    ASSERT_EQUAL(topology.cpus.size(), topology.size(), "Topology nodes and cpus differ.");
+
+    {   // every item exactly once, over repeated runs of uneven work, and workers spread over the nodes
+        const numa::Topology twoNodes{{0, 1}, {{0}, {0}}};
+        executor::Executor pool(3, false, twoNodes);
+        ASSERT_EQUAL(pool.size(), size_t(3), "Wrong number of workers.");
+        ASSERT_EQUAL(pool.workers()[1].node, size_t(1), "Workers not spread over the nodes.");
+        ASSERT_EQUAL(pool.workers()[2].node, size_t(0), "Workers not spread over the nodes.");
+        ASSERT_EQUAL(pool.workers()[0].cpu, -1, "Unpinned worker has a cpu.");
+
+        for (const size_t numItems : {size_t(0), size_t(1), size_t(7), size_t(10007)}) {
+            std::vector<std::atomic<int>> visits(numItems);
+            std::atomic<uint64_t> sum = 0;
+            pool.run(numItems, [&](size_t item, executor::Worker const& worker) {
+                visits[item] += 1;
+                uint64_t work = item;
+                for (size_t i = 0; i < (item % 97) * 50; i += 1) {
+                    work = work * 6364136223846793005 + worker.id + 1;
+                }
+                sum += work & 1;
+            });
+            ASSERT_EQUAL(std::all_of(std::begin(visits), std::end(visits), [](auto const& v) { return v == 1; }), true,
+                "Executor did not visit every item exactly once.");
+        }
+
+        bool threw = false;
+        try {
+            pool.run(1000, [](size_t item, executor::Worker const&) {
+                if (item == 500) {
+                    throw std::runtime_error("query failed");
+                }
+            });
+        } catch (std::runtime_error const&) {
+            threw = true;
+        }
+        ASSERT_EQUAL(threw, true, "Executor did not rethrow a failed item.");
+        std::atomic<size_t> count = 0;
+        pool.run(100, [&count](size_t, executor::Worker const&) { count += 1; });
+        ASSERT_EQUAL(count.load(), size_t(100), "Executor unusable after a failed run.");
+    }
+
+    {   // interleaved and node bound copies of every array answer like the original
+        std::mt19937 rng(2705);
+        std::string text;
+        for (size_t i = 0; i < 20000; i += 1) {
+            text.push_back((i % 1000 == 999) ? fasta::RECORD_SEPARATOR : "ACGT"[rng() % 4]);
+        }
+        const SuffixArray original = SuffixArray::fromString(text, {.prefixTableLength = 6, .lcp = true,
+            .sampleTreeLevels = 5, .refinedPrefixLength = 2});
+        const SuffixArray interleaved = original.copied([&topology](auto const& storage) {
+            return numa::interleaved(storage, topology); });
+        const SuffixArray bound = original.copied([&topology](auto const& storage) {
+            return numa::boundTo(storage, topology.nodes[0]); });
+        ASSERT_EQUAL(interleaved.isMapped() && bound.isMapped(), true, "Placed copies are not in mapped memory.");
+        ASSERT_EQUAL(interleaved.suffixes().data() != original.suffixes().data(), true, "Placed copy shares suffixes.");
+        ASSERT_EQUAL(bound.data(), original.data(), "Placed copy has a different text.");
+        ASSERT_EQUAL(bound.getPrefixTableSize(), original.getPrefixTableSize(), "Placed copy lost the prefix table.");
+        ASSERT_EQUAL(bound.getSampleTreeLevels(), original.getSampleTreeLevels(), "Placed copy lost the sample tree.");
+
+        executor::Executor pool(3, true, topology);
+        std::vector<SuffixArray::Query> queries, expected;
+        for (size_t i = 0; i < 500; i += 1) {
+            const size_t length = 3 + rng() % 20;
+            queries.push_back({"", text.substr(rng() % (text.size() - length), length), {}});
+        }
+        expected = queries;
+        original.queries(std::begin(expected), std::end(expected), SuffixArray::LCPAccelerated);
+        for (auto const* copy : {&interleaved, &bound}) {
+            std::vector<SuffixArray::Query> results = queries;
+            pool.run(results.size(), [&](size_t i, executor::Worker const&) {
+                copy->query(results[i], SuffixArray::LCPAccelerated); });
+            for (size_t i = 0; i < results.size(); i += 1) {
+                ASSERT_EQUAL(results[i].count, expected[i].count, "Placed copy query count differs.");
+                ASSERT_EQUAL(results[i].result == expected[i].result, true, "Placed copy query positions differ.");
+            }
+        }
+    }
+}
+
+void test_interleaved() {
+    using namespace suffixarray;
+
+    /* records with repeats, so queries range from absent to thousands of occurrences */
+    std::mt19937 rng(2805);
+    const std::string text = repetitiveText(rng, 50000, 3, 50);
+
+    /* the batch is not a multiple of INTERLEAVED_SEARCHES or INTERLEAVED_RUN, so runs end part way through */
+    std::vector<SuffixArray::Query> queries;
+    for (size_t i = 0; i < 2 * SuffixArray::INTERLEAVED_RUN + 37; i += 1) {
+        const size_t length = 1 + rng() % ((i % 50 == 0) ? 300 : 40);
+        std::string query = text.substr(rng() % (text.size() - length), length);
+        if (i % 7 == 0) {
+            query[rng() % length] = "ACGT"[rng() % 4];
+        } else if (i % 97 == 0) {
+            query[rng() % length] = 'N';
+        }
+        queries.push_back({"", query, {}});
+    }
+
+    for (auto const& options : {BuildOptions{.lcp = true}, BuildOptions{.prefixTableLength = 6, .lcp = true},
+        BuildOptions{.prefixTableLength = 4, .lcp = true, .sampleTreeLevels = 6, .refinedPrefixLength = 3},
+        BuildOptions{.prefixTableLength = AUTO_PREFIX_TABLE, .sampleTreeLevels = 4}}) {
+        const SuffixArray sa = SuffixArray::fromString(text, options);
+        for (auto mode : {SuffixArray::Naive, SuffixArray::SimpleAccelerant, SuffixArray::LCPAccelerated}) {
+            for (const int64_t maxResults : {SuffixArray::ALL_RESULTS, int64_t(0), int64_t(3)}) {
+                std::vector<SuffixArray::Query> interleaved = queries;
+                sa.queries(std::begin(interleaved), std::end(interleaved), mode, maxResults);
+                for (size_t i = 0; i < queries.size(); i += 1) {
+                    SuffixArray::Query expected = queries[i];
+                    sa.query(expected, mode, maxResults);
+                    ASSERT_EQUAL(interleaved[i].count, expected.count, "Interleaved query count differs.");
+                    ASSERT_EQUAL(interleaved[i].result == expected.result, true, "Interleaved query positions differ.");
+                }
+            }
+        }
+    }
+
+    std::vector<SuffixArray::Query> empty;
+    SuffixArray::fromString(text).queries(std::begin(empty), std::end(empty));
+}
+
+void test_shards() {
+    using namespace suffixarray;
+
+    /* shards with records and repeats of each other, so suffixes tie across shards up to their record ends */
+    std::mt19937 rng(2904);
+    std::string common;
+    for (size_t i = 0; i < 300; i += 1) {
+        common.push_back("ACGT"[rng() % 4]);
+    }
+    std::vector<std::string> texts(3);
+    for (auto &text : texts) {
+        text = repetitiveText(rng, 8000, 3, 20, common) + common.substr(0, 50);
+    }
+    const std::string joined = texts[0] + "#" + texts[1] + "#" + texts[2];
+    const SuffixArray whole = SuffixArray::fromString(joined);
+
+    std::vector<SuffixArray> shards;
+    for (auto const& text : texts) {
+        shards.push_back(SuffixArray::fromString(text, {.lcp = true}));
+    }
+    const BuildOptions options{.prefixTableLength = 3, .lcp = true, .sampleTreeLevels = 5};
+    const SuffixArray merged = SuffixArray::merged(std::span<const SuffixArray>(shards), options);
+    ASSERT_EQUAL(merged.data(), joined + "$", "Merged text is not the shards joined by separators.");
+    ASSERT_EQUAL(merged.hasLCP() && merged.getPrefixTableSize() == 3 && merged.getSampleTreeLevels() == 5, true,
+        "Merged suffix array is missing structures.");
+
+    /* ties across shards keep shard order past the record ends, which the sample tree keys must allow; short
+     * records copied from one source sample many such ties */
+    merged.save("tmp.sa");
+    const SuffixArray mergedLoaded = SuffixArray::fromSave("tmp.sa");
+    ASSERT_EQUAL(mergedLoaded.getSampleTreeLevels(), size_t(5), "Merged sample tree lost after load.");
+    {
+        std::vector<SuffixArray> shortRecords;
+        for (size_t i = 0; i < 3; i += 1) {
+            shortRecords.push_back(SuffixArray::fromString(repetitiveText(rng, 600, 2, 2, common)));
+        }
+        SuffixArray::merged(std::span<const SuffixArray>(shortRecords), {.sampleTreeLevels = 10}).save("tmp2.sa");
+        ASSERT_EQUAL(SuffixArray::fromSave("tmp2.sa").getSampleTreeLevels() > 5, true,
+            "Merged sample tree of short records lost after load.");
+        std::remove("tmp2.sa");
+    }
+    std::remove("tmp.sa");
+
+    /* merging a merged index again, into a wider one */
+    const std::vector<SuffixArray> twoShards{SuffixArray::merged(std::span<const SuffixArray>(shards.data(), 2)), shards[2]};
+    const SuffixArray40 remerged = SuffixArray40::merged(std::span<const SuffixArray>(twoShards), {.lcp = true});
+
+    shards[1].save("tmp1.sa");
+    shards[2].save("tmp2.sa");
+    ShardedIndex<SuffixArray>::writeManifest("tmp_shards.txt", {"tmp1.sa", std::filesystem::absolute("tmp2.sa").string()});
+    ASSERT_EQUAL(ShardedIndex<SuffixArray>::isManifest("tmp_shards.txt"), true, "Manifest not recognized.");
+    const std::vector<SuffixArray> loadedShards{shards[0], SuffixArray::fromSave("tmp1.sa"), SuffixArray::fromSave("tmp2.sa")};
+    const ShardedIndex<SuffixArray> fromManifest = ShardedIndex<SuffixArray>::fromSave("tmp_shards.txt");
+    std::remove("tmp1.sa");
+    std::remove("tmp2.sa");
+    std::remove("tmp_shards.txt");
+    ASSERT_EQUAL(fromManifest.shards().size(), size_t(2), "Wrong number of shards loaded from the manifest.");
+    const ShardedIndex<SuffixArray> sharded(loadedShards);
+    ASSERT_EQUAL(sharded.size(), whole.size(), "Sharded index size is not that of the joined text.");
+
+    auto sortedResults = [](auto q) {
+        std::sort(std::begin(q.result), std::end(q.result));
+        return std::vector<int64_t>(std::begin(q.result), std::end(q.result));
+    };
+    std::vector<SuffixArray::Query> queries;
+    std::vector<ShardedIndex<SuffixArray>::Query> shardedQueries, shardedApproximate;
+    for (size_t i = 0; i < 500; i += 1) {
+        const size_t length = 1 + rng() % 40;
+        const size_t position = rng() % (joined.size() - length);
+        const std::string query = (i % 7 == 0) ? std::string(length, "ACGT"[rng() % 4]) : joined.substr(position, length);
+        queries.push_back({"", query, {}});
+        shardedQueries.push_back({"", query, {}});
+    }
+    shardedApproximate = shardedQueries;
+    sharded.queries(std::begin(shardedQueries), std::end(shardedQueries), SuffixArray::LCPAccelerated);
+    sharded.approximateQueries(std::begin(shardedApproximate), std::end(shardedApproximate), 1, SuffixArray::SimpleAccelerant);
+
+    for (size_t i = 0; i < queries.size(); i += 1) {
+        SuffixArray::Query expected = queries[i];
+        whole.query(expected);
+        if (expected.result.empty() || expected.query.find(fasta::RECORD_SEPARATOR) != std::string::npos) {
+            continue;
+        }
+        for (auto mode : {SuffixArray::Naive, SuffixArray::SimpleAccelerant, SuffixArray::LCPAccelerated}) {
+            SuffixArray::Query q = queries[i];
+            merged.query(q, mode);
+            ASSERT_EQUAL(sortedResults(q) == sortedResults(expected), true, "Merged query positions differ.");
+            SuffixArray::Query loaded = queries[i];
+            mergedLoaded.query(loaded, mode);
+            ASSERT_EQUAL(sortedResults(loaded) == sortedResults(expected), true, "Loaded merged query positions differ.");
+            SuffixArray40::Query wide{"", queries[i].query, {}};
+            remerged.query(wide, static_cast<SuffixArray40::QueryMode>(mode));
+            ASSERT_EQUAL(sortedResults(wide) == sortedResults(expected), true, "Merged again query positions differ.");
+        }
+        ASSERT_EQUAL(shardedQueries[i].count, expected.count, "Sharded query count differs.");
+        ASSERT_EQUAL(sortedResults(shardedQueries[i]) == sortedResults(expected), true, "Sharded query positions differ.");
+
+        SuffixArray::Query approximate = queries[i];
+        whole.approximateQuery(approximate, 1, SuffixArray::SimpleAccelerant);
+        ASSERT_EQUAL(sortedResults(shardedApproximate[i]) == sortedResults(approximate), true,
+            "Sharded approximate query positions differ.");
+    }
+
+    ShardedIndex<SuffixArray>::Query limited{"", common.substr(0, 12), {}};
+    sharded.query(limited, SuffixArray::SimpleAccelerant, 2);
+    ASSERT_EQUAL(limited.count, whole.count(limited.query), "Limited sharded query count differs.");
+    ASSERT_EQUAL(limited.result.size(), size_t(2), "Limited sharded query stored too many positions.");
+
+    /* the joined contig table counts every shard's records, gaps included */
+    {
+        std::ofstream outputFile("tmp.fasta");
+        outputFile << ">a\nACGTNNNNAC\n>b\nGGTT\n";
+    }
+    const SuffixArray named = SuffixArray::fromFASTAFile("tmp.fasta", {.ambiguousBases = AmbiguousBases::Collapse});
+    std::remove("tmp.fasta");
+    const std::vector<SuffixArray> namedShards{shards[0], named};
+    const ShardedIndex<SuffixArray> namedIndex(namedShards);
+    const SuffixArray namedMerged = SuffixArray::merged(std::span<const SuffixArray>(namedShards));
+    for (ContigTable const* table : {&namedIndex.contigs(), &namedMerged.contigs()}) {
+        ASSERT_EQUAL(table->size(), shards[0].contigs().size() + 2, "Wrong number of joined contigs.");
+        const auto hit = table->lookup(static_cast<int64_t>(shards[0].size()) + 6);
+        ASSERT_EQUAL(table->name(hit.contig), std::string_view("a"), "Wrong joined contig name.");
+        ASSERT_EQUAL(hit.offset, int64_t(9), "Joined contig offset does not skip the collapsed gap.");
+        ASSERT_EQUAL(table->name(table->lookup(static_cast<int64_t>(shards[0].size()) + 8).contig), std::string_view("b"),
+            "Wrong joined contig name.");
+    }
+
+    bool threw = false;
+    try {
+        const std::vector<SuffixArray> sparse{SuffixArray::fromString(texts[0], {.suffixSampling = 2})};
+        SuffixArray::merged(std::span<const SuffixArray>(sparse));
+    } catch (std::invalid_argument const&) {
+        threw = true;
+    }
+    ASSERT_EQUAL(threw, true, "Merging a sparse suffix array did not throw.");
+}
+
+void test_querybatch() {
+    using namespace suffixarray;
+    using Batch = querybatch::QueryBatch<SuffixArray::position_type>;
+
+    /* batches read the same records as strings do, including lines before any header, a record longer than a
+     * read block, and a trailing header with no sequence or newline */
+    std::mt19937 rng(3011);
+    std::string longRecord;
+    while (longRecord.size() < fasta::QueryReader::BUFFER_SIZE + 1000) {
+        longRecord.push_back("ACGT"[rng() % 4]);
+    }
+    {
+        std::ofstream outputFile("tmp.fasta");
+        outputFile << "ACG\n>q0\nAC\nGT\n>empty\n>long\n";
+        for (size_t start = 0; start < longRecord.size(); start += 60) {
+            outputFile << longRecord.substr(start, 60) << "\n";
+        }
+        outputFile << ">q2\nA\n\n>last";
+    }
+    for (size_t batchSize : {1, 2, 3, 10}) {
+        fasta::QueryReader reader("tmp.fasta");
+        std::vector<std::string> titles, sequences;
+        for (auto batch = reader.nextBatch<Batch>(batchSize); !batch.empty(); batch = reader.nextBatch<Batch>(batchSize)) {
+            ASSERT_EQUAL(batch.size() <= batchSize, true, "Query batch too large.");
+            for (auto const& q : batch) {
+                titles.push_back(std::string(q.title));
+                sequences.push_back(std::string(q.query));
+            }
+        }
+        ASSERT_EQUAL(titles, (std::vector<std::string>{"", "q0", "long", "q2", "last"}), "Wrong titles from query batches.");
+        ASSERT_EQUAL(sequences, (std::vector<std::string>{"ACG", "ACGT", longRecord, "A", ""}), "Wrong sequences from query batches.");
+    }
+    std::remove("tmp.fasta");
+
+    /* lists grown in turn on one thread outgrow their chunks and still keep every position */
+    {
+        querybatch::PositionPool<int64_t> pool;
+        std::vector<querybatch::PooledPositions<int64_t>> lists(3, querybatch::PooledPositions<int64_t>(&pool));
+        for (int64_t i = 0; i < static_cast<int64_t>(querybatch::PositionPool<int64_t>::CHUNK_SIZE); i += 1) {
+            for (size_t list = 0; list < lists.size(); list += 1) {
+                if (i % static_cast<int64_t>(list + 1) == 0) {
+                    lists[list].push_back(i);
+                }
+            }
+        }
+        for (size_t list = 0; list < lists.size(); list += 1) {
+            bool intact = true;
+            for (size_t i = 0; i < lists[list].size(); i += 1) {
+                intact = intact && lists[list][i] == static_cast<int64_t>(i * (list + 1));
+            }
+            ASSERT_EQUAL(intact, true, "Pooled positions lost while growing.");
+        }
+        lists[0].assign(std::begin(lists[2]), std::end(lists[2]));
+        ASSERT_EQUAL(std::vector<int64_t>(std::begin(lists[0]), std::end(lists[0])),
+            std::vector<int64_t>(std::begin(lists[2]), std::end(lists[2])), "Wrong pooled positions after assign.");
+    }
+
+    /* every index searches a batch exactly as it searches Query objects */
+    const std::string text = repetitiveText(rng, 20000, 3, 0);
+    std::vector<SuffixArray::Query> queries;
+    std::string joined;
+    for (size_t i = 0; i < SuffixArray::INTERLEAVED_RUN + 37; i += 1) {
+        const size_t length = 8 + rng() % 30;
+        queries.push_back({"q" + std::to_string(i), text.substr(rng() % (text.size() - length), length), {}});
+        joined += queries.back().title + queries.back().query;
+    }
+    auto batchOf = [&queries, &joined] {
+        Batch batch(std::vector<char>(std::begin(joined), std::end(joined)));
+        size_t start = 0;
+        for (auto const& q : queries) {
+            batch.add(batch.text().substr(start, q.title.size()), batch.text().substr(start + q.title.size(), q.query.size()));
+            start += q.title.size() + q.query.size();
+        }
+        return batch;
+    };
+    auto sameResults = [&queries](Batch const& batch, std::vector<SuffixArray::Query> const& expected, std::string const& what) {
+        ASSERT_EQUAL(batch.size(), queries.size(), what + " batch lost queries.");
+        for (size_t i = 0; i < queries.size(); i += 1) {
+            ASSERT_EQUAL(std::string(batch[i].title), queries[i].title, what + " batch query title differs.");
+            ASSERT_EQUAL(batch[i].count, expected[i].count, what + " batch query count differs.");
+            ASSERT_EQUAL(std::vector<int32_t>(std::begin(batch[i].result), std::end(batch[i].result)), expected[i].result,
+                what + " batch query positions differ.");
+            ASSERT_EQUAL(batch[i].reverseResults, expected[i].reverseResults, what + " batch reverse results differ.");
+        }
+    };
+
+    const SuffixArray sa = SuffixArray::fromString(text, {.prefixTableLength = 4, .lcp = true});
+    const SuffixArray sparse = SuffixArray::fromString(text, {.suffixSampling = 3});
+    const auto fm = FMIndex::fromSuffixArray(sa, 4);
+    for (const int64_t maxResults : {SuffixArray::ALL_RESULTS, int64_t(0), int64_t(2)}) {
+        for (auto mode : {SuffixArray::Naive, SuffixArray::SimpleAccelerant, SuffixArray::LCPAccelerated}) {
+            auto expected = queries;
+            sa.queries(std::begin(expected), std::end(expected), mode, maxResults);
+            auto batch = batchOf();
+            sa.queries(std::begin(batch), std::end(batch), mode, maxResults);
+            sameResults(batch, expected, "Interleaved");
+
+            batch = batchOf();
+            sa.sortedQueries(std::begin(batch), std::end(batch), mode, maxResults);
+            sameResults(batch, expected, "Sorted");
+
+            expected = queries;
+            sparse.queries(std::begin(expected), std::end(expected), mode, maxResults);
+            batch = batchOf();
+            sparse.queries(std::begin(batch), std::end(batch), mode, maxResults);
+            sameResults(batch, expected, "Sparse");
+
+            expected = queries;
+            sa.approximateQueries(std::begin(expected), std::end(expected), 1, mode, maxResults);
+            batch = batchOf();
+            sa.approximateQueries(std::begin(batch), std::end(batch), 1, mode, maxResults);
+            sameResults(batch, expected, "Approximate");
+        }
+
+        auto expected = queries;
+        searchBothStrands(expected, maxResults, [&sa, maxResults](auto &strands) {
+            sa.queries(std::begin(strands), std::end(strands), SuffixArray::SimpleAccelerant, maxResults); });
+        auto batch = batchOf();
+        searchBothStrands(batch, maxResults, [&sa, maxResults](auto &strands) {
+            sa.queries(std::begin(strands), std::end(strands), SuffixArray::SimpleAccelerant, maxResults); });
+        sameResults(batch, expected, "Stranded");
+
+        expected = queries;
+        fm.queries(std::begin(expected), std::end(expected), maxResults);
+        batch = batchOf();
+        fm.queries(std::begin(batch), std::end(batch), maxResults);
+        sameResults(batch, expected, "FM-index");
+    }
+
+    /* a sharded index fills a batch of joined text positions */
+    const std::vector<SuffixArray> shards{SuffixArray::fromString(text.substr(0, 9000)), SuffixArray::fromString(text.substr(9000))};
+    const ShardedIndex<SuffixArray> sharded(shards);
+    std::vector<ShardedIndex<SuffixArray>::Query> expected;
+    for (auto const& q : queries) {
+        expected.push_back({q.title, q.query, {}});
+    }
+    sharded.queries(std::begin(expected), std::end(expected), SuffixArray::SimpleAccelerant);
+    querybatch::QueryBatch<int64_t> batch;
+    for (auto const& q : queries) {
+        batch.add(q.title, q.query);
+    }
+    sharded.queries(std::begin(batch), std::end(batch), SuffixArray::SimpleAccelerant);
+    for (size_t i = 0; i < queries.size(); i += 1) {
+        ASSERT_EQUAL(batch[i].count, expected[i].count, "Sharded batch query count differs.");
+        ASSERT_EQUAL(std::vector<int64_t>(std::begin(batch[i].result), std::end(batch[i].result)), expected[i].result,
+            "Sharded batch query positions differ.");
+    }
+}